@@ -181,6 +181,27 @@ int webauth_context_init(struct webauth_context **, WA_APR_POOL_T *)
 int webauth_context_init_apr(struct webauth_context **, WA_APR_POOL_T *)
     __attribute__((__nonnull__));
 
+/*
+ * Initialize a new WebAuth context for APR-aware applications that shares
+ * the WebKDC and user information service configuration of an existing
+ * context.  The configuration is referenced, not copied, so the source
+ * context must outlive the new one and must not be reconfigured.  Logging
+ * callbacks are not inherited.
+ */
+int webauth_context_init_shared(struct webauth_context **, WA_APR_POOL_T *,
+                                const struct webauth_context *)
+    __attribute__((__nonnull__));
+
+/*
+ * Reset a WebAuth context so that it can be reused.  Frees all memory
+ * allocated from the context since the last reset and clears the saved
+ * error, but keeps the configuration and logging callbacks.  Nothing
+ * returned by a WebAuth function before the reset may be used afterwards.
+ * Returns WA_ERR_APR if the subpool could not be created.
+ */
+int webauth_context_reset(struct webauth_context *)
+    __attribute__((__nonnull__));
+
 /*
  * Free a WebAuth context.  After this call, the contents of the provided
  * webauth_context struct will be invalid and should not be reused without
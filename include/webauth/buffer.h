@@ -0,0 +1,54 @@
+/*
+ * WebAuth functions for collecting data.
+ *
+ * These interfaces accumulate data that arrives in pieces, such as the body
+ * of an HTTP response or the text of an XML element, in memory allocated
+ * from an APR pool.  The data is kept as a chain of blocks that is never
+ * copied as it grows, so that it only has to be made contiguous once, when
+ * the caller needs it as a single string.
+ *
+ * Copyright 2014
+ *     The Board of Trustees of the Leland Stanford Junior University
+ *
+ * See LICENSE for licensing terms.
+ */
+
+#ifndef WEBAUTH_BUFFER_H
+#define WEBAUTH_BUFFER_H 1
+
+#include <webauth/defines.h>
+#include <webauth/basic.h>
+
+#include <sys/types.h>
+
+struct webauth_buffer;
+
+BEGIN_DECLS
+
+/*
+ * Create a new, empty buffer.  The buffer and all of its data are allocated
+ * from the given pool and are freed when the pool is cleared.
+ */
+struct webauth_buffer *webauth_buffer_new(WA_APR_POOL_T *)
+    __attribute__((__nonnull__));
+
+/* Append data, which may contain nuls, to the end of a buffer. */
+void webauth_buffer_append(struct webauth_buffer *, const void *, size_t)
+    __attribute__((__nonnull__));
+
+/* Return the total length of the data in a buffer. */
+size_t webauth_buffer_length(const struct webauth_buffer *)
+    __attribute__((__nonnull__));
+
+/*
+ * Return the contents of the buffer as a single nul-terminated string.  This
+ * copies the data if it is held in more than one block.  The string is part
+ * of the buffer and may be modified, but it may change if the buffer is
+ * appended to.
+ */
+char *webauth_buffer_string(struct webauth_buffer *)
+    __attribute__((__nonnull__));
+
+END_DECLS
+
+#endif /* !WEBAUTH_BUFFER_H */
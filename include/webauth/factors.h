@@ -77,8 +77,8 @@ int webauth_factors_contains(struct webauth_context *,
 /*
  * Given an array of factor strings (possibly NULL), create a new
  * pool-allocated webauth_factors struct and return it.  If the array is NULL,
- * the resulting factors struct will be empty.  This function does not
- * synthesize multifactor.
+ * the resulting factors struct will be empty.  Duplicate factors are dropped.
+ * This function does not synthesize multifactor.
  */
 struct webauth_factors *webauth_factors_new(struct webauth_context *,
                                             const WA_APR_ARRAY_HEADER_T *)
@@ -58,6 +58,38 @@ enum webauth_kau_status {
     WA_KAU_UPDATE
 };
 
+/*
+ * Formats for encrypted tokens, chosen for each keyring with
+ * webauth_keyring_set_format.  WA_TOKEN_FORMAT_HINT tokens start with the
+ * time at which they were created, which is used as a hint for the key to try
+ * first, and can be read by any version of WebAuth.  WA_TOKEN_FORMAT_KEY_ID
+ * tokens start with an identifier derived from the key instead, so only that
+ * key is ever tried, but they can only be read by WebAuth 4.7.1 or later.
+ * WA_TOKEN_FORMAT_AEAD tokens also carry the key identifier but are
+ * encrypted and authenticated together with AES-GCM, using a key derived
+ * from the keyring key, instead of with AES-CBC and a separate HMAC-SHA1.
+ * Tokens in any format can be decrypted with any keyring.
+ */
+enum webauth_token_format {
+    WA_TOKEN_FORMAT_HINT   = 0,
+    WA_TOKEN_FORMAT_KEY_ID = 1,
+    WA_TOKEN_FORMAT_AEAD   = 2
+};
+
+/*
+ * Formats for keyring and service token cache files.  WA_FILE_FORMAT_ATTR is
+ * the attribute encoding, which every version of WebAuth can read, and is
+ * what webauth_keyring_write and webauth_was_token_cache_write use.
+ * WA_FILE_FORMAT_BINARY files have a checksum and are read in place without
+ * copying the keys, but can only be read by WebAuth 4.7.1 or later, so only
+ * use them once every system sharing the file has been upgraded.  Files in
+ * either format can be read.
+ */
+enum webauth_file_format {
+    WA_FILE_FORMAT_ATTR   = 0,
+    WA_FILE_FORMAT_BINARY = 1
+};
+
 /* Intended usage for a key, used for webauth_keyring_best_key. */
 enum webauth_key_usage {
     WA_KEY_DECRYPT = 0,
@@ -83,6 +115,13 @@ struct webauth_keyring_entry {
  * serialized to disk.  We could just use the apr_array_header_t directly, but
  * it's not typed and we could end up with the wrong header.  Wrap it in a
  * struct so that we get the benefits of type checking.
+ *
+ * Keyrings must be created by the library with webauth_keyring_new or one of
+ * the functions that returns a keyring, since the library keeps a private
+ * index of the keys with each keyring it creates.  The index is kept up to
+ * date by webauth_keyring_add and webauth_keyring_remove.  If the entries are
+ * changed directly, key lookups still work but search every key until the
+ * next add or remove.
  */
 struct webauth_keyring {
     WA_APR_ARRAY_HEADER_T *entries;
@@ -156,10 +195,20 @@ int webauth_keyring_best_key(struct webauth_context *,
                              const struct webauth_key **)
     __attribute__((__nonnull__));
 
+/*
+ * Set the format of the tokens encrypted with a keyring.  New keyrings use
+ * WA_TOKEN_FORMAT_HINT.  The format is not stored with the keyring, so it has
+ * to be set again each time the keyring is read.
+ */
+void webauth_keyring_set_format(struct webauth_keyring *,
+                                enum webauth_token_format)
+    __attribute__((__nonnull__));
+
 /*
  * Decode a keyring from the serialization format used for storing it in a
  * file or generated by webauth_keyring_encode, storing the result in the
- * webauth_keyring argument.  Returns a WebAuth status code.
+ * webauth_keyring argument.  Keyrings in either file format are accepted.
+ * Returns a WebAuth status code.
  */
 int webauth_keyring_decode(struct webauth_context *, const char *, size_t,
                            struct webauth_keyring **)
@@ -175,10 +224,22 @@ int webauth_keyring_encode(struct webauth_context *,
                            const struct webauth_keyring *, char **, size_t *)
     __attribute__((__nonnull__));
 
+/*
+ * The same as webauth_keyring_encode, but encodes the keyring in the given
+ * file format.
+ */
+int webauth_keyring_encode_format(struct webauth_context *,
+                                  const struct webauth_keyring *,
+                                  enum webauth_file_format, char **, size_t *)
+    __attribute__((__nonnull__));
+
 /*
  * Reads a keyring from a file in encoded form and stores the newly-allocated
- * keyring in the provided argument.  Returns a WebAuth status code, which may
- * be WA_ERR_FILE_OPENREAD, WA_ERR_FILE_READ, WA_ERR_CORRUPT, or
+ * keyring in the provided argument.  The file is mapped into memory and the
+ * keys may point into that read-only mapping, so they must not be modified.
+ * The keyring file must be replaced, as webauth_keyring_write does, rather
+ * than rewritten in place.  Returns a WebAuth status code, which may be
+ * WA_ERR_FILE_OPENREAD, WA_ERR_FILE_READ, WA_ERR_CORRUPT, or
  * WA_ERR_FILE_VERSION on failure.
  */
 int webauth_keyring_read(struct webauth_context *, const char *,
@@ -186,13 +247,23 @@ int webauth_keyring_read(struct webauth_context *, const char *,
     __attribute__((__nonnull__));
 
 /*
- * Write a keyring to a file in encoded form.  Returns a WebAuth status code,
- * which may be WA_ERR_FILE_OPENWRITE or WA_ERR_FILE_WRITE on failure.
+ * Write a keyring to a file in encoded form, using the attribute encoding.
+ * Returns a WebAuth status code, which may be WA_ERR_FILE_OPENWRITE or
+ * WA_ERR_FILE_WRITE on failure.
  */
 int webauth_keyring_write(struct webauth_context *,
                           const struct webauth_keyring *, const char *)
     __attribute__((__nonnull__));
 
+/*
+ * The same as webauth_keyring_write, but writes the keyring in the given file
+ * format.
+ */
+int webauth_keyring_write_format(struct webauth_context *,
+                                 const struct webauth_keyring *,
+                                 enum webauth_file_format, const char *)
+    __attribute__((__nonnull__));
+
 /*
  * Attempts to read a keyring file, storing the keyring read in the provided
  * argument.  If create is non-zero, it will create the file if it doesn't
@@ -41,6 +41,7 @@
 
 struct webauth_context;
 struct webauth_krb5;
+struct webauth_krb5_ticket_cache;
 
 /* Supported protocols for Kerberos password change. */
 enum webauth_change_protocol {
@@ -310,6 +311,51 @@ int webauth_krb5_change_password(struct webauth_context *,
                                  struct webauth_krb5 *, const char *password)
     __attribute__((__nonnull__));
 
+/*
+ * Create a cache of service tickets exported with webauth_krb5_export_cred,
+ * so that a ticket for the same server obtained with the same TGT can be
+ * reused instead of asking the KDC again.  slots is the number of tickets
+ * the cache can hold, and tickets with less than minimum seconds of life
+ * left are not returned.  The cache lasts for the lifetime of the WebAuth
+ * context and is not released by webauth_context_reset.
+ *
+ * The cache is private to the process and is not locked.  Callers that use
+ * it from more than one thread must serialize calls to the functions below.
+ */
+int webauth_krb5_ticket_cache_new(struct webauth_context *,
+                                  unsigned long slots, time_t minimum,
+                                  struct webauth_krb5_ticket_cache **)
+    __attribute__((__nonnull__));
+
+/*
+ * Look up a ticket in the cache.  Takes the exported TGT with which the
+ * ticket would be obtained, as passed to webauth_krb5_import_cred, the
+ * server principal, and the current time.  On a hit, stores a copy of the
+ * ticket, allocated from the context pool, its length, and its expiration
+ * in the last three arguments.  Returns WA_ERR_NOT_FOUND if there is no
+ * cached ticket with enough life left.
+ */
+int webauth_krb5_ticket_cache_get(struct webauth_context *,
+                                  struct webauth_krb5_ticket_cache *,
+                                  const void *tgt, size_t tgt_len,
+                                  const char *principal, time_t now,
+                                  void **ticket, size_t *ticket_len,
+                                  time_t *expiration)
+    __attribute__((__nonnull__));
+
+/*
+ * Add a ticket obtained with the given TGT for the given server principal to
+ * the cache.  If the cache is full, replaces an expired ticket or, if there
+ * are none, the one that will expire first.
+ */
+int webauth_krb5_ticket_cache_add(struct webauth_context *,
+                                  struct webauth_krb5_ticket_cache *,
+                                  const void *tgt, size_t tgt_len,
+                                  const char *principal, time_t now,
+                                  const void *ticket, size_t ticket_len,
+                                  time_t expiration)
+    __attribute__((__nonnull__));
+
 
 END_DECLS
 
@@ -0,0 +1,123 @@
+/*
+ * WebAuth functions for runtime metrics.
+ *
+ * These interfaces maintain counters and latency histograms for the
+ * operations done by libwebauth and the Apache modules, and format them for
+ * scraping in the Prometheus text exposition format.  The metrics are stored
+ * in a block of memory supplied by the caller, normally shared memory
+ * created in the Apache parent so that all children update the same
+ * counters.  Updates use atomic operations where available and never block.
+ *
+ * Copyright 2014
+ *     The Board of Trustees of the Leland Stanford Junior University
+ *
+ * See LICENSE for licensing terms.
+ */
+
+#ifndef WEBAUTH_METRICS_H
+#define WEBAUTH_METRICS_H 1
+
+#include <webauth/defines.h>
+
+#include <sys/types.h>
+
+struct webauth_context;
+struct webauth_metrics;
+
+/* Counters.  Add new counters before WA_METRIC_MAX. */
+enum webauth_metric {
+    WA_METRIC_TOKEN_DECODE = 0,         /* Tokens decoded */
+    WA_METRIC_TOKEN_DECODE_FAIL,        /* Tokens that failed to decode */
+    WA_METRIC_TOKEN_ENCODE,             /* Tokens encoded */
+    WA_METRIC_DECRYPT_BAD_HMAC,         /* Decryption failed: bad HMAC */
+    WA_METRIC_DECRYPT_BAD_KEY,          /* Decryption failed: no usable key */
+    WA_METRIC_DECRYPT_CORRUPT,          /* Decryption failed: malformed */
+    WA_METRIC_KEYRING_HINT_MISS,        /* Hinted key didn't decrypt token */
+    WA_METRIC_WEBKDC_REQUEST,           /* Requests from a WAS to the WebKDC */
+    WA_METRIC_WEBKDC_REQUEST_FAIL,      /* ...that failed */
+    WA_METRIC_SERVICE_TOKEN_HIT,        /* Service token found in memory */
+    WA_METRIC_SERVICE_TOKEN_MISS,       /* Service token reread or renewed */
+    WA_METRIC_SERVICE_TOKEN_RENEW,      /* Service token requested from KDC */
+    WA_METRIC_WEBKDC_LOGIN,             /* WebKDC login requests */
+    WA_METRIC_USERINFO,                 /* User information service calls */
+    WA_METRIC_USERINFO_FAIL,            /* ...that failed */
+    WA_METRIC_TOKEN_ACL_HIT,            /* Token ACL used from cache */
+    WA_METRIC_TOKEN_ACL_RELOAD,         /* Token ACL reloaded from disk */
+    WA_METRIC_TICKET_CACHE_HIT,         /* Service ticket found in cache */
+    WA_METRIC_TICKET_CACHE_MISS,        /* Service ticket requested from KDC */
+    WA_METRIC_MAX
+};
+
+/* Latency histograms.  Add new histograms before WA_TIMER_MAX. */
+enum webauth_timer {
+    WA_TIMER_TOKEN_DECODE = 0,          /* Decoding a token */
+    WA_TIMER_TOKEN_ENCODE,              /* Encoding a token */
+    WA_TIMER_WEBKDC_REQUEST,            /* WAS request to the WebKDC */
+    WA_TIMER_WEBKDC_LOGIN,              /* Processing a WebKDC login */
+    WA_TIMER_USERINFO,                  /* User information service call */
+    WA_TIMER_LOGIN_PARSE,               /* Login: decrypting the request */
+    WA_TIMER_LOGIN_AUTHENTICATE,        /* Login: password and OTP logins */
+    WA_TIMER_LOGIN_MERGE,               /* Login: merging proxy and factors */
+    WA_TIMER_LOGIN_USERINFO,            /* Login: user information service */
+    WA_TIMER_LOGIN_AUTHZ,               /* Login: factor and identity checks */
+    WA_TIMER_LOGIN_ENCODE,              /* Login: encoding the response */
+    WA_TIMER_MAX
+};
+
+BEGIN_DECLS
+
+/*
+ * Return the size of memory required to hold a set of metrics.  The caller
+ * should allocate (normally as shared memory) at least this much memory,
+ * aligned for 64-bit integers, and pass it to webauth_metrics_init.
+ */
+size_t webauth_metrics_size(void);
+
+/*
+ * Initialize a new, empty set of metrics in the provided memory, which must
+ * be at least webauth_metrics_size() bytes.  Stores a pointer to the metrics
+ * in the final argument.  Returns WA_ERR_INVALID if the memory is too small.
+ */
+int webauth_metrics_init(struct webauth_context *, void *, size_t,
+                         struct webauth_metrics **)
+    __attribute__((__nonnull__));
+
+/*
+ * Attach a set of metrics to a WebAuth context.  Once attached, library
+ * operations done with that context, such as token encoding and decoding,
+ * will update the metrics.  Pass NULL to detach.  Contexts created with
+ * webauth_context_init_shared inherit the metrics of their source.
+ */
+void webauth_metrics_set(struct webauth_context *, struct webauth_metrics *)
+    __attribute__((__nonnull__(1)));
+
+/*
+ * Return the metrics attached to a context, or NULL if there are none.
+ */
+struct webauth_metrics *webauth_metrics_get(struct webauth_context *)
+    __attribute__((__nonnull__));
+
+/*
+ * Increment a counter.  Does nothing if the metrics are NULL, so callers
+ * don't need to check whether metrics are enabled.
+ */
+void webauth_metrics_count(struct webauth_metrics *, enum webauth_metric);
+
+/*
+ * Record an observation, in microseconds, in a latency histogram.  Does
+ * nothing if the metrics are NULL.
+ */
+void webauth_metrics_observe(struct webauth_metrics *, enum webauth_timer,
+                             unsigned long);
+
+/*
+ * Format the metrics in the Prometheus text exposition format, storing the
+ * result, allocated from the context pool, in the final argument.
+ */
+int webauth_metrics_format(struct webauth_context *,
+                           const struct webauth_metrics *, char **)
+    __attribute__((__nonnull__));
+
+END_DECLS
+
+#endif /* !WEBAUTH_METRICS_H */
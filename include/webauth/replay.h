@@ -0,0 +1,99 @@
+/*
+ * WebAuth functions for replay detection and login rate limiting.
+ *
+ * These interfaces provide a replay cache for request tokens and per-user
+ * counters of failed logins, both stored in a file mapped into shared memory
+ * so that all WebLogin processes on a host see the same state.  All updates
+ * are done with atomic compare-and-swap operations, so no locks are held
+ * except while first initializing the file.
+ *
+ * Copyright 2014
+ *     The Board of Trustees of the Leland Stanford Junior University
+ *
+ * See LICENSE for licensing terms.
+ */
+
+#ifndef WEBAUTH_REPLAY_H
+#define WEBAUTH_REPLAY_H 1
+
+#include <webauth/defines.h>
+
+#include <sys/types.h>
+
+struct webauth_context;
+struct webauth_replay;
+
+/*
+ * Configuration for the replay cache.  The path is the file backing the
+ * shared memory, which will be created if it doesn't exist.  slots is the
+ * number of entries in each of the replay and rate limit tables; it's only
+ * used when creating the file and is otherwise taken from the existing file.
+ * If slots is 0, a default of 65536 is used.
+ *
+ * replay_timeout is how long, in seconds, a request token is remembered after
+ * it was last seen.  limit_threshold is the number of failed logins within
+ * limit_interval seconds after which a user is rate-limited.  Failures are
+ * counted in a sliding window, so older failures age out gradually rather
+ * than all at once at the end of a fixed interval.
+ */
+struct webauth_replay_config {
+    const char *path;
+    unsigned long slots;
+    unsigned long replay_timeout;
+    unsigned long limit_threshold;
+    unsigned long limit_interval;
+};
+
+BEGIN_DECLS
+
+/*
+ * Open the shared replay cache, creating and initializing the backing file if
+ * needed.  The mapping lasts for the lifetime of the WebAuth context and is
+ * not released by webauth_context_reset.  Returns WA_ERR_UNIMPLEMENTED if
+ * WebAuth was built on a platform without 64-bit lock-free atomics.
+ */
+int webauth_replay_open(struct webauth_context *,
+                        const struct webauth_replay_config *,
+                        struct webauth_replay **)
+    __attribute__((__nonnull__));
+
+/*
+ * Check whether a request token has already been used.  Takes the token data
+ * and its length and the current time.  If the token was seen within the
+ * replay timeout, stores the time it was last seen in the final argument and
+ * refreshes that time to now.  Otherwise, stores 0.
+ */
+int webauth_replay_check(struct webauth_context *, struct webauth_replay *,
+                         const void *, size_t, time_t, time_t *)
+    __attribute__((__nonnull__));
+
+/*
+ * Record that a request token was used for a successful authentication at
+ * the given time.
+ */
+int webauth_replay_add(struct webauth_context *, struct webauth_replay *,
+                       const void *, size_t, time_t)
+    __attribute__((__nonnull__));
+
+/*
+ * Check whether the given user has reached the limit of failed logins as of
+ * the given time.  Stores true or false in the final argument.  Always stores
+ * false if the configured threshold is 0.
+ */
+int webauth_replay_limited(struct webauth_context *, struct webauth_replay *,
+                           const char *, time_t, int *)
+    __attribute__((__nonnull__));
+
+/* Record a failed login for the given user at the given time. */
+int webauth_replay_fail(struct webauth_context *, struct webauth_replay *,
+                        const char *, time_t)
+    __attribute__((__nonnull__));
+
+/* Clear the failed login count for a user after a successful login. */
+int webauth_replay_clear(struct webauth_context *, struct webauth_replay *,
+                         const char *)
+    __attribute__((__nonnull__));
+
+END_DECLS
+
+#endif /* !WEBAUTH_REPLAY_H */
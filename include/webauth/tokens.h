@@ -325,9 +325,11 @@ int webauth_token_encode_raw(struct webauth_context *,
     __attribute__((__nonnull__));
 
 /*
- * Decrypts a token.  The best decryption key on the ring will be tried first,
- * and if that fails all the remaining keys will be tried.  Returns the
- * decrypted data in output and its length in output_len.
+ * Decrypts a token.  If the token has a key identifier, only the key on the
+ * ring with that identifier will be tried.  Otherwise, the best decryption
+ * key on the ring will be tried first, and if that fails all the remaining
+ * keys will be tried.  Returns the decrypted data in output and its length in
+ * output_len.
  *
  * Returns WA_ERR_NONE, WA_ERR_NO_MEM, WA_ERR_CORRUPT, WA_ERR_BAD_HMAC, or
  * WA_ERR_BAD_KEY.
@@ -339,7 +341,8 @@ int webauth_token_decrypt(struct webauth_context *, const void *input,
 
 /*
  * Encrypts an input buffer (normally encoded attributes) into a token, using
- * the key from the keyring that has the most recent valid valid_from time.
+ * the key from the keyring that has the most recent valid valid_from time and
+ * the token format set for the keyring with webauth_keyring_set_format.
  * The encoded token will be stored in newly pool-allocated memory in the
  * provided output argument, with its length stored in output_len.
  *
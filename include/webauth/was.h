@@ -33,6 +33,7 @@
 #define WEBAUTH_WAS_H 1
 
 #include <webauth/defines.h>
+#include <webauth/keys.h>
 
 #include <sys/types.h>
 
@@ -64,20 +65,32 @@ BEGIN_DECLS
 /*
  * Read a service token and key from the given token cache.  Takes the WebAuth
  * context and the path and stores the result in the provided struct argument.
+ * The token and key may point into a read-only mapping of the file and must
+ * not be modified.
  */
 int webauth_was_token_cache_read(struct webauth_context *, const char *,
                                  struct webauth_was_token_cache *)
     __attribute__((__nonnull__));
 
 /*
- * Write a service token and key to the given token cache.  Takes the WebAuth
- * context, the webauth_was_token_cache struct, and the path.
+ * Write a service token and key to the given token cache in the attribute
+ * encoding.  Takes the WebAuth context, the webauth_was_token_cache struct,
+ * and the path.
  */
 int webauth_was_token_cache_write(struct webauth_context *,
                                   const struct webauth_was_token_cache *,
                                   const char *)
     __attribute__((__nonnull__));
 
+/*
+ * The same as webauth_was_token_cache_write, but writes the cache in the
+ * given file format.
+ */
+int webauth_was_token_cache_write_format(
+    struct webauth_context *, const struct webauth_was_token_cache *,
+    enum webauth_file_format, const char *)
+    __attribute__((__nonnull__));
+
 END_DECLS
 
 #endif /* !WEBAUTH_WEBKDC_H */
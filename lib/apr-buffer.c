@@ -4,10 +4,17 @@
  * A buffer is an allocated bit of memory with a known size and a separate
  * data length.  It's intended to store strings that need to be appended to an
  * unbounded number of times, and tries to minimize the number of memory
- * allocations.  Buffers increase in increments of 64 bytes.
+ * allocations.  Buffers at least double in size each time they grow, in
+ * multiples of 64 bytes.  Since memory can't be returned to an APR pool,
+ * this also bounds the memory lost to blocks abandoned by growth to the size
+ * of the final buffer.
+ *
+ * Chunked buffers don't copy when they grow.  The full block is added to a
+ * list of chunks and appends continue in a new block, which is useful for
+ * large data that can be consumed in pieces.
  *
  * Written by Russ Allbery <eagle@eyrie.org>
- * Copyright 2011, 2013
+ * Copyright 2011, 2013, 2014
  *     The Board of Trustees of the Leland Stanford Junior University
  *
  * See LICENSE for licensing terms.
@@ -20,6 +27,10 @@
 #include <lib/internal.h>
 
 
+/* Round a size up to the multiple of 64 bytes used for buffer blocks. */
+#define BUFFER_ROUND(size) (((size) + 63) & ~63UL)
+
+
 /*
  * Allocate a new struct wai_buffer and initialize it.
  */
@@ -28,44 +39,123 @@ wai_buffer_new(apr_pool_t *pool)
 {
     struct wai_buffer *buffer;
 
-    buffer = apr_palloc(pool, sizeof(struct wai_buffer));
+    buffer = apr_pcalloc(pool, sizeof(struct wai_buffer));
     if (buffer == NULL)
         return buffer;
     buffer->pool = pool;
-    buffer->size = 0;
-    buffer->used = 0;
-    buffer->data = NULL;
+    buffer->tail = &buffer->chunks;
+    return buffer;
+}
+
+
+/*
+ * Allocate a new chunked buffer.
+ */
+struct wai_buffer *
+wai_buffer_new_chunked(apr_pool_t *pool)
+{
+    struct wai_buffer *buffer;
+
+    buffer = wai_buffer_new(pool);
+    if (buffer != NULL)
+        buffer->chunked = true;
     return buffer;
 }
 
 
 /*
  * Resize a buffer to be at least as large as the provided second argument.
- * Resize buffers to multiples of 64 bytes to reduce the number of
- * reallocations.  Refuse to resize a buffer to make it smaller.
+ * Grow to at least twice the current size so that a buffer built by many
+ * small appends is only copied a logarithmic number of times.  Refuse to
+ * resize a buffer to make it smaller.
+ *
+ * A chunked buffer with data in it instead moves the current block to the
+ * end of the chunk list and starts over with an empty block.
  */
 void
 wai_buffer_resize(struct wai_buffer *buffer, size_t size)
 {
+    struct wai_buffer_chunk *chunk;
     char *data;
 
-    if (size < buffer->size)
+    if (size <= buffer->size)
         return;
-    buffer->size = (size + 63) & ~63UL;
-    data = apr_palloc(buffer->pool, buffer->size);
-    if (buffer->data != NULL)
+    if (size < buffer->size * 2)
+        size = buffer->size * 2;
+    size = BUFFER_ROUND(size);
+    data = apr_palloc(buffer->pool, size);
+    buffer->allocated += size;
+    if (buffer->chunked && buffer->used > 0) {
+        chunk = apr_palloc(buffer->pool, sizeof(struct wai_buffer_chunk));
+        chunk->next = NULL;
+        chunk->data = buffer->data;
+        chunk->used = buffer->used;
+        *buffer->tail = chunk;
+        buffer->tail = &chunk->next;
+        buffer->chunks_used += buffer->used;
+        buffer->used = 0;
+        data[0] = '\0';
+    } else if (buffer->data != NULL) {
         memcpy(data, buffer->data, buffer->used);
+    }
+    buffer->data = data;
+    buffer->size = size;
+}
+
+
+/*
+ * Return the total length of the data in a buffer.
+ */
+size_t
+wai_buffer_length(const struct wai_buffer *buffer)
+{
+    return buffer->chunks_used + buffer->used;
+}
+
+
+/*
+ * Copy the chunks of a chunked buffer and the current block into a single
+ * new block.  Does nothing if there are no chunks.
+ */
+void
+wai_buffer_flatten(struct wai_buffer *buffer)
+{
+    struct wai_buffer_chunk *chunk;
+    size_t length, offset;
+    char *data;
+
+    if (buffer->chunks == NULL)
+        return;
+    length = buffer->chunks_used + buffer->used;
+    buffer->size = BUFFER_ROUND(length + 1);
+    data = apr_palloc(buffer->pool, buffer->size);
+    buffer->allocated += buffer->size;
+    offset = 0;
+    for (chunk = buffer->chunks; chunk != NULL; chunk = chunk->next) {
+        memcpy(data + offset, chunk->data, chunk->used);
+        offset += chunk->used;
+    }
+    memcpy(data + offset, buffer->data, buffer->used);
+    data[length] = '\0';
     buffer->data = data;
+    buffer->used = length;
+    buffer->chunks = NULL;
+    buffer->tail = &buffer->chunks;
+    buffer->chunks_used = 0;
 }
 
 
 /*
- * Replace whatever data is currently in the buffer with the provided data.
- * Resize the buffer if needed.
+ * Replace whatever data is currently in the buffer, including any chunks,
+ * with the provided data.  Resize the buffer if needed.
  */
 void
 wai_buffer_set(struct wai_buffer *buffer, const char *data, size_t length)
 {
+    buffer->chunks = NULL;
+    buffer->tail = &buffer->chunks;
+    buffer->chunks_used = 0;
+    buffer->used = 0;
     wai_buffer_resize(buffer, length + 1);
     if (length > 0)
         memmove(buffer->data, data, length + 1);
@@ -4,7 +4,9 @@
  * Provided here is a table-driven decoder that fills out the elements of a
  * struct from a WebAuth attribute encoding.  This is the encoding used inside
  * tokens and for some other WebAuth persistant data structures, such as
- * service token caches and keyrings.
+ * service token caches and keyrings.  Normal decoding uses the specialized
+ * functions generated along with the tables, which call the helpers here;
+ * the table-driven decoder is kept as the reference they are tested against.
  *
  * Written by Russ Allbery <eagle@eyrie.org>
  * Copyright 2012, 2013, 2014
@@ -27,16 +29,6 @@
 #include <webauth/basic.h>
 #include <webauth/tokens.h>
 
-/*
- * Stores metadata about a particular attribute in encoded data.  This is
- * stored as the value in a hash of attributes, with the key being the
- * attribute name.
- */
-struct value {
-    void *data;
-    size_t length;
-};
-
 /*
  * Macros used to resolve a void * pointer to a struct and an offset into a
  * pointer to the appropriate type.  Scary violations of the C type system
@@ -52,25 +44,25 @@ struct value {
 
 
 /*
- * Report an error while encoding an attribute.  Takes the WebAuth context,
+ * Report an error while decoding an attribute.  Takes the WebAuth context,
  * status, description, context (for repeated elements), and element number
- * (for repeated elements).
+ * (for repeated elements).  Returns the status.
  */
-static void
-decode_error_set(struct webauth_context *ctx, int s, const char *desc,
-                 const char *context, size_t element)
+int
+wai_attr_decode_error(struct webauth_context *ctx, int s, const char *desc,
+                      const char *context, unsigned long element)
 {
     if (context != NULL && element != 0)
-        wai_error_set(ctx, s, "decoding %s %s %lu", context, desc,
-                      (unsigned long) element);
+        return wai_error_set(ctx, s, "decoding %s %s %lu", context, desc,
+                             element);
     else
-        wai_error_set(ctx, s, "decoding %s", desc);
+        return wai_error_set(ctx, s, "decoding %s", desc);
 }
 
 
 /*
  * Convert the attribute-encoded data to a hash table of attribute names to
- * values, where values are represented by struct value.  This destructively
+ * values, where values are represented by struct wai_attr.  This destructively
  * modifies the encoded form in place to avoid having to make another copy of
  * the data.  Returns a WebAuth status code.
  */
@@ -79,7 +71,7 @@ decode_attrs(struct webauth_context *ctx, void *data, size_t length,
              apr_hash_t **output)
 {
     apr_hash_t *attrs;
-    struct value *values;
+    struct wai_attr *values;
     size_t i, n, offset;
     char *name, *value;
     size_t attr_count = 0;
@@ -110,7 +102,7 @@ decode_attrs(struct webauth_context *ctx, void *data, size_t length,
      * structures.
      */
     attrs = apr_hash_make(ctx->pool);
-    values = apr_pcalloc(ctx->pool, attr_count * sizeof(struct value));
+    values = apr_pcalloc(ctx->pool, attr_count * sizeof(struct wai_attr));
 
     /*
      * Now, do the decoding.  As we go, we'll make two transformations:
@@ -187,10 +179,15 @@ corrupt:
  * the value, the memory location to which to write the data, the memory
  * location to which to write the length, and a flag saying whether the value
  * is hex-encoded.  Returns a WebAuth error code.
+ *
+ * Binary data is not copied.  The attribute buffer belongs to the decode and
+ * is allocated from the same pool as the result, so the result points into
+ * it.  This avoids copying large values such as Kerberos tickets that most
+ * callers never look at.
  */
-static int
-decode_data(struct webauth_context *ctx, struct value *value, void **output,
-            size_t *size, bool ascii)
+int
+wai_attr_decode_data(struct webauth_context *ctx, const struct wai_attr *value,
+                     void **output, size_t *size, bool ascii)
 {
     int s;
     size_t length;
@@ -204,7 +201,7 @@ decode_data(struct webauth_context *ctx, struct value *value, void **output,
         if (s != WA_ERR_NONE)
             return wai_error_set(ctx, s, "invalid hex-encoded data");
     } else {
-        *output = apr_pmemdup(ctx->pool, value->data, value->length);
+        *output = value->data;
         *size = value->length;
     }
     return WA_ERR_NONE;
@@ -212,17 +209,15 @@ decode_data(struct webauth_context *ctx, struct value *value, void **output,
 
 
 /*
- * Decode an attribute value as a string.  This is very similar to the
- * non-ascii case of decode_data, except that we nul-terminate the result.
- * Takes the WebAuth context, the value, and the location to which to write
- * the string.
+ * Decode an attribute value as a string.  decode_attrs has already
+ * nul-terminated every value in the attribute buffer, so like binary data
+ * this just points into that buffer.  Takes the value and the location to
+ * which to write the string.
  */
 static void
-decode_string(struct webauth_context *ctx, struct value *value, char **output)
+decode_string(const struct wai_attr *value, char **output)
 {
-    *output = apr_palloc(ctx->pool, value->length + 1);
-    memcpy(*output, value->data, value->length);
-    (*output)[value->length] = '\0';
+    *output = value->data;
 }
 
 
@@ -233,9 +228,10 @@ decode_string(struct webauth_context *ctx, struct value *value, char **output)
  * the WebAuth context, the value, a place to write the 32-bit unsigned value,
  * and a flag saying whether it was encoded as a string.
  */
-static int
-decode_number(struct webauth_context *ctx, struct value *value,
-              uint32_t *output, bool ascii)
+int
+wai_attr_decode_number(struct webauth_context *ctx,
+                       const struct wai_attr *value, uint32_t *output,
+                       bool ascii)
 {
     char *end;
     uint32_t data;
@@ -268,7 +264,7 @@ corrupt:
  * are handling a repeated attribute encoding, and the element number is
  * appended to the attribute name when decoding it.
  *
- * This is an internal helper function used by wai_decode.
+ * This is an internal helper function used by wai_decode_rules.
  */
 static int
 decode_by_rule(struct webauth_context *ctx, const struct wai_encoding *rules,
@@ -277,7 +273,7 @@ decode_by_rule(struct webauth_context *ctx, const struct wai_encoding *rules,
 {
     const struct wai_encoding *rule;
     const char *attr;
-    struct value *value;
+    struct wai_attr *value;
     unsigned long i;
     int s;
     void *data;
@@ -297,41 +293,43 @@ decode_by_rule(struct webauth_context *ctx, const struct wai_encoding *rules,
             if (rule->optional)
                 continue;
             s = WA_ERR_CORRUPT;
-            decode_error_set(ctx, s, rule->desc, context, element);
-            return s;
+            return wai_attr_decode_error(ctx, s, rule->desc, context,
+                                         element);
         }
             
         /* Otherwise, interpret the value by data type. */
         switch (rule->type) {
         case WA_TYPE_DATA:
-            s = decode_data(ctx, value, LOC_DATA(result, rule->offset),
-                            LOC_SIZE(result, rule->len_offset), rule->ascii);
+            s = wai_attr_decode_data(ctx, value,
+                                     LOC_DATA(result, rule->offset),
+                                     LOC_SIZE(result, rule->len_offset),
+                                     rule->ascii);
             break;
         case WA_TYPE_STRING:
-            decode_string(ctx, value, LOC_STRING(result, rule->offset));
+            decode_string(value, LOC_STRING(result, rule->offset));
             break;
         case WA_TYPE_INT32:
-            s = decode_number(ctx, value, &uint32, rule->ascii);
+            s = wai_attr_decode_number(ctx, value, &uint32, rule->ascii);
             if (s == WA_ERR_NONE)
                 *LOC_INT32(result, rule->offset) = (int32_t) uint32;
             break;
         case WA_TYPE_UINT32:
-            s = decode_number(ctx, value, &uint32, rule->ascii);
+            s = wai_attr_decode_number(ctx, value, &uint32, rule->ascii);
             if (s == WA_ERR_NONE)
                 *LOC_UINT32(result, rule->offset) = uint32;
             break;
         case WA_TYPE_ULONG:
-            s = decode_number(ctx, value, &uint32, rule->ascii);
+            s = wai_attr_decode_number(ctx, value, &uint32, rule->ascii);
             if (s == WA_ERR_NONE)
                 *LOC_ULONG(result, rule->offset) = uint32;
             break;
         case WA_TYPE_TIME:
-            s = decode_number(ctx, value, &uint32, rule->ascii);
+            s = wai_attr_decode_number(ctx, value, &uint32, rule->ascii);
             if (s == WA_ERR_NONE)
                 *LOC_TIME(result, rule->offset) = (time_t) uint32;
             break;
         case WA_TYPE_REPEAT:
-            s = decode_number(ctx, value, &uint32, rule->ascii);
+            s = wai_attr_decode_number(ctx, value, &uint32, rule->ascii);
             if (s != WA_ERR_NONE)
                 break;
             *LOC_UINT32(result, rule->len_offset) = uint32;
@@ -353,18 +351,39 @@ decode_by_rule(struct webauth_context *ctx, const struct wai_encoding *rules,
 
 
 /*
- * Given an encoding specification, attribute-encoded data, and a data
- * structure, decode that data into the data structure as newly-allocated pool
- * memory.
+ * Given a codec, attribute-encoded data, and a data structure, decode that
+ * data into the data structure as newly-allocated pool memory.
  */
 int
-wai_decode(struct webauth_context *ctx, const struct wai_encoding *rules,
+wai_decode(struct webauth_context *ctx, const struct wai_codec *codec,
            const void *input, size_t length, void *data)
 {
     apr_hash_t *attrs;
     int s;
     void *buf;
 
+    buf = apr_pmemdup(ctx->pool, input, length);
+    s = decode_attrs(ctx, buf, length, &attrs);
+    if (s != WA_ERR_NONE)
+        return s;
+    return codec->decode(ctx, attrs, data);
+}
+
+
+/*
+ * The same as wai_decode, but interprets the encoding rules instead of
+ * calling the generated decoder.  This is the reference decoder used to check
+ * the generated ones.
+ */
+int
+wai_decode_rules(struct webauth_context *ctx,
+                 const struct wai_encoding *rules, const void *input,
+                 size_t length, void *data)
+{
+    apr_hash_t *attrs;
+    int s;
+    void *buf;
+
     buf = apr_pmemdup(ctx->pool, input, length);
     s = decode_attrs(ctx, buf, length, &attrs);
     if (s != WA_ERR_NONE)
@@ -378,34 +397,37 @@ wai_decode(struct webauth_context *ctx, const struct wai_encoding *rules,
  * determination of the type of the token from the attributes.  This does not
  * perform any sanity checking on the token data; that must be done by
  * higher-level code.
+ *
+ * Unlike wai_decode, the input is decoded in place rather than copied first,
+ * and the decoded token points into it.  The caller passes the freshly
+ * decrypted token, which is already pool memory that nothing else uses.
  */
 int
-wai_decode_token(struct webauth_context *ctx, const void *input,
-                 size_t length, struct webauth_token *token)
+wai_decode_token(struct webauth_context *ctx, void *input, size_t length,
+                 struct webauth_token *token)
 {
     apr_hash_t *attrs;
     int s;
-    void *buf, *data;
-    struct value *value;
+    void *data;
+    struct wai_attr *value;
     char *type;
-    const struct wai_encoding *rules;
+    const struct wai_codec *codec;
 
     memset(token, 0, sizeof(*token));
-    buf = apr_pmemdup(ctx->pool, input, length);
-    s = decode_attrs(ctx, buf, length, &attrs);
+    s = decode_attrs(ctx, input, length, &attrs);
     if (s != WA_ERR_NONE)
         return s;
     value = apr_hash_get(attrs, "t", strlen("t"));
     if (value == NULL)
         return wai_error_set(ctx, WA_ERR_CORRUPT, "no token type attribute");
-    decode_string(ctx, value, &type);
+    decode_string(value, &type);
     token->type = webauth_token_type_code(type);
     if (token->type == WA_TOKEN_UNKNOWN) {
         wai_error_set(ctx, WA_ERR_CORRUPT, "unknown token type %s", type);
         return WA_ERR_CORRUPT;
     }
-    s = wai_token_encoding(ctx, token, &rules, (const void **) &data);
+    s = wai_token_encoding(ctx, token, &codec, (const void **) &data);
     if (s != WA_ERR_NONE)
         return s;
-    return decode_by_rule(ctx, rules, attrs, data, NULL, 0);
+    return codec->decode(ctx, attrs, data);
 }
@@ -4,7 +4,9 @@
  * Provided here is a table-driven encoder that transforms a struct into
  * WebAuth attribute encoding.  This is the encoding used inside tokens and
  * for some other WebAuth persistant data structures, such as service token
- * caches and keyrings.
+ * caches and keyrings.  Normal encoding uses the specialized functions
+ * generated along with the tables, which call the helpers here; the
+ * table-driven encoder is kept as the reference they are tested against.
  *
  * Written by Russ Allbery <eagle@eyrie.org>
  * Copyright 2012, 2013, 2014
@@ -42,37 +44,38 @@
 /*
  * Report an error while encoding an attribute.  Takes the WebAuth context,
  * status, description, context (for repeated elements), and element number
- * (for repeated elements).  This is an internal helper function for
- * encode_to_attrs.
+ * (for repeated elements).  Returns the status.
  */
-static void
-encode_error_set(struct webauth_context *ctx, int s, const char *desc,
-                 const char *context, size_t element)
+int
+wai_attr_encode_error(struct webauth_context *ctx, int s, const char *desc,
+                      const char *context, unsigned long element)
 {
     if (context != NULL && element != 0)
-        wai_error_set(ctx, s, "encoding %s %s %lu", context, desc,
-                      (unsigned long) element);
+        return wai_error_set(ctx, s, "encoding %s %s %lu", context, desc,
+                             element);
     else
-        wai_error_set(ctx, s, "encoding %s", desc);
+        return wai_error_set(ctx, s, "encoding %s", desc);
 }
 
 
 /*
  * Append an attribute and value to the output buffer.  Takes the output
- * buffer, the attribute key (as a string), the value and its length, and a
+ * buffer, the attribute key and its length, the value and its length, and a
  * flag indicating whether to hex-encode the data.  Returns a WebAuth error
  * code.
  */
-static int
-encode_data(struct wai_buffer *output, const char *attr, const void *data,
-            size_t length, bool ascii)
+int
+wai_attr_encode_data(struct wai_buffer *output, const char *attr,
+                     size_t attr_len, const void *data, size_t length,
+                     bool ascii)
 {
     size_t hexlen, i, enclen;
     const char *in = data;
     char *p;
     int s;
 
-    wai_buffer_append_sprintf(output, "%s=", attr);
+    wai_buffer_append(output, attr, attr_len);
+    wai_buffer_append(output, "=", 1);
     if (ascii) {
         hexlen = wai_hex_encoded_length(length);
         wai_buffer_resize(output, output->used + hexlen + 1);
@@ -104,20 +107,22 @@ encode_data(struct wai_buffer *output, const char *attr, const void *data,
 
 /*
  * Encode an attribute and numeric value to the output buffer.  Takes the
- * output buffer, the attribute key (as a string), the value as an unsigned
+ * output buffer, the attribute key and its length, the value as an unsigned
  * integer, and a flag indicating whether to format the number as a string.
  */
-static void
-encode_number(struct wai_buffer *output, const char *attr, unsigned long value,
-              bool ascii)
+void
+wai_attr_encode_number(struct wai_buffer *output, const char *attr,
+                       size_t attr_len, unsigned long value, bool ascii)
 {
-    if (ascii)
-        wai_buffer_append_sprintf(output, "%s=%lu;", attr, value);
-    else {
+    if (ascii) {
+        wai_buffer_append(output, attr, attr_len);
+        wai_buffer_append_sprintf(output, "=%lu;", value);
+    } else {
         uint32_t data = value;
 
         data = htonl(data);
-        encode_data(output, attr, &data, sizeof(data), false);
+        wai_attr_encode_data(output, attr, attr_len, &data, sizeof(data),
+                             false);
     }
 }
 
@@ -129,7 +134,7 @@ encode_number(struct wai_buffer *output, const char *attr, unsigned long value,
  * repeated attribute encoding, and the element number is appended to the
  * attribute name when encoding it.
  *
- * This is an internal helper function used by wai_encode.
+ * This is an internal helper function used by wai_encode_rules.
  */
 static int
 encode_to_attrs(struct webauth_context *ctx, const struct wai_encoding *rules,
@@ -138,6 +143,7 @@ encode_to_attrs(struct webauth_context *ctx, const struct wai_encoding *rules,
 {
     const struct wai_encoding *rule;
     const char *attr;
+    size_t attr_len;
     unsigned long i;
     int s;
     void *data, *repeat;
@@ -153,6 +159,7 @@ encode_to_attrs(struct webauth_context *ctx, const struct wai_encoding *rules,
             attr = rule->attr;
         else
             attr = apr_psprintf(ctx->pool, "%s%lu", rule->attr, element);
+        attr_len = strlen(attr);
         s = WA_ERR_NONE;
         switch (rule->type) {
         case WA_TYPE_DATA:
@@ -164,7 +171,8 @@ encode_to_attrs(struct webauth_context *ctx, const struct wai_encoding *rules,
                 break;
             }
             size = *LOC_SIZE(input, rule->len_offset);
-            s = encode_data(output, attr, data, size, rule->ascii);
+            s = wai_attr_encode_data(output, attr, attr_len, data, size,
+                                     rule->ascii);
             break;
         case WA_TYPE_STRING:
             string = *LOC_STRING(input, rule->offset);
@@ -174,25 +182,29 @@ encode_to_attrs(struct webauth_context *ctx, const struct wai_encoding *rules,
                 s = WA_ERR_INVALID;
                 break;
             }
-            s = encode_data(output, attr, string, strlen(string), false);
+            s = wai_attr_encode_data(output, attr, attr_len, string,
+                                     strlen(string), false);
             break;
         case WA_TYPE_INT32:
             int32 = *LOC_INT32(input, rule->offset);
             if (rule->optional && int32 == 0)
                 break;
-            encode_number(output, attr, int32, rule->ascii);
+            wai_attr_encode_number(output, attr, attr_len, int32,
+                                   rule->ascii);
             break;
         case WA_TYPE_UINT32:
             uint32 = *LOC_UINT32(input, rule->offset);
             if (rule->optional && uint32 == 0)
                 break;
-            encode_number(output, attr, uint32, rule->ascii);
+            wai_attr_encode_number(output, attr, attr_len, uint32,
+                                   rule->ascii);
             break;
         case WA_TYPE_ULONG:
             ulong = *LOC_ULONG(input, rule->offset);
             if (rule->optional && ulong == 0)
                 break;
-            encode_number(output, attr, ulong, rule->ascii);
+            wai_attr_encode_number(output, attr, attr_len, ulong,
+                                   rule->ascii);
             break;
         case WA_TYPE_TIME:
             timev = *LOC_TIME(input, rule->offset);
@@ -200,13 +212,15 @@ encode_to_attrs(struct webauth_context *ctx, const struct wai_encoding *rules,
                 timev = time(NULL);
             if (rule->optional && timev == 0)
                 break;
-            encode_number(output, attr, timev, rule->ascii);
+            wai_attr_encode_number(output, attr, attr_len, timev,
+                                   rule->ascii);
             break;
         case WA_TYPE_REPEAT:
             uint32 = *LOC_UINT32(input, rule->len_offset);
             if (rule->optional && uint32 == 0)
                 break;
-            encode_number(output, attr, uint32, rules->ascii);
+            wai_attr_encode_number(output, attr, attr_len, uint32,
+                                   rules->ascii);
             for (i = 0; i < uint32; i++) {
                 repeat = *LOC_STRING(input, rule->offset) + rule->size * i;
                 s = encode_to_attrs(ctx, rule->repeat, repeat, output,
@@ -216,28 +230,48 @@ encode_to_attrs(struct webauth_context *ctx, const struct wai_encoding *rules,
             }
             break;
         }
-        if (s != WA_ERR_NONE) {
-            encode_error_set(ctx, s, rule->desc, context, element);
-            return s;
-        }
+        if (s != WA_ERR_NONE)
+            return wai_attr_encode_error(ctx, s, rule->desc, context,
+                                         element);
     }
     return WA_ERR_NONE;
 }
 
 
 /*
- * Given an encoding specification and a pointer to the data to encode, encode
- * into attributes and return the encoded string in newly-allocated pool
- * memory.  Takes a separate pool to use rather than using the normal WebAuth
- * context pool, since attribute encoding can churn a lot of memory.
+ * Given a codec and a pointer to the data to encode, encode into attributes
+ * and return the encoded string in newly-allocated pool memory.
  */
 int
-wai_encode(struct webauth_context *ctx, const struct wai_encoding *rules,
+wai_encode(struct webauth_context *ctx, const struct wai_codec *codec,
            const void *data, void **output, size_t *length)
 {
     struct wai_buffer *buffer;
     int s;
 
+    buffer = wai_buffer_new(ctx->pool);
+    s = codec->encode(ctx, data, buffer);
+    if (s != WA_ERR_NONE)
+        return s;
+    *output = buffer->data;
+    *length = buffer->used;
+    return WA_ERR_NONE;
+}
+
+
+/*
+ * The same as wai_encode, but interprets the encoding rules instead of
+ * calling the generated encoder.  This is the reference encoder used to check
+ * the generated ones.
+ */
+int
+wai_encode_rules(struct webauth_context *ctx,
+                 const struct wai_encoding *rules, const void *data,
+                 void **output, size_t *length)
+{
+    struct wai_buffer *buffer;
+    int s;
+
     buffer = wai_buffer_new(ctx->pool);
     s = encode_to_attrs(ctx, rules, data, buffer, NULL, 0);
     if (s != WA_ERR_NONE)
@@ -261,16 +295,16 @@ wai_encode_token(struct webauth_context *ctx,
     struct wai_buffer *buffer;
     int s;
     const char *type;
-    const struct wai_encoding *rules;
+    const struct wai_codec *codec;
     const void *data;
 
-    s = wai_token_encoding(ctx, token, &rules, &data);
+    s = wai_token_encoding(ctx, token, &codec, &data);
     if (s != WA_ERR_NONE)
         return s;
     buffer = wai_buffer_new(ctx->pool);
     type = webauth_token_type_string(token->type);
     wai_buffer_append_sprintf(buffer, "t=%s;", type);
-    s = encode_to_attrs(ctx, rules, data, buffer, NULL, 0);
+    s = codec->encode(ctx, data, buffer);
     if (s != WA_ERR_NONE)
         return s;
     *output = buffer->data;
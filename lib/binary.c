@@ -0,0 +1,412 @@
+/*
+ * Binary encoding of WebAuth data files.
+ *
+ * Keyrings and service token caches are read by every Apache child when it
+ * starts and re-read whenever they change.  The attribute encoding used for
+ * them originally has to be unescaped and parsed into a hash before the
+ * fields can be picked out, so they can also be written in a small versioned
+ * binary format, if asked for with WA_FILE_FORMAT_BINARY.  The fields are
+ * read directly from the file data, and only the keys and token are copied.
+ *
+ * Every file starts with a 16-byte header:
+ *
+ *     magic     4 bytes   "\0WAF"
+ *     type      2 bytes   WA_BINARY_KEYRING or WA_BINARY_WAS_CACHE
+ *     version   2 bytes   currently 1
+ *     length    4 bytes   length of the body following the header
+ *     checksum  4 bytes   CRC-32 of the body
+ *
+ * All integers are in network byte order and times are 64-bit signed
+ * integers.  The leading nul in the magic number can never start a file in
+ * the attribute encoding, which is what lets the readers accept both.  A
+ * keyring body is a 4-byte count of entries, each of which is the creation
+ * and valid-after times followed by the key type, key length, and key.  A
+ * service token cache body is the created, expires, last renewal, and next
+ * renewal times, the key type, key length, and token length, then the key
+ * and the token with a trailing nul.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ * Copyright 2014
+ *     The Board of Trustees of the Leland Stanford Junior University
+ *
+ * See LICENSE for licensing terms.
+ */
+
+#include <config.h>
+#include <portable/apr.h>
+#include <portable/system.h>
+
+#include <lib/internal.h>
+#include <webauth/basic.h>
+#include <webauth/keys.h>
+#include <webauth/was.h>
+
+/* The magic number and version of the header. */
+#define BINARY_MAGIC      "\0WAF"
+#define BINARY_MAGIC_LEN  4
+#define BINARY_HEADER_LEN 16
+#define BINARY_VERSION    1
+
+/* Sizes of the fixed parts of the bodies. */
+#define KEYRING_ENTRY_LEN (8 + 8 + 4 + 4)
+#define WAS_CACHE_LEN     (8 * 4 + 4 * 3)
+
+/*
+ * A cursor for reading a body.  Reads past the end set the overflow flag
+ * instead of failing immediately, so that callers can check once at the end.
+ */
+struct reader {
+    const unsigned char *data;
+    size_t left;
+    bool overflow;
+};
+
+
+/*
+ * Compute the standard CRC-32 (as used by zlib and Ethernet) of some data.
+ * The files are small, so the simple bitwise algorithm is fast enough.
+ */
+static uint32_t
+binary_crc32(const unsigned char *data, size_t length)
+{
+    uint32_t crc = 0xffffffffUL;
+    size_t i;
+    int bit;
+
+    for (i = 0; i < length; i++) {
+        crc ^= data[i];
+        for (bit = 0; bit < 8; bit++)
+            crc = (crc >> 1) ^ (0xedb88320UL & (0 - (crc & 1)));
+    }
+    return crc ^ 0xffffffffUL;
+}
+
+
+/*
+ * Store integers in network byte order.  Return the position after them.
+ */
+static unsigned char *
+put_uint16(unsigned char *p, uint16_t value)
+{
+    p[0] = (value >> 8) & 0xff;
+    p[1] = value & 0xff;
+    return p + 2;
+}
+
+static unsigned char *
+put_uint32(unsigned char *p, uint32_t value)
+{
+    p[0] = (value >> 24) & 0xff;
+    p[1] = (value >> 16) & 0xff;
+    p[2] = (value >> 8) & 0xff;
+    p[3] = value & 0xff;
+    return p + 4;
+}
+
+static unsigned char *
+put_time(unsigned char *p, time_t value)
+{
+    uint64_t wide = (uint64_t) (int64_t) value;
+
+    p = put_uint32(p, (uint32_t) (wide >> 32));
+    return put_uint32(p, (uint32_t) (wide & 0xffffffffUL));
+}
+
+
+/*
+ * Read integers and data from a body, advancing the reader.
+ */
+static const unsigned char *
+get_data(struct reader *reader, size_t length)
+{
+    const unsigned char *p = reader->data;
+
+    if (reader->overflow || reader->left < length) {
+        reader->overflow = true;
+        return NULL;
+    }
+    reader->data += length;
+    reader->left -= length;
+    return p;
+}
+
+static uint16_t
+get_uint16(const unsigned char *p)
+{
+    return ((uint16_t) p[0] << 8) | p[1];
+}
+
+static uint32_t
+get_uint32(struct reader *reader)
+{
+    const unsigned char *p;
+
+    p = get_data(reader, 4);
+    if (p == NULL)
+        return 0;
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16)
+        | ((uint32_t) p[2] << 8) | p[3];
+}
+
+static time_t
+get_time(struct reader *reader)
+{
+    uint64_t high, low;
+
+    high = get_uint32(reader);
+    low = get_uint32(reader);
+    return (time_t) (int64_t) ((high << 32) | low);
+}
+
+
+/*
+ * Allocate the buffer for a file of the given type with a body of the given
+ * length.  Returns a pointer to where the body should be written.  The
+ * header is completed by finish_file once the body is written.
+ */
+static unsigned char *
+start_file(struct webauth_context *ctx, enum wai_binary_type type,
+           size_t length, void **output, size_t *output_len)
+{
+    unsigned char *file, *p;
+
+    file = apr_palloc(ctx->pool, BINARY_HEADER_LEN + length);
+    memcpy(file, BINARY_MAGIC, BINARY_MAGIC_LEN);
+    p = put_uint16(file + BINARY_MAGIC_LEN, type);
+    p = put_uint16(p, BINARY_VERSION);
+    p = put_uint32(p, length);
+    *output = file;
+    *output_len = BINARY_HEADER_LEN + length;
+    return file + BINARY_HEADER_LEN;
+}
+
+static void
+finish_file(void *file, size_t length)
+{
+    unsigned char *body = (unsigned char *) file + BINARY_HEADER_LEN;
+
+    put_uint32(body - 4, binary_crc32(body, length - BINARY_HEADER_LEN));
+}
+
+
+/*
+ * Check the header of a file of the given type and set up a reader for its
+ * body.  Returns a WebAuth status code.
+ */
+static int
+open_file(struct webauth_context *ctx, enum wai_binary_type type,
+          const void *input, size_t length, struct reader *reader)
+{
+    const unsigned char *data = input;
+    struct reader header;
+    uint32_t body_len, checksum;
+    int s;
+
+    if (!wai_binary_is(input, length) || length < BINARY_HEADER_LEN) {
+        s = WA_ERR_CORRUPT;
+        return wai_error_set(ctx, s, "truncated binary file header");
+    }
+    if (get_uint16(data + 4) != type) {
+        s = WA_ERR_CORRUPT;
+        return wai_error_set(ctx, s, "binary file type %u, expected %u",
+                             get_uint16(data + 4), (unsigned int) type);
+    }
+    if (get_uint16(data + 6) != BINARY_VERSION) {
+        s = WA_ERR_FILE_VERSION;
+        return wai_error_set(ctx, s, "binary file version %u",
+                             get_uint16(data + 6));
+    }
+    header.data = data + 8;
+    header.left = 8;
+    header.overflow = false;
+    body_len = get_uint32(&header);
+    checksum = get_uint32(&header);
+    if (body_len != length - BINARY_HEADER_LEN) {
+        s = WA_ERR_CORRUPT;
+        return wai_error_set(ctx, s, "binary file length %lu, expected %lu",
+                             (unsigned long) (length - BINARY_HEADER_LEN),
+                             (unsigned long) body_len);
+    }
+    reader->data = data + BINARY_HEADER_LEN;
+    reader->left = body_len;
+    reader->overflow = false;
+    if (binary_crc32(reader->data, body_len) != checksum) {
+        s = WA_ERR_CORRUPT;
+        return wai_error_set(ctx, s, "binary file checksum mismatch");
+    }
+    return WA_ERR_NONE;
+}
+
+
+/*
+ * Return true if the data looks like a file in the binary encoding.
+ */
+bool
+wai_binary_is(const void *input, size_t length)
+{
+    if (length < BINARY_MAGIC_LEN)
+        return false;
+    return memcmp(input, BINARY_MAGIC, BINARY_MAGIC_LEN) == 0;
+}
+
+
+/*
+ * Encode a keyring in the binary format.
+ */
+int
+wai_binary_encode_keyring(struct webauth_context *ctx,
+                          const struct webauth_keyring *ring,
+                          void **output, size_t *length)
+{
+    const struct webauth_keyring_entry *entry;
+    unsigned char *p;
+    size_t size, i;
+
+    size = 4;
+    for (i = 0; i < (size_t) ring->entries->nelts; i++) {
+        entry = &APR_ARRAY_IDX(ring->entries, i, struct webauth_keyring_entry);
+        size += KEYRING_ENTRY_LEN + entry->key->length;
+    }
+    p = start_file(ctx, WA_BINARY_KEYRING, size, output, length);
+    p = put_uint32(p, ring->entries->nelts);
+    for (i = 0; i < (size_t) ring->entries->nelts; i++) {
+        entry = &APR_ARRAY_IDX(ring->entries, i, struct webauth_keyring_entry);
+        p = put_time(p, entry->creation);
+        p = put_time(p, entry->valid_after);
+        p = put_uint32(p, entry->key->type);
+        p = put_uint32(p, entry->key->length);
+        memcpy(p, entry->key->data, entry->key->length);
+        p += entry->key->length;
+    }
+    finish_file(*output, *length);
+    return WA_ERR_NONE;
+}
+
+
+/*
+ * Decode a keyring in the binary format.  The keys are copied out of the
+ * input, which may be a mapping of a file that goes away.  The key types and
+ * sizes are checked the same way as webauth_key_create does.
+ */
+int
+wai_binary_decode_keyring(struct webauth_context *ctx, const void *input,
+                          size_t length, struct webauth_keyring **output)
+{
+    struct reader reader;
+    struct webauth_keyring *ring;
+    struct webauth_keyring_entry entry;
+    struct webauth_key *keys;
+    const unsigned char *data;
+    uint32_t count, i, type, size;
+    int s;
+
+    *output = NULL;
+    s = open_file(ctx, WA_BINARY_KEYRING, input, length, &reader);
+    if (s != WA_ERR_NONE)
+        return s;
+    count = get_uint32(&reader);
+    if (count > reader.left / KEYRING_ENTRY_LEN) {
+        s = WA_ERR_CORRUPT;
+        return wai_error_set(ctx, s, "keyring entry count %lu too large",
+                             (unsigned long) count);
+    }
+    ring = webauth_keyring_new(ctx, count);
+    keys = apr_palloc(ctx->pool, count * sizeof(struct webauth_key));
+    for (i = 0; i < count; i++) {
+        entry.creation = get_time(&reader);
+        entry.valid_after = get_time(&reader);
+        type = get_uint32(&reader);
+        size = get_uint32(&reader);
+        data = get_data(&reader, size);
+        if (reader.overflow)
+            break;
+        if (type != WA_KEY_AES) {
+            s = WA_ERR_UNIMPLEMENTED;
+            return wai_error_set(ctx, s, "unsupported key type %lu",
+                                 (unsigned long) type);
+        }
+        if (size != WA_AES_128 && size != WA_AES_192 && size != WA_AES_256) {
+            s = WA_ERR_UNIMPLEMENTED;
+            return wai_error_set(ctx, s, "unsupported key size %lu",
+                                 (unsigned long) size);
+        }
+        keys[i].type = type;
+        keys[i].length = size;
+        keys[i].data = apr_pmemdup(ctx->pool, data, size);
+        entry.key = &keys[i];
+        wai_keyring_push(ring, &entry);
+    }
+    if (reader.overflow || reader.left != 0) {
+        s = WA_ERR_CORRUPT;
+        return wai_error_set(ctx, s, "keyring entries do not match length");
+    }
+    *output = ring;
+    return WA_ERR_NONE;
+}
+
+
+/*
+ * Encode a service token cache in the binary format.
+ */
+int
+wai_binary_encode_was_cache(struct webauth_context *ctx,
+                            const struct webauth_was_token_cache *cache,
+                            void **output, size_t *length)
+{
+    unsigned char *p;
+    size_t token_len;
+
+    token_len = strlen(cache->token);
+    p = start_file(ctx, WA_BINARY_WAS_CACHE,
+                   WAS_CACHE_LEN + cache->key_data_len + token_len + 1,
+                   output, length);
+    p = put_time(p, cache->created);
+    p = put_time(p, cache->expires);
+    p = put_time(p, cache->last_renewal);
+    p = put_time(p, cache->next_renewal);
+    p = put_uint32(p, cache->key_type);
+    p = put_uint32(p, cache->key_data_len);
+    p = put_uint32(p, token_len);
+    memcpy(p, cache->key_data, cache->key_data_len);
+    p += cache->key_data_len;
+    memcpy(p, cache->token, token_len + 1);
+    finish_file(*output, *length);
+    return WA_ERR_NONE;
+}
+
+
+/*
+ * Decode a service token cache in the binary format.  The key and token are
+ * copied out of the input.
+ */
+int
+wai_binary_decode_was_cache(struct webauth_context *ctx, const void *input,
+                            size_t length,
+                            struct webauth_was_token_cache *cache)
+{
+    struct reader reader;
+    uint32_t token_len;
+    const unsigned char *key, *token;
+    int s;
+
+    s = open_file(ctx, WA_BINARY_WAS_CACHE, input, length, &reader);
+    if (s != WA_ERR_NONE)
+        return s;
+    cache->created = get_time(&reader);
+    cache->expires = get_time(&reader);
+    cache->last_renewal = get_time(&reader);
+    cache->next_renewal = get_time(&reader);
+    cache->key_type = get_uint32(&reader);
+    cache->key_data_len = get_uint32(&reader);
+    token_len = get_uint32(&reader);
+    key = get_data(&reader, cache->key_data_len);
+    token = get_data(&reader, token_len);
+    if (!reader.overflow && reader.left == 1 && token[token_len] == '\0') {
+        cache->key_data = apr_pmemdup(ctx->pool, key, cache->key_data_len);
+        cache->token = apr_pstrmemdup(ctx->pool, (const char *) token,
+                                      token_len);
+        return WA_ERR_NONE;
+    }
+    s = WA_ERR_CORRUPT;
+    return wai_error_set(ctx, s, "malformed service token cache");
+}
@@ -0,0 +1,69 @@
+/*
+ * Public interface for collecting data in buffers.
+ *
+ * These functions wrap a chunked struct wai_buffer so that the Apache
+ * modules can collect response bodies and element text with the same
+ * growth policy as the library, without copying data as it arrives.
+ *
+ * Copyright 2014
+ *     The Board of Trustees of the Leland Stanford Junior University
+ *
+ * See LICENSE for licensing terms.
+ */
+
+#include <config.h>
+#include <portable/apr.h>
+#include <portable/system.h>
+
+#include <lib/internal.h>
+#include <webauth/buffer.h>
+
+
+/*
+ * Create a new buffer, allocated from the given pool.
+ */
+struct webauth_buffer *
+webauth_buffer_new(apr_pool_t *pool)
+{
+    struct webauth_buffer *buffer;
+
+    buffer = apr_palloc(pool, sizeof(struct webauth_buffer));
+    buffer->buffer = wai_buffer_new_chunked(pool);
+    return buffer;
+}
+
+
+/*
+ * Append data to a buffer.
+ */
+void
+webauth_buffer_append(struct webauth_buffer *buffer, const void *data,
+                      size_t length)
+{
+    wai_buffer_append(buffer->buffer, data, length);
+}
+
+
+/*
+ * Return the length of the data in a buffer.
+ */
+size_t
+webauth_buffer_length(const struct webauth_buffer *buffer)
+{
+    return wai_buffer_length(buffer->buffer);
+}
+
+
+/*
+ * Return the contents of a buffer as a single string, flattening it first
+ * if needed.  A buffer that was never appended to has no block yet, so give
+ * it an empty one.
+ */
+char *
+webauth_buffer_string(struct webauth_buffer *buffer)
+{
+    if (buffer->buffer->data == NULL)
+        wai_buffer_set(buffer->buffer, "", 0);
+    wai_buffer_flatten(buffer->buffer);
+    return buffer->buffer->data;
+}
@@ -5,7 +5,7 @@
  * state required by the WebAuth APIs.
  *
  * Written by Russ Allbery <eagle@eyrie.org>
- * Copyright 2011, 2012, 2013
+ * Copyright 2011, 2012, 2013, 2014
  *     The Board of Trustees of the Leland Stanford Junior University
  *
  * See LICENSE for licensing terms.
@@ -30,6 +30,7 @@ init_context(apr_pool_t *pool)
 
     ctx = apr_pcalloc(pool, sizeof(struct webauth_context));
     ctx->pool = pool;
+    ctx->config_pool = pool;
     return ctx;
 }
 
@@ -99,6 +100,55 @@ webauth_context_init_apr(struct webauth_context **context, apr_pool_t *parent)
 }
 
 
+/*
+ * Initialize a WebAuth context that shares the configuration of an existing
+ * context.  The WebKDC and user information service configuration are not
+ * copied; the new context points to the configuration in the source context,
+ * which therefore must not be reconfigured or freed while the new context is
+ * in use.  Any attached metrics are shared as well.  Logging callbacks are
+ * not shared.  This is used to create cheap per-thread contexts from a
+ * configuration validated once at startup.
+ */
+int
+webauth_context_init_shared(struct webauth_context **context,
+                            apr_pool_t *parent,
+                            const struct webauth_context *source)
+{
+    int s;
+
+    s = webauth_context_init_apr(context, parent);
+    if (s != WA_ERR_NONE)
+        return s;
+    (*context)->webkdc  = source->webkdc;
+    (*context)->user    = source->user;
+    (*context)->metrics = source->metrics;
+    return WA_ERR_NONE;
+}
+
+
+/*
+ * Reset a WebAuth context for reuse.  All memory allocated from the context
+ * since the previous reset is released and any saved error is cleared, but
+ * the configuration and logging callbacks are kept.  On the first call, this
+ * creates the subpool that subsequent allocations will come from.
+ */
+int
+webauth_context_reset(struct webauth_context *ctx)
+{
+    if (ctx->arena == NULL) {
+        if (apr_pool_create(&ctx->arena, ctx->config_pool) != APR_SUCCESS)
+            return WA_ERR_APR;
+        apr_pool_abort_set(pool_failure, ctx->arena);
+    } else {
+        apr_pool_clear(ctx->arena);
+    }
+    ctx->pool   = ctx->arena;
+    ctx->error  = NULL;
+    ctx->status = WA_ERR_NONE;
+    return WA_ERR_NONE;
+}
+
+
 /*
  * Free the WebAuth context and its corresponding subpool, which will free all
  * memory that was allocated from that context.  This should only be called by
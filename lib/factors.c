@@ -21,19 +21,164 @@
 #include <webauth/basic.h>
 #include <webauth/factors.h>
 
+/*
+ * Factors that we know about are interned as a bit in a bitmask so that set
+ * operations on them don't require string comparisons.  These are the bit
+ * positions for each known factor.
+ */
+enum factor_bit {
+    FACTOR_COOKIE = 0,
+    FACTOR_DEVICE,
+    FACTOR_HUMAN,
+    FACTOR_KERBEROS,
+    FACTOR_MOBILE_PUSH,
+    FACTOR_MULTIFACTOR,
+    FACTOR_OTP,
+    FACTOR_OTP1,
+    FACTOR_OTP2,
+    FACTOR_OTP3,
+    FACTOR_PASSWORD,
+    FACTOR_RANDOM_MULTIFACTOR,
+    FACTOR_UNKNOWN,
+    FACTOR_VOICE,
+    FACTOR_X509,
+    FACTOR_X509_1
+};
+#define FBIT(f) (1UL << (f))
+
+/* Masks for the classes of factors used to synthesize multifactor. */
+#define FACTORS_OTP                                             \
+    (FBIT(FACTOR_OTP) | FBIT(FACTOR_OTP1) | FBIT(FACTOR_OTP2)   \
+     | FBIT(FACTOR_OTP3))
+#define FACTORS_X509 (FBIT(FACTOR_X509) | FBIT(FACTOR_X509_1))
+
 /*
  * Stores a set of factors that we want to perform operations on.  This is a
- * list of authentication methods (like "p", "o1", etc.) plus flags for
- * multifactor and random multifactor.  Those flags are just optimizations
- * (and may be worth dropping).
+ * list of authentication methods (like "p", "o1", etc.) in the order in which
+ * they were added, plus a bitmask of the known factors in the set and a
+ * spillover list of any other factors, which are used for membership tests.
  */
 struct webauth_factors {
-    int multifactor;                    /* "m" (two factors in use) */
-    int random;                         /* "rm" (random multifactor) */
+    unsigned long known;                /* Bitmask of known factors. */
+    apr_array_header_t *unknown;        /* Other factor codes, or NULL. */
     apr_array_header_t *factors;        /* Array of char * factor codes. */
 };
 
 
+/*
+ * Map a factor code to its bit in the known factor bitmask.  Returns 0 if
+ * this isn't a factor we know about.
+ */
+static unsigned long
+factor_bit(const char *factor)
+{
+    switch (factor[0]) {
+    case 'c':
+        return (factor[1] == '\0') ? FBIT(FACTOR_COOKIE) : 0;
+    case 'd':
+        return (factor[1] == '\0') ? FBIT(FACTOR_DEVICE) : 0;
+    case 'h':
+        return (factor[1] == '\0') ? FBIT(FACTOR_HUMAN) : 0;
+    case 'k':
+        return (factor[1] == '\0') ? FBIT(FACTOR_KERBEROS) : 0;
+    case 'm':
+        if (factor[1] == '\0')
+            return FBIT(FACTOR_MULTIFACTOR);
+        if (factor[1] == 'p' && factor[2] == '\0')
+            return FBIT(FACTOR_MOBILE_PUSH);
+        return 0;
+    case 'o':
+        if (factor[1] == '\0')
+            return FBIT(FACTOR_OTP);
+        if (factor[1] >= '1' && factor[1] <= '3' && factor[2] == '\0')
+            return FBIT(FACTOR_OTP1 + (factor[1] - '1'));
+        return 0;
+    case 'p':
+        return (factor[1] == '\0') ? FBIT(FACTOR_PASSWORD) : 0;
+    case 'r':
+        if (factor[1] == 'm' && factor[2] == '\0')
+            return FBIT(FACTOR_RANDOM_MULTIFACTOR);
+        return 0;
+    case 'u':
+        return (factor[1] == '\0') ? FBIT(FACTOR_UNKNOWN) : 0;
+    case 'v':
+        return (factor[1] == '\0') ? FBIT(FACTOR_VOICE) : 0;
+    case 'x':
+        if (factor[1] == '\0')
+            return FBIT(FACTOR_X509);
+        if (factor[1] == '1' && factor[2] == '\0')
+            return FBIT(FACTOR_X509_1);
+        return 0;
+    default:
+        return 0;
+    }
+}
+
+
+/*
+ * Create a new, empty webauth_factors struct, with space for the given
+ * number of factors.
+ */
+static struct webauth_factors *
+factors_empty(struct webauth_context *ctx, int size)
+{
+    struct webauth_factors *factors;
+
+    factors = apr_pcalloc(ctx->pool, sizeof(struct webauth_factors));
+    factors->factors = apr_array_make(ctx->pool, size, sizeof(const char *));
+    return factors;
+}
+
+
+/*
+ * Returns true if the given webauth_factors struct contains the provided
+ * factor and false otherwise.  Only factors we don't know about require
+ * string comparisons.
+ */
+static bool
+factors_has(const struct webauth_factors *factors, const char *factor)
+{
+    unsigned long bit;
+    int i;
+
+    bit = factor_bit(factor);
+    if (bit != 0)
+        return (factors->known & bit) != 0;
+    if (factors->unknown == NULL)
+        return false;
+    for (i = 0; i < factors->unknown->nelts; i++)
+        if (strcmp(factor, APR_ARRAY_IDX(factors->unknown, i, char *)) == 0)
+            return true;
+    return false;
+}
+
+
+/*
+ * Add a factor to a webauth_factors struct if it isn't already present.  The
+ * factor string is not copied.
+ */
+static void
+factors_add(struct webauth_context *ctx, struct webauth_factors *factors,
+            const char *factor)
+{
+    unsigned long bit;
+
+    bit = factor_bit(factor);
+    if (bit != 0) {
+        if (factors->known & bit)
+            return;
+        factors->known |= bit;
+    } else {
+        if (factors_has(factors, factor))
+            return;
+        if (factors->unknown == NULL)
+            factors->unknown = apr_array_make(ctx->pool, 1, sizeof(char *));
+        APR_ARRAY_PUSH(factors->unknown, const char *) = factor;
+    }
+    APR_ARRAY_PUSH(factors->factors, const char *) = factor;
+}
+
+
 /*
  * Scan a set of factors and add a synthesized multifactor factor if it
  * includes authentications from multiple factors.
@@ -43,32 +188,32 @@ maybe_synthesize_multifactor(struct webauth_factors *factors)
 {
     int types, i;
     const char *factor;
-    bool human    = false;
-    bool mobile   = false;
-    bool otp      = false;
-    bool password = false;
-    bool voice    = false;
-    bool x509     = false;
+    unsigned long known = factors->known;
+    bool otp  = (known & FACTORS_OTP) != 0;
+    bool x509 = (known & FACTORS_X509) != 0;
 
     /* If this set of factors already includes multifactor, do nothing. */
-    if (factors->multifactor)
+    if (known & FBIT(FACTOR_MULTIFACTOR))
         return;
 
-    /* Scan the factors and count how many classes we have. */
-    for (i = 0; i < factors->factors->nelts; i++) {
-        factor = APR_ARRAY_IDX(factors->factors, i, const char *);
-        if      (strcmp(factor, WA_FA_HUMAN)       == 0) human    = true;
-        else if (strcmp(factor, WA_FA_MOBILE_PUSH) == 0) mobile   = true;
-        else if (strcmp(factor, WA_FA_PASSWORD)    == 0) password = true;
-        else if (strcmp(factor, WA_FA_VOICE)       == 0) voice    = true;
-        else if (factor[0] == 'o')                       otp      = true;
-        else if (factor[0] == 'x')                       x509     = true;
-    }
-    types = (int) human + mobile + password + otp + voice + x509;
+    /* Any other OTP or X.509 factors only show up in the spillover list. */
+    if (factors->unknown != NULL)
+        for (i = 0; i < factors->unknown->nelts; i++) {
+            factor = APR_ARRAY_IDX(factors->unknown, i, const char *);
+            if      (factor[0] == 'o') otp  = true;
+            else if (factor[0] == 'x') x509 = true;
+        }
+
+    /* Count how many classes of factors we have. */
+    types = (int) otp + x509;
+    types += (known & FBIT(FACTOR_HUMAN))       ? 1 : 0;
+    types += (known & FBIT(FACTOR_MOBILE_PUSH)) ? 1 : 0;
+    types += (known & FBIT(FACTOR_PASSWORD))    ? 1 : 0;
+    types += (known & FBIT(FACTOR_VOICE))       ? 1 : 0;
 
     /* If we have factors from more than one class, synthesize multifactor. */
     if (types >= 2) {
-        factors->multifactor = true;
+        factors->known |= FBIT(FACTOR_MULTIFACTOR);
         APR_ARRAY_PUSH(factors->factors, const char *) = WA_FA_MULTIFACTOR;
     }
 }
@@ -85,41 +230,16 @@ factors_copy(struct webauth_context *ctx,
 {
     struct webauth_factors *copy;
 
-    if (factors == NULL) {
-        copy = apr_pcalloc(ctx->pool, sizeof(struct webauth_factors));
-        copy->factors = apr_array_make(ctx->pool, 1, sizeof(const char *));
-    } else {
-        copy = apr_pmemdup(ctx->pool, factors, sizeof(*factors));
-        copy->factors = apr_array_copy(ctx->pool, factors->factors);
-    }
+    if (factors == NULL)
+        return factors_empty(ctx, 1);
+    copy = apr_pmemdup(ctx->pool, factors, sizeof(*factors));
+    copy->factors = apr_array_copy(ctx->pool, factors->factors);
+    if (factors->unknown != NULL)
+        copy->unknown = apr_array_copy(ctx->pool, factors->unknown);
     return copy;
 }
 
 
-/*
- * Returns true if the given webauth_factors struct satisfies the provided
- * factor, and false otherwise.  As a special case, factor sets containing
- * multifactor are always considered to satisfy random multifactor as well.
- */
-static bool
-factors_satisfies(const struct webauth_factors *factors, const char *factor)
-{
-    int i;
-    const char *candidate;
-
-    if (factors == NULL || apr_is_empty_array(factors->factors))
-        return false;
-    if (strcmp(factor, WA_FA_RANDOM_MULTIFACTOR) == 0 && factors->multifactor)
-        return true;
-    for (i = 0; i < factors->factors->nelts; i++) {
-        candidate = APR_ARRAY_IDX(factors->factors, i, const char *);
-        if (strcmp(factor, candidate) == 0)
-            return true;
-    }
-    return false;
-}
-
-
 /*
  * Return all the factors as a newly pool-allocated array.  We do a deep copy
  * just in case the factors came from a different context.
@@ -145,24 +265,16 @@ webauth_factors_contains(struct webauth_context *ctx UNUSED,
                          const struct webauth_factors *factors,
                          const char *factor)
 {
-    int i;
-    const char *candidate;
-
-    if (factors == NULL || apr_is_empty_array(factors->factors))
+    if (factors == NULL)
         return false;
-    for (i = 0; i < factors->factors->nelts; i++) {
-        candidate = APR_ARRAY_IDX(factors->factors, i, const char *);
-        if (strcmp(factor, candidate) == 0)
-            return true;
-    }
-    return false;
+    return factors_has(factors, factor);
 }
 
 
 /*
  * Given an array of factor strings (possibly NULL), create a new
- * pool-allocated webauth_factors struct and return it.  This function does
- * not synthesize multifactor.
+ * pool-allocated webauth_factors struct and return it.  Duplicate factors are
+ * dropped.  This function does not synthesize multifactor.
  */
 struct webauth_factors *
 webauth_factors_new(struct webauth_context *ctx,
@@ -170,24 +282,12 @@ webauth_factors_new(struct webauth_context *ctx,
 {
     struct webauth_factors *result;
     int i;
-    const char *factor;
-
-    /* Create the new webauth_factors struct and copy the factors. */
-    result = apr_pcalloc(ctx->pool, sizeof(struct webauth_factors));
-    if (factors != NULL)
-        result->factors = apr_array_copy(ctx->pool, factors);
-    else
-        result->factors = apr_array_make(ctx->pool, 1, sizeof(const char *));
-
-    /* Fill out the multifactor and random multifactor data. */
-    for (i = 0; i < result->factors->nelts; i++) {
-        factor = APR_ARRAY_IDX(result->factors, i, const char *);
-        if (strcmp(factor, WA_FA_MULTIFACTOR) == 0)
-            result->multifactor = true;
-        else if (strcmp(factor, WA_FA_RANDOM_MULTIFACTOR) == 0)
-            result->random = true;
-    }
 
+    if (factors == NULL)
+        return factors_empty(ctx, 1);
+    result = factors_empty(ctx, factors->nelts > 0 ? factors->nelts : 1);
+    for (i = 0; i < factors->nelts; i++)
+        factors_add(ctx, result, APR_ARRAY_IDX(factors, i, const char *));
     return result;
 }
 
@@ -209,8 +309,7 @@ webauth_factors_parse(struct webauth_context *ctx, const char *input)
      * Create an empty webauth_factors struct and return it if the string is
      * NULL or empty.
      */
-    factors = apr_pcalloc(ctx->pool, sizeof(struct webauth_factors));
-    factors->factors = apr_array_make(ctx->pool, 1, sizeof(const char *));
+    factors = factors_empty(ctx, 4);
     if (input == NULL || input[0] == '\0')
         return factors;
 
@@ -220,24 +319,10 @@ webauth_factors_parse(struct webauth_context *ctx, const char *input)
      */
     copy = apr_pstrdup(ctx->pool, input);
 
-    /*
-     * Walk through each factor and add it to the array.  In the process, set
-     * the booleans for multifactor and random multifactor if we see them.
-     */
+    /* Walk through each factor and add it to the set, dropping duplicates. */
     for (factor = apr_strtok(copy, ",", &last); factor != NULL;
-         factor = apr_strtok(NULL, ",", &last)) {
-
-        /* Only add the factor if it's not a duplicate. */
-        if (webauth_factors_contains(ctx, factors, factor))
-            continue;
-
-        /* Add the factor and set the multifactor and random flags. */
-        APR_ARRAY_PUSH(factors->factors, const char *) = factor;
-        if (strcmp(factor, WA_FA_MULTIFACTOR) == 0)
-            factors->multifactor = true;
-        else if (strcmp(factor, WA_FA_RANDOM_MULTIFACTOR) == 0)
-            factors->random = true;
-    }
+         factor = apr_strtok(NULL, ",", &last))
+        factors_add(ctx, factors, factor);
 
     /* See if we should synthesize a multifactor factor. */
     maybe_synthesize_multifactor(factors);
@@ -259,7 +344,6 @@ webauth_factors_union(struct webauth_context *ctx,
 {
     struct webauth_factors *result;
     int i;
-    const char *factor;
 
     /* Handle trivial cases. */
     if (one == NULL || apr_is_empty_array(one->factors))
@@ -267,22 +351,12 @@ webauth_factors_union(struct webauth_context *ctx,
     else if (two == NULL || apr_is_empty_array(two->factors))
         return factors_copy(ctx, one);
 
-    /* We have to merge. */
+    /* We have to merge, unless two adds nothing new. */
     result = factors_copy(ctx, one);
-    for (i = 0; i < two->factors->nelts; i++) {
-        factor = APR_ARRAY_IDX(two->factors, i, const char *);
-
-        /* Check whether the factor already exists in the result. */
-        if (webauth_factors_contains(ctx, result, factor))
-            continue;
-
-        /* Add the new factor to the result. */
-        APR_ARRAY_PUSH(result->factors, const char *) = factor;
-        if (strcmp(factor, WA_FA_MULTIFACTOR) == 0)
-            result->multifactor = true;
-        else if (strcmp(factor, WA_FA_RANDOM_MULTIFACTOR) == 0)
-            result->random = true;
-    }
+    if ((two->known & ~one->known) != 0 || two->unknown != NULL)
+        for (i = 0; i < two->factors->nelts; i++)
+            factors_add(ctx, result,
+                        APR_ARRAY_IDX(two->factors, i, const char *));
 
     /* See if we should synthesize a multifactor factor. */
     maybe_synthesize_multifactor(result);
@@ -309,25 +383,29 @@ webauth_factors_string(struct webauth_context *ctx,
 
 /*
  * Given two sets of factors (struct webauth_factors), return true if the
- * first set satisfies the second set, false otherwise.
+ * first set satisfies the second set, false otherwise.  Known factors are
+ * checked with a single mask operation; only factors we don't know about
+ * need to be checked individually.
  */
 int
 webauth_factors_satisfies(struct webauth_context *ctx UNUSED,
                           const struct webauth_factors *one,
                           const struct webauth_factors *two)
 {
-    const char *factor;
+    unsigned long missing;
     int i;
 
     if (two == NULL)
         return true;
-    if (!one->multifactor && two->multifactor)
+    missing = two->known & ~one->known;
+    if (one->known & FBIT(FACTOR_MULTIFACTOR))
+        missing &= ~FBIT(FACTOR_RANDOM_MULTIFACTOR);
+    if (missing != 0)
         return false;
-    for (i = 0; i < two->factors->nelts; i++) {
-        factor = APR_ARRAY_IDX(two->factors, i, const char *);
-        if (!factors_satisfies(one, factor))
-            return false;
-    }
+    if (two->unknown != NULL)
+        for (i = 0; i < two->unknown->nelts; i++)
+            if (!factors_has(one, APR_ARRAY_IDX(two->unknown, i, char *)))
+                return false;
     return true;
 }
 
@@ -344,34 +422,38 @@ webauth_factors_subtract(struct webauth_context *ctx,
 {
     struct webauth_factors *result;
     const char *factor;
+    unsigned long bit;
     int i;
 
     /* Handle some trivial cases. */
     if (one == NULL)
         return NULL;
-    if (two == NULL) {
-        result = apr_pmemdup(ctx->pool, one, sizeof(struct webauth_factors));
-        result->factors = apr_array_copy(ctx->pool, one->factors);
-        return result;
-    }
+    if (two == NULL)
+        return factors_copy(ctx, one);
 
     /* Create the new set of factors that we will return. */
-    result = apr_pcalloc(ctx->pool, sizeof(struct webauth_factors));
-    result->factors = apr_array_make(ctx->pool, 2, sizeof(const char *));
+    result = factors_empty(ctx, 2);
 
     /*
      * Walk the list of factors in one and, for each, check whether it's
-     * satisifed by two.  This is O(n^2), but factor lists tend to be small.
+     * satisifed by two.  Preserve the order of the factors in one.  Known
+     * factors only need a mask check, and one contains no duplicates.
      */
     for (i = 0; i < one->factors->nelts; i++) {
         factor = APR_ARRAY_IDX(one->factors, i, const char *);
-        if (!factors_satisfies(two, factor)) {
-            APR_ARRAY_PUSH(result->factors, const char *) = factor;
-            if (strcmp(factor, WA_FA_MULTIFACTOR) == 0)
-                result->multifactor = true;
-            if (strcmp(factor, WA_FA_RANDOM_MULTIFACTOR) == 0)
-                result->random = true;
+        bit = factor_bit(factor);
+        if (bit == 0) {
+            if (!factors_has(two, factor))
+                factors_add(ctx, result, factor);
+            continue;
         }
+        if (two->known & bit)
+            continue;
+        if (bit == FBIT(FACTOR_RANDOM_MULTIFACTOR))
+            if (two->known & FBIT(FACTOR_MULTIFACTOR))
+                continue;
+        result->known |= bit;
+        APR_ARRAY_PUSH(result->factors, const char *) = factor;
     }
     return result;
 }
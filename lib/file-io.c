@@ -12,9 +12,46 @@
 #include <portable/apr.h>
 #include <portable/system.h>
 
+#include <apr_mmap.h>
+#include <apr_user.h>
+
 #include <lib/internal.h>
 #include <webauth/basic.h>
 
+/*
+ * The cached contents of a file, kept in the context by path.  The data is
+ * either a read-only mapping of the file or a copy read into memory.  The
+ * identity fields say which version of the file it is.  Each entry lives in
+ * its own subpool of the configuration pool, and only the latest version of
+ * each path is kept, so the pool of the previous version, and with it any
+ * mapping, is destroyed when the file changes.
+ */
+struct file_map {
+    apr_pool_t *pool;
+    const void *data;
+    size_t length;
+    apr_dev_t device;
+    apr_ino_t inode;
+    apr_time_t mtime;
+    apr_off_t size;
+};
+
+/* The file information used to tell whether a cached entry is current. */
+#define FILE_MAP_WANTED \
+    (APR_FINFO_DEV | APR_FINFO_INODE | APR_FINFO_MTIME | APR_FINFO_SIZE)
+
+/*
+ * The file information used to decide whether a file may be mapped rather
+ * than read.
+ */
+#define FILE_MAP_SAFE (FILE_MAP_WANTED | APR_FINFO_USER | APR_FINFO_PROT)
+
+/*
+ * Files smaller than this are read rather than mapped.  Reading a small file
+ * costs little more than setting up a mapping, and a copy can't be changed
+ * underneath us.
+ */
+#define FILE_MAP_MIN_SIZE (64 * 1024)
 
 /*
  * Lock a file by name.  Returns a WebAuth error code, and stores the object
@@ -159,6 +196,190 @@ done:
 }
 
 
+/*
+ * Return true if a cached entry is of the file described by finfo.
+ */
+static bool
+file_map_current(const struct file_map *map, const apr_finfo_t *finfo)
+{
+    return (map->device == finfo->device && map->inode == finfo->inode
+            && map->mtime == finfo->mtime && map->size == finfo->size);
+}
+
+
+/*
+ * Return true if a file may be mapped rather than read.  Only large files
+ * owned by us and not writable by anyone else are mapped, since a mapped file
+ * that's truncated in place kills the process with SIGBUS.
+ */
+static bool
+file_map_safe(apr_pool_t *pool, const apr_finfo_t *finfo)
+{
+    apr_uid_t uid;
+    apr_gid_t gid;
+
+    if (finfo->size < FILE_MAP_MIN_SIZE)
+        return false;
+    if ((finfo->valid & FILE_MAP_SAFE) != FILE_MAP_SAFE)
+        return false;
+    if (finfo->protection & (APR_FPROT_GWRITE | APR_FPROT_WWRITE))
+        return false;
+    if (apr_uid_current(&uid, &gid, pool) != APR_SUCCESS)
+        return false;
+    return apr_uid_compare(uid, finfo->user) == APR_SUCCESS;
+}
+
+
+/*
+ * Map or read a file and store it in the context cache under the given path,
+ * replacing any older version of that path.  Returns a WebAuth error code.
+ */
+static int
+file_map_create(struct webauth_context *ctx, const char *path,
+                struct file_map **result)
+{
+    apr_file_t *file = NULL;
+    apr_finfo_t finfo;
+    apr_pool_t *pool = NULL;
+    apr_mmap_t *mmap;
+    struct file_map *map;
+    apr_status_t code;
+    const void *data;
+    void *buf;
+    size_t size;
+    int s;
+
+    /* Open the file. */
+    if (apr_pool_create(&pool, ctx->config_pool) != APR_SUCCESS)
+        return wai_error_set(ctx, WA_ERR_APR, "cannot create pool");
+    code = apr_file_open(&file, path, APR_FOPEN_READ,
+                         APR_FPROT_UREAD | APR_FPROT_UWRITE, pool);
+    if (code != APR_SUCCESS) {
+        if (APR_STATUS_IS_ENOENT(code))
+            s = WA_ERR_FILE_NOT_FOUND;
+        else
+            s = WA_ERR_FILE_OPENREAD;
+        wai_error_set_apr(ctx, s, code, "%s", path);
+        goto fail;
+    }
+
+    /*
+     * Identify the file we actually opened, which may be newer than the one
+     * our caller looked at, and map or read it.  A mapping stays valid after
+     * the file is closed.
+     */
+    code = apr_file_info_get(&finfo, FILE_MAP_SAFE, file);
+    if (code != APR_SUCCESS && code != APR_INCOMPLETE) {
+        s = WA_ERR_FILE_READ;
+        wai_error_set_apr(ctx, s, code, "stat of %s", path);
+        goto fail;
+    }
+    if (finfo.size == 0) {
+        s = WA_ERR_FILE_READ;
+        wai_error_set(ctx, s, "%s is empty", path);
+        goto fail;
+    }
+    if (file_map_safe(pool, &finfo)) {
+        code = apr_mmap_create(&mmap, file, 0, finfo.size, APR_MMAP_READ,
+                               pool);
+        if (code != APR_SUCCESS) {
+            s = WA_ERR_FILE_READ;
+            wai_error_set_apr(ctx, s, code, "mapping %s", path);
+            goto fail;
+        }
+        data = mmap->mm;
+    } else {
+        buf = apr_palloc(pool, finfo.size);
+        code = apr_file_read_full(file, buf, finfo.size, &size);
+        if (code != APR_SUCCESS) {
+            s = WA_ERR_FILE_READ;
+            wai_error_set_apr(ctx, s, code, "%s", path);
+            goto fail;
+        }
+        if ((apr_off_t) size != finfo.size) {
+            s = WA_ERR_FILE_READ;
+            wai_error_set(ctx, s, "%s modified during read", path);
+            goto fail;
+        }
+        data = buf;
+    }
+    apr_file_close(file);
+
+    /* Replace the old version, which also unmaps it if it was mapped. */
+    if (ctx->files == NULL)
+        ctx->files = apr_hash_make(ctx->config_pool);
+    map = apr_hash_get(ctx->files, path, APR_HASH_KEY_STRING);
+    if (map == NULL) {
+        map = apr_palloc(ctx->config_pool, sizeof(struct file_map));
+        path = apr_pstrdup(ctx->config_pool, path);
+        apr_hash_set(ctx->files, path, APR_HASH_KEY_STRING, map);
+    } else {
+        apr_pool_destroy(map->pool);
+    }
+    map->pool   = pool;
+    map->data   = data;
+    map->length = finfo.size;
+    map->device = finfo.device;
+    map->inode  = finfo.inode;
+    map->mtime  = finfo.mtime;
+    map->size   = finfo.size;
+    *result = map;
+    return WA_ERR_NONE;
+
+fail:
+    if (file != NULL)
+        apr_file_close(file);
+    apr_pool_destroy(pool);
+    return s;
+}
+
+
+/*
+ * Get the contents of a file without copying them on every call.  Takes the
+ * WebAuth context, the file name, and pointers into which to store the
+ * contents of the file and its length.  Returns a WebAuth error code.
+ *
+ * The contents are cached in the context by path and reused as long as the
+ * device, inode, modification time, and size of the file are unchanged, so
+ * rereading an unchanged file costs only a stat.  Large files that only we
+ * can write are mapped and others are read.  The contents are only valid
+ * until the next call for the same path, which drops them if the file has
+ * changed, so callers must copy anything they keep.  Files must be replaced
+ * with wai_file_write rather than modified in place.
+ */
+int
+wai_file_map(struct webauth_context *ctx, const char *path,
+             const void **output, size_t *length)
+{
+    struct file_map *map = NULL;
+    apr_finfo_t finfo;
+    apr_status_t code;
+    int s;
+
+    /* Set output parameters in case of error. */
+    *output = NULL;
+    *length = 0;
+
+    /* Use the cached contents if the file hasn't changed. */
+    if (ctx->files != NULL)
+        map = apr_hash_get(ctx->files, path, APR_HASH_KEY_STRING);
+    if (map != NULL) {
+        code = apr_stat(&finfo, path, FILE_MAP_WANTED, ctx->pool);
+        if (code != APR_SUCCESS && code != APR_INCOMPLETE)
+            map = NULL;
+        else if (!file_map_current(map, &finfo))
+            map = NULL;
+    }
+    if (map == NULL) {
+        s = file_map_create(ctx, path, &map);
+        if (s != WA_ERR_NONE)
+            return s;
+    }
+    *output = map->data;
+    *length = map->length;
+    return WA_ERR_NONE;
+}
+
 /*
  * Write data to a file atomically, continuing after partial reads or signal
  * interruptions.  Takes the WebAuth context, the data, and the file name.
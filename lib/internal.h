@@ -16,16 +16,23 @@
 
 #include <apr_errno.h>          /* apr_status_t */
 #include <apr_file_io.h>        /* apr_file_t */
+#include <apr_hash.h>           /* apr_hash_t */
 #include <apr_pools.h>          /* apr_pool_t */
 #include <apr_tables.h>         /* apr_array_header_t */
+#include <apr_time.h>           /* apr_time_t */
 #include <apr_xml.h>            /* apr_xml_elem */
 #include <webauth/basic.h>      /* enum webauth_log_level, webauth_log_func */
+#include <webauth/keys.h>       /* enum webauth_token_format */
+#include <webauth/metrics.h>    /* enum webauth_timer */
 
+struct webauth_key;
 struct webauth_keyring;
+struct webauth_keyring_entry;
 struct webauth_token;
 struct webauth_token_request;
 struct webauth_user_info;
 struct webauth_user_validate;
+struct webauth_was_token_cache;
 struct webauth_webkdc_login_request;
 struct webauth_webkdc_login_response;
 
@@ -45,6 +52,8 @@ struct wai_log_callback {
  */
 struct webauth_context {
     apr_pool_t *pool;           /* Pool used for all memory allocations. */
+    apr_pool_t *config_pool;    /* Pool for configuration, kept on reset. */
+    apr_pool_t *arena;          /* Per-use subpool, created on first reset. */
     const char *error;          /* Error message from last failure. */
     int status;                 /* WebAuth status code from last failure. */
 
@@ -54,6 +63,12 @@ struct webauth_context {
     struct wai_log_callback info;
     struct wai_log_callback trace;
 
+    /* Runtime metrics, if enabled, usually in shared memory. */
+    struct webauth_metrics *metrics;
+
+    /* Cached contents of files, by path, managed by wai_file_map. */
+    apr_hash_t *files;
+
     /* The below are used only for the WebKDC functions. */
 
     /* General WebKDC configuration. */
@@ -68,12 +83,36 @@ struct webauth_context {
  * is managed by the wai_buffer_* functions.  The data will always be
  * nul-terminated, but the nul won't be counted as part of the used size, and
  * nul characters are permitted in the buffer.
- */
+ *
+ * A chunked buffer never copies data when it grows.  Instead, the full data
+ * is moved to the chunks list and a new, larger block is started, so data
+ * and used only describe the last part of the contents.  Walk chunks and
+ * then data to see everything, or call wai_buffer_flatten to turn it back
+ * into a single block.
+ */
+struct wai_buffer_chunk {
+    struct wai_buffer_chunk *next;
+    const char *data;
+    size_t used;
+};
 struct wai_buffer {
     apr_pool_t *pool;
     size_t size;
     size_t used;
     char *data;
+    bool chunked;                       /* Grow by adding chunks */
+    struct wai_buffer_chunk *chunks;    /* Earlier data if chunked */
+    struct wai_buffer_chunk **tail;     /* Where to add the next chunk */
+    size_t chunks_used;                 /* Total length of the chunks */
+    size_t allocated;                   /* Pool memory used by all blocks */
+};
+
+/*
+ * The public interface to a chunked buffer, used to collect data in the
+ * Apache modules.
+ */
+struct webauth_buffer {
+    struct wai_buffer *buffer;
 };
 
 /*
@@ -120,6 +159,9 @@ struct wai_encoding {
     const struct wai_encoding *repeat;  /* Rules for nested structure */
 };
 
+/* Length of the key identifier in tokens in WA_TOKEN_FORMAT_KEY_ID. */
+#define WAI_KEY_ID_SIZE 8
+
 /* Used as the terminator for an encoding specification. */
 #define WA_ENCODING_END { NULL, NULL, 0, false, false, false, 0, 0, 0, NULL }
 
@@ -145,6 +187,56 @@ extern const struct wai_encoding wai_token_webkdc_proxy_encoding[];
 extern const struct wai_encoding wai_token_webkdc_service_encoding[];
 extern const struct wai_encoding wai_was_token_cache_encoding[];
 
+/*
+ * A single attribute found while decoding, stored as the value in a hash of
+ * attributes whose key is the attribute name.  The data is nul-terminated.
+ */
+struct wai_attr {
+    void *data;
+    size_t length;
+};
+
+/*
+ * The generated encoder and decoder for a struct.  The encoder appends the
+ * attributes for the struct pointed to by the data argument to the buffer.
+ * The decoder fills in that struct from a hash of attribute names to struct
+ * wai_attr.  Both return a WebAuth status code.
+ */
+typedef int (*wai_encode_func)(struct webauth_context *, const void *,
+                               struct wai_buffer *);
+typedef int (*wai_decode_func)(struct webauth_context *, apr_hash_t *,
+                               void *);
+
+/*
+ * Everything needed to encode and decode a struct: the encoding rules, which
+ * are still used for reference, and the functions generated from the same
+ * rules that do the work with the attribute names and types resolved at
+ * compile time.
+ */
+struct wai_codec {
+    const struct wai_encoding *rules;
+    wai_encode_func encode;
+    wai_decode_func decode;
+};
+
+/*
+ * Codecs for the top-level structs, also generated by lib/encoding-rules into
+ * the lib/rules-*.c files.
+ */
+extern const struct wai_codec wai_keyring_codec;
+extern const struct wai_codec wai_krb5_cred_codec;
+extern const struct wai_codec wai_token_app_codec;
+extern const struct wai_codec wai_token_cred_codec;
+extern const struct wai_codec wai_token_error_codec;
+extern const struct wai_codec wai_token_id_codec;
+extern const struct wai_codec wai_token_login_codec;
+extern const struct wai_codec wai_token_proxy_codec;
+extern const struct wai_codec wai_token_request_codec;
+extern const struct wai_codec wai_token_webkdc_factor_codec;
+extern const struct wai_codec wai_token_webkdc_proxy_codec;
+extern const struct wai_codec wai_token_webkdc_service_codec;
+extern const struct wai_codec wai_was_token_cache_codec;
+
 /*
  * The internal representation of a Kerberos credential.  This representation
  * avoids any nested data structures and uses informative member names (so
@@ -208,6 +300,26 @@ struct wai_keyring {
     struct wai_keyring_entry *entry;
 };
 
+/* The types of files in the binary encoding, stored in the file header. */
+enum wai_binary_type {
+    WA_BINARY_KEYRING   = 1,
+    WA_BINARY_WAS_CACHE = 2
+};
+
+/*
+ * The phases of a WebKDC login that are timed separately.  These must be in
+ * the same order as the WA_TIMER_LOGIN_* histograms.
+ */
+enum wai_login_phase {
+    WAI_PHASE_PARSE = 0,        /* Parsing and decrypting the request */
+    WAI_PHASE_AUTHENTICATE,     /* Password and OTP logins */
+    WAI_PHASE_MERGE,            /* Merging webkdc-proxy and factor tokens */
+    WAI_PHASE_USERINFO,         /* Calling the user information service */
+    WAI_PHASE_AUTHZ,            /* Checking factors and identity ACL */
+    WAI_PHASE_ENCODE,           /* Encoding result tokens and response */
+    WAI_PHASE_MAX
+};
+
 /*
  * Internal state for the WebKDC login process.  This is used to hold
  * information from a webauth_webkdc_login_request and information that will
@@ -264,6 +376,14 @@ struct wai_webkdc_login_state {
 
     /* Permitted authorization identities from the identity ACL. */
     const apr_array_header_t *permitted_authz;
+
+    /*
+     * Time in microseconds spent in each phase of the login and in total,
+     * and a bitmask (by phase number) of the phases that were reached.
+     */
+    apr_interval_time_t timing[WAI_PHASE_MAX];
+    apr_interval_time_t timing_total;
+    unsigned int timing_phases;
 };
 
 BEGIN_DECLS
@@ -271,16 +391,58 @@ BEGIN_DECLS
 /* Default to a hidden visibility for all internal functions. */
 #pragma GCC visibility push(hidden)
 
+/*
+ * Encode and decode keyrings and service token caches in the binary file
+ * format.  The decoded keys and tokens are copied into pool memory.  Use
+ * wai_binary_is to tell whether data is in the binary format or the older
+ * attribute encoding.
+ */
+int wai_binary_decode_keyring(struct webauth_context *, const void *, size_t,
+                              struct webauth_keyring **)
+    __attribute__((__nonnull__));
+int wai_binary_decode_was_cache(struct webauth_context *, const void *,
+                                size_t, struct webauth_was_token_cache *)
+    __attribute__((__nonnull__));
+int wai_binary_encode_keyring(struct webauth_context *,
+                              const struct webauth_keyring *, void **,
+                              size_t *)
+    __attribute__((__nonnull__));
+int wai_binary_encode_was_cache(struct webauth_context *,
+                                const struct webauth_was_token_cache *,
+                                void **, size_t *)
+    __attribute__((__nonnull__));
+bool wai_binary_is(const void *, size_t)
+    __attribute__((__nonnull__, __pure__));
+
 /* Allocate a new buffer and initialize its contents. */
 struct wai_buffer *wai_buffer_new(apr_pool_t *)
     __attribute__((__nonnull__));
 
+/* Allocate a new chunked buffer, which never copies data to grow. */
+struct wai_buffer *wai_buffer_new_chunked(apr_pool_t *)
+    __attribute__((__nonnull__));
+
 /*
- * Resize a buffer to be at least as large as the provided size.  Invalidates
- * pointers into the buffer.
+ * Resize a buffer to be at least as large as the provided size.  Buffers
+ * grow geometrically, so appending is amortized linear time.  Invalidates
+ * pointers into the buffer.  For a chunked buffer, if the current block
+ * isn't big enough, it is moved to the chunks list and data is a new, empty
+ * block of at least that size.
  */
 void wai_buffer_resize(struct wai_buffer *, size_t);
 
+/* Return the total length of the data in a buffer, including any chunks. */
+size_t wai_buffer_length(const struct wai_buffer *)
+    __attribute__((__nonnull__));
+
+/*
+ * Collect any chunks of a chunked buffer into a single block in data, so
+ * that data and used again describe all of the contents.  The buffer stays
+ * chunked for later appends.
+ */
+void wai_buffer_flatten(struct wai_buffer *)
+    __attribute__((__nonnull__));
+
 /* Set the buffer contents, ignoring anything currently there. */
 void wai_buffer_set(struct wai_buffer *, const char *data, size_t length)
     __attribute__((__nonnull__));
@@ -298,39 +460,88 @@ void wai_buffer_append_vsprintf(struct wai_buffer *, const char *, va_list)
 /*
  * Find a given string in the buffer.  Returns the offset of the string (with
  * the same meaning as start) in offset if found, and returns true if the
- * terminator is found and false otherwise.
+ * terminator is found and false otherwise.  Only searches data, so chunked
+ * buffers should be flattened first.
  */
 bool wai_buffer_find_string(struct wai_buffer *, const char *, size_t start,
                             size_t *offset)
     __attribute__((__nonnull__));
 
+/*
+ * Helpers for the generated attribute encoders and decoders.  The error
+ * functions set the error message for a problem with an attribute, given its
+ * description and, for an element of a repeated structure, the description
+ * of that structure and the element number, and return the status.  The
+ * encoders append an attribute given its name and the length of the name,
+ * hex-encoding data or formatting numbers as strings if ascii is true.  The
+ * decoders reverse that for a single attribute value.
+ */
+int wai_attr_decode_data(struct webauth_context *, const struct wai_attr *,
+                         void **, size_t *, bool ascii)
+    __attribute__((__nonnull__));
+int wai_attr_decode_error(struct webauth_context *, int s, const char *desc,
+                          const char *context, unsigned long element)
+    __attribute__((__nonnull__(1, 3)));
+int wai_attr_decode_number(struct webauth_context *, const struct wai_attr *,
+                           uint32_t *, bool ascii)
+    __attribute__((__nonnull__));
+int wai_attr_encode_data(struct wai_buffer *, const char *attr,
+                         size_t attr_len, const void *, size_t, bool ascii)
+    __attribute__((__nonnull__(1, 2)));
+int wai_attr_encode_error(struct webauth_context *, int s, const char *desc,
+                          const char *context, unsigned long element)
+    __attribute__((__nonnull__(1, 3)));
+void wai_attr_encode_number(struct wai_buffer *, const char *attr,
+                            size_t attr_len, unsigned long, bool ascii)
+    __attribute__((__nonnull__));
+
 /*
  * Decode the binary attribute representation into the struct pointed to by
- * data following the provided rules.
+ * data using the provided codec.  The input is copied once into the context
+ * pool, and strings and data in the result point into that copy.
  */
-int wai_decode(struct webauth_context *, const struct wai_encoding *,
+int wai_decode(struct webauth_context *, const struct wai_codec *,
                const void *input, size_t, void *data)
     __attribute__((__nonnull__));
 
+/*
+ * The same as wai_decode, but interprets the encoding rules instead of using
+ * the generated decoder.  Used to check the generated decoders.
+ */
+int wai_decode_rules(struct webauth_context *, const struct wai_encoding *,
+                     const void *input, size_t, void *data)
+    __attribute__((__nonnull__));
+
 /*
  * Similar to wai_decode, but decodes a WebAuth token, including handling the
  * determination of the type of the token from the attributes.  Uses the
  * memory pool from the WebAuth context.  This does not perform any sanity
  * checking on the token data; that must be done by higher-level code.
+ *
+ * The input is modified in place and the strings and data in the decoded
+ * token point into it, so it must live as long as the token.
  */
-int wai_decode_token(struct webauth_context *, const void *input, size_t,
+int wai_decode_token(struct webauth_context *, void *input, size_t,
                      struct webauth_token *)
     __attribute__((__nonnull__));
 
 /*
- * Encode the struct pointed to by data according to given the rules into the
- * output parameter, storing the encoded data length.  The result will be in
- * WebAuth attribute encoding format.
+ * Encode the struct pointed to by data using the given codec into the output
+ * parameter, storing the encoded data length.  The result will be in WebAuth
+ * attribute encoding format.
  */
-int wai_encode(struct webauth_context *, const struct wai_encoding *,
+int wai_encode(struct webauth_context *, const struct wai_codec *,
                const void *data, void **, size_t *)
     __attribute__((__nonnull__));
 
+/*
+ * The same as wai_encode, but interprets the encoding rules instead of using
+ * the generated encoder.  Used to check the generated encoders.
+ */
+int wai_encode_rules(struct webauth_context *, const struct wai_encoding *,
+                     const void *data, void **, size_t *)
+    __attribute__((__nonnull__));
+
 /*
  * Similar to wai_encode, but encodes a WebAuth token, including adding the
  * appropriate encoding of the token type.  This does not perform any sanity
@@ -391,6 +602,17 @@ int wai_file_lock(struct webauth_context *, const char *, apr_file_t **)
 int wai_file_unlock(struct webauth_context *, const char *, apr_file_t *)
     __attribute__((__nonnull__));
 
+/*
+ * Get the contents of a file, mapped or read, without copying them on each
+ * call.  The contents are cached in the context and reused until the file
+ * changes.  They are only valid until the next call for the same path, so
+ * callers must copy anything they keep.  Callers that need to modify the data
+ * should use wai_file_read instead.
+ */
+int wai_file_map(struct webauth_context *, const char *, const void **,
+                 size_t *)
+    __attribute__((__nonnull__));
+
 /* Read the contents of a file into memory. */
 int wai_file_read(struct webauth_context *, const char *, void **, size_t *)
     __attribute__((__nonnull__));
@@ -438,6 +660,47 @@ int wai_hex_decode(char *input, size_t input_len, char *output,
                    size_t *output_length, size_t max_output_len)
     __attribute__((__nonnull__));
 
+/*
+ * Compute the key identifier of a key, which is derived from the key material
+ * so that every server sharing a keyring computes the same identifier.  The
+ * output buffer must hold WAI_KEY_ID_SIZE bytes.
+ */
+void wai_key_id(const struct webauth_key *, unsigned char *)
+    __attribute__((__nonnull__));
+
+/*
+ * Add an entry to a keyring without copying its key, keeping the keyring
+ * index up to date.  Used when the keys are already allocated, such as when
+ * decoding a keyring.
+ */
+void wai_keyring_push(struct webauth_keyring *,
+                      const struct webauth_keyring_entry *)
+    __attribute__((__nonnull__));
+
+/*
+ * Find the best encryption key in a keyring, as webauth_keyring_best_key
+ * does, and also return its key identifier, which is valid as long as the
+ * keyring is not changed.
+ */
+int wai_keyring_encrypt_key(struct webauth_context *,
+                            const struct webauth_keyring *,
+                            const struct webauth_key **,
+                            const unsigned char **id)
+    __attribute__((__nonnull__));
+
+/*
+ * Find the key in a keyring with the given key identifier.  Returns
+ * WA_ERR_NOT_FOUND if there is no such key.
+ */
+int wai_keyring_find_id(struct webauth_context *,
+                        const struct webauth_keyring *,
+                        const unsigned char *id, const struct webauth_key **)
+    __attribute__((__nonnull__));
+
+/* Return the format of the tokens encrypted with a keyring. */
+enum webauth_token_format wai_keyring_format(const struct webauth_keyring *)
+    __attribute__((__nonnull__, __pure__));
+
 /*
  * Log a message at various possible log levels.  This is controlled by the
  * configured callback.  If the callback is NULL, the message will be silently
@@ -463,15 +726,34 @@ void wai_log_error(struct webauth_context *, enum webauth_log_level, int,
     __attribute__((__nonnull__(1), __format__(printf, 4, 5)));
 
 /*
- * Map a token type code to the corresponding encoding rule set and data
- * pointer.  Takes the token struct (which must have the type filled out), and
- * stores a pointer to the encoding rules and a pointer to the correct data
- * portion of the token struct in the provided output arguments.  Returns an
- * error code, which will be set to an error if the token type is not
- * recognized.
+ * Time an operation for the metrics attached to a context.  wai_metrics_start
+ * returns the start time (or 0 if the context has no metrics), which should
+ * be passed to wai_metrics_stop along with the histogram to update.
+ */
+apr_time_t wai_metrics_start(struct webauth_context *)
+    __attribute__((__nonnull__));
+void wai_metrics_stop(struct webauth_context *, enum webauth_timer,
+                      apr_time_t)
+    __attribute__((__nonnull__));
+
+/*
+ * Fill the buffer with random data for a token nonce or IV.  The data comes
+ * from a per-thread block of random data that stays in memory until it's
+ * used, so this shouldn't be used for keys.  Returns WA_ERR_RAND_FAILURE if
+ * the block cannot be filled.
+ */
+int wai_random_nonce(struct webauth_context *, void *, size_t)
+    __attribute__((__nonnull__));
+
+/*
+ * Map a token type code to the corresponding codec and data pointer.  Takes
+ * the token struct (which must have the type filled out), and stores a
+ * pointer to the codec and a pointer to the correct data portion of the
+ * token struct in the provided output arguments.  Returns an error code,
+ * which will be set to an error if the token type is not recognized.
  */
 int wai_token_encoding(struct webauth_context *, const struct webauth_token *,
-                       const struct wai_encoding **, const void **)
+                       const struct wai_codec **, const void **)
     __attribute__((__nonnull__));
 
 /*
@@ -510,7 +792,8 @@ int wai_token_merge_webkdc_proxy_factor(struct webauth_context *,
 
 /*
  * Make a remctl call to the user information service and return the results
- * in the provided buffer.
+ * in the provided buffer, which may be chunked to avoid copying large
+ * output as it arrives.
  */
 int wai_user_remctl(struct webauth_context *, const char **command,
                     struct wai_buffer *)
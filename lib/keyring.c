@@ -20,9 +20,70 @@
 #include <webauth/basic.h>
 #include <webauth/keys.h>
 
-/* The version of the keyring file format that we implement. */
+/* The version of the attribute-encoded keyring file format. */
 #define KEYRING_VERSION 1
 
+/*
+ * Access the cached position of the best encryption key.  Keyrings read at
+ * startup are shared between threads, so lookups may update the cache
+ * concurrently.  Every thread computes the same position for the same time,
+ * so relaxed atomics are enough.  Without the GCC atomic builtins, fall back
+ * on plain access of an int.
+ */
+#ifdef __ATOMIC_RELAXED
+# define BEST_LOAD(p)     __atomic_load_n((p), __ATOMIC_RELAXED)
+# define BEST_STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#else
+# define BEST_LOAD(p)     (*(p))
+# define BEST_STORE(p, v) (*(p) = (v))
+#endif
+
+/*
+ * The index of a keyring.  order holds the positions of the entries in the
+ * entries array sorted by valid_after, with entries with the same valid_after
+ * in the order in which they appear in the keyring.  Positions rather than
+ * pointers are used since the entries array moves as it grows.  ids holds
+ * the key identifier of each entry, in the order of the entries array.  best
+ * is the position in order of the current best encryption key, or -1 if it
+ * has to be found again.  count is the number of entries indexed, which no
+ * longer matches the keyring if the entries were changed directly.  format
+ * is the format of tokens encrypted with the keyring, which is kept here
+ * since it's private to the library like the rest of the index.
+ */
+struct keyring_index {
+    int *order;
+    unsigned char *ids;
+    int count;
+    int size;
+    int best;
+    enum webauth_token_format format;
+};
+
+/*
+ * The allocation behind every keyring created by the library.  The public
+ * struct webauth_keyring comes first, so a pointer to it is also a pointer to
+ * the index that follows, and the public struct doesn't change size.
+ */
+struct keyring {
+    struct webauth_keyring ring;
+    struct keyring_index index;
+};
+
+/*
+ * The index of a keyring.  Keyrings read at startup are shared between
+ * threads as const, but the cached best key is updated on lookups, so this
+ * drops the const.
+ */
+#define INDEX(ring) (&((struct keyring *) (ring))->index)
+
+/* The key identifier of the entry at the given position in the keyring. */
+#define KEY_ID(ring, pos) (INDEX(ring)->ids + (pos) * WAI_KEY_ID_SIZE)
+
+/* The valid_after time of the entry at the given position in the order. */
+#define VALID(ring, i)                                                  \
+    (APR_ARRAY_IDX((ring)->entries, INDEX(ring)->order[(i)],            \
+                   struct webauth_keyring_entry).valid_after)
+
 
 /*
  * Create a new keyring.  Takes one argument specifying the initial capacity
@@ -31,14 +92,124 @@
 struct webauth_keyring *
 webauth_keyring_new(struct webauth_context *ctx, size_t capacity)
 {
-    struct webauth_keyring *ring;
+    struct keyring *keyring;
+    struct keyring_index *index;
     size_t size = sizeof(struct webauth_keyring_entry);
 
     if (capacity < 1)
         capacity = 1;
-    ring = apr_palloc(ctx->pool, sizeof(struct webauth_keyring));
-    ring->entries = apr_array_make(ctx->pool, capacity, size);
-    return ring;
+    keyring = apr_palloc(ctx->pool, sizeof(struct keyring));
+    keyring->ring.entries = apr_array_make(ctx->pool, capacity, size);
+    index = &keyring->index;
+    index->order = apr_palloc(ctx->pool, capacity * sizeof(int));
+    index->ids = apr_palloc(ctx->pool, capacity * WAI_KEY_ID_SIZE);
+    index->count = 0;
+    index->size = capacity;
+    index->best = -1;
+    index->format = WA_TOKEN_FORMAT_HINT;
+    return &keyring->ring;
+}
+
+
+/*
+ * Return the number of entries in the order whose valid_after time is at or
+ * before the given time, which is also the position in the order of the
+ * first entry that is valid after that time.
+ */
+static int
+index_valid_count(const struct webauth_keyring *ring, time_t when)
+{
+    int low = 0;
+    int high = INDEX(ring)->count;
+    int middle;
+
+    while (low < high) {
+        middle = low + (high - low) / 2;
+        if (VALID(ring, middle) <= when)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low;
+}
+
+
+/*
+ * Add the entry at the given position of the entries array to the index,
+ * which must already hold all of the entries before it, and compute its key
+ * identifier.  It goes after any other entries with the same valid_after
+ * time, which keeps those entries in keyring order.  The index grows in the
+ * pool of the entries array so that it lives as long as the keyring.
+ */
+static void
+index_insert(struct webauth_keyring *ring, int pos)
+{
+    struct keyring_index *index = INDEX(ring);
+    const struct webauth_keyring_entry *entry;
+    unsigned char *ids;
+    int *order;
+    int i;
+
+    if (index->count == index->size) {
+        order = apr_palloc(ring->entries->pool,
+                           index->size * 2 * sizeof(int));
+        memcpy(order, index->order, index->count * sizeof(int));
+        ids = apr_palloc(ring->entries->pool,
+                         index->size * 2 * WAI_KEY_ID_SIZE);
+        memcpy(ids, index->ids, index->count * WAI_KEY_ID_SIZE);
+        index->order = order;
+        index->ids = ids;
+        index->size *= 2;
+    }
+    entry = &APR_ARRAY_IDX(ring->entries, pos, struct webauth_keyring_entry);
+    wai_key_id(entry->key, KEY_ID(ring, pos));
+    i = index_valid_count(ring, entry->valid_after);
+    memmove(index->order + i + 1, index->order + i,
+            (index->count - i) * sizeof(int));
+    index->order[i] = pos;
+    index->count++;
+    index->best = -1;
+}
+
+
+/*
+ * Rebuild the index from scratch.  This is needed if the entries were
+ * changed directly rather than through the keyring functions.
+ */
+static void
+index_rebuild(struct webauth_keyring *ring)
+{
+    int i;
+
+    INDEX(ring)->count = 0;
+    for (i = 0; i < ring->entries->nelts; i++)
+        index_insert(ring, i);
+}
+
+
+/*
+ * Add an entry that has already been pushed onto the end of the entries
+ * array to the index, rebuilding the index first if it's out of date.
+ */
+static void
+index_add(struct webauth_keyring *ring)
+{
+    if (INDEX(ring)->count == ring->entries->nelts - 1)
+        index_insert(ring, ring->entries->nelts - 1);
+    else
+        index_rebuild(ring);
+}
+
+
+/*
+ * Add an entry to a keyring without copying the key.
+ */
+void
+wai_keyring_push(struct webauth_keyring *ring,
+                 const struct webauth_keyring_entry *entry)
+{
+    APR_ARRAY_PUSH(ring->entries, struct webauth_keyring_entry) = *entry;
+    index_add(ring);
 }
 
 
@@ -58,7 +229,7 @@ webauth_keyring_add(struct webauth_context *ctx, struct webauth_keyring *ring,
     entry.creation = creation;
     entry.valid_after = valid_after;
     entry.key = webauth_key_copy(ctx, key);
-    APR_ARRAY_PUSH(ring->entries, struct webauth_keyring_entry) = entry;
+    wai_keyring_push(ring, &entry);
 }
 
 
@@ -99,11 +270,142 @@ webauth_keyring_remove(struct webauth_context *ctx,
         entry = &APR_ARRAY_IDX(entries, i, struct webauth_keyring_entry);
         APR_ARRAY_IDX(entries, i - 1, struct webauth_keyring_entry) = *entry;
     }
-    apr_array_pop(entries);
+
+    /*
+     * Drop the entry from the index and renumber the entries after it, or
+     * rebuild the index if it's out of date.
+     */
+    if (INDEX(ring)->count == entries->nelts) {
+        struct keyring_index *index = INDEX(ring);
+        int j, k, pos;
+
+        for (j = 0, k = 0; j < index->count; j++) {
+            pos = index->order[j];
+            if ((size_t) pos != n)
+                index->order[k++] = ((size_t) pos > n) ? pos - 1 : pos;
+        }
+        memmove(KEY_ID(ring, n), KEY_ID(ring, n + 1),
+                (index->count - n - 1) * WAI_KEY_ID_SIZE);
+        index->count--;
+        index->best = -1;
+        apr_array_pop(entries);
+    } else {
+        apr_array_pop(entries);
+        index_rebuild(ring);
+    }
     return WA_ERR_NONE;
 }
 
 
+/*
+ * Find the best key by searching every entry in the keyring, for keyrings
+ * whose entries were changed without updating the index.
+ */
+static const struct webauth_keyring_entry *
+best_key_search(const struct webauth_keyring *ring,
+                enum webauth_key_usage usage, time_t hint, time_t now)
+{
+    size_t i;
+    time_t valid;
+    struct webauth_keyring_entry *best, *entry;
+
+    best = NULL;
+    for (i = 0; i < (size_t) ring->entries->nelts; i++) {
+        entry = &APR_ARRAY_IDX(ring->entries, i, struct webauth_keyring_entry);
+        valid = entry->valid_after;
+        if (valid > now)
+            continue;
+        if (usage == WA_KEY_ENCRYPT) {
+            if (best == NULL || valid > best->valid_after)
+                best = entry;
+        } else {
+            if (hint >= valid && (best == NULL || valid >= best->valid_after))
+                best = entry;
+        }
+    }
+    return best;
+}
+
+
+/*
+ * Return whether the given position in the index order is the best
+ * encryption key at the given time: valid at that time, the first of the
+ * entries with its valid_after time, and with no later key valid yet.
+ */
+static bool
+best_key_current(const struct webauth_keyring *ring, int pos, time_t now)
+{
+    int i;
+    time_t valid;
+
+    if (pos < 0 || pos >= INDEX(ring)->count)
+        return false;
+    valid = VALID(ring, pos);
+    if (valid > now || (pos > 0 && VALID(ring, pos - 1) == valid))
+        return false;
+    for (i = pos + 1; i < INDEX(ring)->count; i++)
+        if (VALID(ring, i) != valid)
+            return VALID(ring, i) > now;
+    return true;
+}
+
+
+/*
+ * Find the best key using the index.  The position of the best encryption
+ * key is cached until the keyring changes or a later key becomes valid.  For
+ * encryption, this is the first of the latest keys that are valid now.  For
+ * decryption, it's the last of the latest keys that were valid at the hint
+ * time and are valid now.  These match the choices of best_key_search.
+ */
+static const struct webauth_keyring_entry *
+best_key_index(const struct webauth_keyring *ring,
+               enum webauth_key_usage usage, time_t hint, time_t now)
+{
+    struct keyring_index *index = INDEX(ring);
+    int pos, end;
+    time_t valid;
+
+    if (usage == WA_KEY_ENCRYPT) {
+        pos = BEST_LOAD(&index->best);
+        if (!best_key_current(ring, pos, now)) {
+            end = index_valid_count(ring, now);
+            if (end == 0)
+                return NULL;
+            valid = VALID(ring, end - 1);
+            for (pos = end - 1; pos > 0; pos--)
+                if (VALID(ring, pos - 1) != valid)
+                    break;
+            BEST_STORE(&index->best, pos);
+        }
+    } else {
+        end = index_valid_count(ring, hint < now ? hint : now);
+        if (end == 0)
+            return NULL;
+        pos = end - 1;
+    }
+    return &APR_ARRAY_IDX(ring->entries, index->order[pos],
+                          struct webauth_keyring_entry);
+}
+
+
+/*
+ * Find the best entry using the index if it's up to date and otherwise by
+ * searching the keyring.
+ */
+static const struct webauth_keyring_entry *
+best_key_entry(const struct webauth_keyring *ring,
+               enum webauth_key_usage usage, time_t hint)
+{
+    time_t now;
+
+    now = time(NULL);
+    if (INDEX(ring)->count == ring->entries->nelts)
+        return best_key_index(ring, usage, hint, now);
+    else
+        return best_key_search(ring, usage, hint, now);
+}
+
+
 /*
  * Given a keyring and a timestamp hint, return the best key in the keyring.
  * The timestamp is used to select the key that was most likely used at that
@@ -124,26 +426,10 @@ webauth_keyring_best_key(struct webauth_context *ctx,
                          enum webauth_key_usage usage, time_t hint,
                          const struct webauth_key **output)
 {
-    size_t i;
-    time_t now, valid;
-    struct webauth_keyring_entry *best, *entry;
+    const struct webauth_keyring_entry *best;
 
     *output = NULL;
-    now = time(NULL);
-    best = NULL;
-    for (i = 0; i < (size_t) ring->entries->nelts; i++) {
-        entry = &APR_ARRAY_IDX(ring->entries, i, struct webauth_keyring_entry);
-        valid = entry->valid_after;
-        if (valid > now)
-            continue;
-        if (usage == WA_KEY_ENCRYPT) {
-            if (best == NULL || valid > best->valid_after)
-                best = entry;
-        } else {
-            if (hint >= valid && (best == NULL || valid >= best->valid_after))
-                best = entry;
-        }
-    }
+    best = best_key_entry(ring, usage, hint);
     if (best == NULL)
         return wai_error_set(ctx, WA_ERR_NOT_FOUND, "no valid keys");
     else {
@@ -153,9 +439,92 @@ webauth_keyring_best_key(struct webauth_context *ctx,
 }
 
 
+/*
+ * Find the best encryption key and its key identifier.  The identifier comes
+ * from the index if it's up to date and is otherwise computed.
+ */
+int
+wai_keyring_encrypt_key(struct webauth_context *ctx,
+                        const struct webauth_keyring *ring,
+                        const struct webauth_key **key,
+                        const unsigned char **id)
+{
+    const struct webauth_keyring_entry *best, *first;
+    unsigned char *buf;
+
+    *key = NULL;
+    *id = NULL;
+    best = best_key_entry(ring, WA_KEY_ENCRYPT, 0);
+    if (best == NULL)
+        return wai_error_set(ctx, WA_ERR_NOT_FOUND, "no valid keys");
+    if (INDEX(ring)->count == ring->entries->nelts) {
+        first = (const struct webauth_keyring_entry *) ring->entries->elts;
+        *id = KEY_ID(ring, best - first);
+    } else {
+        buf = apr_palloc(ctx->pool, WAI_KEY_ID_SIZE);
+        wai_key_id(best->key, buf);
+        *id = buf;
+    }
+    *key = best->key;
+    return WA_ERR_NONE;
+}
+
+
+/*
+ * Find the key with the given key identifier.  Keys that aren't valid yet are
+ * included, since the token may come from a server whose clock is ahead.
+ */
+int
+wai_keyring_find_id(struct webauth_context *ctx,
+                    const struct webauth_keyring *ring,
+                    const unsigned char *id, const struct webauth_key **key)
+{
+    const struct webauth_keyring_entry *entry;
+    unsigned char buf[WAI_KEY_ID_SIZE];
+    const unsigned char *entry_id;
+    bool indexed;
+    int i;
+
+    *key = NULL;
+    indexed = (INDEX(ring)->count == ring->entries->nelts);
+    for (i = 0; i < ring->entries->nelts; i++) {
+        entry = &APR_ARRAY_IDX(ring->entries, i, struct webauth_keyring_entry);
+        if (indexed)
+            entry_id = KEY_ID(ring, i);
+        else {
+            wai_key_id(entry->key, buf);
+            entry_id = buf;
+        }
+        if (memcmp(entry_id, id, WAI_KEY_ID_SIZE) == 0) {
+            *key = entry->key;
+            return WA_ERR_NONE;
+        }
+    }
+    return wai_error_set(ctx, WA_ERR_NOT_FOUND, "no key matches identifier");
+}
+
+
+/*
+ * Set or return the format of tokens encrypted with the keyring.
+ */
+void
+webauth_keyring_set_format(struct webauth_keyring *ring,
+                           enum webauth_token_format format)
+{
+    INDEX(ring)->format = format;
+}
+
+enum webauth_token_format
+wai_keyring_format(const struct webauth_keyring *ring)
+{
+    return INDEX(ring)->format;
+}
+
+
 /*
  * Decode the encoded form of a keyring into a new keyring structure and store
- * that in the ring argument.  Returns a WA_ERR code.
+ * that in the ring argument.  Returns a WA_ERR code.  Both the binary format
+ * and the older attribute encoding are accepted.
  */
 int
 webauth_keyring_decode(struct webauth_context *ctx, const char *input,
@@ -166,13 +535,16 @@ webauth_keyring_decode(struct webauth_context *ctx, const char *input,
     struct webauth_keyring *ring;
     struct wai_keyring data;
 
+    if (wai_binary_is(input, length))
+        return wai_binary_decode_keyring(ctx, input, length, output);
+
     /*
      * Decode the keyring to our internal data structure and check the file
      * format version.
      */
     *output = NULL;
     memset(&data, 0, sizeof(data));
-    s = wai_decode(ctx, wai_keyring_encoding, input, length, &data);
+    s = wai_decode(ctx, &wai_keyring_codec, input, length, &data);
     if (s != WA_ERR_NONE)
         return s;
     if (data.version != KEYRING_VERSION) {
@@ -208,42 +580,49 @@ webauth_keyring_decode(struct webauth_context *ctx, const char *input,
  * storing it in the ring argument.  Returns a WA_ERR code.  We do not do any
  * locking for reads and instead rely on atomic replacement of the keyring on
  * update (although we do read the keyring within a lock while doing
- * auto-update).
+ * auto-update).  The decoders copy the keys out of the file contents, which
+ * are only valid until the file is next read.
  */
 int
 webauth_keyring_read(struct webauth_context *ctx, const char *path,
                      struct webauth_keyring **ring)
 {
     int s;
-    void *buf;
+    const void *buf;
     size_t length;
 
     *ring = NULL;
-    s = wai_file_read(ctx, path, &buf, &length);
+    s = wai_file_map(ctx, path, &buf, &length);
     if (s != WA_ERR_NONE)
         return s;
+    if (wai_binary_is(buf, length))
+        return wai_binary_decode_keyring(ctx, buf, length, ring);
     return webauth_keyring_decode(ctx, buf, length, ring);
 }
 
 
 /*
- * Encode a keyring into the format for the file on disk.  Stores the encoded
- * keyring in buffer (allocating new memory for it) and the length of the
- * encoded buffer in buffer_len.  Returns an WA_ERR code.
+ * Encode a keyring into the given format for the file on disk.  Stores the
+ * encoded keyring in buffer (allocating new memory for it) and the length of
+ * the encoded buffer in buffer_len.  Returns an WA_ERR code.
  */
 int
-webauth_keyring_encode(struct webauth_context *ctx,
-                       const struct webauth_keyring *ring, char **output,
-                       size_t *length)
+webauth_keyring_encode_format(struct webauth_context *ctx,
+                              const struct webauth_keyring *ring,
+                              enum webauth_file_format format, char **output,
+                              size_t *length)
 {
     struct wai_keyring data;
     size_t i, size;
 
+    *output = NULL;
+    if (format == WA_FILE_FORMAT_BINARY)
+        return wai_binary_encode_keyring(ctx, ring, (void **) output, length);
+
     /*
      * Convert the keyring into the struct wai_keyring format, which is what
      * we will serialize to disk.
      */
-    *output = NULL;
     memset(&data, 0, sizeof(data));
     data.version = KEYRING_VERSION;
     data.entry_count = ring->entries->nelts;
@@ -261,13 +640,27 @@ webauth_keyring_encode(struct webauth_context *ctx,
     }
 
     /* Do the encoding. */
-    return wai_encode(ctx, wai_keyring_encoding, &data, (void **) output,
+    return wai_encode(ctx, &wai_keyring_codec, &data, (void **) output,
                       length);
 }
 
 
 /*
- * Write a keyring to the given file in encoded format.  Returns a WA_ERR
+ * Encode a keyring into the attribute encoding, which every version of
+ * WebAuth can read.
+ */
+int
+webauth_keyring_encode(struct webauth_context *ctx,
+                       const struct webauth_keyring *ring, char **output,
+                       size_t *length)
+{
+    return webauth_keyring_encode_format(ctx, ring, WA_FILE_FORMAT_ATTR,
+                                         output, length);
+}
+
+
+/*
+ * Write a keyring to the given file in the given format.  Returns a WA_ERR
  * code.  This is the internal function that does no locking.
  *
  * We unfortunately have to use POSIX I/O functions since APR doesn't have
@@ -275,7 +668,7 @@ webauth_keyring_encode(struct webauth_context *ctx,
  */
 static int
 write_keyring(struct webauth_context *ctx, const struct webauth_keyring *ring,
-              const char *path)
+              enum webauth_file_format format, const char *path)
 {
     struct stat st;
     bool sync_perms = false;
@@ -342,7 +735,7 @@ write_keyring(struct webauth_context *ctx, const struct webauth_keyring *ring,
     }
 
     /* Encode and write out the file. */
-    s = webauth_keyring_encode(ctx, ring, &buf, &length);
+    s = webauth_keyring_encode_format(ctx, ring, format, &buf, &length);
     if (s != WA_ERR_NONE)
         goto done;
     result = write(fd, buf, length);
@@ -376,8 +769,10 @@ done:
  * Public wrapper around write_keyring with locking.
  */
 int
-webauth_keyring_write(struct webauth_context *ctx,
-                      const struct webauth_keyring *ring, const char *path)
+webauth_keyring_write_format(struct webauth_context *ctx,
+                             const struct webauth_keyring *ring,
+                             enum webauth_file_format format,
+                             const char *path)
 {
     int s;
     apr_file_t *lock;
@@ -385,12 +780,24 @@ webauth_keyring_write(struct webauth_context *ctx,
     s = wai_file_lock(ctx, path, &lock);
     if (s != WA_ERR_NONE)
         return s;
-    s = write_keyring(ctx, ring, path);
+    s = write_keyring(ctx, ring, format, path);
     wai_file_unlock(ctx, path, lock);
     return s;
 }
 
 
+/*
+ * Write a keyring in the attribute encoding, which every version of WebAuth
+ * can read.
+ */
+int
+webauth_keyring_write(struct webauth_context *ctx,
+                      const struct webauth_keyring *ring, const char *path)
+{
+    return webauth_keyring_write_format(ctx, ring, WA_FILE_FORMAT_ATTR, path);
+}
+
+
 /*
  * Create a new keyring initialized with a single new random key and write it
  * to the specified path.  Used to create a new keyring file when none
@@ -411,7 +818,7 @@ new_ring(struct webauth_context *ctx, const char *path,
     *ring = webauth_keyring_new(ctx, 1);
     now = time(NULL);
     webauth_keyring_add(ctx, *ring, now, now, key);
-    return write_keyring(ctx, *ring, path);
+    return write_keyring(ctx, *ring, WA_FILE_FORMAT_ATTR, path);
 }
 
 
@@ -450,7 +857,7 @@ check_ring(struct webauth_context *ctx, const char *path,
     if (s != WA_ERR_NONE)
         return s;
     webauth_keyring_add(ctx, ring, now, now, key);
-    return write_keyring(ctx, ring, path);
+    return write_keyring(ctx, ring, WA_FILE_FORMAT_ATTR, path);
 }
 
 
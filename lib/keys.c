@@ -14,6 +14,7 @@
 
 #include <openssl/err.h>
 #include <openssl/rand.h>
+#include <openssl/sha.h>
 
 #include <lib/internal.h>
 #include <webauth/basic.h>
@@ -93,3 +94,25 @@ webauth_key_copy(struct webauth_context *ctx, const struct webauth_key *key)
     memcpy(copy->data, key->data, key->length);
     return copy;
 }
+
+
+/*
+ * Compute the key identifier of a key: the start of a SHA-256 digest of a
+ * fixed label followed by the key material.  The label keeps the digest from
+ * matching a digest of the key used for anything else.  This is a plain
+ * hash rather than an HMAC since it's computed for every key added to a
+ * keyring, and a one-shot HMAC is much slower.
+ */
+void
+wai_key_id(const struct webauth_key *key, unsigned char *id)
+{
+    static const char label[] = "WebAuth key identifier";
+    unsigned char digest[SHA256_DIGEST_LENGTH];
+    SHA256_CTX sha;
+
+    SHA256_Init(&sha);
+    SHA256_Update(&sha, label, sizeof(label) - 1);
+    SHA256_Update(&sha, key->data, key->length);
+    SHA256_Final(digest, &sha);
+    memcpy(id, digest, WAI_KEY_ID_SIZE);
+}
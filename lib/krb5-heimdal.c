@@ -107,7 +107,7 @@ encode_creds(struct webauth_context *ctx, struct webauth_krb5 *kc,
     data.flags = swap_flag_bits(creds->flags.i);
 
     /* All done.  Do the attribute encoding. */
-    return wai_encode(ctx, wai_krb5_cred_encoding, &data, output, length);
+    return wai_encode(ctx, &wai_krb5_cred_codec, &data, output, length);
 }
 
 
@@ -135,7 +135,7 @@ decode_creds(struct webauth_context *ctx, struct webauth_krb5 *kc,
      * Heimdal, so ignore it.
      */
     memset(&data, 0, sizeof(data));
-    s = wai_decode(ctx, wai_krb5_cred_encoding, input, length, &data);
+    s = wai_decode(ctx, &wai_krb5_cred_codec, input, length, &data);
     if (s != WA_ERR_NONE)
         return s;
     memset(creds, 0, sizeof(krb5_creds));
@@ -106,7 +106,7 @@ encode_creds(struct webauth_context *ctx, struct webauth_krb5 *kc,
     }
 
     /* All done.  Do the attribute encoding. */
-    return wai_encode(ctx, wai_krb5_cred_encoding, &data, output, length);
+    return wai_encode(ctx, &wai_krb5_cred_codec, &data, output, length);
 }
 
 
@@ -133,7 +133,7 @@ decode_creds(struct webauth_context *ctx, struct webauth_krb5 *kc,
      * the data structure used by the library.
      */
     memset(&data, 0, sizeof(data));
-    s = wai_decode(ctx, wai_krb5_cred_encoding, input, length, &data);
+    s = wai_decode(ctx, &wai_krb5_cred_codec, input, length, &data);
     if (s != WA_ERR_NONE)
         return s;
     memset(creds, 0, sizeof(krb5_creds));
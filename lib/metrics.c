@@ -0,0 +1,344 @@
+/*
+ * Runtime counters and latency histograms.
+ *
+ * The metrics live in a caller-supplied block of memory, normally shared
+ * memory created by the Apache parent process and inherited by every child,
+ * so that all children update one set of totals.  Every value is a 64-bit
+ * integer updated with a relaxed atomic add, which is enough for counters
+ * that are only ever incremented and read for reporting.  Histograms use
+ * fixed buckets in microseconds and are converted to cumulative buckets in
+ * seconds when formatted.
+ *
+ * Copyright 2014
+ *     The Board of Trustees of the Leland Stanford Junior University
+ *
+ * See LICENSE for licensing terms.
+ */
+
+#include <config.h>
+#include <portable/apr.h>
+#include <portable/system.h>
+
+#include <apr_strings.h>
+#include <apr_time.h>
+
+#include <lib/internal.h>
+#include <webauth/basic.h>
+#include <webauth/metrics.h>
+
+/* Magic number and version at the start of the metrics block. */
+#define METRICS_MAGIC   0x5741544dUL    /* "WATM" */
+#define METRICS_VERSION 1
+
+/*
+ * Upper bounds of the histogram buckets in microseconds.  Chosen to cover
+ * everything from a cached token decode to a slow remote service call.
+ */
+static const unsigned long buckets[] = {
+    100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000,
+    500000, 1000000, 2500000, 5000000, 10000000
+};
+#define BUCKET_COUNT (sizeof(buckets) / sizeof(buckets[0]))
+
+/*
+ * Add to a value in the metrics block.  Without the GCC atomic builtins,
+ * fall back to a plain add, which may lose the occasional update between
+ * processes but is otherwise harmless.
+ */
+#ifdef __ATOMIC_RELAXED
+# define METRIC_ADD(p, n)  __atomic_fetch_add((p), (n), __ATOMIC_RELAXED)
+# define METRIC_LOAD(p)    __atomic_load_n((p), __ATOMIC_RELAXED)
+#else
+# define METRIC_ADD(p, n)  (*(p) += (n))
+# define METRIC_LOAD(p)    (*(p))
+#endif
+
+/* A latency histogram.  The last bucket counts everything past the bounds. */
+struct metrics_histogram {
+    uint64_t buckets[BUCKET_COUNT + 1];
+    uint64_t sum;
+};
+
+/* The metrics block. */
+struct webauth_metrics {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t counters[WA_METRIC_MAX];
+    struct metrics_histogram timers[WA_TIMER_MAX];
+};
+
+/*
+ * Names, labels, and descriptions for formatting.  Metrics that share a name
+ * are one Prometheus metric family distinguished by their labels, and must
+ * be adjacent in these tables.
+ */
+struct metric_desc {
+    const char *name;
+    const char *labels;
+    const char *help;
+};
+static const struct metric_desc counter_desc[WA_METRIC_MAX] = {
+    { "webauth_token_decode_total", NULL,
+      "Tokens successfully decoded" },
+    { "webauth_token_decode_failures_total", NULL,
+      "Tokens that could not be decoded" },
+    { "webauth_token_encode_total", NULL,
+      "Tokens encoded" },
+    { "webauth_token_decrypt_failures_total", "reason=\"bad_hmac\"",
+      "Token decryption failures by reason" },
+    { "webauth_token_decrypt_failures_total", "reason=\"bad_key\"",
+      "Token decryption failures by reason" },
+    { "webauth_token_decrypt_failures_total", "reason=\"corrupt\"",
+      "Token decryption failures by reason" },
+    { "webauth_keyring_hint_misses_total", NULL,
+      "Tokens not decryptable with the key named by their hint" },
+    { "webauth_webkdc_requests_total", NULL,
+      "Requests sent to the WebKDC" },
+    { "webauth_webkdc_request_failures_total", NULL,
+      "Requests to the WebKDC that failed" },
+    { "webauth_service_token_cache_total", "result=\"hit\"",
+      "Service token lookups by result" },
+    { "webauth_service_token_cache_total", "result=\"miss\"",
+      "Service token lookups by result" },
+    { "webauth_service_token_renewals_total", NULL,
+      "Service tokens requested from the WebKDC" },
+    { "webauth_webkdc_logins_total", NULL,
+      "Login requests processed by the WebKDC" },
+    { "webauth_userinfo_calls_total", NULL,
+      "Calls to the user information service" },
+    { "webauth_userinfo_failures_total", NULL,
+      "Calls to the user information service that failed" },
+    { "webauth_token_acl_cache_total", "result=\"hit\"",
+      "Token ACL lookups by result" },
+    { "webauth_token_acl_cache_total", "result=\"reload\"",
+      "Token ACL lookups by result" },
+    { "webauth_ticket_cache_total", "result=\"hit\"",
+      "Service ticket lookups by result" },
+    { "webauth_ticket_cache_total", "result=\"miss\"",
+      "Service ticket lookups by result" },
+};
+static const struct metric_desc timer_desc[WA_TIMER_MAX] = {
+    { "webauth_token_decode_seconds", NULL,
+      "Time to decode a token" },
+    { "webauth_token_encode_seconds", NULL,
+      "Time to encode a token" },
+    { "webauth_webkdc_request_seconds", NULL,
+      "Time for a request to the WebKDC" },
+    { "webauth_webkdc_login_seconds", NULL,
+      "Time to process a WebKDC login" },
+    { "webauth_userinfo_seconds", NULL,
+      "Time for a call to the user information service" },
+    { "webauth_webkdc_login_phase_seconds", "phase=\"parse\"",
+      "Time spent in each phase of a WebKDC login" },
+    { "webauth_webkdc_login_phase_seconds", "phase=\"authenticate\"",
+      "Time spent in each phase of a WebKDC login" },
+    { "webauth_webkdc_login_phase_seconds", "phase=\"merge\"",
+      "Time spent in each phase of a WebKDC login" },
+    { "webauth_webkdc_login_phase_seconds", "phase=\"userinfo\"",
+      "Time spent in each phase of a WebKDC login" },
+    { "webauth_webkdc_login_phase_seconds", "phase=\"authz\"",
+      "Time spent in each phase of a WebKDC login" },
+    { "webauth_webkdc_login_phase_seconds", "phase=\"encode\"",
+      "Time spent in each phase of a WebKDC login" },
+};
+
+
+/*
+ * Return the size of the metrics block.
+ */
+size_t
+webauth_metrics_size(void)
+{
+    return sizeof(struct webauth_metrics);
+}
+
+
+/*
+ * Initialize a metrics block in the provided memory.
+ */
+int
+webauth_metrics_init(struct webauth_context *ctx, void *memory, size_t size,
+                     struct webauth_metrics **metrics)
+{
+    struct webauth_metrics *block = memory;
+
+    *metrics = NULL;
+    if (size < sizeof(struct webauth_metrics))
+        return wai_error_set(ctx, WA_ERR_INVALID, "metrics block too small");
+    memset(block, 0, sizeof(struct webauth_metrics));
+    block->magic = METRICS_MAGIC;
+    block->version = METRICS_VERSION;
+    *metrics = block;
+    return WA_ERR_NONE;
+}
+
+
+/*
+ * Attach metrics to a context, or retrieve the attached metrics.
+ */
+void
+webauth_metrics_set(struct webauth_context *ctx,
+                    struct webauth_metrics *metrics)
+{
+    ctx->metrics = metrics;
+}
+
+struct webauth_metrics *
+webauth_metrics_get(struct webauth_context *ctx)
+{
+    return ctx->metrics;
+}
+
+
+/*
+ * Increment a counter.
+ */
+void
+webauth_metrics_count(struct webauth_metrics *metrics,
+                      enum webauth_metric metric)
+{
+    if (metrics == NULL || metric >= WA_METRIC_MAX)
+        return;
+    METRIC_ADD(&metrics->counters[metric], 1);
+}
+
+
+/*
+ * Record an observation in a histogram.
+ */
+void
+webauth_metrics_observe(struct webauth_metrics *metrics,
+                        enum webauth_timer timer, unsigned long usec)
+{
+    struct metrics_histogram *histogram;
+    size_t i;
+
+    if (metrics == NULL || timer >= WA_TIMER_MAX)
+        return;
+    histogram = &metrics->timers[timer];
+    for (i = 0; i < BUCKET_COUNT; i++)
+        if (usec <= buckets[i])
+            break;
+    METRIC_ADD(&histogram->buckets[i], 1);
+    METRIC_ADD(&histogram->sum, usec);
+}
+
+
+/*
+ * Start timing an operation for a context.  Returns the current time, or 0
+ * if the context has no metrics so that untimed contexts skip the clock.
+ */
+apr_time_t
+wai_metrics_start(struct webauth_context *ctx)
+{
+    return (ctx->metrics == NULL) ? 0 : apr_time_now();
+}
+
+
+/*
+ * Finish timing an operation started with wai_metrics_start, recording the
+ * elapsed time in the given histogram.
+ */
+void
+wai_metrics_stop(struct webauth_context *ctx, enum webauth_timer timer,
+                 apr_time_t start)
+{
+    apr_time_t elapsed;
+
+    if (ctx->metrics == NULL || start == 0)
+        return;
+    elapsed = apr_time_now() - start;
+    if (elapsed < 0)
+        elapsed = 0;
+    webauth_metrics_observe(ctx->metrics, timer, (unsigned long) elapsed);
+}
+
+
+/*
+ * Append the HELP and TYPE lines for a metric family to the buffer unless
+ * they were just written for the previous entry of the same family.
+ */
+static void
+format_header(struct wai_buffer *output, const struct metric_desc *desc,
+              const char *previous, const char *type)
+{
+    if (previous != NULL && strcmp(previous, desc->name) == 0)
+        return;
+    wai_buffer_append_sprintf(output, "# HELP %s %s\n", desc->name,
+                              desc->help);
+    wai_buffer_append_sprintf(output, "# TYPE %s %s\n", desc->name, type);
+}
+
+
+/*
+ * Format the metrics in the Prometheus text format.
+ */
+int
+webauth_metrics_format(struct webauth_context *ctx,
+                       const struct webauth_metrics *metrics, char **output)
+{
+    struct wai_buffer *buffer;
+    const struct metric_desc *desc;
+    const struct metrics_histogram *histogram;
+    const char *previous = NULL;
+    const char *labels, *prefix;
+    unsigned long long value, total;
+    size_t i, j;
+
+    *output = NULL;
+    if (metrics->magic != METRICS_MAGIC || metrics->version != METRICS_VERSION)
+        return wai_error_set(ctx, WA_ERR_CORRUPT, "invalid metrics block");
+    buffer = wai_buffer_new(ctx->pool);
+
+    /* Counters. */
+    for (i = 0; i < WA_METRIC_MAX; i++) {
+        desc = &counter_desc[i];
+        format_header(buffer, desc, previous, "counter");
+        previous = desc->name;
+        value = METRIC_LOAD(&metrics->counters[i]);
+        if (desc->labels == NULL)
+            wai_buffer_append_sprintf(buffer, "%s %llu\n", desc->name, value);
+        else
+            wai_buffer_append_sprintf(buffer, "%s{%s} %llu\n", desc->name,
+                                      desc->labels, value);
+    }
+
+    /*
+     * Histograms, with cumulative buckets.  The labels of the histogram, if
+     * any, are added to the le label of each bucket and are the only labels
+     * of the sum and count.
+     */
+    previous = NULL;
+    for (i = 0; i < WA_TIMER_MAX; i++) {
+        desc = &timer_desc[i];
+        histogram = &metrics->timers[i];
+        format_header(buffer, desc, previous, "histogram");
+        previous = desc->name;
+        if (desc->labels == NULL) {
+            labels = "";
+            prefix = "";
+        } else {
+            labels = apr_psprintf(ctx->pool, "{%s}", desc->labels);
+            prefix = apr_psprintf(ctx->pool, "%s,", desc->labels);
+        }
+        total = 0;
+        for (j = 0; j < BUCKET_COUNT; j++) {
+            total += METRIC_LOAD(&histogram->buckets[j]);
+            wai_buffer_append_sprintf(buffer, "%s_bucket{%sle=\"%lu.%06lu\"}"
+                                      " %llu\n", desc->name, prefix,
+                                      buckets[j] / 1000000,
+                                      buckets[j] % 1000000, total);
+        }
+        total += METRIC_LOAD(&histogram->buckets[BUCKET_COUNT]);
+        wai_buffer_append_sprintf(buffer, "%s_bucket{%sle=\"+Inf\"} %llu\n",
+                                  desc->name, prefix, total);
+        value = METRIC_LOAD(&histogram->sum);
+        wai_buffer_append_sprintf(buffer, "%s_sum%s %llu.%06llu\n",
+                                  desc->name, labels, value / 1000000,
+                                  value % 1000000);
+        wai_buffer_append_sprintf(buffer, "%s_count%s %llu\n", desc->name,
+                                  labels, total);
+    }
+    *output = buffer->data;
+    return WA_ERR_NONE;
+}
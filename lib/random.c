@@ -0,0 +1,97 @@
+/*
+ * Buffered random data for token nonces.
+ *
+ * Every encrypted token needs a random nonce or IV.  Getting each one from
+ * OpenSSL separately takes the lock around OpenSSL's global random number
+ * generator once per token, which shows up as contention in servers with
+ * many threads.  Instead, each thread fills a block of random data from
+ * OpenSSL and hands out nonces from it until it runs out.
+ *
+ * The block is in thread-local storage, so it needs no locking and goes away
+ * with the thread.  A forked child must never hand out the nonces its parent
+ * will also use, so the block is refilled whenever the process ID differs
+ * from the one that filled it.  This covers Apache child processes without
+ * any help from the modules.  Without compiler support for thread-local
+ * storage, each nonce comes directly from OpenSSL.
+ *
+ * Copyright 2014
+ *     The Board of Trustees of the Leland Stanford Junior University
+ *
+ * See LICENSE for licensing terms.
+ */
+
+#include <config.h>
+#include <portable/apr.h>
+#include <portable/system.h>
+
+#include <openssl/err.h>
+#include <openssl/rand.h>
+
+#include <lib/internal.h>
+#include <webauth/basic.h>
+
+/* Size of the per-thread block, enough for 64 nonces. */
+#define NONCE_BLOCK_SIZE 1024
+
+/*
+ * The per-thread block, how much of it has been handed out, and the process
+ * that filled it.
+ */
+#ifdef HAVE_THREAD_LOCAL
+static __thread unsigned char nonce_block[NONCE_BLOCK_SIZE];
+static __thread size_t nonce_used = NONCE_BLOCK_SIZE;
+static __thread pid_t nonce_pid;
+#endif
+
+
+/*
+ * Fill a buffer with random data from OpenSSL, setting the WebAuth error on
+ * failure.
+ */
+static int
+random_fill(struct webauth_context *ctx, unsigned char *buf, size_t length)
+{
+    char errbuf[BUFSIZ];
+    unsigned long err;
+    int s;
+
+    if (RAND_bytes(buf, length) > 0)
+        return WA_ERR_NONE;
+    s = WA_ERR_RAND_FAILURE;
+    err = ERR_get_error();
+    if (err == 0)
+        return wai_error_set(ctx, s, "cannot generate random nonce");
+    ERR_error_string_n(err, errbuf, sizeof(errbuf));
+    return wai_error_set(ctx, s, "cannot generate random nonce: %s", errbuf);
+}
+
+
+/*
+ * Copy the next length bytes of the thread's block to the output buffer,
+ * refilling the block first if there isn't enough left or if it was filled
+ * by another process.
+ */
+int
+wai_random_nonce(struct webauth_context *ctx, void *nonce, size_t length)
+{
+#ifdef HAVE_THREAD_LOCAL
+    pid_t pid;
+    int s;
+
+    if (length <= NONCE_BLOCK_SIZE) {
+        pid = getpid();
+        if (pid != nonce_pid || NONCE_BLOCK_SIZE - nonce_used < length) {
+            nonce_used = NONCE_BLOCK_SIZE;
+            s = random_fill(ctx, nonce_block, NONCE_BLOCK_SIZE);
+            if (s != WA_ERR_NONE)
+                return s;
+            nonce_used = 0;
+            nonce_pid = pid;
+        }
+        memcpy(nonce, nonce_block + nonce_used, length);
+        nonce_used += length;
+        return WA_ERR_NONE;
+    }
+#endif
+    return random_fill(ctx, nonce, length);
+}
@@ -0,0 +1,713 @@
+/*
+ * Shared-memory replay cache and login rate limiting.
+ *
+ * The cache is a file mapped shared into every process that opens it.  It
+ * starts with a header, followed by two tables of 64-bit slots: one for
+ * request tokens that have been used and one for per-user counts of failed
+ * logins.  Each slot is a single 64-bit word updated with compare-and-swap,
+ * so readers and writers in different processes never block each other.
+ *
+ * Keys are hashed with SHA-256 together with a random secret generated when
+ * the file is created, so that a remote user cannot choose usernames that
+ * collide with someone else's slot and lock them out.  The hash picks a
+ * starting slot and a fingerprint stored in the slot.  Lookups probe a small
+ * window of slots from the starting point.  When the window is full, the
+ * stalest entry in it is overwritten, so the tables degrade by forgetting
+ * old entries rather than by refusing new ones.
+ *
+ * A replay slot holds a 32-bit fingerprint and the 32-bit time the token was
+ * last seen.  A rate limit slot holds a 20-bit fingerprint, the low 20 bits
+ * of the interval number, and failure counts for that interval and the one
+ * before it.  The number of failures in the sliding window is estimated by
+ * weighting the previous interval's count by how much of it still overlaps
+ * the window.
+ *
+ * Copyright 2014
+ *     The Board of Trustees of the Leland Stanford Junior University
+ *
+ * See LICENSE for licensing terms.
+ */
+
+#include <config.h>
+#include <portable/apr.h>
+#include <portable/system.h>
+
+#include <apr_mmap.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+
+#include <lib/internal.h>
+#include <util/macros.h>
+#include <webauth/basic.h>
+#include <webauth/replay.h>
+
+/* Magic number and version at the start of the file. */
+#define REPLAY_MAGIC    0x57415243UL    /* "WARC" */
+#define REPLAY_VERSION  1
+
+/* Default number of slots in each table, and the size of a probe window. */
+#define REPLAY_SLOTS    65536
+#define REPLAY_PROBE    8
+
+/* Layout of a rate limit slot. */
+#define LIMIT_FP_BITS     20
+#define LIMIT_EPOCH_BITS  20
+#define LIMIT_COUNT_BITS  12
+#define LIMIT_FP_MASK     ((1UL << LIMIT_FP_BITS) - 1)
+#define LIMIT_EPOCH_MASK  ((1UL << LIMIT_EPOCH_BITS) - 1)
+#define LIMIT_COUNT_MAX   ((1UL << LIMIT_COUNT_BITS) - 1)
+
+/*
+ * Whether we can use the GCC atomic builtins on 64-bit values without a
+ * lock.  A lock-based fallback would be private to each process and hence
+ * useless for memory shared between processes.
+ */
+#if defined(__ATOMIC_SEQ_CST) && defined(__GCC_ATOMIC_LLONG_LOCK_FREE) \
+    && __GCC_ATOMIC_LLONG_LOCK_FREE == 2
+# define HAVE_REPLAY_ATOMICS 1
+# define SLOT_LOAD(p)        __atomic_load_n((p), __ATOMIC_ACQUIRE)
+# define SLOT_CAS(p, o, n)                                              \
+    __atomic_compare_exchange_n((p), (o), (n), false, __ATOMIC_ACQ_REL, \
+                                __ATOMIC_ACQUIRE)
+#endif
+
+/*
+ * The file header.  The magic number is written last when initializing the
+ * file so that a file is never used with a partially written header.
+ */
+struct replay_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slots;
+    uint32_t unused;
+    unsigned char secret[32];
+};
+
+/* The opaque handle returned to callers. */
+struct webauth_replay {
+    struct webauth_replay_config config;
+    const struct replay_header *header;
+    uint64_t *replay;
+    uint64_t *limit;
+    unsigned long slots;
+};
+
+/* An unpacked rate limit slot. */
+struct limit_entry {
+    unsigned long fp;
+    unsigned long epoch;
+    unsigned long current;
+    unsigned long previous;
+};
+
+
+#ifdef HAVE_REPLAY_ATOMICS
+
+/*
+ * Given the size of the tables, return the total size of the file.
+ */
+static apr_size_t
+replay_size(unsigned long slots)
+{
+    return sizeof(struct replay_header) + 2 * slots * sizeof(uint64_t);
+}
+
+
+/*
+ * Make sure the file is at least large enough for a cache of the given size.
+ * The file is only ever extended, never truncated, since another process may
+ * still have it mapped and would get SIGBUS when touching a page past the
+ * new end of the file.
+ */
+static int
+replay_extend(struct webauth_context *ctx, const char *path, apr_file_t *file,
+              apr_off_t current, unsigned long slots)
+{
+    apr_off_t size = replay_size(slots);
+    apr_status_t code;
+
+    if (current >= size)
+        return WA_ERR_NONE;
+    code = apr_file_trunc(file, size);
+    if (code != APR_SUCCESS)
+        return wai_error_set_apr(ctx, WA_ERR_FILE_WRITE, code, "%s", path);
+    return WA_ERR_NONE;
+}
+
+
+/*
+ * Initialize an empty cache of the given size in the mapping of a file
+ * that didn't hold a valid cache.  The caller holds the lock.  This is done
+ * inside the existing mapping so that other processes that still have the
+ * file mapped see an empty cache rather than a file shrinking under them.
+ * The magic number is cleared first and written last so that a file is
+ * never used with a partially written header.
+ */
+static int
+replay_init(struct webauth_context *ctx, void *base, unsigned long slots)
+{
+    struct replay_header *header = base;
+    unsigned char secret[sizeof(header->secret)];
+
+    if (RAND_bytes(secret, sizeof(secret)) <= 0)
+        return wai_error_set(ctx, WA_ERR_RAND_FAILURE, "replay cache secret");
+    __atomic_store_n(&header->magic, 0, __ATOMIC_RELEASE);
+    memset(header + 1, 0, replay_size(slots) - sizeof(*header));
+    header->version = REPLAY_VERSION;
+    header->slots = slots;
+    header->unused = 0;
+    memcpy(header->secret, secret, sizeof(secret));
+    __atomic_store_n(&header->magic, REPLAY_MAGIC, __ATOMIC_RELEASE);
+    return WA_ERR_NONE;
+}
+
+
+/*
+ * Open the replay cache.  Takes the lock only long enough to check the
+ * header and initialize the file if needed, and then maps the file.
+ */
+int
+webauth_replay_open(struct webauth_context *ctx,
+                    const struct webauth_replay_config *config,
+                    struct webauth_replay **replay)
+{
+    apr_pool_t *pool = ctx->config_pool;
+    struct webauth_replay *cache;
+    struct replay_header header;
+    apr_file_t *lock = NULL;
+    apr_file_t *file = NULL;
+    apr_finfo_t finfo;
+    apr_mmap_t *mmap;
+    apr_int32_t flags;
+    apr_size_t size;
+    apr_status_t code;
+    unsigned long slots;
+    bool valid;
+    int s;
+
+    /* Set the output parameter in case of error. */
+    *replay = NULL;
+
+    /* Sanity-check the configuration. */
+    if (config->path == NULL)
+        return wai_error_set(ctx, WA_ERR_INVALID, "no replay cache path");
+    if (config->limit_threshold > 0 && config->limit_interval == 0) {
+        s = WA_ERR_INVALID;
+        return wai_error_set(ctx, s, "rate limit interval must be nonzero");
+    }
+    slots = (config->slots == 0) ? REPLAY_SLOTS : config->slots;
+    if (slots < REPLAY_PROBE || slots > UINT32_MAX / 2) {
+        s = WA_ERR_INVALID;
+        return wai_error_set(ctx, s, "invalid replay cache size %lu", slots);
+    }
+
+    /* Open the file, creating it if needed, and lock it. */
+    s = wai_file_lock(ctx, config->path, &lock);
+    if (s != WA_ERR_NONE)
+        return s;
+    flags = APR_FOPEN_READ | APR_FOPEN_WRITE | APR_FOPEN_CREATE;
+    code = apr_file_open(&file, config->path, flags,
+                         APR_FPROT_UREAD | APR_FPROT_UWRITE, pool);
+    if (code != APR_SUCCESS) {
+        s = WA_ERR_FILE_OPENWRITE;
+        wai_error_set_apr(ctx, s, code, "%s", config->path);
+        goto done;
+    }
+
+    /*
+     * See if the file already holds a cache.  If so, use its size, not ours.
+     * If not, or if it's from some other version, it will be initialized once
+     * it is mapped.  If the file is already the size of some cache, keep that
+     * size, so that any process still using the file sees the same layout;
+     * otherwise, make sure it's large enough for the configured size.
+     */
+    code = apr_file_info_get(&finfo, APR_FINFO_SIZE, file);
+    if (code != APR_SUCCESS) {
+        s = WA_ERR_FILE_READ;
+        wai_error_set_apr(ctx, s, code, "stat of %s", config->path);
+        goto done;
+    }
+    memset(&header, 0, sizeof(header));
+    if (finfo.size >= (apr_off_t) sizeof(header)) {
+        code = apr_file_read_full(file, &header, sizeof(header), NULL);
+        if (code != APR_SUCCESS) {
+            s = WA_ERR_FILE_READ;
+            wai_error_set_apr(ctx, s, code, "%s", config->path);
+            goto done;
+        }
+    }
+    valid = (header.magic == REPLAY_MAGIC && header.version == REPLAY_VERSION
+             && header.slots >= REPLAY_PROBE
+             && finfo.size >= (apr_off_t) replay_size(header.slots));
+    if (valid)
+        slots = header.slots;
+    else {
+        size = (finfo.size > (apr_off_t) sizeof(header))
+            ? (apr_size_t) finfo.size - sizeof(header) : 0;
+        if (size % (2 * sizeof(uint64_t)) == 0
+            && size / (2 * sizeof(uint64_t)) >= REPLAY_PROBE
+            && size / (2 * sizeof(uint64_t)) <= UINT32_MAX / 2)
+            slots = size / (2 * sizeof(uint64_t));
+        else {
+            s = replay_extend(ctx, config->path, file, finfo.size, slots);
+            if (s != WA_ERR_NONE)
+                goto done;
+        }
+    }
+
+    /* Map the file.  The mapping stays valid after the file is closed. */
+    size = replay_size(slots);
+    flags = APR_MMAP_READ | APR_MMAP_WRITE;
+    code = apr_mmap_create(&mmap, file, 0, size, flags, pool);
+    if (code != APR_SUCCESS) {
+        s = WA_ERR_FILE_READ;
+        wai_error_set_apr(ctx, s, code, "mapping %s", config->path);
+        goto done;
+    }
+    if (!valid) {
+        s = replay_init(ctx, mmap->mm, slots);
+        if (s != WA_ERR_NONE)
+            goto done;
+    }
+    cache = apr_pcalloc(pool, sizeof(struct webauth_replay));
+    cache->config = *config;
+    cache->config.path = apr_pstrdup(pool, config->path);
+    cache->header = mmap->mm;
+    cache->replay = (uint64_t *) ((char *) mmap->mm + sizeof(header));
+    cache->limit = cache->replay + slots;
+    cache->slots = slots;
+    *replay = cache;
+    s = WA_ERR_NONE;
+
+done:
+    if (file != NULL)
+        apr_file_close(file);
+    if (lock != NULL) {
+        if (s == WA_ERR_NONE)
+            s = wai_file_unlock(ctx, config->path, lock);
+        else
+            apr_file_close(lock);
+    }
+    return s;
+}
+
+
+/*
+ * Hash a key with the secret for this cache, returning the starting slot
+ * index and a fingerprint of the key with the given number of bits.  The
+ * fingerprint is never zero, since zero marks an empty slot.
+ */
+static int
+replay_hash(struct webauth_context *ctx, struct webauth_replay *replay,
+            const void *data, size_t length, unsigned int bits,
+            unsigned long *index, unsigned long *fp)
+{
+    EVP_MD_CTX *md;
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    uint64_t start;
+    uint32_t print;
+    bool okay;
+
+    md = EVP_MD_CTX_create();
+    if (md == NULL)
+        return wai_error_set(ctx, WA_ERR_NO_MEM, "creating digest context");
+    okay = (EVP_DigestInit_ex(md, EVP_sha256(), NULL)
+            && EVP_DigestUpdate(md, replay->header->secret,
+                                sizeof(replay->header->secret))
+            && EVP_DigestUpdate(md, data, length)
+            && EVP_DigestFinal_ex(md, digest, NULL));
+    EVP_MD_CTX_destroy(md);
+    if (!okay)
+        return wai_error_set(ctx, WA_ERR_INTERNAL, "cannot hash replay key");
+    memcpy(&start, digest, sizeof(start));
+    memcpy(&print, digest + sizeof(start), sizeof(print));
+    *index = start % replay->slots;
+    *fp = print & ((1UL << bits) - 1);
+    if (*fp == 0)
+        *fp = 1;
+    return WA_ERR_NONE;
+}
+
+
+/*
+ * Pack and unpack replay slots.
+ */
+static uint64_t
+replay_pack(unsigned long fp, time_t seen)
+{
+    return ((uint64_t) fp << 32) | (uint32_t) seen;
+}
+
+static void
+replay_unpack(uint64_t slot, unsigned long *fp, time_t *seen)
+{
+    *fp = slot >> 32;
+    *seen = (time_t) (uint32_t) slot;
+}
+
+
+/*
+ * Pack and unpack rate limit slots.
+ */
+static uint64_t
+limit_pack(const struct limit_entry *entry)
+{
+    uint64_t slot;
+
+    slot = entry->fp;
+    slot = (slot << LIMIT_EPOCH_BITS) | entry->epoch;
+    slot = (slot << LIMIT_COUNT_BITS) | entry->current;
+    slot = (slot << LIMIT_COUNT_BITS) | entry->previous;
+    return slot;
+}
+
+static void
+limit_unpack(uint64_t slot, struct limit_entry *entry)
+{
+    entry->previous = slot & LIMIT_COUNT_MAX;
+    slot >>= LIMIT_COUNT_BITS;
+    entry->current = slot & LIMIT_COUNT_MAX;
+    slot >>= LIMIT_COUNT_BITS;
+    entry->epoch = slot & LIMIT_EPOCH_MASK;
+    slot >>= LIMIT_EPOCH_BITS;
+    entry->fp = slot & LIMIT_FP_MASK;
+}
+
+
+/*
+ * Age a rate limit entry to the given interval number, moving or discarding
+ * counts from older intervals.
+ */
+static void
+limit_age(struct limit_entry *entry, unsigned long epoch)
+{
+    if (entry->epoch == epoch)
+        return;
+    if (((entry->epoch + 1) & LIMIT_EPOCH_MASK) == epoch)
+        entry->previous = entry->current;
+    else
+        entry->previous = 0;
+    entry->current = 0;
+    entry->epoch = epoch;
+}
+
+
+/*
+ * Return the estimated number of failures in the sliding window ending now
+ * for an entry that has already been aged to the current interval.
+ */
+static unsigned long
+limit_count(struct webauth_replay *replay, const struct limit_entry *entry,
+            time_t now)
+{
+    unsigned long interval = replay->config.limit_interval;
+    unsigned long remaining;
+
+    remaining = interval - (unsigned long) now % interval;
+    return entry->current + entry->previous * remaining / interval;
+}
+
+
+/*
+ * Find the slot for a token in the replay table.  Returns the matching slot,
+ * or NULL if there is none, and stores the current value of that slot.
+ */
+static uint64_t *
+replay_find(struct webauth_replay *replay, unsigned long index,
+            unsigned long fp, uint64_t *value)
+{
+    unsigned long i, slot_fp;
+    uint64_t *slot;
+    time_t seen;
+
+    for (i = 0; i < REPLAY_PROBE; i++) {
+        slot = &replay->replay[(index + i) % replay->slots];
+        *value = SLOT_LOAD(slot);
+        replay_unpack(*value, &slot_fp, &seen);
+        if (slot_fp == fp)
+            return slot;
+    }
+    return NULL;
+}
+
+
+/*
+ * Find the slot for a user in the rate limit table.  Returns the matching
+ * slot, or NULL if there is none, and stores the current value of that slot.
+ */
+static uint64_t *
+limit_find(struct webauth_replay *replay, unsigned long index,
+           unsigned long fp, uint64_t *value)
+{
+    struct limit_entry entry;
+    unsigned long i;
+    uint64_t *slot;
+
+    for (i = 0; i < REPLAY_PROBE; i++) {
+        slot = &replay->limit[(index + i) % replay->slots];
+        *value = SLOT_LOAD(slot);
+        limit_unpack(*value, &entry);
+        if (entry.fp == fp)
+            return slot;
+    }
+    return NULL;
+}
+
+
+/*
+ * Check whether a request token has been seen within the replay timeout.  If
+ * so, refresh its last-seen time so that a token replayed repeatedly stays in
+ * the cache, as the memcached implementation in WebLogin did.
+ */
+int
+webauth_replay_check(struct webauth_context *ctx,
+                     struct webauth_replay *replay, const void *token,
+                     size_t length, time_t now, time_t *seen)
+{
+    unsigned long index, fp, slot_fp;
+    uint64_t *slot;
+    uint64_t value;
+    time_t when;
+    int s;
+
+    *seen = 0;
+    s = replay_hash(ctx, replay, token, length, 32, &index, &fp);
+    if (s != WA_ERR_NONE)
+        return s;
+    slot = replay_find(replay, index, fp, &value);
+    while (slot != NULL) {
+        replay_unpack(value, &slot_fp, &when);
+        if (slot_fp != fp
+            || now - when >= (time_t) replay->config.replay_timeout)
+            break;
+        *seen = when;
+        if (when >= now || SLOT_CAS(slot, &value, replay_pack(fp, now)))
+            break;
+    }
+    return WA_ERR_NONE;
+}
+
+
+/*
+ * Record a request token as used.  If the token is already present, update
+ * its time.  Otherwise, claim an empty or expired slot in the probe window,
+ * or failing that the one seen least recently.
+ */
+int
+webauth_replay_add(struct webauth_context *ctx, struct webauth_replay *replay,
+                   const void *token, size_t length, time_t now)
+{
+    unsigned long index, fp, slot_fp, i;
+    uint64_t *slot, *oldest;
+    uint64_t value, oldest_value;
+    time_t when, oldest_when;
+    int s;
+
+    s = replay_hash(ctx, replay, token, length, 32, &index, &fp);
+    if (s != WA_ERR_NONE)
+        return s;
+    do {
+        slot = replay_find(replay, index, fp, &value);
+        if (slot == NULL) {
+            oldest = NULL;
+            oldest_value = 0;
+            oldest_when = 0;
+            for (i = 0; i < REPLAY_PROBE; i++) {
+                slot = &replay->replay[(index + i) % replay->slots];
+                value = SLOT_LOAD(slot);
+                replay_unpack(value, &slot_fp, &when);
+                if (oldest == NULL || when < oldest_when) {
+                    oldest = slot;
+                    oldest_value = value;
+                    oldest_when = when;
+                }
+                if (slot_fp == 0)
+                    break;
+            }
+            slot = oldest;
+            value = oldest_value;
+        }
+    } while (!SLOT_CAS(slot, &value, replay_pack(fp, now)));
+    return WA_ERR_NONE;
+}
+
+
+/*
+ * Check whether a user has reached the failed login threshold.
+ */
+int
+webauth_replay_limited(struct webauth_context *ctx,
+                       struct webauth_replay *replay, const char *user,
+                       time_t now, int *limited)
+{
+    struct limit_entry entry;
+    unsigned long index, fp, epoch;
+    uint64_t value;
+    int s;
+
+    *limited = false;
+    if (replay->config.limit_threshold == 0)
+        return WA_ERR_NONE;
+    s = replay_hash(ctx, replay, user, strlen(user), LIMIT_FP_BITS, &index,
+                    &fp);
+    if (s != WA_ERR_NONE)
+        return s;
+    if (limit_find(replay, index, fp, &value) == NULL)
+        return WA_ERR_NONE;
+    limit_unpack(value, &entry);
+    epoch = ((unsigned long) now / replay->config.limit_interval)
+        & LIMIT_EPOCH_MASK;
+    limit_age(&entry, epoch);
+    *limited = (limit_count(replay, &entry, now)
+                >= replay->config.limit_threshold);
+    return WA_ERR_NONE;
+}
+
+
+/*
+ * Record a failed login for a user.  If the user has no slot, claim one
+ * whose counts have aged out, or failing that the one with the lowest count.
+ */
+int
+webauth_replay_fail(struct webauth_context *ctx, struct webauth_replay *replay,
+                    const char *user, time_t now)
+{
+    struct limit_entry entry;
+    unsigned long index, fp, epoch, i, count, best_count;
+    uint64_t *slot, *best;
+    uint64_t value, best_value;
+    int s;
+
+    if (replay->config.limit_threshold == 0)
+        return WA_ERR_NONE;
+    s = replay_hash(ctx, replay, user, strlen(user), LIMIT_FP_BITS, &index,
+                    &fp);
+    if (s != WA_ERR_NONE)
+        return s;
+    epoch = ((unsigned long) now / replay->config.limit_interval)
+        & LIMIT_EPOCH_MASK;
+    do {
+        slot = limit_find(replay, index, fp, &value);
+        if (slot != NULL) {
+            limit_unpack(value, &entry);
+            limit_age(&entry, epoch);
+        } else {
+            best = NULL;
+            best_value = 0;
+            best_count = 0;
+            for (i = 0; i < REPLAY_PROBE; i++) {
+                slot = &replay->limit[(index + i) % replay->slots];
+                value = SLOT_LOAD(slot);
+                limit_unpack(value, &entry);
+                limit_age(&entry, epoch);
+                count = limit_count(replay, &entry, now);
+                if (best == NULL || count < best_count) {
+                    best = slot;
+                    best_value = value;
+                    best_count = count;
+                }
+                if (count == 0)
+                    break;
+            }
+            slot = best;
+            value = best_value;
+            memset(&entry, 0, sizeof(entry));
+            entry.epoch = epoch;
+        }
+        entry.fp = fp;
+        if (entry.current < LIMIT_COUNT_MAX)
+            entry.current++;
+    } while (!SLOT_CAS(slot, &value, limit_pack(&entry)));
+    return WA_ERR_NONE;
+}
+
+
+/*
+ * Clear the failed login count for a user.
+ */
+int
+webauth_replay_clear(struct webauth_context *ctx,
+                     struct webauth_replay *replay, const char *user)
+{
+    unsigned long index, fp;
+    uint64_t *slot;
+    uint64_t value;
+    int s;
+
+    if (replay->config.limit_threshold == 0)
+        return WA_ERR_NONE;
+    s = replay_hash(ctx, replay, user, strlen(user), LIMIT_FP_BITS, &index,
+                    &fp);
+    if (s != WA_ERR_NONE)
+        return s;
+    do {
+        slot = limit_find(replay, index, fp, &value);
+        if (slot == NULL)
+            break;
+    } while (!SLOT_CAS(slot, &value, 0));
+    return WA_ERR_NONE;
+}
+
+#else /* !HAVE_REPLAY_ATOMICS */
+
+/*
+ * Without atomics, webauth_replay_open always fails, so there is never a
+ * cache to pass to the other functions.  Provide stubs so that the library
+ * exports the same interface everywhere.
+ */
+int
+webauth_replay_open(struct webauth_context *ctx,
+                    const struct webauth_replay_config *config UNUSED,
+                    struct webauth_replay **replay)
+{
+    *replay = NULL;
+    return wai_error_set(ctx, WA_ERR_UNIMPLEMENTED,
+                         "no lock-free 64-bit atomic operations");
+}
+
+int
+webauth_replay_check(struct webauth_context *ctx,
+                     struct webauth_replay *replay UNUSED,
+                     const void *token UNUSED, size_t length UNUSED,
+                     time_t now UNUSED, time_t *seen)
+{
+    *seen = 0;
+    return wai_error_set(ctx, WA_ERR_UNIMPLEMENTED, "replay cache");
+}
+
+int
+webauth_replay_add(struct webauth_context *ctx,
+                   struct webauth_replay *replay UNUSED,
+                   const void *token UNUSED, size_t length UNUSED,
+                   time_t now UNUSED)
+{
+    return wai_error_set(ctx, WA_ERR_UNIMPLEMENTED, "replay cache");
+}
+
+int
+webauth_replay_limited(struct webauth_context *ctx,
+                       struct webauth_replay *replay UNUSED,
+                       const char *user UNUSED, time_t now UNUSED,
+                       int *limited)
+{
+    *limited = false;
+    return wai_error_set(ctx, WA_ERR_UNIMPLEMENTED, "replay cache");
+}
+
+int
+webauth_replay_fail(struct webauth_context *ctx,
+                    struct webauth_replay *replay UNUSED,
+                    const char *user UNUSED, time_t now UNUSED)
+{
+    return wai_error_set(ctx, WA_ERR_UNIMPLEMENTED, "replay cache");
+}
+
+int
+webauth_replay_clear(struct webauth_context *ctx,
+                     struct webauth_replay *replay UNUSED,
+                     const char *user UNUSED)
+{
+    return wai_error_set(ctx, WA_ERR_UNIMPLEMENTED, "replay cache");
+}
+
+#endif /* !HAVE_REPLAY_ATOMICS */
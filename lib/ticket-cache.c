@@ -0,0 +1,211 @@
+/*
+ * Cache of exported Kerberos service tickets.
+ *
+ * The WebKDC obtains service tickets for cred tokens by importing the TGT
+ * from a webkdc-proxy token into a fresh memory ticket cache, so the
+ * Kerberos libraries never have an earlier ticket to reuse and every request
+ * is a round trip to the KDC.  This cache keeps the exported tickets in
+ * memory, keyed by a SHA-256 digest of the exported TGT and the server
+ * principal, so that a ticket is only reused with the same TGT with which it
+ * was obtained.
+ *
+ * The table has a fixed number of slots.  The digest picks a starting slot,
+ * and lookups probe a small window of slots from there.  When the window is
+ * full, an expired ticket or else the one that will expire first is
+ * replaced, so the cache degrades by forgetting tickets rather than by
+ * refusing new ones.  Each slot keeps its ticket buffer when the ticket is
+ * replaced and only allocates a new one if the new ticket doesn't fit, so
+ * memory use is bounded by the number of slots and the largest tickets.
+ *
+ * Copyright 2014
+ *     The Board of Trustees of the Leland Stanford Junior University
+ *
+ * See LICENSE for licensing terms.
+ */
+
+#include <config.h>
+#include <portable/apr.h>
+#include <portable/system.h>
+
+#include <openssl/evp.h>
+
+#include <lib/internal.h>
+#include <webauth/basic.h>
+#include <webauth/krb5.h>
+
+/* Size of the key digest and of a probe window. */
+#define TICKET_DIGEST 32
+#define TICKET_PROBE  8
+
+/* A cached ticket.  The expiration is 0 if the slot is empty. */
+struct ticket_entry {
+    unsigned char digest[TICKET_DIGEST];
+    time_t expiration;
+    void *ticket;
+    size_t length;
+    size_t size;
+};
+
+/* The opaque handle returned to callers. */
+struct webauth_krb5_ticket_cache {
+    apr_pool_t *pool;
+    struct ticket_entry *entries;
+    unsigned long slots;
+    time_t minimum;
+};
+
+
+/*
+ * Create a new, empty ticket cache.  All of its memory comes from a subpool
+ * of the configuration pool, which is not cleared on context reset.
+ */
+int
+webauth_krb5_ticket_cache_new(struct webauth_context *ctx,
+                              unsigned long slots, time_t minimum,
+                              struct webauth_krb5_ticket_cache **cache)
+{
+    struct webauth_krb5_ticket_cache *tc;
+    apr_pool_t *pool;
+    int s;
+
+    *cache = NULL;
+    if (slots < TICKET_PROBE) {
+        s = WA_ERR_INVALID;
+        return wai_error_set(ctx, s, "invalid ticket cache size %lu", slots);
+    }
+    if (apr_pool_create(&pool, ctx->config_pool) != APR_SUCCESS)
+        return wai_error_set(ctx, WA_ERR_APR, "cannot create ticket cache");
+    tc = apr_palloc(pool, sizeof(struct webauth_krb5_ticket_cache));
+    tc->pool = pool;
+    tc->entries = apr_pcalloc(pool, slots * sizeof(struct ticket_entry));
+    tc->slots = slots;
+    tc->minimum = minimum;
+    *cache = tc;
+    return WA_ERR_NONE;
+}
+
+
+/*
+ * Hash the TGT and server principal, storing the digest in the provided
+ * buffer and returning the starting slot index in the final argument.  The
+ * TGT length is hashed first so that the boundary between the TGT and the
+ * principal is unambiguous.
+ */
+static int
+ticket_hash(struct webauth_context *ctx,
+            const struct webauth_krb5_ticket_cache *cache,
+            const void *tgt, size_t tgt_len, const char *principal,
+            unsigned char digest[TICKET_DIGEST], unsigned long *index)
+{
+    EVP_MD_CTX *md;
+    uint64_t length = tgt_len;
+    uint64_t start;
+    bool okay;
+
+    md = EVP_MD_CTX_create();
+    if (md == NULL)
+        return wai_error_set(ctx, WA_ERR_NO_MEM, "creating digest context");
+    okay = (EVP_DigestInit_ex(md, EVP_sha256(), NULL)
+            && EVP_DigestUpdate(md, &length, sizeof(length))
+            && EVP_DigestUpdate(md, tgt, tgt_len)
+            && EVP_DigestUpdate(md, principal, strlen(principal))
+            && EVP_DigestFinal_ex(md, digest, NULL));
+    EVP_MD_CTX_destroy(md);
+    if (!okay)
+        return wai_error_set(ctx, WA_ERR_INTERNAL, "cannot hash ticket key");
+    memcpy(&start, digest, sizeof(start));
+    *index = start % cache->slots;
+    return WA_ERR_NONE;
+}
+
+
+/*
+ * Look up a ticket, returning a copy of it if it has at least the minimum
+ * lifetime left.
+ */
+int
+webauth_krb5_ticket_cache_get(struct webauth_context *ctx,
+                              struct webauth_krb5_ticket_cache *cache,
+                              const void *tgt, size_t tgt_len,
+                              const char *principal, time_t now,
+                              void **ticket, size_t *ticket_len,
+                              time_t *expiration)
+{
+    unsigned char digest[TICKET_DIGEST];
+    struct ticket_entry *entry;
+    unsigned long index, i;
+    int s;
+
+    *ticket = NULL;
+    *ticket_len = 0;
+    *expiration = 0;
+    s = ticket_hash(ctx, cache, tgt, tgt_len, principal, digest, &index);
+    if (s != WA_ERR_NONE)
+        return s;
+    for (i = 0; i < TICKET_PROBE; i++) {
+        entry = &cache->entries[(index + i) % cache->slots];
+        if (entry->expiration == 0)
+            continue;
+        if (memcmp(entry->digest, digest, TICKET_DIGEST) != 0)
+            continue;
+        if (entry->expiration - cache->minimum <= now)
+            break;
+        *ticket = apr_pmemdup(ctx->pool, entry->ticket, entry->length);
+        *ticket_len = entry->length;
+        *expiration = entry->expiration;
+        return WA_ERR_NONE;
+    }
+    return wai_error_set(ctx, WA_ERR_NOT_FOUND, "ticket for %s", principal);
+}
+
+
+/*
+ * Add a ticket to the cache, replacing any cached ticket for the same TGT
+ * and principal.
+ */
+int
+webauth_krb5_ticket_cache_add(struct webauth_context *ctx,
+                              struct webauth_krb5_ticket_cache *cache,
+                              const void *tgt, size_t tgt_len,
+                              const char *principal, time_t now,
+                              const void *ticket, size_t ticket_len,
+                              time_t expiration)
+{
+    unsigned char digest[TICKET_DIGEST];
+    struct ticket_entry *entry, *victim;
+    unsigned long index, i;
+    int s;
+
+    if (expiration <= now)
+        return WA_ERR_NONE;
+    s = ticket_hash(ctx, cache, tgt, tgt_len, principal, digest, &index);
+    if (s != WA_ERR_NONE)
+        return s;
+
+    /*
+     * Prefer the slot holding the same key, and otherwise take the slot with
+     * the earliest expiration, which is an empty slot if there is one.
+     */
+    victim = NULL;
+    for (i = 0; i < TICKET_PROBE; i++) {
+        entry = &cache->entries[(index + i) % cache->slots];
+        if (entry->expiration != 0
+            && memcmp(entry->digest, digest, TICKET_DIGEST) == 0) {
+            victim = entry;
+            break;
+        }
+        if (victim == NULL || victim->expiration > entry->expiration)
+            victim = entry;
+    }
+
+    /* Store the ticket, reusing the slot's buffer if it's big enough. */
+    if (victim->size < ticket_len) {
+        victim->ticket = apr_palloc(cache->pool, ticket_len);
+        victim->size = ticket_len;
+    }
+    memcpy(victim->ticket, ticket, ticket_len);
+    memcpy(victim->digest, digest, TICKET_DIGEST);
+    victim->length = ticket_len;
+    victim->expiration = expiration;
+    return WA_ERR_NONE;
+}
@@ -24,7 +24,6 @@
 #include <openssl/err.h>
 #include <openssl/evp.h>
 #include <openssl/hmac.h>
-#include <openssl/rand.h>
 #include <openssl/sha.h>
 #include <time.h>
 
@@ -46,21 +45,45 @@ static unsigned char aes_ivec[AES_BLOCK_SIZE] = {
 
 /*
  * Define some macros for offsets (_O) and sizes (_S) in tokens.  The token
- * form is:
+ * forms are:
  *
  *     {key-hint}{nonce}{hmac}{attr}{padding}
+ *     {0}{version}{key-id}{nonce}{hmac}{attr}{padding}
+ *     {0}{version}{key-id}{iv}{attr}{tag}
  *
- * The SHA digest length for the HMAC comes from OpenSSL.
+ * The first is WA_TOKEN_FORMAT_HINT, in which the hint is the creation time
+ * of the token in network byte order.  The others start with a zero byte,
+ * which a hint would only have for times in the first months of 1970,
+ * followed by a version byte and the key identifier of the encryption key.
+ * Version 1 is WA_TOKEN_FORMAT_KEY_ID, which is encrypted the same way as
+ * the first form.  Version 2 is WA_TOKEN_FORMAT_AEAD, which is encrypted and
+ * authenticated in one pass with AES-GCM.
+ *
+ * In the first two forms, everything after the header is encrypted, so the
+ * offsets are from the end of the header.  The SHA digest length for the
+ * HMAC comes from OpenSSL.
  */
-#define T_HINT_S   4
-#define T_NONCE_S 16
-#define T_HMAC_S  (SHA_DIGEST_LENGTH)
-
-#define T_HINT_O  0
-#define T_NONCE_O (T_HINT_O  + T_HINT_S)
-#define T_HMAC_O  (T_NONCE_O + T_NONCE_S)
-#define T_ATTR_O  (T_HMAC_O  + T_HMAC_S)
+#define T_HINT_S      4
+#define T_VERSION_S   2
+#define T_KEY_ID_S   (T_VERSION_S + WAI_KEY_ID_SIZE)
+#define T_NONCE_S    16
+#define T_HMAC_S     (SHA_DIGEST_LENGTH)
+#define T_IV_S       12
+#define T_TAG_S      16
+
+#define T_NONCE_O  0
+#define T_HMAC_O   (T_NONCE_O + T_NONCE_S)
+#define T_ATTR_O   (T_HMAC_O  + T_HMAC_S)
+
+/* The version bytes of WA_TOKEN_FORMAT_KEY_ID and _AEAD tokens. */
+#define T_VERSION_KEY_ID 1
+#define T_VERSION_AEAD   2
 
+/*
+ * Label for deriving the AES-GCM key from a keyring key, so that the same
+ * key is never used directly with two different ciphers.
+ */
+static const char aead_label[] = "WebAuth AES-GCM token key";
 
 /*
  * Set the internal error for an OpenSSL error.  Takes the WebAuth context to
@@ -94,11 +117,12 @@ openssl_error(struct webauth_context *ctx, int s, const char *format, ...)
 
 
 /*
- * Given the length of the encoded attributes, calculate the encoded binary
- * length.  The length of the padding needed is stored in plen.
+ * Given the length of the encoded attributes and of the token header,
+ * calculate the encoded binary length.  The length of the padding needed is
+ * stored in plen.
  */
 static size_t
-encoded_length(size_t alen, size_t *plen)
+encoded_length(size_t alen, size_t hlen, size_t *plen)
 {
     size_t elen, modulo;
 
@@ -117,13 +141,99 @@ encoded_length(size_t alen, size_t *plen)
         *plen = AES_BLOCK_SIZE;
     elen += *plen;
 
-    /* Add in the hint length. */
-    elen += T_HINT_S;
+    /* Add in the header length. */
+    elen += hlen;
 
     return elen;
 }
 
 
+/*
+ * Derive the AES-GCM key for a keyring key, storing it in subkey, which must
+ * have room for the length of the key.  The derived key is the start of the
+ * SHA-256 digest of a label and the key.  Returns the OpenSSL cipher to use
+ * with the derived key, or NULL if the key isn't a valid AES key size.
+ */
+static const EVP_CIPHER *
+aead_key(const struct webauth_key *key, unsigned char *subkey)
+{
+    unsigned char digest[SHA256_DIGEST_LENGTH];
+    const EVP_CIPHER *cipher;
+    SHA256_CTX sha;
+
+    switch (key->length) {
+    case WA_AES_128: cipher = EVP_aes_128_gcm(); break;
+    case WA_AES_192: cipher = EVP_aes_192_gcm(); break;
+    case WA_AES_256: cipher = EVP_aes_256_gcm(); break;
+    default:         return NULL;
+    }
+    SHA256_Init(&sha);
+    SHA256_Update(&sha, aead_label, sizeof(aead_label) - 1);
+    SHA256_Update(&sha, key->data, key->length);
+    SHA256_Final(digest, &sha);
+    memcpy(subkey, digest, key->length);
+    return cipher;
+}
+
+
+/*
+ * Encrypt a token in the WA_TOKEN_FORMAT_AEAD format, given the key and its
+ * key identifier.  The header is authenticated along with the data, and the
+ * encryption and authentication are done in a single pass with AES-GCM.
+ */
+static int
+encrypt_aead(struct webauth_context *ctx, const void *input, size_t len,
+             void **output, size_t *output_len,
+             const struct webauth_key *key, const unsigned char *id)
+{
+    unsigned char subkey[SHA256_DIGEST_LENGTH];
+    const EVP_CIPHER *cipher;
+    EVP_CIPHER_CTX *cipher_ctx;
+    unsigned char *result, *iv, *data;
+    size_t elen;
+    int n, s;
+    bool okay;
+
+    /* Derive the key for this format. */
+    cipher = aead_key(key, subkey);
+    if (cipher == NULL) {
+        s = WA_ERR_BAD_KEY;
+        return wai_error_set(ctx, s, "invalid key length %d", key->length);
+    }
+
+    /* {0}{version}{key-id}{iv}{attr}{tag} */
+    elen = T_KEY_ID_S + T_IV_S + len + T_TAG_S;
+    result = apr_palloc(ctx->pool, elen);
+    result[0] = 0;
+    result[1] = T_VERSION_AEAD;
+    memcpy(result + T_VERSION_S, id, WAI_KEY_ID_SIZE);
+    iv = result + T_KEY_ID_S;
+    data = iv + T_IV_S;
+    s = wai_random_nonce(ctx, iv, T_IV_S);
+    if (s != WA_ERR_NONE)
+        return s;
+
+    /* Authenticate the header and encrypt the data, adding the tag. */
+    cipher_ctx = EVP_CIPHER_CTX_new();
+    if (cipher_ctx == NULL)
+        return openssl_error(ctx, WA_ERR_NO_MEM, "cannot create cipher");
+    okay = (EVP_EncryptInit_ex(cipher_ctx, cipher, NULL, subkey, iv)
+            && EVP_EncryptUpdate(cipher_ctx, NULL, &n, result, T_KEY_ID_S)
+            && EVP_EncryptUpdate(cipher_ctx, data, &n, input, (int) len)
+            && EVP_EncryptFinal_ex(cipher_ctx, data + n, &n)
+            && EVP_CIPHER_CTX_ctrl(cipher_ctx, EVP_CTRL_GCM_GET_TAG,
+                                   T_TAG_S, data + len));
+    EVP_CIPHER_CTX_free(cipher_ctx);
+    if (!okay)
+        return openssl_error(ctx, WA_ERR_CORRUPT, "cannot encrypt token");
+
+    /* All done.  Return the result. */
+    *output = result;
+    *output_len = elen;
+    return WA_ERR_NONE;
+}
+
+
 /*
  * A wrapper around webauth_token_create_with_key that first finds the best
  * key from the given keyring and then encodes with that key, returning the
@@ -135,9 +245,11 @@ webauth_token_encrypt(struct webauth_context *ctx, const void *input,
                       const struct webauth_keyring *ring)
 {
     const struct webauth_key *key;
-    size_t elen, plen, i;
+    const unsigned char *id = NULL;
+    enum webauth_token_format format;
+    size_t elen, hlen, plen, i;
     int s;
-    unsigned char *result, *p, *hmac;
+    unsigned char *result, *body, *p, *hmac;
     AES_KEY aes_key;
     uint32_t hint;
 
@@ -145,10 +257,22 @@ webauth_token_encrypt(struct webauth_context *ctx, const void *input,
     *output = NULL;
     *output_len = 0;
 
-    /* Find the encryption key to use. */
-    s = webauth_keyring_best_key(ctx, ring, WA_KEY_ENCRYPT, 0, &key);
+    /*
+     * Find the encryption key to use, along with its key identifier if the
+     * keyring's tokens carry one.
+     */
+    format = wai_keyring_format(ring);
+    if (format == WA_TOKEN_FORMAT_HINT) {
+        s = webauth_keyring_best_key(ctx, ring, WA_KEY_ENCRYPT, 0, &key);
+        hlen = T_HINT_S;
+    } else {
+        s = wai_keyring_encrypt_key(ctx, ring, &key, &id);
+        hlen = T_KEY_ID_S;
+    }
     if (s != WA_ERR_NONE)
         return s;
+    if (format == WA_TOKEN_FORMAT_AEAD)
+        return encrypt_aead(ctx, input, len, output, output_len, key, id);
 
     /* Create our encryption key. */
     s = AES_set_encrypt_key(key->data, key->length * 8, &aes_key);
@@ -157,22 +281,27 @@ webauth_token_encrypt(struct webauth_context *ctx, const void *input,
         return openssl_error(ctx, s, "cannot set encryption key");
     }
 
-    /* {key-hint}{nonce}{hmac}{attr}{padding} */
-    elen = encoded_length(len, &plen);
+    /* {header}{nonce}{hmac}{attr}{padding} */
+    elen = encoded_length(len, hlen, &plen);
     result = apr_palloc(ctx->pool, elen);
     p = result;
 
-    /* {key-hint} */
-    hint = htonl(time(NULL));
-    memcpy(p, &hint, T_HINT_S);
-    p += T_HINT_S;
+    /* {key-hint} or {0}{version}{key-id} */
+    if (id == NULL) {
+        hint = htonl(time(NULL));
+        memcpy(p, &hint, T_HINT_S);
+    } else {
+        p[0] = 0;
+        p[1] = T_VERSION_KEY_ID;
+        memcpy(p + T_VERSION_S, id, WAI_KEY_ID_SIZE);
+    }
+    p += hlen;
+    body = p;
 
     /* {nonce} */
-    s = RAND_pseudo_bytes(p, T_NONCE_S);
-    if (s < 0) {
-        s = WA_ERR_RAND_FAILURE;
-        return openssl_error(ctx, s, "cannot generate random nonce");
-    }
+    s = wai_random_nonce(ctx, p, T_NONCE_S);
+    if (s != WA_ERR_NONE)
+        return s;
     p += T_NONCE_S;
 
     /* Leave room for HMAC, which we'll add later. */
@@ -191,17 +320,16 @@ webauth_token_encrypt(struct webauth_context *ctx, const void *input,
      * better than this for the HMAC key.
      */
     hmac = HMAC(EVP_sha1(), key->data, key->length,
-                result + T_ATTR_O, len + plen,         /* data, len */
-                result + T_HMAC_O, NULL);              /* hmac, len */
+                body + T_ATTR_O, len + plen,           /* data, len */
+                body + T_HMAC_O, NULL);                /* hmac, len */
     if (hmac == NULL)
         return openssl_error(ctx, WA_ERR_CORRUPT, "cannot compute HMAC");
 
     /*
-     * Now AES-encrypt in place everything but the time at the front.
+     * Now AES-encrypt in place everything but the header at the front.
      * AES_cbc_encrypt doesn't return anything.
      */
-    AES_cbc_encrypt(result + T_NONCE_O, result + T_NONCE_O, elen - T_HINT_S,
-                    &aes_key, aes_ivec, AES_ENCRYPT);
+    AES_cbc_encrypt(body, body, elen - hlen, &aes_key, aes_ivec, AES_ENCRYPT);
 
     /* All done.  Return the result. */
     *output = result;
@@ -211,27 +339,32 @@ webauth_token_encrypt(struct webauth_context *ctx, const void *input,
 
 
 /*
- * Given a token and its length, decrypt it into the provided output buffer
- * with the length stored in output_len.  The output buffer must be at least
- * as large as the input length.  Uses the provided decryption key.
+ * Given a token encrypted with AES-CBC, its length, and the length of its
+ * header, decrypt it into the provided output buffer with the length stored
+ * in output_len.  The output buffer must be at least as large as the input
+ * length.  Uses the provided decryption key.
  *
  * Returns a WA_ERR code.
  */
 static int
-decrypt_token(struct webauth_context *ctx, const unsigned char *input,
-              size_t length, unsigned char *output, size_t *output_len,
-              const struct webauth_key *key)
+decrypt_cbc(struct webauth_context *ctx, const unsigned char *input,
+            size_t length, size_t hlen, unsigned char *output,
+            size_t *output_len, const struct webauth_key *key)
 {
     unsigned char computed_hmac[T_HMAC_S];
-    size_t needed, plen, i;
+    size_t plen, i;
     int s;
     unsigned char *hmac;
     AES_KEY aes_key;
 
-    /* Basic sanity check. */
-    needed = T_HINT_S + T_NONCE_S + T_HMAC_S;
-    if (length < needed + needed % AES_BLOCK_SIZE)
+    /*
+     * Basic sanity check.  There is always at least one byte of padding, and
+     * the encrypted part must be a whole number of blocks.
+     */
+    if (length < hlen + T_ATTR_O + 1)
         return wai_error_set(ctx, WA_ERR_CORRUPT, "token too short");
+    if ((length - hlen) % AES_BLOCK_SIZE != 0)
+        return wai_error_set(ctx, WA_ERR_CORRUPT, "token length invalid");
 
     /* Create our decryption key. */
     s = AES_set_decrypt_key(key->data, key->length * 8, &aes_key);
@@ -239,15 +372,15 @@ decrypt_token(struct webauth_context *ctx, const unsigned char *input,
         return openssl_error(ctx, WA_ERR_BAD_KEY, "cannot set encryption key");
 
     /*
-     * Decrypt everything except the time at the front.  We intentionally skip
-     * the same number of bytes at the start of the output buffer as we skip
-     * at the start of the input buffer to make the offsets line up and be
-     * less annoying.
+     * Decrypt everything except the header.  The decrypted data goes at the
+     * start of the output buffer, so the offsets in the output buffer are
+     * the offsets from the end of the header.
      *
      * AES_cbc_encrypt doesn't return anything useful.
      */
-    AES_cbc_encrypt(input + T_NONCE_O, output + T_NONCE_O, length - T_HINT_S,
-                    &aes_key, aes_ivec, AES_DECRYPT);
+    length -= hlen;
+    AES_cbc_encrypt(input + hlen, output, length, &aes_key, aes_ivec,
+                    AES_DECRYPT);
 
     /*
      * We now need to compute the HMAC over data and padding to see if
@@ -262,7 +395,7 @@ decrypt_token(struct webauth_context *ctx, const unsigned char *input,
 
     /* Check padding length and data validity. */
     plen = output[length - 1];
-    if (plen > AES_BLOCK_SIZE || plen > length)
+    if (plen > AES_BLOCK_SIZE || plen > length - T_ATTR_O)
         return wai_error_set(ctx, WA_ERR_CORRUPT, "token padding corrupt");
     for (i = length - plen; i < length - 1; i++)
         if (output[i] != plen)
@@ -278,6 +411,78 @@ decrypt_token(struct webauth_context *ctx, const unsigned char *input,
 }
 
 
+/*
+ * Given a WA_TOKEN_FORMAT_AEAD token and its length, decrypt it into the
+ * provided output buffer with the length stored in output_len, with the same
+ * requirements as decrypt_cbc.  A token that fails authentication, including
+ * a modified header, is reported as WA_ERR_BAD_HMAC like a bad HMAC.
+ */
+static int
+decrypt_aead(struct webauth_context *ctx, const unsigned char *input,
+             size_t length, unsigned char *output, size_t *output_len,
+             const struct webauth_key *key)
+{
+    unsigned char subkey[SHA256_DIGEST_LENGTH];
+    const EVP_CIPHER *cipher;
+    EVP_CIPHER_CTX *cipher_ctx;
+    const unsigned char *iv, *data;
+    size_t dlen;
+    int n, s;
+    bool okay, valid;
+
+    /* Basic sanity check.  The data may be empty. */
+    if (length < T_KEY_ID_S + T_IV_S + T_TAG_S)
+        return wai_error_set(ctx, WA_ERR_CORRUPT, "token too short");
+    dlen = length - T_KEY_ID_S - T_IV_S - T_TAG_S;
+    iv = input + T_KEY_ID_S;
+    data = iv + T_IV_S;
+
+    /* Derive the key for this format. */
+    cipher = aead_key(key, subkey);
+    if (cipher == NULL) {
+        s = WA_ERR_BAD_KEY;
+        return wai_error_set(ctx, s, "invalid key length %d", key->length);
+    }
+
+    /*
+     * Authenticate the header and decrypt the data.  The decrypted data is
+     * only valid if the tag then checks out.
+     */
+    cipher_ctx = EVP_CIPHER_CTX_new();
+    if (cipher_ctx == NULL)
+        return openssl_error(ctx, WA_ERR_NO_MEM, "cannot create cipher");
+    okay = (EVP_DecryptInit_ex(cipher_ctx, cipher, NULL, subkey, iv)
+            && EVP_DecryptUpdate(cipher_ctx, NULL, &n, input, T_KEY_ID_S)
+            && EVP_DecryptUpdate(cipher_ctx, output, &n, data, (int) dlen)
+            && EVP_CIPHER_CTX_ctrl(cipher_ctx, EVP_CTRL_GCM_SET_TAG,
+                                   T_TAG_S, (void *) (data + dlen)));
+    valid = okay && EVP_DecryptFinal_ex(cipher_ctx, output + dlen, &n) > 0;
+    EVP_CIPHER_CTX_free(cipher_ctx);
+    if (!okay)
+        return openssl_error(ctx, WA_ERR_CORRUPT, "cannot decrypt token");
+    if (!valid)
+        return wai_error_set(ctx, WA_ERR_BAD_HMAC, NULL);
+    *output_len = dlen;
+    return WA_ERR_NONE;
+}
+
+
+/*
+ * Decrypt a token with the given key, choosing how from the token format.
+ * Takes the same arguments as decrypt_cbc.
+ */
+static int
+decrypt_token(struct webauth_context *ctx, const unsigned char *input,
+              size_t length, size_t hlen, unsigned char *output,
+              size_t *output_len, const struct webauth_key *key)
+{
+    if (hlen == T_KEY_ID_S && input[1] == T_VERSION_AEAD)
+        return decrypt_aead(ctx, input, length, output, output_len, key);
+    else
+        return decrypt_cbc(ctx, input, length, hlen, output, output_len, key);
+}
+
+
 /*
  * Decrypts a token into new pool-allocated memory, given the token as input
  * and its length as input_len, and stores the results in output and
@@ -288,7 +493,7 @@ webauth_token_decrypt(struct webauth_context *ctx, const void *input,
                       size_t input_len, void **output, size_t *output_len,
                       const struct webauth_keyring *ring)
 {
-    size_t dlen, i;
+    size_t dlen, hlen, i;
     int s;
     const struct webauth_key *key;
     const unsigned char *inbuf = input;
@@ -300,26 +505,48 @@ webauth_token_decrypt(struct webauth_context *ctx, const void *input,
     *output_len = 0;
 
     /* Sanity-check our keyring. */
-    if (ring->entries->nelts == 0)
+    if (ring->entries->nelts == 0) {
+        webauth_metrics_count(ctx->metrics, WA_METRIC_DECRYPT_BAD_KEY);
         return wai_error_set(ctx, WA_ERR_BAD_KEY, "empty keyring");
+    }
 
     /*
-     * Create a buffer to hold the decrypted output.  We don't need to include
-     * the hint in this buffer, but keeping the same offsets in the input and
-     * output buffer during decryption makes the code much easier to read.
+     * Create a buffer to hold the decrypted output.  This is a bit larger
+     * than needed since the header isn't decrypted, but it's simpler.
      */
     dlen = input_len;
     outbuf = apr_palloc(ctx->pool, dlen);
 
+    /* Determine the token format from the first byte. */
+    if (input_len > T_KEY_ID_S && inbuf[0] == 0) {
+        if (inbuf[1] != T_VERSION_KEY_ID && inbuf[1] != T_VERSION_AEAD) {
+            s = WA_ERR_CORRUPT;
+            wai_error_set(ctx, s, "unknown token version %d", inbuf[1]);
+            webauth_metrics_count(ctx->metrics, WA_METRIC_DECRYPT_CORRUPT);
+            return s;
+        }
+        hlen = T_KEY_ID_S;
+    } else {
+        hlen = T_HINT_S;
+    }
+
     /*
      * Find the decryption key.  If there's only one entry in the keyring,
-     * this is easy: we use that key.  Otherwise, we try the hinted key.
-     * Failing that, we try all keys.
+     * this is easy: we use that key.  If the token has a key identifier, we
+     * use the key with that identifier and no other.  Otherwise, we try the
+     * hinted key.  Failing that, we try all keys.
      */
     if (ring->entries->nelts == 1) {
         entry = &APR_ARRAY_IDX(ring->entries, 0, struct webauth_keyring_entry);
         key = entry->key;
-        s = decrypt_token(ctx, inbuf, input_len, outbuf, &dlen, key);
+        s = decrypt_token(ctx, inbuf, input_len, hlen, outbuf, &dlen, key);
+    } else if (hlen == T_KEY_ID_S) {
+        s = wai_keyring_find_id(ctx, ring, inbuf + T_VERSION_S, &key);
+        if (s == WA_ERR_NONE)
+            s = decrypt_token(ctx, inbuf, input_len, hlen, outbuf, &dlen,
+                              key);
+        else
+            s = wai_error_set(ctx, WA_ERR_BAD_HMAC, "no key for token");
     } else {
         uint32_t hint_buf;
         time_t h;
@@ -329,7 +556,8 @@ webauth_token_decrypt(struct webauth_context *ctx, const void *input,
         h = ntohl(hint_buf);
         s = webauth_keyring_best_key(ctx, ring, WA_KEY_DECRYPT, h, &key);
         if (s == WA_ERR_NONE)
-            s = decrypt_token(ctx, inbuf, input_len, outbuf, &dlen, key);
+            s = decrypt_token(ctx, inbuf, input_len, hlen, outbuf, &dlen,
+                              key);
         else
             s = WA_ERR_BAD_HMAC;
 
@@ -338,21 +566,36 @@ webauth_token_decrypt(struct webauth_context *ctx, const void *input,
          * keyring in turn.  If the input is dirty, we have to replace the
          * input with our temporary buffer and try again.
          */
-        if (s == WA_ERR_BAD_HMAC)
+        if (s == WA_ERR_BAD_HMAC) {
+            webauth_metrics_count(ctx->metrics, WA_METRIC_KEYRING_HINT_MISS);
             for (i = 0; i < (size_t) ring->entries->nelts; i++) {
                 entry = &APR_ARRAY_IDX(ring->entries, i,
                                        struct webauth_keyring_entry);
                 if (entry->key == key)
                     continue;
-                s = decrypt_token(ctx, inbuf, input_len, outbuf, &dlen,
-                                  entry->key);
+                s = decrypt_token(ctx, inbuf, input_len, hlen, outbuf,
+                                  &dlen, entry->key);
                 if (s != WA_ERR_BAD_HMAC)
                     break;
             }
+        }
     }
-    if (s == WA_ERR_NONE) {
+
+    /* Record the result for the metrics and return it. */
+    switch (s) {
+    case WA_ERR_NONE:
         *output = outbuf;
         *output_len = dlen;
+        break;
+    case WA_ERR_BAD_HMAC:
+        webauth_metrics_count(ctx->metrics, WA_METRIC_DECRYPT_BAD_HMAC);
+        break;
+    case WA_ERR_BAD_KEY:
+        webauth_metrics_count(ctx->metrics, WA_METRIC_DECRYPT_BAD_KEY);
+        break;
+    default:
+        webauth_metrics_count(ctx->metrics, WA_METRIC_DECRYPT_CORRUPT);
+        break;
     }
     return s;
 }
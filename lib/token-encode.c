@@ -147,59 +147,58 @@ webauth_token_type_string(enum webauth_token_type type)
 
 
 /*
- * Map a token type code to the corresponding encoding rule set and data
- * pointer.  Takes the token struct (which must have the type filled out), and
- * stores a pointer to the encoding rules and a pointer to the correct data
- * portion of the token struct in the provided output arguments.  Returns an
- * error code, which will be set to an error if the token type is not
- * recognized.
+ * Map a token type code to the corresponding codec and data pointer.  Takes
+ * the token struct (which must have the type filled out), and stores a
+ * pointer to the codec and a pointer to the correct data portion of the
+ * token struct in the provided output arguments.  Returns an error code,
+ * which will be set to an error if the token type is not recognized.
  */
 int
 wai_token_encoding(struct webauth_context *ctx,
                    const struct webauth_token *token,
-                   const struct wai_encoding **rules, const void **data)
+                   const struct wai_codec **codec, const void **data)
 {
     int s;
 
     switch (token->type) {
     case WA_TOKEN_APP:
-        *rules = wai_token_app_encoding;
+        *codec = &wai_token_app_codec;
         *data = &token->token.app;
         break;
     case WA_TOKEN_CRED:
-        *rules = wai_token_cred_encoding;
+        *codec = &wai_token_cred_codec;
         *data = &token->token.cred;
         break;
     case WA_TOKEN_ERROR:
-        *rules = wai_token_error_encoding;
+        *codec = &wai_token_error_codec;
         *data = &token->token.error;
         break;
     case WA_TOKEN_ID:
-        *rules = wai_token_id_encoding;
+        *codec = &wai_token_id_codec;
         *data = &token->token.id;
         break;
     case WA_TOKEN_LOGIN:
-        *rules = wai_token_login_encoding;
+        *codec = &wai_token_login_codec;
         *data = &token->token.login;
         break;
     case WA_TOKEN_PROXY:
-        *rules = wai_token_proxy_encoding;
+        *codec = &wai_token_proxy_codec;
         *data = &token->token.proxy;
         break;
     case WA_TOKEN_REQUEST:
-        *rules = wai_token_request_encoding;
+        *codec = &wai_token_request_codec;
         *data = &token->token.request;
         break;
     case WA_TOKEN_WEBKDC_FACTOR:
-        *rules = wai_token_webkdc_factor_encoding;
+        *codec = &wai_token_webkdc_factor_codec;
         *data = &token->token.webkdc_factor;
         break;
     case WA_TOKEN_WEBKDC_PROXY:
-        *rules = wai_token_webkdc_proxy_encoding;
+        *codec = &wai_token_webkdc_proxy_codec;
         *data = &token->token.webkdc_proxy;
         break;
     case WA_TOKEN_WEBKDC_SERVICE:
-        *rules = wai_token_webkdc_service_encoding;
+        *codec = &wai_token_webkdc_service_codec;
         *data = &token->token.webkdc_service;
         break;
     case WA_TOKEN_UNKNOWN:
@@ -588,10 +587,12 @@ webauth_token_decode_raw(struct webauth_context *ctx,
     size_t alen;
     const char *type_string = NULL;
     struct webauth_token *out;
+    apr_time_t start;
     int s;
 
     /* Allocate some space to store the decoded token. */
     *decoded = NULL;
+    start = wai_metrics_start(ctx);
     out = apr_palloc(ctx->pool, sizeof(struct webauth_token));
 
     /* Do some initial sanity checking. */
@@ -628,9 +629,12 @@ webauth_token_decode_raw(struct webauth_context *ctx,
 
     /* Success. */
     *decoded = out;
+    webauth_metrics_count(ctx->metrics, WA_METRIC_TOKEN_DECODE);
+    wai_metrics_stop(ctx, WA_TIMER_TOKEN_DECODE, start);
     return WA_ERR_NONE;
 
 fail:
+    webauth_metrics_count(ctx->metrics, WA_METRIC_TOKEN_DECODE_FAIL);
     if (type_string == NULL)
         wai_error_context(ctx, "decoding token");
     else
@@ -680,9 +684,11 @@ webauth_token_encode_raw(struct webauth_context *ctx,
     const char *type;
     void *attrs, *output;
     size_t alen;
+    apr_time_t start;
     int s;
 
     /* Get the token type for error context reporting. */
+    start = wai_metrics_start(ctx);
     type = webauth_token_type_string(data->type);
     if (type == NULL)
         type = "unknown";
@@ -705,6 +711,8 @@ webauth_token_encode_raw(struct webauth_context *ctx,
     if (s != WA_ERR_NONE)
         goto fail;
     *token = output;
+    webauth_metrics_count(ctx->metrics, WA_METRIC_TOKEN_ENCODE);
+    wai_metrics_stop(ctx, WA_TIMER_TOKEN_ENCODE, start);
     return WA_ERR_NONE;
 
 fail:
@@ -287,13 +287,23 @@ xml_parse_document(struct webauth_context *ctx, struct wai_buffer *string,
                    apr_xml_doc **doc)
 {
     apr_xml_parser *parser = NULL;
-    apr_status_t code;
+    struct wai_buffer_chunk *chunk;
+    apr_status_t code = APR_SUCCESS;
     char errbuf[BUFSIZ] = "";
     int s;
 
-    /* Create a parser and feed it the string. */
+    /*
+     * Create a parser and feed it the string.  The string may be a chunked
+     * buffer, in which case each chunk is fed in turn.
+     */
     parser = apr_xml_parser_create(ctx->pool);
-    code = apr_xml_parser_feed(parser, string->data, string->used);
+    for (chunk = string->chunks; chunk != NULL; chunk = chunk->next) {
+        code = apr_xml_parser_feed(parser, chunk->data, chunk->used);
+        if (code != APR_SUCCESS)
+            break;
+    }
+    if (code == APR_SUCCESS)
+        code = apr_xml_parser_feed(parser, string->data, string->used);
     if (code != APR_SUCCESS) {
         apr_xml_parser_geterror(parser, errbuf, sizeof(errbuf));
         s = wai_error_set(ctx, WA_ERR_REMOTE_FAILURE, "XML error: %s", errbuf);
@@ -343,7 +353,7 @@ wai_user_info_xml(struct webauth_context *ctx, const char *user,
     argv[8] = NULL;
 
     /* Make the call. */
-    output = wai_buffer_new(ctx->pool);
+    output = wai_buffer_new_chunked(ctx->pool);
     s = wai_user_remctl(ctx, argv, output);
     if (s != WA_ERR_NONE)
         return s;
@@ -381,7 +391,7 @@ wai_user_validate_xml(struct webauth_context *ctx, const char *user,
     argv[5] = type;
     argv[6] = state;
     argv[7] = NULL;
-    output = wai_buffer_new(ctx->pool);
+    output = wai_buffer_new_chunked(ctx->pool);
     s = wai_user_remctl(ctx, argv, output);
     if (s != WA_ERR_NONE)
         return s;
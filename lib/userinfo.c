@@ -52,6 +52,7 @@ int
 webauth_user_config(struct webauth_context *ctx,
                     const struct webauth_user_config *user)
 {
+    apr_pool_t *pool = ctx->config_pool;
     int s = WA_ERR_NONE;
 
     /* Verify that the new configuration is sane. */
@@ -81,14 +82,14 @@ webauth_user_config(struct webauth_context *ctx,
 #endif
 
     /* Copy the configuration into the context. */
-    ctx->user = apr_pcalloc(ctx->pool, sizeof(struct webauth_user_config));
+    ctx->user = apr_pcalloc(pool, sizeof(struct webauth_user_config));
     ctx->user->protocol       = user->protocol;
-    ctx->user->host           = apr_pstrdup(ctx->pool, user->host);
+    ctx->user->host           = apr_pstrdup(pool, user->host);
     ctx->user->port           = user->port;
-    ctx->user->identity       = pstrdup_null(ctx->pool, user->identity);
-    ctx->user->command        = pstrdup_null(ctx->pool, user->command);
-    ctx->user->keytab         = pstrdup_null(ctx->pool, user->keytab);
-    ctx->user->principal      = pstrdup_null(ctx->pool, user->principal);
+    ctx->user->identity       = pstrdup_null(pool, user->identity);
+    ctx->user->command        = pstrdup_null(pool, user->command);
+    ctx->user->keytab         = pstrdup_null(pool, user->keytab);
+    ctx->user->principal      = pstrdup_null(pool, user->principal);
     ctx->user->timeout        = user->timeout;
     ctx->user->ignore_failure = user->ignore_failure;
     ctx->user->json           = user->json;
@@ -159,6 +160,7 @@ webauth_user_info(struct webauth_context *ctx, const char *user,
                   const char *ip, int random_mf, const char *url,
                   const char *factors, struct webauth_user_info **info)
 {
+    apr_time_t start;
     int s;
 
     /* Ensure the output variable is cleared on error. */
@@ -170,10 +172,15 @@ webauth_user_info(struct webauth_context *ctx, const char *user,
         return s;
 
     /* Call the appropriate implementation for JSON or XML. */
+    start = wai_metrics_start(ctx);
     if (ctx->user->json)
         s = wai_user_info_json(ctx, user, ip, random_mf, url, factors, info);
     else
         s = wai_user_info_xml(ctx, user, ip, random_mf, url, factors, info);
+    wai_metrics_stop(ctx, WA_TIMER_USERINFO, start);
+    webauth_metrics_count(ctx->metrics, WA_METRIC_USERINFO);
+    if (s != WA_ERR_NONE)
+        webauth_metrics_count(ctx->metrics, WA_METRIC_USERINFO_FAIL);
 
     /* Map a timeout to a general failure for userinfo. */
     if (s == WA_ERR_REMOTE_TIMEOUT)
@@ -213,6 +220,7 @@ webauth_user_validate(struct webauth_context *ctx, const char *user,
                       const char *device, const char *state,
                       struct webauth_user_validate **result)
 {
+    apr_time_t start;
     int s;
 
     /* Ensure the output variable is cleared on error. */
@@ -224,11 +232,16 @@ webauth_user_validate(struct webauth_context *ctx, const char *user,
         return s;
 
     /* Call the appropriate implementation for JSON or XML. */
+    start = wai_metrics_start(ctx);
     if (ctx->user->json)
         s = wai_user_validate_json(ctx, user, ip, code, type, device, state,
                                    result);
     else
         s = wai_user_validate_xml(ctx, user, ip, code, type, state, result);
+    wai_metrics_stop(ctx, WA_TIMER_USERINFO, start);
+    webauth_metrics_count(ctx->metrics, WA_METRIC_USERINFO);
+    if (s != WA_ERR_NONE)
+        webauth_metrics_count(ctx->metrics, WA_METRIC_USERINFO_FAIL);
 
     /* Map a timeout to a protocol error for validation. */
     if (s == WA_ERR_REMOTE_TIMEOUT)
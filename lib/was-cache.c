@@ -2,7 +2,7 @@
  * Interface for the WebAuth Application Server token cache.
  *
  * Written by Russ Allbery <eagle@eyrie.org>
- * Copyright 2012
+ * Copyright 2012, 2014
  *     The Board of Trustees of the Leland Stanford Junior University
  *
  * See LICENSE for licensing terms.
@@ -19,37 +19,59 @@
 /*
  * Read a service token and key from the given token cache.  Takes the WebAuth
  * context and the path and stores the result in the provided struct argument.
+ * Caches in either the binary format or the attribute encoding are read.
  */
 int
 webauth_was_token_cache_read(struct webauth_context *ctx, const char *path,
                              struct webauth_was_token_cache *cache)
 {
-    void *data;
+    const void *data;
     size_t length;
     int s;
 
-    s = wai_file_read(ctx, path, &data, &length);
+    s = wai_file_map(ctx, path, &data, &length);
     if (s != WA_ERR_NONE)
         return s;
-    return wai_decode(ctx, wai_was_token_cache_encoding, data, length, cache);
+    if (wai_binary_is(data, length))
+        return wai_binary_decode_was_cache(ctx, data, length, cache);
+    return wai_decode(ctx, &wai_was_token_cache_codec, data, length, cache);
 }
 
 
 /*
- * Write a service token and key to the given token cache.  Takes the WebAuth
- * context, the webauth_was_token_cache struct, and the path.
+ * Write a service token and key to the given token cache in the given
+ * format.  Takes the WebAuth context, the webauth_was_token_cache struct, the
+ * format, and the path.
  */
 int
-webauth_was_token_cache_write(struct webauth_context *ctx,
-                              const struct webauth_was_token_cache *cache,
-                              const char *path)
+webauth_was_token_cache_write_format(struct webauth_context *ctx,
+                                     const struct webauth_was_token_cache *tc,
+                                     enum webauth_file_format format,
+                                     const char *path)
 {
     void *data;
     size_t length;
     int s;
 
-    s = wai_encode(ctx, wai_was_token_cache_encoding, cache, &data, &length);
+    if (format == WA_FILE_FORMAT_BINARY)
+        s = wai_binary_encode_was_cache(ctx, tc, &data, &length);
+    else
+        s = wai_encode(ctx, &wai_was_token_cache_codec, tc, &data, &length);
     if (s != WA_ERR_NONE)
         return s;
     return wai_file_write(ctx, data, length, path);
 }
+
+
+/*
+ * Write a service token and key to the given token cache in the attribute
+ * encoding, which every version of WebAuth can read.
+ */
+int
+webauth_was_token_cache_write(struct webauth_context *ctx,
+                              const struct webauth_was_token_cache *cache,
+                              const char *path)
+{
+    return webauth_was_token_cache_write_format(ctx, cache,
+                                                WA_FILE_FORMAT_ATTR, path);
+}
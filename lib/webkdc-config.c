@@ -31,6 +31,25 @@ pstrdup_null(apr_pool_t *pool, const char *string)
 }
 
 
+/*
+ * Helper function to copy an array of strings into the given pool, including
+ * the strings themselves, so that the configuration doesn't depend on the
+ * lifetime of the caller's memory.
+ */
+static apr_array_header_t *
+copy_strings(apr_pool_t *pool, const apr_array_header_t *array)
+{
+    apr_array_header_t *copy;
+    int i;
+
+    copy = apr_array_make(pool, array->nelts, sizeof(const char *));
+    for (i = 0; i < array->nelts; i++)
+        APR_ARRAY_PUSH(copy, const char *)
+            = apr_pstrdup(pool, APR_ARRAY_IDX(array, i, const char *));
+    return copy;
+}
+
+
 /*
  * Configure the WebKDC services.  Takes the context and the configuration
  * information.  The configuration information is stored in the WebAuth
@@ -43,6 +62,7 @@ webauth_webkdc_config(struct webauth_context *ctx,
                       const struct webauth_webkdc_config *conf)
 {
     struct webauth_webkdc_config *webkdc;
+    apr_pool_t *pool = ctx->config_pool;
 
     /* Verify that the new configuration is sane. */
     if (conf->local_realms == NULL) {
@@ -55,16 +75,15 @@ webauth_webkdc_config(struct webauth_context *ctx,
     }
 
     /* Copy the configuration into the context. */
-    webkdc = apr_pcalloc(ctx->pool, sizeof(struct webauth_webkdc_config));
-    webkdc->keytab_path      = pstrdup_null(ctx->pool, conf->keytab_path);
-    webkdc->id_acl_path      = pstrdup_null(ctx->pool, conf->id_acl_path);
-    webkdc->principal        = pstrdup_null(ctx->pool, conf->principal);
+    webkdc = apr_pcalloc(pool, sizeof(struct webauth_webkdc_config));
+    webkdc->keytab_path      = pstrdup_null(pool, conf->keytab_path);
+    webkdc->id_acl_path      = pstrdup_null(pool, conf->id_acl_path);
+    webkdc->principal        = pstrdup_null(pool, conf->principal);
     webkdc->proxy_lifetime   = conf->proxy_lifetime;
     webkdc->login_time_limit = conf->login_time_limit;
-    webkdc->fast_armor_path  = pstrdup_null(ctx->pool, conf->fast_armor_path);
-    webkdc->local_realms     = apr_array_copy(ctx->pool, conf->local_realms);
-    webkdc->permitted_realms
-        = apr_array_copy(ctx->pool, conf->permitted_realms);
+    webkdc->fast_armor_path  = pstrdup_null(pool, conf->fast_armor_path);
+    webkdc->local_realms     = copy_strings(pool, conf->local_realms);
+    webkdc->permitted_realms = copy_strings(pool, conf->permitted_realms);
     ctx->webkdc = webkdc;
 
     /* FIXME: Add more error checking for consistency of configuration. */
@@ -6,8 +6,8 @@
  *
  * Originally written by Roland Schemers
  * Substantially updated by Russ Allbery <eagle@eyrie.org>
- * Copyright 2002, 2003, 2004, 2005, 2006, 2008, 2009, 2010, 2011, 2012, 2013
- *     The Board of Trustees of the Leland Stanford Junior University
+ * Copyright 2002, 2003, 2004, 2005, 2006, 2008, 2009, 2010, 2011, 2012, 2013,
+ *     2014 The Board of Trustees of the Leland Stanford Junior University
  *
  * See LICENSE for licensing terms.
  */
@@ -25,6 +25,11 @@
 #include <webauth/tokens.h>
 #include <webauth/webkdc.h>
 
+/* Log keys for the time spent in each phase of a login. */
+static const char * const phase_keys[WAI_PHASE_MAX] = {
+    "tparse", "tauth", "tmerge", "tuserinfo", "tauthz", "tencode"
+};
+
 
 /*
  * Given a message, scan it for whitespace or double quotes.  If there are
@@ -195,11 +200,22 @@ wai_webkdc_log_login(struct webauth_context *ctx,
             wai_buffer_append_sprintf(message, " loa=%lu", wpt->loa);
     }
 
-    /* Finally, log the error code and error message. */
+    /* Log the error code and error message. */
     wai_buffer_append_sprintf(message, " lec=%d", result);
     if (error != NULL)
         log_attribute(message, "lem", error);
 
+    /*
+     * Finally, log the time in microseconds spent in each phase of the login
+     * that was reached and the total time.
+     */
+    for (i = 0; i < WAI_PHASE_MAX; i++)
+        if (state->timing_phases & (1U << i))
+            wai_buffer_append_sprintf(message, " %s=%lu", phase_keys[i],
+                                      (unsigned long) state->timing[i]);
+    wai_buffer_append_sprintf(message, " ttotal=%lu",
+                              (unsigned long) state->timing_total);
+
     /* Actually log the message. */
     wai_log_notice(ctx, "%s", message->data);
 }
@@ -1664,6 +1664,44 @@ encode_response(struct webauth_context *ctx,
 }
 
 
+/*
+ * Record the end of a phase of the login.  Adds the time since the mark to
+ * that phase and moves the mark to the current time so that it starts the
+ * next phase.
+ */
+static void
+end_phase(struct wai_webkdc_login_state *state, enum wai_login_phase phase,
+          apr_time_t *mark)
+{
+    apr_time_t now;
+
+    now = apr_time_now();
+    state->timing[phase] += now - *mark;
+    state->timing_phases |= 1U << phase;
+    *mark = now;
+}
+
+
+/*
+ * Record the timing of each phase of the login that was reached in the
+ * histograms of the context metrics.
+ */
+static void
+record_phases(struct webauth_context *ctx,
+              const struct wai_webkdc_login_state *state)
+{
+    int phase;
+
+    if (ctx->metrics == NULL)
+        return;
+    for (phase = 0; phase < WAI_PHASE_MAX; phase++)
+        if (state->timing_phases & (1U << phase))
+            webauth_metrics_observe(ctx->metrics,
+                                    WA_TIMER_LOGIN_PARSE + phase,
+                                    (unsigned long) state->timing[phase]);
+}
+
+
 /*
  * Given the data from a <requestTokenRequest> login attempt, process that
  * attempted login and return the information for a <requestTokenResponse> in
@@ -1679,14 +1717,18 @@ webauth_webkdc_login(struct webauth_context *ctx,
     struct wai_webkdc_login_state state;
     struct webauth_user_info *info = NULL;
     const char *subject;
+    apr_time_t start, mark;
     int s, result;
 
     /* Set up our data structures. */
+    start = apr_time_now();
+    mark = start;
     *response = apr_pcalloc(ctx->pool, sizeof(**response));
     memset(&state, 0, sizeof(state));
 
     /* Parse the request into our login state.  This does token decryption. */
     s = parse_request(ctx, request, &state, ring);
+    end_phase(&state, WAI_PHASE_PARSE, &mark);
     if (s != WA_ERR_NONE)
         goto done;
 
@@ -1696,6 +1738,7 @@ webauth_webkdc_login(struct webauth_context *ctx,
      * also set the did_login state.
      */
     s = do_logins(ctx, &state);
+    end_phase(&state, WAI_PHASE_AUTHENTICATE, &mark);
     if (s != WA_ERR_NONE)
         goto done;
 
@@ -1711,6 +1754,7 @@ webauth_webkdc_login(struct webauth_context *ctx,
      * service call may change the factors.
      */
     s = merge_webkdc_proxies(ctx, &state);
+    end_phase(&state, WAI_PHASE_MERGE, &mark);
     if (s != WA_ERR_NONE)
         goto done;
 
@@ -1745,15 +1789,18 @@ webauth_webkdc_login(struct webauth_context *ctx,
         s = merge_webkdc_factors(ctx, &state, &state.wkproxy);
     else {
         s = add_user_info(ctx, &state, &info);
+        end_phase(&state, WAI_PHASE_USERINFO, &mark);
         if (s != WA_ERR_NONE)
             goto done;
         s = merge_webkdc_factors(ctx, &state, NULL);
     }
+    end_phase(&state, WAI_PHASE_MERGE, &mark);
     if (s != WA_ERR_NONE)
         goto done;
 
     /* Encode the webkdc-proxy token in the response and set the subject. */
     s = encode_webkdc_proxy(ctx, state.wkproxy, *response, ring);
+    end_phase(&state, WAI_PHASE_ENCODE, &mark);
     if (s != WA_ERR_NONE)
         goto done;
 
@@ -1768,11 +1815,13 @@ webauth_webkdc_login(struct webauth_context *ctx,
      * credentials.
      */
     s = check_factors_proxy(ctx, &state, info);
+    end_phase(&state, WAI_PHASE_AUTHZ, &mark);
     if (s != WA_ERR_NONE)
         goto done;
 
     /* Check for forced authentication. */
     s = check_forced_auth(ctx, &state);
+    end_phase(&state, WAI_PHASE_AUTHZ, &mark);
     if (s != WA_ERR_NONE)
         goto done;
 
@@ -1783,6 +1832,7 @@ webauth_webkdc_login(struct webauth_context *ctx,
      */
     subject = state.wkproxy->token.webkdc_proxy.subject;
     s = check_authz_identity(ctx, &state, subject);
+    end_phase(&state, WAI_PHASE_AUTHZ, &mark);
     if (s != WA_ERR_NONE)
         goto done;
 
@@ -1791,6 +1841,7 @@ webauth_webkdc_login(struct webauth_context *ctx,
      * know about the user.  Attempt to satisfy their request.
      */
     s = encode_result_token(ctx, &state, *response, ring);
+    end_phase(&state, WAI_PHASE_ENCODE, &mark);
     if (s != WA_ERR_NONE)
         goto done;
 
@@ -1798,6 +1849,7 @@ done:
     /* Always encode the response, but save any earlier error. */
     result = s;
     s = encode_response(ctx, &state, *response, ring);
+    end_phase(&state, WAI_PHASE_ENCODE, &mark);
     if (s != WA_ERR_NONE)
         result = s;
 
@@ -1815,7 +1867,12 @@ done:
         }
     }
 
-    /* Log the result and return. */
+    /* Log the result, record the timing, and return. */
+    state.timing_total = apr_time_now() - start;
     wai_webkdc_log_login(ctx, &state, result, *response);
+    webauth_metrics_count(ctx->metrics, WA_METRIC_WEBKDC_LOGIN);
+    webauth_metrics_observe(ctx->metrics, WA_TIMER_WEBKDC_LOGIN,
+                            (unsigned long) state.timing_total);
+    record_phases(ctx, &state);
     return result;
 }
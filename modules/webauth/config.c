@@ -79,6 +79,7 @@ DIRD(SSLRedirectPort,    "SSL port for SSL redirects", int, 443)
 DIRN(SSLReturn,          "whether to force the return URL to be https")
 DIRD(StripURL,           "whether to strip tokens in internal URL", bool, true)
 DIRD(SubjectAuthType,    "requested subject authenticator", char *, "webkdc")
+DIRN(TokenFormat,        "encrypted token format: hint, keyid, or aead")
 DIRD(TokenMaxTTL,        "maximum lifetime of recent tokens", int, 300)
 DIRN(TrustAuthzIdentity, "whether to trust asserted authorization identities")
 DIRN(WebKdcPrincipal,    "WebKDC Kerberos principal name")
@@ -146,6 +147,7 @@ enum {
     E_ServiceTokenCache,
     E_StripURL,
     E_SubjectAuthType,
+    E_TokenFormat,
     E_TokenMaxTTL,
     E_TrustAuthzIdentity,
     E_UseCreds,
@@ -267,6 +269,7 @@ mwa_server_config_merge(apr_pool_t *pool, void *basev, void *overv)
     MERGE_PTR(st_cache_path);
     MERGE_SET(strip_url);
     MERGE_SET(subject_auth_type);
+    MERGE_SET(token_format);
     MERGE_SET(trust_authz_identity);
     MERGE_SET(webkdc_cert_check);
     MERGE_PTR(webkdc_cert_file);
@@ -415,6 +418,27 @@ parse_interval(cmd_parms *cmd, const char *arg, unsigned long *value)
 }
 
 
+/*
+ * Utility function for parsing a token format.  Returns an error string or
+ * NULL on success.
+ */
+static const char *
+parse_token_format(cmd_parms *cmd, const char *arg,
+                   enum webauth_token_format *value)
+{
+    if (strcmp(arg, "hint") == 0)
+        *value = WA_TOKEN_FORMAT_HINT;
+    else if (strcmp(arg, "keyid") == 0)
+        *value = WA_TOKEN_FORMAT_KEY_ID;
+    else if (strcmp(arg, "aead") == 0)
+        *value = WA_TOKEN_FORMAT_AEAD;
+    else
+        return apr_psprintf(cmd->pool, "Invalid token format \"%s\" for %s",
+                            arg, cmd->directive->directive);
+    return NULL;
+}
+
+
 /*
  * Utility function for parsing a number.  Returns an error string or NULL
  * on success.
@@ -508,6 +532,11 @@ cfg_str(cmd_parms *cmd, void *mconf, const char *arg)
             err = apr_psprintf(cmd->pool, "Invalid value %s for directive %s",
                                arg, cmd->directive->directive);
         break;
+    case E_TokenFormat:
+        err = parse_token_format(cmd, arg, &sconf->token_format);
+        if (err == NULL)
+            sconf->token_format_set = true;
+        break;
     case E_TokenMaxTTL:
         err = parse_interval(cmd, arg, &sconf->token_max_ttl);
         if (err == NULL)
@@ -785,6 +814,7 @@ const command_rec webauth_cmds[] = {
     DIRECTIVE(AP_INIT_TAKE1,   cfg_str,   RSRC_CONF,   SSLRedirectPort),
     DIRECTIVE(AP_INIT_FLAG,    cfg_flag,  RSRC_CONF,   StripURL),
     DIRECTIVE(AP_INIT_TAKE1,   cfg_str,   RSRC_CONF,   SubjectAuthType),
+    DIRECTIVE(AP_INIT_TAKE1,   cfg_str,   RSRC_CONF,   TokenFormat),
     DIRECTIVE(AP_INIT_TAKE1,   cfg_str,   RSRC_CONF,   TokenMaxTTL),
     DIRECTIVE(AP_INIT_TAKE1,   cfg_str,   RSRC_CONF,   WebKdcPrincipal),
     DIRECTIVE(AP_INIT_FLAG,    cfg_flag,  RSRC_CONF,   WebKdcSSLCertCheck),
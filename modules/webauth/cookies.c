@@ -0,0 +1,132 @@
+/*
+ * Cookie header parsing for the Apache WebAuth module.
+ *
+ * The Cookie header is tokenized once per request into a table of the
+ * webauth_* cookies, which is then used for every cookie lookup.  Browsers
+ * may send several kilobytes of unrelated cookies, so this avoids scanning
+ * the whole header again for each of the app, proxy, and cred cookies.
+ *
+ * Copyright 2014
+ *     The Board of Trustees of the Leland Stanford Junior University
+ *
+ * See LICENSE for licensing terms.
+ */
+
+#include <config-mod.h>
+#include <portable/apr.h>
+
+#include <apr_hash.h>
+#include <string.h>
+
+#include <modules/webauth/cookies.h>
+
+/* The prefix of the names of the cookies we keep. */
+#define COOKIE_PREFIX     "webauth_"
+#define COOKIE_PREFIX_LEN (sizeof(COOKIE_PREFIX) - 1)
+
+/*
+ * A cookie value, which points into the parsed header.  The hash keys are
+ * the cookie names, which also point into the header and are not
+ * nul-terminated, so the hash is always used with explicit key lengths.
+ */
+struct cookie_value {
+    const char *data;
+    size_t length;
+};
+
+
+/*
+ * Parse a Cookie header.  Cookies are separated by semicolons and optional
+ * whitespace, and the value runs to the next semicolon, less any trailing
+ * whitespace.  Quotes around a value are kept as part of it.  Rather than
+ * tokenizing every cookie, search for the prefix and skip matches that are
+ * not at the start of a cookie name, so that the bulk of the header is only
+ * examined by strstr.  Each part of the header is still looked at once.
+ * Nothing is copied from the header until it's asked for.
+ */
+MWA_COOKIES *
+mwa_cookies_parse(apr_pool_t *pool, const char *header)
+{
+    MWA_COOKIES *cookies;
+    const char *p, *start, *name, *end, *value;
+    struct cookie_value *data;
+    apr_ssize_t length;
+
+    cookies = apr_pcalloc(pool, sizeof(MWA_COOKIES));
+    if (header == NULL)
+        return cookies;
+    p = header;
+    while ((name = strstr(p, COOKIE_PREFIX)) != NULL) {
+        end = strchr(name + COOKIE_PREFIX_LEN, ';');
+        if (end == NULL)
+            end = name + strlen(name);
+        p = end;
+
+        /* Skip matches inside some other cookie's name or value. */
+        for (start = name; start > header; start--)
+            if (start[-1] != ' ' && start[-1] != '\t')
+                break;
+        if (start > header && start[-1] != ';')
+            continue;
+        value = memchr(name, '=', end - name);
+        if (value == NULL)
+            continue;
+        length = value - name;
+        value++;
+
+        /* Only keep the first value of each cookie. */
+        if (cookies->values == NULL)
+            cookies->values = apr_hash_make(pool);
+        else if (apr_hash_get(cookies->values, name, length) != NULL)
+            continue;
+        while (end > value && (end[-1] == ' ' || end[-1] == '\t'))
+            end--;
+        data = apr_palloc(pool, sizeof(struct cookie_value));
+        data->data = value;
+        data->length = end - value;
+        apr_hash_set(cookies->values, name, length, data);
+    }
+    return cookies;
+}
+
+
+/*
+ * Look up the value of a cookie and return a copy of it.
+ */
+char *
+mwa_cookies_get(apr_pool_t *pool, const MWA_COOKIES *cookies,
+                const char *name)
+{
+    struct cookie_value *value;
+
+    if (cookies->values == NULL)
+        return NULL;
+    value = apr_hash_get(cookies->values, name, APR_HASH_KEY_STRING);
+    if (value == NULL)
+        return NULL;
+    return apr_pstrmemdup(pool, value->data, value->length);
+}
+
+
+/*
+ * Return copies of the names of all of the cookies.
+ */
+apr_array_header_t *
+mwa_cookies_names(apr_pool_t *pool, const MWA_COOKIES *cookies)
+{
+    apr_array_header_t *names;
+    apr_hash_index_t *hi;
+    const void *key;
+    apr_ssize_t length;
+
+    if (cookies->values == NULL)
+        return NULL;
+    names = apr_array_make(pool, apr_hash_count(cookies->values),
+                           sizeof(char *));
+    for (hi = apr_hash_first(pool, cookies->values); hi != NULL;
+         hi = apr_hash_next(hi)) {
+        apr_hash_this(hi, &key, &length, NULL);
+        APR_ARRAY_PUSH(names, char *) = apr_pstrmemdup(pool, key, length);
+    }
+    return names;
+}
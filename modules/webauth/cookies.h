@@ -0,0 +1,54 @@
+/*
+ * Cookie header parsing for the Apache WebAuth module.
+ *
+ * This is kept separate from mod_webauth.h and uses only APR so that it can
+ * be built into the benchmarks without the Apache headers.
+ *
+ * Copyright 2014
+ *     The Board of Trustees of the Leland Stanford Junior University
+ *
+ * See LICENSE for licensing terms.
+ */
+
+#ifndef MODULES_WEBAUTH_COOKIES_H
+#define MODULES_WEBAUTH_COOKIES_H 1
+
+#include <apr_hash.h>           /* apr_hash_t */
+#include <apr_pools.h>          /* apr_pool_t */
+#include <apr_tables.h>         /* apr_array_header_t */
+
+/*
+ * The webauth_* cookies from a Cookie header.  Other cookies are skipped
+ * when parsing, since mod_webauth never looks at them.  The table is NULL
+ * if the header had no webauth_* cookies.
+ */
+typedef struct {
+    apr_hash_t *values;         /* cookie name to value in header */
+} MWA_COOKIES;
+
+/*
+ * Parse a Cookie header, which may be NULL, in a single pass.  If a cookie
+ * appears more than once, the first value wins.  Cookies without an equal
+ * sign are ignored, whitespace after a value is dropped, and quotes around a
+ * value are kept.  The result is allocated from the given pool and refers to
+ * the header, so it is only valid while the header is unchanged.
+ */
+MWA_COOKIES *
+mwa_cookies_parse(apr_pool_t *pool, const char *header);
+
+/*
+ * Return a copy, allocated from the given pool, of the value of a webauth_*
+ * cookie, or NULL if it wasn't set.
+ */
+char *
+mwa_cookies_get(apr_pool_t *pool, const MWA_COOKIES *cookies,
+                const char *name);
+
+/*
+ * Return an array of copies, allocated from the given pool, of the names of
+ * all of the webauth_* cookies, or NULL if there were none.
+ */
+apr_array_header_t *
+mwa_cookies_names(apr_pool_t *pool, const MWA_COOKIES *cookies);
+
+#endif /* !MODULES_WEBAUTH_COOKIES_H */
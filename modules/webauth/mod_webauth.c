@@ -13,6 +13,7 @@
 #include <portable/apr.h>
 #include <portable/stdbool.h>
 
+#include <apr_shm.h>
 #include <unistd.h>
 
 #include <modules/webauth/mod_webauth.h>
@@ -20,6 +21,7 @@
 #include <webauth/basic.h>
 #include <webauth/factors.h>
 #include <webauth/keys.h>
+#include <webauth/metrics.h>
 #include <webauth/tokens.h>
 
 APLOG_USE_MODULE(webauth);
@@ -29,6 +31,44 @@ APLOG_USE_MODULE(webauth);
 #endif
 
 
+/*
+ * Return the request context of the top-level request, which holds the
+ * state shared with its subrequests and internal redirects.  Falls back on
+ * the current context if the top-level request has none.
+ */
+static MWA_REQ_CTXT *
+top_context(MWA_REQ_CTXT *rc)
+{
+    request_rec *top;
+    MWA_REQ_CTXT *trc;
+
+    top = mwa_get_top(rc->r);
+    if (top == rc->r)
+        return rc;
+    trc = ap_get_module_config(top->request_config, &webauth_module);
+    return (trc == NULL) ? rc : trc;
+}
+
+
+/*
+ * Return the webauth_* cookies sent with the request, parsing the Cookie
+ * header the first time they're needed.  They are kept with the top-level
+ * request, since its subrequests and internal redirects see the same header.
+ */
+static MWA_COOKIES *
+get_cookies(MWA_REQ_CTXT *rc)
+{
+    MWA_REQ_CTXT *trc = top_context(rc);
+    const char *header;
+
+    if (trc->cookies == NULL) {
+        header = apr_table_get(rc->r->headers_in, "Cookie");
+        trc->cookies = mwa_cookies_parse(trc->r->pool, header);
+    }
+    return trc->cookies;
+}
+
+
 /*
  * Called at any entry point where we may be doing WebAuth operations that
  * need a keyring.  Do lazy initialization of the in-memory keyring from the
@@ -139,9 +179,10 @@ strip_webauth_info(MWA_REQ_CTXT *rc)
     if (c != NULL)
         strip_end(c, WEBAUTHR_MAGIC);
 
+    if (get_cookies(rc)->values == NULL)
+        return;
     c = (char*) apr_table_get(rc->r->headers_in, "Cookie");
-
-    if (c == NULL || (ap_strstr(c, "webauth_") == NULL))
+    if (c == NULL)
         return;
 
     if (rc->sconf->debug)
@@ -171,6 +212,9 @@ strip_webauth_info(MWA_REQ_CTXT *rc)
     /* null-terminate */
     *d = '\0';
 
+    /* The parsed cookies refer to the header and no longer apply. */
+    top_context(rc)->cookies = NULL;
+
     if (*c == '\0') {
         apr_table_unset(rc->r->headers_in, "Cookie");
         if (rc->sconf->debug)
@@ -186,42 +230,13 @@ strip_webauth_info(MWA_REQ_CTXT *rc)
 
 
 /*
- * find a cookie in the Cookie header and return its value, otherwise
- * return NULL.
+ * find a cookie in the Cookie header and return a copy of its value that
+ * the caller may modify, otherwise return NULL.
  */
 static char *
 find_cookie(MWA_REQ_CTXT *rc, const char *name)
 {
-    const char *c;
-    char *cs, *ce, *cval;
-    int len;
-
-    c = apr_table_get(rc->r->headers_in, "Cookie");
-    if (c == NULL)
-        return NULL;
-
-    len = strlen(name);
-
-    while ((cs = ap_strstr(c, name))) {
-        if (cs[len] == '=') {
-            cs += len+1;
-            break;
-        }
-        c += len;
-    }
-
-    if (cs == NULL)
-        return NULL;
-
-    ce = ap_strchr(cs, ';');
-
-    if (ce == NULL) {
-        cval = apr_pstrdup(rc->r->pool, cs);
-    } else {
-        cval = apr_pstrmemdup(rc->r->pool, cs, ce-cs);
-    }
-
-    return cval;
+    return mwa_cookies_get(rc->r->pool, get_cookies(rc), name);
 }
 
 
@@ -350,26 +365,21 @@ nuke_all_webauth_cookies(MWA_REQ_CTXT *rc)
 {
     int i;
     apr_array_header_t *cookies;
+    const char *cookie;
 
-    cookies = mwa_get_webauth_cookies(rc->r);
+    cookies = mwa_cookies_names(rc->r->pool, get_cookies(rc));
     if (cookies == NULL)
         return;
     for (i = 0; i < cookies->nelts; i++) {
-        char *cookie, *val;
-
         /*
          * Nuke all WebAuth cookies except for the ones used by WebLogin.  The
          * latter may appear if the same virtual host is used as both a
          * WebAuth Application Server and a WebLogin server.
          */
-        cookie = APR_ARRAY_IDX(cookies, i, char *);
-        val = ap_strchr(cookie, '=');
-        if (val != NULL) {
-            *val++ = '\0';
-            if (strncmp(cookie, "webauth_wpt", 11) != 0
-                && strncmp(cookie, "webauth_wft", 11) != 0) {
-                nuke_cookie(rc, cookie, 1);
-            }
+        cookie = APR_ARRAY_IDX(cookies, i, const char *);
+        if (strncmp(cookie, "webauth_wpt", 11) != 0
+            && strncmp(cookie, "webauth_wft", 11) != 0) {
+            nuke_cookie(rc, cookie, 0);
         }
     }
 }
@@ -482,6 +492,45 @@ mod_webauth_cleanup(void *data)
 }
 
 
+/*
+ * Create the runtime metrics in anonymous shared memory so that they are
+ * inherited by and shared among all of the children, and attach them to the
+ * WebAuth context of each virtual host.  The shared memory is allocated from
+ * the configuration pool, so the metrics start over when the server is
+ * restarted.  Failure only disables metrics.
+ */
+static void
+metrics_init(server_rec *s, apr_pool_t *pconf)
+{
+    struct server_config *sconf;
+    struct webauth_metrics *metrics;
+    apr_shm_t *shm;
+    apr_status_t code;
+    server_rec *scheck;
+    int status;
+
+    sconf = ap_get_module_config(s->module_config, &webauth_module);
+    code = apr_shm_create(&shm, webauth_metrics_size(), NULL, pconf);
+    if (code != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, code, s,
+                     "mod_webauth: cannot create shared memory for metrics");
+        return;
+    }
+    status = webauth_metrics_init(sconf->ctx, apr_shm_baseaddr_get(shm),
+                                  apr_shm_size_get(shm), &metrics);
+    if (status != WA_ERR_NONE) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, 0, s,
+                     "mod_webauth: cannot initialize metrics: %s",
+                     webauth_error_message(sconf->ctx, status));
+        return;
+    }
+    for (scheck = s; scheck != NULL; scheck = scheck->next) {
+        sconf = ap_get_module_config(scheck->module_config, &webauth_module);
+        webauth_metrics_set(sconf->ctx, metrics);
+    }
+}
+
+
 /*
  * called after config has been loaded in parent process
  */
@@ -508,6 +557,7 @@ mod_webauth_init(apr_pool_t *pconf, apr_pool_t *plog UNUSED,
     for (scheck=s; scheck; scheck=scheck->next) {
         mwa_config_init(scheck, sconf, pconf);
     }
+    metrics_init(s, pconf);
 
     ap_add_version_component(pconf, "WebAuth/" VERSION);
 
@@ -622,6 +672,42 @@ dd_dir_time(const char *n, time_t t, request_rec *r)
 }
 
 
+/*
+ * The content handler for the webauth-metrics handler, which returns the
+ * runtime metrics in the Prometheus text format.
+ */
+static int
+metrics_handler(request_rec *r)
+{
+    struct server_config *sconf;
+    struct webauth_metrics *metrics;
+    struct webauth_context *ctx;
+    char *output;
+    int status;
+
+    r->allowed |= (AP_METHOD_BIT << M_GET);
+    if (r->method_number != M_GET)
+        return DECLINED;
+    sconf = ap_get_module_config(r->server->module_config, &webauth_module);
+    metrics = webauth_metrics_get(sconf->ctx);
+    if (metrics == NULL)
+        return HTTP_NOT_FOUND;
+    status = webauth_context_init_apr(&ctx, r->pool);
+    if (status == WA_ERR_NONE)
+        status = webauth_metrics_format(ctx, metrics, &output);
+    if (status != WA_ERR_NONE) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, 0, r->server,
+                     "mod_webauth: cannot format metrics: %s",
+                     webauth_error_message(NULL, status));
+        return HTTP_INTERNAL_SERVER_ERROR;
+    }
+    ap_set_content_type(r, "text/plain; version=0.0.4");
+    apr_table_setn(r->headers_out, "Cache-Control", "no-cache");
+    ap_rputs(output, r);
+    return OK;
+}
+
+
 /* The content handler */
 static int
 handler_hook(request_rec *r)
@@ -631,6 +717,8 @@ handler_hook(request_rec *r)
     MWA_SERVICE_TOKEN *st;
     apr_int32_t flags;
 
+    if (strcmp(r->handler, "webauth-metrics") == 0)
+        return metrics_handler(r);
     if (strcmp(r->handler, "webauth")) {
         return DECLINED;
     }
@@ -708,6 +796,12 @@ handler_hook(request_rec *r)
         dd_dir_str("WebAuthSSLRedirectPort",
                    apr_psprintf(r->pool, "%lu", sconf->ssl_redirect_port), r);
     }
+    if (sconf->token_format == WA_TOKEN_FORMAT_KEY_ID)
+        dd_dir_str("WebAuthTokenFormat", "keyid", r);
+    else if (sconf->token_format == WA_TOKEN_FORMAT_AEAD)
+        dd_dir_str("WebAuthTokenFormat", "aead", r);
+    else
+        dd_dir_str("WebAuthTokenFormat", "hint", r);
     dd_dir_str("WebAuthTokenMaxTTL",
                apr_psprintf(r->pool, "%lus", sconf->token_max_ttl), r);
     dd_dir_str("WebAuthWebKdcPrincipal", sconf->webkdc_principal, r);
@@ -1015,6 +1109,70 @@ app_token_maint(MWA_REQ_CTXT *rc)
 }
 
 
+/*
+ * Marker stored in the token cache for tokens that could not be decoded, so
+ * that subrequests don't try (and log the failure) again.
+ */
+static char invalid_token;
+
+
+/*
+ * Build the key for an encoded token in the token cache.  The key includes
+ * the token type, since the same encoded string could be presented in cookies
+ * for different token types and each must be decoded (and its type checked)
+ * separately.
+ */
+static const char *
+cache_token_key(apr_pool_t *pool, enum webauth_token_type type,
+                const char *encoded)
+{
+    return apr_pstrcat(pool, webauth_token_type_string(type), ":", encoded,
+                       NULL);
+}
+
+
+/*
+ * Look up an encoded token of the given type in the cache of tokens decoded
+ * while handling the top-level request.  Returns the decoded token data,
+ * &invalid_token if the token couldn't be decoded, or NULL if the token
+ * hasn't been seen.
+ */
+static void *
+cache_get_token(MWA_REQ_CTXT *rc, enum webauth_token_type type,
+                const char *encoded)
+{
+    MWA_REQ_CTXT *trc = top_context(rc);
+    const char *key;
+
+    if (trc->tokens == NULL)
+        return NULL;
+    key = cache_token_key(rc->r->pool, type, encoded);
+    return apr_hash_get(trc->tokens, key, APR_HASH_KEY_STRING);
+}
+
+
+/*
+ * Store the result of decoding a token of the given type in the cache of the
+ * top-level request.  Pass NULL as the data to record that the token is
+ * invalid.  The data must be allocated from the shared WebAuth context so
+ * that it lives as long as the top-level request.
+ */
+static void
+cache_set_token(MWA_REQ_CTXT *rc, enum webauth_token_type type,
+                const char *encoded, void *data)
+{
+    MWA_REQ_CTXT *trc = top_context(rc);
+    apr_pool_t *pool = trc->r->pool;
+
+    if (trc->tokens == NULL)
+        trc->tokens = apr_hash_make(pool);
+    if (data == NULL)
+        data = &invalid_token;
+    apr_hash_set(trc->tokens, cache_token_key(pool, type, encoded),
+                 APR_HASH_KEY_STRING, data);
+}
+
+
 /*
  * parse an app-token, store in rc->at.
  * return 0 on failure, 1 on success
@@ -1025,23 +1183,33 @@ parse_app_token(char *token, MWA_REQ_CTXT *rc)
     const char *mwa_func = "parse_app_token";
     int status;
     struct webauth_token *app;
+    struct webauth_token_app *at;
 
     if (!ensure_keyring_loaded(rc))
         return 0;
     ap_unescape_url(token);
-    status = webauth_token_decode(rc->ctx, WA_TOKEN_APP, token,
-                                  rc->sconf->ring, &app);
-    if (status == WA_ERR_TOKEN_EXPIRED) {
-        ap_log_error(APLOG_MARK, APLOG_INFO, 0, rc->r->server,
-                     "mod_webauth: user credentials (from %s cookie) have"
-                     " expired", app_cookie_name());
-        return 0;
-    } else if (status != WA_ERR_NONE) {
-        mwa_log_webauth_error(rc, status, mwa_func, "webauth_token_decode",
-                              NULL);
+    at = cache_get_token(rc, WA_TOKEN_APP, token);
+    if (at == (void *) &invalid_token)
         return 0;
+    if (at == NULL) {
+        status = webauth_token_decode(rc->ctx, WA_TOKEN_APP, token,
+                                      rc->sconf->ring, &app);
+        if (status == WA_ERR_TOKEN_EXPIRED) {
+            ap_log_error(APLOG_MARK, APLOG_INFO, 0, rc->r->server,
+                         "mod_webauth: user credentials (from %s cookie) have"
+                         " expired", app_cookie_name());
+            cache_set_token(rc, WA_TOKEN_APP, token, NULL);
+            return 0;
+        } else if (status != WA_ERR_NONE) {
+            mwa_log_webauth_error(rc, status, mwa_func,
+                                  "webauth_token_decode", NULL);
+            cache_set_token(rc, WA_TOKEN_APP, token, NULL);
+            return 0;
+        }
+        at = &app->token.app;
+        cache_set_token(rc, WA_TOKEN_APP, token, at);
     }
-    rc->at = &app->token.app;
+    rc->at = at;
 
     /*
      * Update last-use-time and check inactivity.  If we can't use the app
@@ -1092,18 +1260,26 @@ parse_proxy_token(char *token, MWA_REQ_CTXT *rc)
 {
     const char *mwa_func = "parse_proxy_token";
     struct webauth_token *pt;
+    struct webauth_token_proxy *proxy;
     int status;
 
     if (!ensure_keyring_loaded(rc))
         return 0;
     ap_unescape_url(token);
+    proxy = cache_get_token(rc, WA_TOKEN_PROXY, token);
+    if (proxy == (void *) &invalid_token)
+        return NULL;
+    else if (proxy != NULL)
+        return proxy;
     status = webauth_token_decode(rc->ctx, WA_TOKEN_PROXY, token,
                                   rc->sconf->ring, &pt);
     if (status != WA_ERR_NONE) {
         mwa_log_webauth_error(rc, status, mwa_func, "webauth_token_decode",
                               NULL);
+        cache_set_token(rc, WA_TOKEN_PROXY, token, NULL);
         return NULL;
     }
+    cache_set_token(rc, WA_TOKEN_PROXY, token, &pt->token.proxy);
     return &pt->token.proxy;
 }
 
@@ -1382,6 +1558,8 @@ check_url(MWA_REQ_CTXT *rc, int *in_url)
     const char *note;
     char *wr, *ws;
     struct webauth_key *key = NULL;
+    MWA_REQ_CTXT *trc;
+    int status = OK;
 
     note = mwa_get_note(rc->r, N_WEBAUTHR);
     if (note == NULL) {
@@ -1390,6 +1568,17 @@ check_url(MWA_REQ_CTXT *rc, int *in_url)
     } else {
         *in_url = 1;
     }
+
+    /*
+     * The returned token is only handled once per client request.  Later
+     * subrequests and internal redirects reuse the result.
+     */
+    trc = top_context(rc);
+    if (trc->url_checked) {
+        rc->at = trc->url_at;
+        rc->pt = trc->url_pt;
+        return OK;
+    }
     wr = apr_pstrdup(rc->r->pool, note);
 
     if (rc->sconf->debug)
@@ -1403,17 +1592,21 @@ check_url(MWA_REQ_CTXT *rc, int *in_url)
 
         /* don't have to free key, its allocated from a pool */
         key = get_session_key(ws, rc);
-        if (key == NULL)
-            return OK;
-        return parse_returned_token(wr, key, rc);
+        if (key != NULL)
+            status = parse_returned_token(wr, key, rc);
     } else {
         MWA_SERVICE_TOKEN *st;
 
         st = mwa_get_service_token(rc->r->server, rc->sconf, rc->r->pool, 0);
         if (st != NULL)
-            return parse_returned_token(wr, &st->key, rc);
+            status = parse_returned_token(wr, &st->key, rc);
     }
-    return OK;
+    if (status == OK) {
+        trc->url_checked = true;
+        trc->url_at = rc->at;
+        trc->url_pt = rc->pt;
+    }
+    return status;
 }
 
 
@@ -1668,7 +1861,7 @@ ssl_redirect(MWA_REQ_CTXT *rc)
 static struct webauth_token_cred *
 parse_cred_token_cookie(MWA_REQ_CTXT *rc, MWA_WACRED *cred)
 {
-    char *cval;
+    char *cval, *encoded;
     char *cname = cred_cookie_name(cred->type, cred->service, rc);
     struct webauth_token_cred *ct;
     const char *mwa_func = "parse_cred_token_cookie";
@@ -1680,7 +1873,18 @@ parse_cred_token_cookie(MWA_REQ_CTXT *rc, MWA_WACRED *cred)
     if (cval == NULL)
         return 0;
 
-    ct =  mwa_parse_cred_token(cval, rc->sconf->ring, NULL, rc);
+    /*
+     * mwa_parse_cred_token unescapes the token in place, so cache it under
+     * a copy of the cookie value.
+     */
+    ct = cache_get_token(rc, WA_TOKEN_CRED, cval);
+    if (ct == (void *) &invalid_token)
+        ct = NULL;
+    else if (ct == NULL) {
+        encoded = apr_pstrdup(rc->r->pool, cval);
+        ct = mwa_parse_cred_token(cval, rc->sconf->ring, NULL, rc);
+        cache_set_token(rc, WA_TOKEN_CRED, encoded, ct);
+    }
 
     if (ct == NULL) {
         /* we coudn't use the cookie, lets set it up to be nuked */
@@ -1738,38 +1942,62 @@ prepare_creds(MWA_REQ_CTXT *rc, char *proxy_type, apr_array_header_t *creds)
 
 
 /*
- * acquire all the creds of the specified proxy_type. this
- * means making requests to the webkdc. If we don't have
- * the specified proxy_type, we'll need to do a redirect to
- * get it.
+ * acquire all the needed creds. this means making requests to the
+ * webkdc, one per proxy type, which are all sent in parallel. If we
+ * don't have one of the needed proxy types, we'll need to do a redirect
+ * to get it.
  */
 static int
-acquire_creds(MWA_REQ_CTXT *rc, char *proxy_type,
+acquire_creds(MWA_REQ_CTXT *rc, apr_array_header_t *needed_proxy_types,
               apr_array_header_t *needed_creds,
               apr_array_header_t **acquired_creds)
 {
     const char *mwa_func = "acquire_creds";
-    struct webauth_token_proxy *pt = NULL;
+    struct webauth_token_proxy *pt;
+    apr_array_header_t *requests;
+    MWA_CRED_REQUEST *request;
+    MWA_WACRED *cred, *ncred;
+    char *proxy_type;
+    int i, j;
+
+    requests = apr_array_make(rc->r->pool, needed_proxy_types->nelts,
+                              sizeof(MWA_CRED_REQUEST));
+    for (i = 0; i < needed_proxy_types->nelts; i++) {
+        proxy_type = APR_ARRAY_IDX(needed_proxy_types, i, char *);
+        if (rc->sconf->debug) {
+            ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, rc->r->server,
+                         "mod_webauth: %s: need this proxy type: (%s)",
+                         mwa_func, proxy_type);
+        }
 
-    if (rc->sconf->debug) {
-        ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, rc->r->server,
-                     "mod_webauth: %s: need this proxy type: (%s)",
-                     mwa_func, proxy_type);
-    }
+        if (rc->pt && strcmp(rc->pt->type, proxy_type) == 0) {
+            pt = rc->pt;
+        } else {
+            pt = parse_proxy_token_cookie(rc, proxy_type);
+        }
 
-    if (rc->pt && strcmp(rc->pt->type, proxy_type) == 0) {
-        pt = rc->pt;
-    } else {
-        pt = parse_proxy_token_cookie(rc, proxy_type);
-    }
+        /* if we don't have the proxy type then redirect! */
+        if (pt == NULL) {
+            rc->needed_proxy_type = proxy_type;
+            return redirect_request_token(rc);
+        }
 
-    /* if we don't have the proxy type then redirect! */
-    if (pt == NULL) {
-        rc->needed_proxy_type = proxy_type;
-        return redirect_request_token(rc);
+        /* request only the creds that this proxy type can provide */
+        request = apr_array_push(requests);
+        request->pt = pt;
+        request->needed_creds
+            = apr_array_make(rc->r->pool, needed_creds->nelts,
+                             sizeof(MWA_WACRED));
+        for (j = 0; j < needed_creds->nelts; j++) {
+            cred = &APR_ARRAY_IDX(needed_creds, j, MWA_WACRED);
+            if (strcmp(cred->type, proxy_type) != 0)
+                continue;
+            ncred = apr_array_push(request->needed_creds);
+            *ncred = *cred;
+        }
     }
 
-    if (!mwa_get_creds_from_webkdc(rc, pt, needed_creds, acquired_creds)) {
+    if (!mwa_get_creds_from_webkdc(rc, requests, acquired_creds)) {
 
         /* FIXME: what do we want to do here? mwa_get_creds_from_webkdc
            will log any errors. We could either cause a failure_redirect
@@ -1783,17 +2011,17 @@ acquire_creds(MWA_REQ_CTXT *rc, char *proxy_type,
                          "mod_webauth: %s: mwa_get_creds_from_webkdc failed!",
                          mwa_func);
         }
-    } else {
-        /* need to construct new cookies for newly gathered creds */
-        if (*acquired_creds != NULL) {
-            struct webauth_token_cred *cred;
-            size_t i;
-
-            for (i = 0; i < (size_t) (*acquired_creds)->nelts; i++) {
-                cred = APR_ARRAY_IDX(*acquired_creds, i,
-                                     struct webauth_token_cred *);
-                make_cred_cookie(cred, rc);
-            }
+    }
+
+    /* need to construct new cookies for newly gathered creds */
+    if (*acquired_creds != NULL) {
+        struct webauth_token_cred *cred_token;
+        size_t k;
+
+        for (k = 0; k < (size_t) (*acquired_creds)->nelts; k++) {
+            cred_token = APR_ARRAY_IDX(*acquired_creds, k,
+                                       struct webauth_token_cred *);
+            make_cred_cookie(cred_token, rc);
         }
     }
 
@@ -1856,15 +2084,10 @@ gather_creds(MWA_REQ_CTXT *rc)
     /* now, for each proxy type that has needed credentials,
        try and acquire them from the webkdc. */
     if (needed_proxy_types != NULL) {
-        char *proxy;
-
-        /* foreach proxy type, attempt to acquire the needed creds */
-        for (i = 0; i < needed_proxy_types->nelts; i++) {
-            proxy = APR_ARRAY_IDX(needed_proxy_types, i, char *);
-            code = acquire_creds(rc, proxy, needed_creds, &acquired_creds);
-            if (code != OK)
-                return code;
-        }
+        code = acquire_creds(rc, needed_proxy_types, needed_creds,
+                             &acquired_creds);
+        if (code != OK)
+            return code;
     }
 
     if (gathered_creds != NULL || acquired_creds != NULL) {
@@ -2032,7 +2255,7 @@ gather_tokens(MWA_REQ_CTXT *rc)
 static int
 mod_webauth_check_access(request_rec *r)
 {
-    MWA_REQ_CTXT *rc;
+    MWA_REQ_CTXT *rc, *trc;
     const char *subject = NULL, *authz;
     int status;
 
@@ -2043,13 +2266,24 @@ mod_webauth_check_access(request_rec *r)
     if (!is_supported_authtype(r, rc))
         return DECLINED;
 
-    status = webauth_context_init_apr(&rc->ctx, rc->r->pool);
-    if (status != WA_ERR_NONE) {
-        ap_log_error(APLOG_MARK, APLOG_CRIT, 0, r->server,
-                     "mod_webauth: webauth_context_init failed: %s",
-                     webauth_error_message(NULL, status));
-        return DECLINED;
+    /*
+     * Use the WebAuth context of the top-level request, creating it if
+     * needed, so that tokens decoded while handling that request remain
+     * valid for its subrequests and internal redirects.
+     */
+    trc = top_context(rc);
+    if (trc->shared_ctx == NULL) {
+        status = webauth_context_init_apr(&trc->shared_ctx, trc->r->pool);
+        if (status != WA_ERR_NONE) {
+            ap_log_error(APLOG_MARK, APLOG_CRIT, 0, r->server,
+                         "mod_webauth: webauth_context_init failed: %s",
+                         webauth_error_message(NULL, status));
+            return DECLINED;
+        }
+        webauth_metrics_set(trc->shared_ctx,
+                            webauth_metrics_get(rc->sconf->ctx));
     }
+    rc->ctx = trc->shared_ctx;
 
     /* If we can't load the keyring, return a fatal error. */
     if (!ensure_keyring_loaded(rc))
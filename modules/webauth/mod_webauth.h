@@ -14,11 +14,13 @@
 #include <config-mod.h>
 #include <portable/stdbool.h>
 
+#include <apr_hash.h>           /* apr_hash_t */
 #include <apr_pools.h>          /* apr_pool_t */
 #include <apr_tables.h>         /* apr_array_header_t */
 #include <httpd.h>              /* server_rec and request_rec */
 #include <sys/types.h>          /* size_t, etc. */
 
+#include <modules/webauth/cookies.h>
 #include <webauth/keys.h>
 #include <webauth/tokens.h>
 
@@ -98,6 +100,7 @@ struct server_config {
     unsigned long ssl_redirect_port;
     bool strip_url;
     const char *subject_auth_type;
+    enum webauth_token_format token_format;
     unsigned long token_max_ttl;
     bool trust_authz_identity;
     bool webkdc_cert_check;
@@ -116,6 +119,7 @@ struct server_config {
     bool ssl_redirect_port_set;
     bool strip_url_set;
     bool subject_auth_type_set;
+    bool token_format_set;
     bool token_max_ttl_set;
     bool trust_authz_identity_set;
     bool webkdc_cert_check_set;
@@ -179,6 +183,12 @@ typedef struct {
     char *service;
 } MWA_WACRED;
 
+/* the creds of one proxy type to request from the WebKDC */
+typedef struct {
+    struct webauth_token_proxy *pt;   /* proxy token to request them with */
+    apr_array_header_t *needed_creds; /* Array of MWA_WACRED */
+} MWA_CRED_REQUEST;
+
 /* handy bunch of bits to pass around during a request */
 typedef struct {
     request_rec *r;
@@ -189,15 +199,20 @@ typedef struct {
     char *needed_proxy_type; /* set if we are redirecting for a proxy-token */
     struct webauth_token_proxy *pt; /* proxy-token that came from URL */
     apr_array_header_t *cred_tokens; /* cred token(s) */
-} MWA_REQ_CTXT;
 
-/* used to append a bunch of data together */
-typedef struct {
-    char *data;
-    size_t size;
-    size_t capacity;
-    apr_pool_t *pool;
-} MWA_STRING;
+    /*
+     * Only used in the context of the top-level request.  Subrequests and
+     * internal redirects get their own context but share the WebAuth context
+     * and the decoded tokens of the top-level request, so that each token is
+     * only decoded once per client request.
+     */
+    struct webauth_context *shared_ctx;
+    MWA_COOKIES *cookies;            /* webauth_* cookies sent by client */
+    apr_hash_t *tokens;              /* decoded tokens by encoded form */
+    bool url_checked;                /* WEBAUTHR already handled */
+    struct webauth_token_app *url_at;   /* app-token from WEBAUTHR */
+    struct webauth_token_proxy *url_pt; /* proxy-token from WEBAUTHR */
+} MWA_REQ_CTXT;
 
 /* structure that defines the proxy/credential interface */
 typedef struct {
@@ -245,14 +260,24 @@ mwa_get_service_token(server_rec *server,
                       int local_cache_only);
 
 
+/*
+ * Request creds from the WebKDC.  requests is an array of MWA_CRED_REQUEST,
+ * all of which are sent to the WebKDC in parallel.
+ */
 int
 mwa_get_creds_from_webkdc(MWA_REQ_CTXT *rc,
-                          struct webauth_token_proxy *pt,
-                          apr_array_header_t *needed_creds,
+                          apr_array_header_t *requests,
                           apr_array_header_t **acquired_creds);
 
 /* util.c */
 
+/*
+ * get the top-level request, following both subrequests and internal
+ * redirects
+ */
+request_rec *
+mwa_get_top(request_rec *r);
+
 /*
  * get note from main request
  */
@@ -299,12 +324,6 @@ mwa_log_webauth_error(MWA_REQ_CTXT *rc, int status, const char *mwa_func,
 int
 mwa_cache_keyring(server_rec *serv, struct server_config *sconf);
 
-/*
- * get all cookies that start with webauth_
- */
-apr_array_header_t *
-mwa_get_webauth_cookies(request_rec *r);
-
 /*
  * parse a cred token. If key is non-null use it, otherwise
  * if ring is non-null use it, otherwise log an error and return NULL.
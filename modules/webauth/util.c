@@ -2,8 +2,8 @@
  * Utility functions for the WebAuth Apache module.
  *
  * Written by Roland Schemers
- * Copyright 2002, 2003, 2006, 2008, 2009, 2010, 2011, 2012, 2013
- *     The Board of Trustees of the Leland Stanford Junior University
+ * Copyright 2002, 2003, 2006, 2008, 2009, 2010, 2011, 2012, 2013,
+ *     2014 The Board of Trustees of the Leland Stanford Junior University
  *
  * See LICENSE for licensing terms.
  */
@@ -20,8 +20,12 @@
 APLOG_USE_MODULE(webauth);
 
 
-static request_rec *
-get_top(request_rec *r)
+/*
+ * get the top-level request, following both subrequests and internal
+ * redirects
+ */
+request_rec *
+mwa_get_top(request_rec *r)
 {
     request_rec *mr = r;
     for (;;) {
@@ -42,7 +46,7 @@ get_top(request_rec *r)
 const char *
 mwa_get_note(request_rec *r, const char *note)
 {
-    request_rec *top = get_top(r);
+    request_rec *top = mwa_get_top(r);
     return apr_table_get(top->notes, note);
 }
 
@@ -55,7 +59,7 @@ char *
 mwa_remove_note(request_rec *r, const char *note)
 {
     const char *val;
-    request_rec *top = get_top(r);
+    request_rec *top = mwa_get_top(r);
 
     val = apr_table_get(top->notes, note);
 
@@ -83,7 +87,7 @@ mwa_setn_note(request_rec *r,
     const char *note;
     char *val;
     va_list ap;
-    request_rec *top = get_top(r);
+    request_rec *top = mwa_get_top(r);
 
     note = name ? apr_pstrcat(top->pool, prefix, name, NULL) : prefix;
 
@@ -176,6 +180,8 @@ mwa_cache_keyring(server_rec *serv, struct server_config *sconf)
                      "mod_webauth: opening keyring %s failed: %s",
                      sconf->keyring_path,
                      webauth_error_message(sconf->ctx, status));
+    else
+        webauth_keyring_set_format(sconf->ring, sconf->token_format);
     if (kau_status == WA_KAU_UPDATE && update_status != WA_ERR_NONE)
         ap_log_error(APLOG_MARK, APLOG_ERR, 0, serv,
                      "mod_webauth: updating keyring %s failed: %s",
@@ -201,41 +207,6 @@ mwa_cache_keyring(server_rec *serv, struct server_config *sconf)
 }
 
 
-apr_array_header_t *
-mwa_get_webauth_cookies(request_rec *r)
-{
-    char *c;
-    const char *cookie;
-    char *last, *val;
-    apr_array_header_t *a;
-    char **p;
-
-    cookie = apr_table_get(r->headers_in, "Cookie");
-    if (cookie == NULL || ap_strstr(cookie, "webauth_") == NULL)
-        return NULL;
-    c = apr_pstrdup(r->pool, cookie);
-
-    last = NULL;
-    a = NULL;
-    val = apr_strtok(c, ";\0", &last);
-
-    while(val) {
-        while (*val && *val==' ') {
-            val++;
-        }
-        if (strncmp(val, "webauth_", 8) == 0) {
-            if (a == NULL) {
-                a = apr_array_make(r->pool, 5, sizeof(char *));
-            }
-            p = apr_array_push(a);
-            *p = val;
-        }
-        val = apr_strtok(NULL, ";\0", &last);
-    }
-    return a;
-}
-
-
 /*
  * parse a cred-token. return pointer to it on success, NULL on failure.
  */
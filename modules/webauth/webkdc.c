@@ -19,7 +19,9 @@
 
 #include <modules/webauth/mod_webauth.h>
 #include <webauth/basic.h>
+#include <webauth/buffer.h>
 #include <webauth/keys.h>
+#include <webauth/metrics.h>
 #include <webauth/tokens.h>
 #include <webauth/was.h>
 
@@ -170,90 +172,75 @@ write_service_token_cache(server_rec *server, struct server_config *sconf,
 }
 
 
-#define CHUNK_SIZE 4096
-
 /*
- *
+ * A response from the WebKDC, which is parsed as it arrives so that the
+ * whole body never has to be held in memory as one string.  The body is
+ * only kept if debugging, so that it can be logged.
  */
-static void init_string(MWA_STRING *string, apr_pool_t *pool)
-{
-    memset(string, 0, sizeof(MWA_STRING));
-    string->pool = pool;
-}
+struct webkdc_response {
+    apr_xml_parser *parser;
+    apr_status_t status;            /* First error from the parser */
+    size_t length;                  /* Length of the body so far */
+    struct webauth_buffer *body;    /* Raw body, or NULL if not debugging */
+};
 
 
 /*
- * given an MWA_STRING, append some new data to it.
+ * Create the state for parsing a response from the WebKDC.  Returns NULL
+ * after logging an error if the XML parser couldn't be created.
  */
-static void
-append_string(MWA_STRING *string, const char *in_data, size_t in_size)
+static struct webkdc_response *
+new_webkdc_response(server_rec *server, struct server_config *sconf,
+                    apr_pool_t *pool)
 {
-    size_t needed_size;
-
-    if (in_size == 0)
-        in_size = strlen(in_data);
-
-    needed_size = string->size + in_size;
+    struct webkdc_response *response;
 
-    if (string->data == NULL || needed_size > string->capacity) {
-        char *new_data;
-        while (string->capacity < needed_size+1)
-            string->capacity += CHUNK_SIZE;
-
-        new_data = apr_palloc(string->pool, string->capacity);
-
-        if (string->data != NULL) {
-            memcpy(new_data, string->data, string->size);
-        }
-        /* don't have to free existing data since it from a pool */
-        string->data = new_data;
+    response = apr_pcalloc(pool, sizeof(struct webkdc_response));
+    response->parser = apr_xml_parser_create(pool);
+    if (response->parser == NULL) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, 0, server,
+                     "mod_webauth: apr_xml_parser_create failed");
+        return NULL;
     }
-    memcpy(string->data+string->size, in_data, in_size);
-    string->size = needed_size;
-    /* always null-terminate, we have space becase of the +1 above */
-    string->data[string->size] = '\0';
+    response->status = APR_SUCCESS;
+    if (sconf->debug)
+        response->body = webauth_buffer_new(pool);
+    return response;
 }
 
 
 /*
- * gather up the POST data as it comes back from webkdc
+ * gather up the POST data as it comes back from webkdc, feeding it to the
+ * XML parser.  After a parse error, the rest of the data is ignored.
  */
 static size_t
-post_gather(char *in_data, size_t size, size_t nmemb, void *string)
+post_gather(char *in_data, size_t size, size_t nmemb, void *data)
 {
+    struct webkdc_response *response = data;
     size_t real_size = size * nmemb;
 
-    append_string(string, in_data, real_size);
+    response->length += real_size;
+    if (response->body != NULL)
+        webauth_buffer_append(response->body, in_data, real_size);
+    if (response->status == APR_SUCCESS)
+        response->status = apr_xml_parser_feed(response->parser, in_data,
+                                               real_size);
     return real_size;
 }
 
 
 /*
- * post some xml to the webkdc and return response
- *
- * FIXME: need to think about retry/timeout policy
+ * Set up a cURL handle to post some XML to the WebKDC.  The response will be
+ * parsed into response, and any cURL error message is put into error_buff,
+ * which must remain valid until the transfer is finished.  Returns the list
+ * of custom headers, which the caller must free after the transfer.
  */
-static char *
-post_to_webkdc(char *post_data, size_t post_data_len,
-               server_rec *server, struct server_config *sconf,
-               apr_pool_t *pool)
+static struct curl_slist *
+setup_webkdc_post(CURL *curl, const char *post_data, size_t post_data_len,
+                  struct webkdc_response *response, char *error_buff,
+                  server_rec *server, struct server_config *sconf)
 {
-    CURL *curl;
-    CURLcode code;
-    char curl_error_buff[CURL_ERROR_SIZE+1];
     struct curl_slist *headers = NULL;
-    MWA_STRING string;
-
-    if (post_data_len == 0)
-        post_data_len = strlen(post_data);
-
-    curl = curl_easy_init();
-
-    if (curl == NULL) {
-        ap_log_error(APLOG_MARK, APLOG_ERR, 0, server,
-                     "mod_webauth: post_to_webkdc: curl_easy_init failed");
-        return NULL;
-    }
 
     curl_easy_setopt(curl, CURLOPT_URL, sconf->webkdc_url);
     curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 1);
@@ -263,7 +250,7 @@ post_to_webkdc(char *post_data, size_t post_data_len,
     curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 15);
     curl_easy_setopt(curl, CURLOPT_TIMEOUT, 45);
 #endif
-    curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, curl_error_buff);
+    curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, error_buff);
 
     if (sconf->webkdc_cert_file) {
         curl_easy_setopt(curl, CURLOPT_CAINFO, sconf->webkdc_cert_file);
@@ -278,10 +265,7 @@ post_to_webkdc(char *post_data, size_t post_data_len,
     }
 
     curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, post_gather);
-
-    /* don't pre-allocate in case our write function never gets called */
-    init_string(&string, pool);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &string);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, response);
     headers = curl_slist_append(headers, "Content-Type: text/xml");
 
     /* data to post */
@@ -293,8 +277,71 @@ post_to_webkdc(char *post_data, size_t post_data_len,
     /* pass our list of custom made headers */
     curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
 
-    curl_error_buff[0] = '\0';
+    error_buff[0] = '\0';
+    return headers;
+}
+
+
+/*
+ * Record a completed post to the WebKDC in the metrics for the server, using
+ * cURL's own timing for the transfer so that parallel posts are each timed
+ * correctly.
+ */
+static void
+record_webkdc_post(struct server_config *sconf, CURL *curl, CURLcode code)
+{
+    struct webauth_metrics *metrics;
+    double elapsed = 0;
+
+    metrics = webauth_metrics_get(sconf->ctx);
+    if (metrics == NULL)
+        return;
+    webauth_metrics_count(metrics, WA_METRIC_WEBKDC_REQUEST);
+    if (code != CURLE_OK)
+        webauth_metrics_count(metrics, WA_METRIC_WEBKDC_REQUEST_FAIL);
+    curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME, &elapsed);
+    webauth_metrics_observe(metrics, WA_TIMER_WEBKDC_REQUEST,
+                            (unsigned long) (elapsed * 1000000));
+}
+
+
+/*
+ * post some xml to the webkdc and return the partly parsed response, or NULL
+ * if the post failed or the response was empty
+ *
+ * FIXME: need to think about retry/timeout policy
+ */
+static struct webkdc_response *
+post_to_webkdc(char *post_data, size_t post_data_len,
+               server_rec *server, struct server_config *sconf,
+               apr_pool_t *pool)
+{
+    CURL *curl;
+    CURLcode code;
+    char curl_error_buff[CURL_ERROR_SIZE+1];
+    struct curl_slist *headers;
+    struct webkdc_response *response;
+
+    if (post_data_len == 0)
+        post_data_len = strlen(post_data);
+
+    response = new_webkdc_response(server, sconf, pool);
+    if (response == NULL)
+        return NULL;
+
+    curl = curl_easy_init();
+
+    if (curl == NULL) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, 0, server,
+                     "mod_webauth: post_to_webkdc: curl_easy_init failed");
+        return NULL;
+    }
+
+    headers = setup_webkdc_post(curl, post_data, post_data_len, response,
+                                curl_error_buff, server, sconf);
+
     code = curl_easy_perform(curl); /* post away! */
+    record_webkdc_post(sconf, curl, code);
 
     curl_slist_free_all(headers); /* free the header list */
 
@@ -302,14 +349,192 @@ post_to_webkdc(char *post_data, size_t post_data_len,
         ap_log_error(APLOG_MARK, APLOG_ERR, 0, server,
                      "mod_webauth: curl_easy_perform: error(%d): %s",
                      code, curl_error_buff);
+        curl_easy_cleanup(curl);
         return NULL;
     }
-    /* null-terminate return data */
-    if (string.data) {
-        string.data[string.size] = '\0';
-    }
     curl_easy_cleanup(curl);
-    return string.data;
+    if (response->length == 0)
+        return NULL;
+    return response;
+}
+
+
+/*
+ * State for one of several posts to the WebKDC made in parallel.
+ */
+struct webkdc_post {
+    CURL *curl;
+    struct curl_slist *headers;
+    char error_buff[CURL_ERROR_SIZE + 1];
+    struct webkdc_response *response;
+    CURLcode code;
+};
+
+
+/*
+ * Wait until there is activity on one of the connections managed by the
+ * given cURL multi handle or until cURL wants to be called for a timeout.
+ * curl_multi_wait uses poll, so this works for any descriptor number, unlike
+ * select with an fd_set.
+ */
+static void
+wait_for_webkdc(CURLM *multi)
+{
+    long timeout = -1;
+    int numfds = 0;
+    apr_time_t start;
+
+    curl_multi_timeout(multi, &timeout);
+    if (timeout == 0)
+        return;
+    if (timeout < 0 || timeout > 1000)
+        timeout = 1000;
+    start = apr_time_now();
+    if (curl_multi_wait(multi, NULL, 0, (int) timeout, &numfds) != CURLM_OK)
+        return;
+
+    /*
+     * If cURL has no file descriptors for us yet (such as during name
+     * resolution), curl_multi_wait returns immediately, so sleep briefly and
+     * let it try again.
+     */
+    if (numfds == 0 && apr_time_now() - start < 1000) {
+        if (timeout > 100)
+            timeout = 100;
+        apr_sleep(timeout * 1000);
+    }
+}
+
+
+/*
+ * Post several XML documents to the WebKDC at the same time and return an
+ * array of the partly parsed responses in the same order.  An element of the
+ * returned array will be NULL if that post failed.  A single post is done
+ * directly without setting up a multi handle.
+ */
+static struct webkdc_response **
+post_all_to_webkdc(char **post_data, size_t count, server_rec *server,
+                   struct server_config *sconf, apr_pool_t *pool)
+{
+    CURLM *multi;
+    CURLMcode mcode;
+    CURLMsg *msg;
+    struct webkdc_post *posts;
+    struct webkdc_response **responses;
+    size_t i;
+    int running, left;
+
+    responses = apr_pcalloc(pool, count * sizeof(struct webkdc_response *));
+    if (count == 1) {
+        responses[0] = post_to_webkdc(post_data[0], 0, server, sconf, pool);
+        return responses;
+    }
+    multi = curl_multi_init();
+    if (multi == NULL) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, 0, server,
+                     "mod_webauth: post_all_to_webkdc: curl_multi_init"
+                     " failed");
+        return responses;
+    }
+
+    /* Set up an easy handle for each post and add it to the multi handle. */
+    posts = apr_pcalloc(pool, count * sizeof(struct webkdc_post));
+    for (i = 0; i < count; i++) {
+        posts[i].code = CURLE_FAILED_INIT;
+        posts[i].response = new_webkdc_response(server, sconf, pool);
+        if (posts[i].response == NULL)
+            continue;
+        posts[i].curl = curl_easy_init();
+        if (posts[i].curl == NULL) {
+            ap_log_error(APLOG_MARK, APLOG_ERR, 0, server,
+                         "mod_webauth: post_all_to_webkdc: curl_easy_init"
+                         " failed");
+            continue;
+        }
+        posts[i].headers
+            = setup_webkdc_post(posts[i].curl, post_data[i],
+                                strlen(post_data[i]), posts[i].response,
+                                posts[i].error_buff, server, sconf);
+        curl_multi_add_handle(multi, posts[i].curl);
+    }
+
+    /* Run all of the transfers until they're complete. */
+    do {
+        mcode = curl_multi_perform(multi, &running);
+        if (mcode != CURLM_OK && mcode != CURLM_CALL_MULTI_PERFORM) {
+            ap_log_error(APLOG_MARK, APLOG_ERR, 0, server,
+                         "mod_webauth: curl_multi_perform: error(%d): %s",
+                         mcode, curl_multi_strerror(mcode));
+            break;
+        }
+        if (running > 0)
+            wait_for_webkdc(multi);
+    } while (running > 0);
+
+    /* Collect the result of each transfer. */
+    while ((msg = curl_multi_info_read(multi, &left)) != NULL) {
+        if (msg->msg != CURLMSG_DONE)
+            continue;
+        for (i = 0; i < count; i++)
+            if (posts[i].curl == msg->easy_handle) {
+                posts[i].code = msg->data.result;
+                break;
+            }
+    }
+
+    /* Pull out the responses and clean up. */
+    for (i = 0; i < count; i++) {
+        if (posts[i].curl == NULL)
+            continue;
+        record_webkdc_post(sconf, posts[i].curl, posts[i].code);
+        if (posts[i].code != CURLE_OK)
+            ap_log_error(APLOG_MARK, APLOG_ERR, 0, server,
+                         "mod_webauth: curl_multi_perform: error(%d): %s",
+                         posts[i].code, posts[i].error_buff);
+        else if (posts[i].response->length > 0)
+            responses[i] = posts[i].response;
+        curl_multi_remove_handle(multi, posts[i].curl);
+        curl_easy_cleanup(posts[i].curl);
+        curl_slist_free_all(posts[i].headers);
+    }
+    curl_multi_cleanup(multi);
+    return responses;
+}
+
+
+/*
+ * Finish parsing a response from the WebKDC, the body of which was fed to
+ * the parser as it arrived.  Returns the document, or NULL after logging the
+ * error if it could not be parsed.
+ */
+static apr_xml_doc *
+finish_webkdc_response(struct webkdc_response *response,
+                       const char *mwa_func, server_rec *server)
+{
+    apr_xml_doc *xd;
+    apr_status_t astatus;
+
+    if (response->body != NULL)
+        ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, server,
+                     "mod_webauth: xml_response(%s)",
+                     webauth_buffer_string(response->body));
+
+    astatus = response->status;
+    if (astatus == APR_SUCCESS)
+        astatus = apr_xml_parser_done(response->parser, &xd);
+    if (astatus != APR_SUCCESS) {
+        char errbuff[1024];
+
+        ap_log_error(APLOG_MARK, APLOG_ERR, 0, server,
+                     "mod_webauth: %s: "
+                     "apr_xml_parser_{feed,done} failed: %s (%d)",
+                     mwa_func,
+                     apr_xml_parser_geterror(response->parser, errbuff,
+                                             sizeof(errbuff)),
+                     astatus);
+        return NULL;
+    }
+    return xd;
 }
 
 
@@ -322,12 +547,13 @@ get_elem_text(apr_pool_t *pool, apr_xml_elem *e, const char *def)
     if (e->first_cdata.first &&
         e->first_cdata.first->text) {
         apr_text *t;
-        MWA_STRING string;
-        init_string(&string, pool);
+        struct webauth_buffer *text;
+
+        text = webauth_buffer_new(pool);
         for (t = e->first_cdata.first; t != NULL; t = t->next) {
-            append_string(&string, t->text, 0);
+            webauth_buffer_append(text, t->text, strlen(t->text));
         }
-        return string.data;
+        return webauth_buffer_string(text);
     } else {
         return def;
     }
@@ -476,12 +702,11 @@ request_service_token(struct webauth_context *ctx, server_rec *server,
                       apr_pool_t *pool,
                       time_t curr)
 {
-    apr_xml_parser *xp;
     apr_xml_doc *xd;
-    char *xml_request, *xml_response;
+    char *xml_request;
+    struct webkdc_response *xml_response;
     const char *bk5_req;
     static const char *mwa_func = "request_service_token";
-    apr_status_t astatus;
     MWA_CRED_INTERFACE *mci;
 
     /* FIXME: this is currently hardcoded to krb5, but should be a directive */
@@ -513,34 +738,9 @@ request_service_token(struct webauth_context *ctx, server_rec *server,
     if (xml_response == NULL)
         return 0;
 
-    if (sconf->debug) {
-        ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, server,
-                     "mod_webauth: xml_response(%s)", xml_response);
-    }
-
-    xp = apr_xml_parser_create(pool);
-    if (xp == NULL) {
-        ap_log_error(APLOG_MARK, APLOG_ERR, 0, server,
-                     "mod_webauth: %s: apr_xml_parser_create failed",
-                     mwa_func);
-        return 0;
-    }
-
-    astatus = apr_xml_parser_feed(xp, xml_response, strlen(xml_response));
-    if (astatus == APR_SUCCESS) {
-        astatus = apr_xml_parser_done(xp, &xd);
-    }
-
-    if (astatus != APR_SUCCESS) {
-        char errbuff[1024];
-        ap_log_error(APLOG_MARK, APLOG_ERR, 0, server,
-                     "mod_webauth: %s: "
-                     "apr_xml_parser_{feed,done} failed: %s (%d)",
-                     mwa_func,
-                     apr_xml_parser_geterror(xp, errbuff, sizeof(errbuff)),
-                     astatus);
+    xd = finish_webkdc_response(xml_response, mwa_func, server);
+    if (xd == NULL)
         return 0;
-    }
 
     return parse_service_token_response(xd, server, pool, curr);
 }
@@ -630,10 +830,13 @@ mwa_get_service_token(server_rec *server, struct server_config *sconf,
 
     /* FIXME: Eventually this should be passed around everywhere. */
     webauth_context_init_apr(&ctx, pool);
+    webauth_metrics_set(ctx, webauth_metrics_get(sconf->ctx));
 
     if (sconf->service_token != NULL) {
         /* return the current one, unless we should attempt a renewal */
         if (sconf->service_token->next_renewal_attempt > curr) {
+            webauth_metrics_count(webauth_metrics_get(ctx),
+                                  WA_METRIC_SERVICE_TOKEN_HIT);
             token = copy_service_token(pool, sconf->service_token);
             if (sconf->debug) {
                 ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, server,
@@ -646,6 +849,8 @@ mwa_get_service_token(server_rec *server, struct server_config *sconf,
     }
 
     /* check file first to see if there is a (newer) token */
+    webauth_metrics_count(webauth_metrics_get(ctx),
+                          WA_METRIC_SERVICE_TOKEN_MISS);
     token = read_service_token_cache(server, sconf, pool);
 
     if (token != NULL) {
@@ -673,6 +878,8 @@ mwa_get_service_token(server_rec *server, struct server_config *sconf,
     if (local_cache_only)
         goto done;
 
+    webauth_metrics_count(webauth_metrics_get(ctx),
+                          WA_METRIC_SERVICE_TOKEN_RENEW);
     token = request_service_token(ctx, server, sconf, pool, curr);
 
     if (token == NULL ) {
@@ -827,57 +1034,46 @@ parse_get_creds_response(apr_xml_doc *xd,
 
 
 /*
- * request a service token from the WebKDC
+ * Build the getTokensRequest XML document asking for the given credentials
+ * on the basis of the given proxy token.  Returns NULL on error.
  */
-int
-mwa_get_creds_from_webkdc(MWA_REQ_CTXT *rc,
-                          struct webauth_token_proxy *pt,
-                          apr_array_header_t *needed_creds,
-                          apr_array_header_t **acquired_creds)
+static char *
+make_get_creds_request(MWA_REQ_CTXT *rc, MWA_SERVICE_TOKEN *st,
+                       struct webauth_token_proxy *pt,
+                       apr_array_header_t *needed_creds)
 {
-    apr_xml_parser *xp;
-    apr_xml_doc *xd;
-    char *xml_request, *xml_response, *b64_pt;
+    char *xml_request, *b64_pt;
     size_t i;
-    static const char *mwa_func = "mwa_get_creds_from_webkdc";
-    apr_status_t astatus;
-    MWA_SERVICE_TOKEN *st;
-    MWA_STRING cred_tokens;
+    struct webauth_buffer *cred_tokens;
     const char *request_token;
 
-    /* get service token first */
-    st = mwa_get_service_token(rc->r->server, rc->sconf, rc->r->pool, 0);
-
-    if (st == NULL)
-        return 0;
-
     /* make a new request-token */
     request_token = make_request_token(rc, st, "getTokensRequest");
     if (request_token == NULL)
-        return 0;
+        return NULL;
 
     /* now build up all the cred tokens we need */
-    init_string(&cred_tokens, rc->r->pool);
+    cred_tokens = webauth_buffer_new(rc->r->pool);
 
     for (i = 0; i < (size_t) needed_creds->nelts; i++) {
         MWA_WACRED *cred;
         char *id = apr_psprintf(rc->r->pool, "%lu", (unsigned long) i);
+        char *token;
 
         cred = &APR_ARRAY_IDX(needed_creds, i, MWA_WACRED);
-        append_string(&cred_tokens,
-                      apr_pstrcat(rc->r->pool,
-                                  "<token type='cred' id='",id,"'>",
-                                  "<credentialType>",
-                                  apr_xml_quote_string(rc->r->pool,
-                                                       cred->type, 0),
-                                  "</credentialType>",
-                                  "<serverPrincipal>",
-                                  apr_xml_quote_string(rc->r->pool,
-                                                       cred->service, 0),
-                                  "</serverPrincipal>",
-                                  "</token>",
-                                  NULL),
-                      0);
+        token = apr_pstrcat(rc->r->pool,
+                            "<token type='cred' id='",id,"'>",
+                            "<credentialType>",
+                            apr_xml_quote_string(rc->r->pool,
+                                                 cred->type, 0),
+                            "</credentialType>",
+                            "<serverPrincipal>",
+                            apr_xml_quote_string(rc->r->pool,
+                                                 cred->service, 0),
+                            "</serverPrincipal>",
+                            "</token>",
+                            NULL);
+        webauth_buffer_append(cred_tokens, token, strlen(token));
     }
 
     /* base64 encode the webkdc-proxy-token */
@@ -900,7 +1096,7 @@ mwa_get_creds_from_webkdc(MWA_REQ_CTXT *rc,
                               request_token,
                               "</requestToken>",
                               "<tokens>",
-                              cred_tokens.data,
+                              webauth_buffer_string(cred_tokens),
                               "</tokens>"
                               "</getTokensRequest>",
                               NULL);
@@ -908,47 +1104,81 @@ mwa_get_creds_from_webkdc(MWA_REQ_CTXT *rc,
     if (rc->sconf->debug)
         ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, rc->r->server,
                      "mod_webauth: xml_request(%s)", xml_request);
+    return xml_request;
+}
 
 
-    xml_response = post_to_webkdc(xml_request, 0,
-                                  rc->r->server, rc->sconf, rc->r->pool);
+/*
+ * Parse a getTokensResponse from the WebKDC and add any cred tokens found to
+ * acquired_creds.  Returns 1 on success and 0 on failure.
+ */
+static int
+handle_get_creds_response(MWA_REQ_CTXT *rc, MWA_SERVICE_TOKEN *st,
+                          struct webkdc_response *xml_response,
+                          apr_array_header_t **acquired_creds)
+{
+    apr_xml_doc *xd;
+    static const char *mwa_func = "mwa_get_creds_from_webkdc";
 
-    if (xml_response == NULL)
+    xd = finish_webkdc_response(xml_response, mwa_func, rc->r->server);
+    if (xd == NULL)
         return 0;
 
     if (rc->sconf->debug)
         ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, rc->r->server,
-                     "mod_webauth: xml_response(%s)", xml_response);
+                     "mod_webauth: xml doc root(%s)", xd->root->name);
 
+    return parse_get_creds_response(xd, rc, st, acquired_creds);
+}
 
-    xp = apr_xml_parser_create(rc->r->pool);
-    if (xp == NULL) {
-        ap_log_error(APLOG_MARK, APLOG_ERR, 0, rc->r->server,
-                     "mod_webauth: %s: apr_xml_parser_create failed",
-                     mwa_func);
-        return 0;
-    }
 
-    astatus = apr_xml_parser_feed(xp, xml_response, strlen(xml_response));
-    if (astatus == APR_SUCCESS) {
-        astatus = apr_xml_parser_done(xp, &xd);
-    }
+/*
+ * Request credentials from the WebKDC.  requests is an array of
+ * MWA_CRED_REQUEST, one per proxy type, and all of the requests are sent to
+ * the WebKDC in parallel.  All credentials successfully obtained are added
+ * to acquired_creds.  Returns 1 if every request succeeded and 0 if any of
+ * them failed.
+ */
+int
+mwa_get_creds_from_webkdc(MWA_REQ_CTXT *rc,
+                          apr_array_header_t *requests,
+                          apr_array_header_t **acquired_creds)
+{
+    char **xml_requests;
+    struct webkdc_response **xml_responses;
+    size_t i;
+    int result = 1;
+    MWA_SERVICE_TOKEN *st;
+    MWA_CRED_REQUEST *request;
 
-    if (astatus != APR_SUCCESS) {
-        char errbuff[1024];
+    if (requests->nelts == 0)
+        return 1;
 
-        ap_log_error(APLOG_MARK, APLOG_ERR, 0, rc->r->server,
-                     "mod_webauth: %s: "
-                     "apr_xml_parser_{feed,done} failed: %s (%d)",
-                     mwa_func,
-                     apr_xml_parser_geterror(xp, errbuff, sizeof(errbuff)),
-                     astatus);
+    /* get service token first */
+    st = mwa_get_service_token(rc->r->server, rc->sconf, rc->r->pool, 0);
+
+    if (st == NULL)
         return 0;
-    }
 
-    if (rc->sconf->debug)
-        ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, rc->r->server,
-                     "mod_webauth: xml doc root(%s)", xd->root->name);
+    /* build all of the requests */
+    xml_requests = apr_palloc(rc->r->pool, requests->nelts * sizeof(char *));
+    for (i = 0; i < (size_t) requests->nelts; i++) {
+        request = &APR_ARRAY_IDX(requests, i, MWA_CRED_REQUEST);
+        xml_requests[i] = make_get_creds_request(rc, st, request->pt,
+                                                 request->needed_creds);
+        if (xml_requests[i] == NULL)
+            return 0;
+    }
 
-    return parse_get_creds_response(xd, rc, st, acquired_creds);
+    /* post them all at once and then process the responses */
+    xml_responses = post_all_to_webkdc(xml_requests, requests->nelts,
+                                       rc->r->server, rc->sconf, rc->r->pool);
+    for (i = 0; i < (size_t) requests->nelts; i++) {
+        if (xml_responses[i] == NULL)
+            result = 0;
+        else if (!handle_get_creds_response(rc, st, xml_responses[i],
+                                            acquired_creds))
+            result = 0;
+    }
+    return result;
 }
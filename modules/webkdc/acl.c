@@ -15,6 +15,7 @@
 #include <apr_hash.h>
 
 #include <modules/webkdc/mod_webkdc.h>
+#include <webauth/metrics.h>
 
 APLOG_USE_MODULE(webkdc);
 
@@ -135,8 +136,11 @@ get_acl(MWK_REQ_CTXT *rc)
             return acl;
         }
         /* no change, return current acl */
-        if (finfo.mtime == acl_mtime)
+        if (finfo.mtime == acl_mtime) {
+            webauth_metrics_count(webauth_metrics_get(rc->ctx),
+                                  WA_METRIC_TOKEN_ACL_HIT);
             return acl;
+        }
     }
 
     if (rc->sconf->debug) {
@@ -276,6 +280,8 @@ get_acl(MWK_REQ_CTXT *rc)
 
     if (astatus == APR_EOF) {
         error = 0;
+        astatus = apr_file_info_get(&finfo, APR_FINFO_MTIME, acl_file);
+        acl_mtime = (astatus == APR_SUCCESS) ? finfo.mtime : 0;
     } else {
         log_apr_error(rc, astatus, mwk_func, "apr_file_gets",
                       rc->sconf->token_acl_path);
@@ -302,6 +308,8 @@ get_acl(MWK_REQ_CTXT *rc)
         if (acl != NULL)
             apr_pool_destroy(acl->pool);
         acl = new_acl;
+        webauth_metrics_count(webauth_metrics_get(rc->ctx),
+                              WA_METRIC_TOKEN_ACL_RELOAD);
 
         if (rc->sconf->debug) {
             ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, rc->r->server,
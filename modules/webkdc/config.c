@@ -59,6 +59,7 @@ DIRN(PermittedRealms,     "list of realms permitted for authentication")
 DIRN(ProxyTokenLifetime,  "lifetime of webkdc-proxy tokens")
 DIRN(ServiceTokenLifetime,"lifetime of webkdc-service tokens")
 DIRN(TokenAcl,            "path to the token ACL file")
+DIRN(TokenFormat,         "encrypted token format: hint, keyid, or aead")
 DIRD(TokenMaxTTL,         "max lifetime of recent tokens", int, 60 * 5)
 DIRN(UserInfoIgnoreFail,  "ignore failure to get user information")
 DIRN(UserInfoJSON,        "whether to use JSON protocol for user information")
@@ -81,6 +82,7 @@ enum {
     E_ProxyTokenLifetime,
     E_ServiceTokenLifetime,
     E_TokenAcl,
+    E_TokenFormat,
     E_TokenMaxTTL,
     E_UserInfoIgnoreFail,
     E_UserInfoJSON,
@@ -184,6 +186,7 @@ webkdc_config_merge(apr_pool_t *pool, void *basev, void *overv)
     MERGE_SET(login_time_limit);
     MERGE_SET(proxy_lifetime);
     MERGE_INT(service_lifetime);
+    MERGE_SET(token_format);
     MERGE_SET(token_max_ttl);
     MERGE_ARRAY(permitted_realms);
     MERGE_ARRAY(kerberos_factors);
@@ -273,6 +276,27 @@ parse_interval(cmd_parms *cmd, const char *arg, unsigned long *value)
 }
 
 
+/*
+ * Utility function for parsing a token format.  Returns an error string or
+ * NULL on success.
+ */
+static const char *
+parse_token_format(cmd_parms *cmd, const char *arg,
+                   enum webauth_token_format *value)
+{
+    if (strcmp(arg, "hint") == 0)
+        *value = WA_TOKEN_FORMAT_HINT;
+    else if (strcmp(arg, "keyid") == 0)
+        *value = WA_TOKEN_FORMAT_KEY_ID;
+    else if (strcmp(arg, "aead") == 0)
+        *value = WA_TOKEN_FORMAT_AEAD;
+    else
+        return apr_psprintf(cmd->pool, "Invalid token format \"%s\" for %s",
+                            arg, cmd->directive->directive);
+    return NULL;
+}
+
+
 /*
  * Utility function for parsing a user information service URL.  This also
  * does validation of the URL and the protocol to ensure that it represents a
@@ -378,6 +402,11 @@ cfg_str(cmd_parms *cmd, void *mconf UNUSED, const char *arg)
     case E_TokenAcl:
         sconf->token_acl_path = ap_server_root_relative(cmd->pool, arg);
         break;
+    case E_TokenFormat:
+        err = parse_token_format(cmd, arg, &sconf->token_format);
+        if (err == NULL)
+            sconf->token_format_set = true;
+        break;
     case E_TokenMaxTTL:
         err = parse_interval(cmd, arg, &sconf->token_max_ttl);
         if (err == NULL)
@@ -497,6 +526,7 @@ const command_rec webkdc_cmds[] = {
     DIRECTIVE(AP_INIT_TAKE1,   cfg_str,   ProxyTokenLifetime),
     DIRECTIVE(AP_INIT_TAKE1,   cfg_str,   ServiceTokenLifetime),
     DIRECTIVE(AP_INIT_TAKE1,   cfg_str,   TokenAcl),
+    DIRECTIVE(AP_INIT_TAKE1,   cfg_str,   TokenFormat),
     DIRECTIVE(AP_INIT_TAKE1,   cfg_str,   TokenMaxTTL),
     DIRECTIVE(AP_INIT_FLAG,    cfg_flag,  UserInfoIgnoreFail),
     DIRECTIVE(AP_INIT_FLAG,    cfg_flag,  UserInfoJSON),
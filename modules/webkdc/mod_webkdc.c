@@ -15,14 +15,17 @@
 
 #include <apr_base64.h>
 #include <apr_lib.h>
+#include <apr_shm.h>
 #include <apr_xml.h>
 
 #include <modules/webkdc/mod_webkdc.h>
 #include <util/macros.h>
 #include <webauth/basic.h>
+#include <webauth/buffer.h>
 #include <webauth/factors.h>
 #include <webauth/keys.h>
 #include <webauth/krb5.h>
+#include <webauth/metrics.h>
 #include <webauth/tokens.h>
 #include <webauth/webkdc.h>
 
@@ -165,24 +168,21 @@ unknown_element(MWK_REQ_CTXT *rc,
 static char *
 get_elem_text(MWK_REQ_CTXT *rc, apr_xml_elem *e, const char *mwk_func)
 {
-    MWK_STRING string;
-    mwk_init_string(&string, rc->r->pool);
-
-    if (e->first_cdata.first &&
-        e->first_cdata.first->text) {
-        apr_text *t;
-         for (t = e->first_cdata.first; t != NULL; t = t->next) {
-            mwk_append_string(&string, t->text, 0);
-        }
-    }
+    struct webauth_buffer *text;
+    apr_text *t;
 
-    if (!string.data || string.data[0] == '\0') {
+    text = webauth_buffer_new(rc->r->pool);
+    for (t = e->first_cdata.first; t != NULL; t = t->next)
+        if (t->text != NULL)
+            webauth_buffer_append(text, t->text, strlen(t->text));
+
+    if (webauth_buffer_length(text) == 0) {
         char *msg = apr_psprintf(rc->r->pool, "<%s> does not contain data",
                                  e->name);
         set_errorResponse(rc, WA_PEC_INVALID_REQUEST, msg, mwk_func, true);
         return NULL;
     }
-    return string.data;
+    return webauth_buffer_string(text);
 }
 
 /*
@@ -538,25 +538,33 @@ make_token(MWK_REQ_CTXT *rc, struct webauth_token *data, const char **token,
 }
 
 
+/*
+ * Encode a token with the given session key.  All the tokens returned for a
+ * request are encrypted with the requester's session key, so the keyring for
+ * it is built the first time and kept in the request context.
+ */
 static enum mwk_status
 make_token_with_key(MWK_REQ_CTXT *rc, const void *key, size_t key_len,
                     struct webauth_token *data, const char **token,
                     const char *mwk_func)
 {
     int status;
-    struct webauth_keyring *ring;
     struct webauth_key *wkey;
 
-    status = webauth_key_create(rc->ctx, WA_KEY_AES, key_len, key, &wkey);
-    if (status != WA_ERR_NONE) {
-        mwk_log_webauth_error(rc->ctx, rc->r->server, status, mwk_func,
-                              "webauth_key_create", NULL);
-        return set_errorResponse(rc, WA_PEC_SERVER_FAILURE,
-                                 "invalid key while creating token",
-                                 mwk_func, true);
+    if (rc->session_ring == NULL || rc->session_key != key) {
+        status = webauth_key_create(rc->ctx, WA_KEY_AES, key_len, key,
+                                    &wkey);
+        if (status != WA_ERR_NONE) {
+            mwk_log_webauth_error(rc->ctx, rc->r->server, status, mwk_func,
+                                  "webauth_key_create", NULL);
+            return set_errorResponse(rc, WA_PEC_SERVER_FAILURE,
+                                     "invalid key while creating token",
+                                     mwk_func, true);
+        }
+        rc->session_ring = webauth_keyring_from_key(rc->ctx, wkey);
+        rc->session_key = key;
     }
-    ring = webauth_keyring_from_key(rc->ctx, wkey);
-    status = webauth_token_encode(rc->ctx, data, ring, token);
+    status = webauth_token_encode(rc->ctx, data, rc->session_ring, token);
     if (status != WA_ERR_NONE) {
         mwk_log_webauth_error(rc->ctx, rc->r->server, status, mwk_func,
                               "webauth_token_create", NULL);
@@ -629,32 +637,31 @@ create_service_token_from_req(MWK_REQ_CTXT *rc,
 
 
 /*
- * sad is allocated from request pool
+ * Return a Kerberos context holding the credentials from a krb5 proxy token,
+ * or NULL after setting the error response.  The credentials are imported
+ * the first time and the context is kept in the request context, so all the
+ * tokens in a request made from the same proxy token share it.
  */
-static enum mwk_status
-get_krb5_sad(MWK_REQ_CTXT *rc,
-             MWK_REQUESTER_CREDENTIAL *req_cred,
-             struct webauth_token_webkdc_proxy *sub_pt,
-             void **sad,
-             size_t *sad_len,
-             const char *mwk_func)
+static struct webauth_krb5 *
+get_proxy_krb5(MWK_REQ_CTXT *rc,
+               const struct webauth_token_webkdc_proxy *sub_pt,
+               const char *mwk_func)
 {
     struct webauth_krb5 *kc;
     int status;
-    const char *server_principal;
-    enum mwk_status ms;
 
+    if (rc->proxy_kc != NULL && rc->proxy_pt == sub_pt)
+        return rc->proxy_kc;
     kc = mwk_get_webauth_krb5_ctxt(rc->ctx, rc->r, mwk_func);
     if (kc == NULL) {
         /* mwk_get_webauth_krb5_ctxt already logged error */
-        return set_errorResponse(rc, WA_PEC_SERVER_FAILURE,
-                                      "server failure (webauth_krb5_new)",
-                                      mwk_func, false);
+        set_errorResponse(rc, WA_PEC_SERVER_FAILURE,
+                          "server failure (webauth_krb5_new)", mwk_func,
+                          false);
+        return NULL;
     }
-
     status = webauth_krb5_import_cred(rc->ctx, kc, sub_pt->data,
                                       sub_pt->data_len, NULL);
-
     if (status != WA_ERR_NONE) {
         char *msg = mwk_webauth_error_message(rc->ctx, rc->r,
                                               status,
@@ -664,9 +671,35 @@ get_krb5_sad(MWK_REQ_CTXT *rc,
          *        to determine if we should return a proxy-token error
          *        or a server-failure.
          */
-        return set_errorResponse(rc, WA_PEC_PROXY_TOKEN_INVALID, msg,
-                                 mwk_func, true);
+        set_errorResponse(rc, WA_PEC_PROXY_TOKEN_INVALID, msg, mwk_func,
+                          true);
+        return NULL;
     }
+    rc->proxy_pt = sub_pt;
+    rc->proxy_kc = kc;
+    return kc;
+}
+
+
+/*
+ * sad is allocated from request pool
+ */
+static enum mwk_status
+get_krb5_sad(MWK_REQ_CTXT *rc,
+             MWK_REQUESTER_CREDENTIAL *req_cred,
+             struct webauth_token_webkdc_proxy *sub_pt,
+             void **sad,
+             size_t *sad_len,
+             const char *mwk_func)
+{
+    struct webauth_krb5 *kc;
+    int status;
+    const char *server_principal;
+    enum mwk_status ms;
+
+    kc = get_proxy_krb5(rc, sub_pt, mwk_func);
+    if (kc == NULL)
+        return MWK_ERROR;
 
     server_principal = req_cred->u.st.subject;
     if (strncmp(server_principal, "krb5:", 5) == 0) {
@@ -811,25 +844,23 @@ create_id_token_from_req(MWK_REQ_CTXT *rc,
 
 
 /*
+ * Check a request for a cred token and add it to the cred requests, which
+ * are all handled by make_cred_tokens once the whole request has been
+ * checked.
  */
 static enum mwk_status
 create_cred_token_from_req(MWK_REQ_CTXT *rc,
                            apr_xml_elem *e,
                            MWK_REQUESTER_CREDENTIAL *req_cred,
                            MWK_SUBJECT_CREDENTIAL *sub_cred,
-                           MWK_RETURNED_TOKEN *rtoken)
+                           MWK_RETURNED_TOKEN *rtoken,
+                           apr_array_header_t *creds)
 {
     static const char *mwk_func = "create_cred_token_from_req";
-    size_t ticket_len;
-    int status;
-    time_t expiration, ticket_expiration;
     apr_xml_elem *credential_type, *server_principal;
     char *ct, *sp;
-    struct webauth_krb5 *kc;
     struct webauth_token_webkdc_proxy *sub_pt;
-    struct webauth_token token;
-    void *ticket;
-    enum mwk_status ms;
+    MWK_CRED_REQUEST *request;
 
     /* only create cred tokens from service creds */
     if (strcmp(req_cred->type, "service") != 0 ) {
@@ -881,65 +912,228 @@ create_cred_token_from_req(MWK_REQ_CTXT *rc,
                                  mwk_func, true);
     }
 
-    /* try to get the credentials  */
-    kc = mwk_get_webauth_krb5_ctxt(rc->ctx, rc->r, mwk_func);
-    if (kc == NULL) {
-        return set_errorResponse(rc, WA_PEC_SERVER_FAILURE,
-                                      "server failure", mwk_func, false);
+    request = apr_array_push(creds);
+    memset(request, 0, sizeof(*request));
+    request->sub_pt = sub_pt;
+    request->type = ct;
+    request->service = sp;
+    request->rtoken = rtoken;
+    rtoken->subject = sub_pt->subject;
+    rtoken->info =
+        apr_pstrcat(rc->r->pool, " type=cred crt=", ct, " crs=", sp,NULL);
+    return MWK_OK;
+}
+
+
+/*
+ * Get the ticket for each of the given cred requests with the Kerberos
+ * context holding the proxy token credentials, recording the status and
+ * error message in each request.  All the requests must be for the same
+ * proxy token, whose credentials must already be imported into
+ * rc->proxy_kc.
+ */
+static void
+get_tickets(MWK_REQ_CTXT *rc, MWK_CRED_REQUEST **requests, size_t count)
+{
+    MWK_CRED_REQUEST *request;
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        request = requests[i];
+        request->status = webauth_krb5_export_cred(rc->ctx, rc->proxy_kc,
+                                                   request->service,
+                                                   &request->ticket,
+                                                   &request->ticket_len,
+                                                   &request->expiration);
+        if (request->status != WA_ERR_NONE)
+            request->error = webauth_error_message(rc->ctx, request->status);
     }
+}
 
-    status = webauth_krb5_import_cred(rc->ctx, kc, sub_pt->data,
-                                      sub_pt->data_len, NULL);
-    if (status != WA_ERR_NONE) {
-        char *msg = mwk_webauth_error_message(rc->ctx, rc->r,
-                                              status,
-                                              "webauth_krb5_init_via_cred",
-                                              NULL);
-        /* FIXME: probably need to examine errors a little more closely
-         *        to determine if we should return a proxy-token error
-         *        or a server-failure.
-         */
-        return set_errorResponse(rc, WA_PEC_PROXY_TOKEN_INVALID, msg,
-                                 mwk_func, true);
+
+/*
+ * Look up the given cred requests, all for the same proxy token, in the
+ * ticket cache, filling in the ticket for each hit.  The requests that
+ * missed are moved to the front of the array, and their number is returned.
+ */
+static size_t
+get_cached_tickets(MWK_REQ_CTXT *rc, MWK_CRED_REQUEST **requests,
+                   size_t count)
+{
+    struct webauth_metrics *metrics = webauth_metrics_get(rc->ctx);
+    MWK_CRED_REQUEST *request;
+    size_t i, missing;
+    time_t now;
+    int status;
+
+    if (rc->sconf->tickets == NULL)
+        return count;
+    now = time(NULL);
+    missing = 0;
+    mwk_lock_mutex(rc, MWK_MUTEX_TICKETCACHE);
+    for (i = 0; i < count; i++) {
+        request = requests[i];
+        status = webauth_krb5_ticket_cache_get(rc->ctx, rc->sconf->tickets,
+                                               request->sub_pt->data,
+                                               request->sub_pt->data_len,
+                                               request->service, now,
+                                               &request->ticket,
+                                               &request->ticket_len,
+                                               &request->expiration);
+        if (status == WA_ERR_NONE)
+            webauth_metrics_count(metrics, WA_METRIC_TICKET_CACHE_HIT);
+        else {
+            webauth_metrics_count(metrics, WA_METRIC_TICKET_CACHE_MISS);
+            requests[i] = requests[missing];
+            requests[missing++] = request;
+        }
     }
+    mwk_unlock_mutex(rc, MWK_MUTEX_TICKETCACHE);
+    return missing;
+}
 
-    /* now try and export a ticket */
-    status = webauth_krb5_export_cred(rc->ctx, kc, sp, &ticket, &ticket_len,
-                                      &ticket_expiration);
 
-    if (status != WA_ERR_NONE) {
-        char *msg = mwk_webauth_error_message(rc->ctx, rc->r,
-                                              status,
-                                              "webauth_krb5_export_ticket",
-                                              NULL);
-        return set_errorResponse(rc, WA_PEC_GET_CRED_FAILURE,
-                                 msg, mwk_func, true);
+/*
+ * Add the tickets obtained for the given cred requests to the ticket cache.
+ * Failing to cache a ticket isn't fatal, so errors are only logged.
+ */
+static void
+cache_tickets(MWK_REQ_CTXT *rc, MWK_CRED_REQUEST **requests, size_t count)
+{
+    static const char *mwk_func = "cache_tickets";
+    MWK_CRED_REQUEST *request;
+    size_t i;
+    time_t now;
+    int status;
+
+    if (rc->sconf->tickets == NULL)
+        return;
+    now = time(NULL);
+    mwk_lock_mutex(rc, MWK_MUTEX_TICKETCACHE);
+    for (i = 0; i < count; i++) {
+        request = requests[i];
+        if (request->status != WA_ERR_NONE)
+            continue;
+        status = webauth_krb5_ticket_cache_add(rc->ctx, rc->sconf->tickets,
+                                               request->sub_pt->data,
+                                               request->sub_pt->data_len,
+                                               request->service, now,
+                                               request->ticket,
+                                               request->ticket_len,
+                                               request->expiration);
+        if (status != WA_ERR_NONE)
+            mwk_log_webauth_error(rc->ctx, rc->r->server, status, mwk_func,
+                                  "webauth_krb5_ticket_cache_add", NULL);
     }
+    mwk_unlock_mutex(rc, MWK_MUTEX_TICKETCACHE);
+}
 
 
-    /* now create the cred-token */
-    if (ticket_expiration < sub_pt->expiration)
-        expiration = ticket_expiration;
-    else
-        expiration = sub_pt->expiration;
-    memset(&token, 0, sizeof(token));
-    token.type = WA_TOKEN_CRED;
-    token.token.cred.subject = sub_pt->subject;
-    token.token.cred.type = ct;
-    token.token.cred.service = sp;
-    token.token.cred.data = ticket;
-    token.token.cred.data_len = ticket_len;
-    token.token.cred.expiration = expiration;
+/*
+ * Create the cred tokens for all of the cred requests in a getTokensRequest.
+ * Tickets already in the ticket cache are used from there.  Otherwise, the
+ * credentials from each proxy token are imported once and each distinct
+ * service ticket is only obtained once.  All of the tokens are encrypted
+ * with the requester's session key.
+ */
+static enum mwk_status
+make_cred_tokens(MWK_REQ_CTXT *rc, MWK_REQUESTER_CREDENTIAL *req_cred,
+                 apr_array_header_t *creds)
+{
+    static const char *mwk_func = "make_cred_tokens";
+    MWK_CRED_REQUEST *request, *other, **unique;
+    struct webauth_token_webkdc_proxy *sub_pt;
+    struct webauth_token token;
+    size_t count, missing, k;
+    int i, j;
+    enum mwk_status ms;
 
-    ms = make_token_with_key(rc, req_cred->u.st.session_key,
-                             req_cred->u.st.session_key_len, &token,
-                             &rtoken->token_data, mwk_func);
+    /*
+     * Get the tickets one proxy token at a time.  There is normally only one
+     * proxy token of the krb5 type, so this is normally a single pass.
+     */
+    unique = apr_palloc(rc->r->pool, creds->nelts * sizeof(*unique));
+    for (i = 0; i < creds->nelts; i++) {
+        request = &APR_ARRAY_IDX(creds, i, MWK_CRED_REQUEST);
+        if (request->ticket != NULL || request->error != NULL)
+            continue;
+        sub_pt = request->sub_pt;
+
+        /* Collect the distinct servers needing tickets from this token. */
+        count = 0;
+        for (j = i; j < creds->nelts; j++) {
+            other = &APR_ARRAY_IDX(creds, j, MWK_CRED_REQUEST);
+            if (other->sub_pt == sub_pt && other->ticket == NULL
+                && other->error == NULL) {
+                for (k = 0; k < count; k++)
+                    if (strcmp(unique[k]->service, other->service) == 0)
+                        break;
+                if (k == count)
+                    unique[count++] = other;
+            }
+        }
 
-    rtoken->subject = sub_pt->subject;
-    rtoken->info =
-        apr_pstrcat(rc->r->pool, " type=cred crt=", ct, " crs=", sp,NULL);
+        /*
+         * Take what we can from the ticket cache, moving the tickets that
+         * are still needed to the front of the list.
+         */
+        missing = get_cached_tickets(rc, unique, count);
 
-    return ms;
+        /* Import the credentials if any tickets are needed. */
+        if (missing > 0) {
+            if (get_proxy_krb5(rc, sub_pt, mwk_func) == NULL)
+                return MWK_ERROR;
+            get_tickets(rc, unique, missing);
+            cache_tickets(rc, unique, missing);
+        }
+
+        /* Copy the results to the duplicate requests. */
+        for (j = i; j < creds->nelts; j++) {
+            other = &APR_ARRAY_IDX(creds, j, MWK_CRED_REQUEST);
+            if (other->sub_pt != sub_pt || other->ticket != NULL
+                || other->error != NULL)
+                continue;
+            for (k = 0; k < count; k++)
+                if (strcmp(unique[k]->service, other->service) == 0)
+                    break;
+            other->status = unique[k]->status;
+            other->ticket = unique[k]->ticket;
+            other->ticket_len = unique[k]->ticket_len;
+            other->expiration = unique[k]->expiration;
+            other->error = unique[k]->error;
+        }
+    }
+
+    /* Now create the cred tokens in the order in which they were asked. */
+    for (i = 0; i < creds->nelts; i++) {
+        request = &APR_ARRAY_IDX(creds, i, MWK_CRED_REQUEST);
+        sub_pt = request->sub_pt;
+        if (request->status != WA_ERR_NONE) {
+            char *msg = apr_psprintf(rc->r->pool, "%s error: %s (%d)",
+                                     "webauth_krb5_export_ticket",
+                                     request->error, request->status);
+
+            return set_errorResponse(rc, WA_PEC_GET_CRED_FAILURE, msg,
+                                     mwk_func, true);
+        }
+        memset(&token, 0, sizeof(token));
+        token.type = WA_TOKEN_CRED;
+        token.token.cred.subject = sub_pt->subject;
+        token.token.cred.type = request->type;
+        token.token.cred.service = request->service;
+        token.token.cred.data = request->ticket;
+        token.token.cred.data_len = request->ticket_len;
+        if (request->expiration < sub_pt->expiration)
+            token.token.cred.expiration = request->expiration;
+        else
+            token.token.cred.expiration = sub_pt->expiration;
+        ms = make_token_with_key(rc, req_cred->u.st.session_key,
+                                 req_cred->u.st.session_key_len, &token,
+                                 &request->rtoken->token_data, mwk_func);
+        if (ms != MWK_OK)
+            return ms;
+    }
+    return MWK_OK;
 }
 
 /*
@@ -1012,6 +1206,7 @@ handle_getTokensRequest(MWK_REQ_CTXT *rc, apr_xml_elem *e,
     int req_cred_parsed = 0;
     int sub_cred_parsed = 0;
     size_t num_tokens, i;
+    apr_array_header_t *creds;
 
     MWK_RETURNED_TOKEN rtokens[MAX_TOKENS_RETURNED];
 
@@ -1095,6 +1290,7 @@ handle_getTokensRequest(MWK_REQ_CTXT *rc, apr_xml_elem *e,
     }
 
     num_tokens = 0;
+    creds = apr_array_make(rc->r->pool, 1, sizeof(MWK_CRED_REQUEST));
     /* plow through each <token> in <tokens> */
     for (token = tokens->first_child; token; token = token->next) {
         const char *tt;
@@ -1154,7 +1350,7 @@ handle_getTokensRequest(MWK_REQ_CTXT *rc, apr_xml_elem *e,
             }
         } else if (strcmp(tt, "cred") == 0) {
             if (!create_cred_token_from_req(rc, token, &req_cred, &sub_cred,
-                                            &rtokens[num_tokens])) {
+                                            &rtokens[num_tokens], creds)) {
                 return MWK_ERROR;
             }
         } else {
@@ -1166,6 +1362,11 @@ handle_getTokensRequest(MWK_REQ_CTXT *rc, apr_xml_elem *e,
         num_tokens++;
     }
 
+    /* the cred tokens are all made together once the request is checked */
+    if (creds->nelts > 0)
+        if (!make_cred_tokens(rc, &req_cred, creds))
+            return MWK_ERROR;
+
     /* if we got here, we made it! */
     ap_rvputs(rc->r, "<getTokensResponse><tokens>", NULL);
 
@@ -2265,23 +2466,99 @@ parse_request(MWK_REQ_CTXT *rc)
     return OK;
 }
 
+/*
+ * The content handler for the webkdc-metrics handler, which returns the
+ * runtime metrics in the Prometheus text format.
+ */
+static int
+metrics_handler(request_rec *r)
+{
+    struct config *sconf;
+    struct webauth_metrics *metrics;
+    struct webauth_context *ctx;
+    char *output;
+    int status;
+
+    r->allowed |= (AP_METHOD_BIT << M_GET);
+    if (r->method_number != M_GET)
+        return DECLINED;
+    sconf = ap_get_module_config(r->server->module_config, &webkdc_module);
+    metrics = webauth_metrics_get(sconf->ctx);
+    if (metrics == NULL)
+        return HTTP_NOT_FOUND;
+    status = webauth_context_init_apr(&ctx, r->pool);
+    if (status == WA_ERR_NONE)
+        status = webauth_metrics_format(ctx, metrics, &output);
+    if (status != WA_ERR_NONE) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, 0, r->server,
+                     "mod_webkdc: cannot format metrics: %s",
+                     webauth_error_message(NULL, status));
+        return HTTP_INTERNAL_SERVER_ERROR;
+    }
+    ap_set_content_type(r, "text/plain; version=0.0.4");
+    apr_table_setn(r->headers_out, "Cache-Control", "no-cache");
+    ap_rputs(output, r);
+    return OK;
+}
+
+
+/*
+ * Handle a request to the WebKDC once the request context is set up,
+ * returning the HTTP status.
+ */
+static int
+handle_request(MWK_REQ_CTXT *rc)
+{
+    request_rec *r = rc->r;
+    const char *req_content_type;
+
+    /* Ensure we can load the keyring. */
+    if (!ensure_keyring_loaded(rc))
+        return HTTP_INTERNAL_SERVER_ERROR;
+
+    /* Ensure the client sent POST with the right content type. */
+    if (r->method_number != M_POST)
+        return HTTP_METHOD_NOT_ALLOWED;
+    req_content_type = apr_table_get(r->headers_in, "content-type");
+    if (!req_content_type || strcmp(req_content_type, "text/xml") != 0)
+        return HTTP_BAD_REQUEST;
+
+    /* Our response will also be text/xml. */
+    ap_set_content_type(r, "text/xml");
+
+    /* All the real work happens in parse_request. */
+    return parse_request(rc);
+}
+
+
 /* The content handler */
 static int
 handler_hook(request_rec *r)
 {
     MWK_REQ_CTXT rc;
     int status;
-    const char *req_content_type;
-    struct webauth_webkdc_config config;
 
     /* Make sure that we weren't called inappropriately. */
+    if (strcmp(r->handler, "webkdc-metrics") == 0)
+        return metrics_handler(r);
     if (strcmp(r->handler, "webkdc"))
         return DECLINED;
 
-    /* Initialize our request context. */
+    /*
+     * Initialize our request context.  The WebAuth context is reused across
+     * requests handled by this thread and already has the WebKDC and user
+     * information service configuration, so only the logging callbacks need
+     * to be pointed at this request.
+     */
     memset(&rc, 0, sizeof(rc));
     rc.r = r;
-    status = webauth_context_init_apr(&rc.ctx, r->pool);
+    rc.sconf = ap_get_module_config(r->server->module_config, &webkdc_module);
+    if (!rc.sconf->request_ok) {
+        ap_log_error(APLOG_MARK, APLOG_CRIT, 0, r->server,
+                     "mod_webkdc: WebAuth configuration failed at startup");
+        return HTTP_INTERNAL_SERVER_ERROR;
+    }
+    status = mwk_request_context(&rc);
     if (status != WA_ERR_NONE) {
         ap_log_error(APLOG_MARK, APLOG_CRIT, 0, r->server,
                      "mod_webkdc: webauth_context_init failed: %s",
@@ -2293,59 +2570,52 @@ handler_hook(request_rec *r)
     webauth_log_callback(rc.ctx, WA_LOG_NOTICE, mwk_log_notice,  r);
     webauth_log_callback(rc.ctx, WA_LOG_WARN,   mwk_log_warning, r);
 
-    /* Set up the WebKDC configuration. */
-    rc.sconf = ap_get_module_config(r->server->module_config, &webkdc_module);
-    config.fast_armor_path  = rc.sconf->fast_armor_path;
-    config.id_acl_path      = rc.sconf->identity_acl_path;
-    config.keytab_path      = rc.sconf->keytab_path;
-    config.principal        = rc.sconf->keytab_principal;
-    config.proxy_lifetime   = rc.sconf->proxy_lifetime;
-    config.login_time_limit = rc.sconf->login_time_limit;
-    config.permitted_realms = rc.sconf->permitted_realms;
-    config.local_realms     = rc.sconf->local_realms;
-    status = webauth_webkdc_config(rc.ctx, &config);
-    if (status != WA_ERR_NONE) {
-        ap_log_error(APLOG_MARK, APLOG_CRIT, 0, r->server,
-                     "mod_webkdc: webauth_webkdc_config failed: %s",
-                     webauth_error_message(rc.ctx, status));
-        return HTTP_INTERNAL_SERVER_ERROR;
-    }
-
-    /* Set up the user information service configuration. */
-    if (rc.sconf->userinfo_config != NULL) {
-        struct webauth_user_config *user = rc.sconf->userinfo_config;
-
-        user->identity       = rc.sconf->userinfo_principal;
-        user->timeout        = rc.sconf->userinfo_timeout;
-        user->ignore_failure = rc.sconf->userinfo_ignore_fail;
-        user->json           = rc.sconf->userinfo_json;
-        user->keytab         = rc.sconf->keytab_path;
-        user->principal      = rc.sconf->keytab_principal;
-        status = webauth_user_config(rc.ctx, user);
-        if (status != WA_ERR_NONE) {
-            ap_log_error(APLOG_MARK, APLOG_CRIT, 0, r->server,
-                         "mod_webkdc: webauth_user_config failed: %s",
-                         webauth_error_message(rc.ctx, status));
-            return HTTP_INTERNAL_SERVER_ERROR;
-        }
-    }
-
-    /* Ensure we can load the keyring. */
-    if (!ensure_keyring_loaded(&rc))
-        return HTTP_INTERNAL_SERVER_ERROR;
+    /*
+     * Nothing from this request may be left in the WebAuth context once the
+     * response has been written, since the context is reused.
+     */
+    status = handle_request(&rc);
+    mwk_request_context_release(&rc);
+    return status;
+}
 
-    /* Ensure the client sent POST with the right content type. */
-    if (r->method_number != M_POST)
-        return HTTP_METHOD_NOT_ALLOWED;
-    req_content_type = apr_table_get(r->headers_in, "content-type");
-    if (!req_content_type || strcmp(req_content_type, "text/xml") != 0)
-        return HTTP_BAD_REQUEST;
 
-    /* Our response will also be text/xml. */
-    ap_set_content_type(r, "text/xml");
+/*
+ * Create the runtime metrics in anonymous shared memory so that they are
+ * inherited by and shared among all of the children, and attach them to the
+ * WebAuth context of each virtual host, from which the per-request contexts
+ * inherit them.  The metrics start over when the server is restarted.
+ * Failure only disables metrics.
+ */
+static void
+metrics_init(server_rec *s, apr_pool_t *pconf)
+{
+    struct config *sconf;
+    struct webauth_metrics *metrics;
+    apr_shm_t *shm;
+    apr_status_t code;
+    server_rec *scheck;
+    int status;
 
-    /* All the real work happens in parse_request. */
-    return parse_request(&rc);
+    sconf = ap_get_module_config(s->module_config, &webkdc_module);
+    code = apr_shm_create(&shm, webauth_metrics_size(), NULL, pconf);
+    if (code != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, code, s,
+                     "mod_webkdc: cannot create shared memory for metrics");
+        return;
+    }
+    status = webauth_metrics_init(sconf->ctx, apr_shm_baseaddr_get(shm),
+                                  apr_shm_size_get(shm), &metrics);
+    if (status != WA_ERR_NONE) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, 0, s,
+                     "mod_webkdc: cannot initialize metrics: %s",
+                     webauth_error_message(sconf->ctx, status));
+        return;
+    }
+    for (scheck = s; scheck != NULL; scheck = scheck->next) {
+        sconf = ap_get_module_config(scheck->module_config, &webkdc_module);
+        webauth_metrics_set(sconf->ctx, metrics);
+    }
 }
 
 
@@ -2368,6 +2638,7 @@ mod_webkdc_init(apr_pool_t *pconf, apr_pool_t *plog UNUSED,
     for (scheck=s; scheck; scheck=scheck->next) {
         webkdc_config_init(scheck, sconf, pconf);
     }
+    metrics_init(s, pconf);
 
     ap_add_version_component(pconf, "WebKDC/" VERSION);
 
@@ -2383,10 +2654,16 @@ mod_webkdc_init(apr_pool_t *pconf, apr_pool_t *plog UNUSED,
  * called once per-child
  */
 static void
-mod_webkdc_child_init(apr_pool_t *p UNUSED, server_rec *s)
+mod_webkdc_child_init(apr_pool_t *p, server_rec *s)
 {
+    server_rec *t;
+
     /* initialize mutexes */
     mwk_init_mutexes(s);
+
+    /* validate library configuration and set up reusable contexts */
+    for (t = s; t != NULL; t = t->next)
+        mwk_init_context(t, p);
 }
 
 static void
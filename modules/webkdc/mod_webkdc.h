@@ -17,12 +17,16 @@
 #include <httpd.h>
 #include <apr_pools.h>
 #include <apr_tables.h>
+#include <apr_thread_proc.h>
 #include <sys/types.h>
 
+#include <webauth/keys.h>
 #include <webauth/tokens.h>
 
 struct webauth_context;
 struct webauth_keyring;
+struct webauth_krb5;
+struct webauth_krb5_ticket_cache;
 
 /* defines for config directives */
 
@@ -34,10 +38,15 @@ struct webauth_keyring;
 #define MAX_PROXY_TOKENS_ACCEPTED 64
 #define MAX_PROXY_TOKENS_RETURNED 64
 
+/* number of service tickets cached per child, and the minimum life left */
+#define TICKET_CACHE_SLOTS 4096
+#define TICKET_CACHE_MINIMUM (5 * 60)
+
 /* enum for mutexes */
 enum mwk_mutex_type {
     MWK_MUTEX_TOKENACL,
     MWK_MUTEX_KEYRING,
+    MWK_MUTEX_TICKETCACHE,
     MWK_MUTEX_MAX /* MUST BE LAST! */
 };
 
@@ -73,6 +82,7 @@ struct config {
     unsigned long login_time_limit;
     unsigned long proxy_lifetime;
     unsigned long service_lifetime;
+    enum webauth_token_format token_format;
     unsigned long token_max_ttl;
     apr_array_header_t *local_realms;           /* Array of const char * */
     apr_array_header_t *permitted_realms;       /* Array of const char * */
@@ -87,6 +97,7 @@ struct config {
     bool key_lifetime_set;
     bool login_time_limit_set;
     bool proxy_lifetime_set;
+    bool token_format_set;
     bool token_max_ttl_set;
 
     /*
@@ -96,6 +107,20 @@ struct config {
      */
     struct webauth_context *ctx;
     struct webauth_keyring *ring;
+
+    /* Service tickets for cred tokens, per child and created at startup. */
+    struct webauth_krb5_ticket_cache *tickets;
+
+    /*
+     * Reusable per-request contexts sharing the configuration of ctx, which
+     * is validated once per child.  request_ok is false if that failed.
+     */
+#if APR_HAS_THREADS
+    apr_threadkey_t *request_key;
+#else
+    struct webauth_context *request_ctx;
+#endif
+    bool request_ok;
 };
 
 /* requestInfo */
@@ -145,6 +170,23 @@ typedef struct {
     const char *info; /* used only for logging */
 } MWK_RETURNED_TOKEN;
 
+/*
+ * used to represent a cred token requested in a getTokensRequest.  the
+ * tickets for all of them are obtained together once the request has been
+ * checked, so that the proxy token credentials are only imported once.
+ */
+typedef struct {
+    struct webauth_token_webkdc_proxy *sub_pt;
+    const char *type;
+    const char *service;
+    MWK_RETURNED_TOKEN *rtoken;
+    void *ticket;
+    size_t ticket_len;
+    time_t expiration;
+    int status;                 /* status from getting the ticket */
+    const char *error;          /* error message if status is an error */
+} MWK_CRED_REQUEST;
+
 /* used to represent returned proxy-tokens for
  * the processRequestTokenResponse.
  */
@@ -153,14 +195,6 @@ typedef struct {
     const char *token_data;
 } MWK_RETURNED_PROXY_TOKEN;
 
-/* used to append a bunch of data together */
-typedef struct {
-    char *data;
-    size_t size;
-    size_t capacity;
-    apr_pool_t *pool;
-} MWK_STRING;
-
 /* handy bunch of bits to pass around during a request */
 typedef struct {
     request_rec *r;
@@ -170,6 +204,14 @@ typedef struct {
     const char *error_message;
     const char *mwk_func; /* function error occured in */
     bool need_to_log; /* set if we need to log error  */
+
+    /* keyring for the requester's session key, built on first use */
+    const void *session_key;
+    struct webauth_keyring *session_ring;
+
+    /* Kerberos context holding the credentials from a proxy token */
+    const struct webauth_token_webkdc_proxy *proxy_pt;
+    struct webauth_krb5 *proxy_kc;
 } MWK_REQ_CTXT;
 
 BEGIN_DECLS
@@ -231,6 +273,27 @@ void mwk_log_warning(struct webauth_context *ctx, void *, const char *);
 void
 mwk_init_mutexes(server_rec *s);
 
+/*
+ * Validate the library configuration for a server once per child and set up
+ * its reusable request contexts.  Called from child_init.
+ */
+void
+mwk_init_context(server_rec *s, apr_pool_t *p);
+
+/*
+ * Set rc->ctx to the reusable WebAuth context for this thread, reset for a
+ * new request.  Returns a WebAuth status code.
+ */
+int
+mwk_request_context(MWK_REQ_CTXT *rc);
+
+/*
+ * Release the memory and logging callbacks used by the request from the
+ * reusable WebAuth context at the end of the request.
+ */
+void
+mwk_request_context_release(MWK_REQ_CTXT *rc);
+
 /*
  * lock a mutex
  */
@@ -272,18 +335,6 @@ mwk_log_webauth_error(struct webauth_context *,
                       const char *func,
                       const char *extra);
 
-/*
- * initialize a string for use with mwk_append_string
- */
-void
-mwk_init_string(MWK_STRING *string, apr_pool_t *pool);
-
-/*
- * given an MWK_STRING, append some new data to it.
- */
-void
-mwk_append_string(MWK_STRING *string, const char *in_data, size_t in_size);
-
 int
 mwk_cache_keyring(server_rec *serv, struct config *sconf);
 
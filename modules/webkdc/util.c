@@ -2,7 +2,7 @@
  * Utility functions for Apache WebKDC module.
  *
  * Written by Roland Schemers
- * Copyright 2002, 2003, 2009, 2011, 2012, 2013
+ * Copyright 2002, 2003, 2009, 2011, 2012, 2013, 2014
  *     The Board of Trustees of the Leland Stanford Junior University
  *
  * See LICENSE for licensing terms.
@@ -14,6 +14,7 @@
 
 #include <apr_errno.h>
 #include <apr_thread_mutex.h>
+#include <apr_thread_proc.h>
 #include <stdlib.h>
 #include <unistd.h>
 
@@ -21,14 +22,23 @@
 #include <webauth/basic.h>
 #include <webauth/keys.h>
 #include <webauth/krb5.h>
+#include <webauth/webkdc.h>
 
 APLOG_USE_MODULE(webkdc);
 
 /* Initiaized in child. */
 static apr_thread_mutex_t *mwk_mutex[MWK_MUTEX_MAX];
 
-/* The increment used for resizing an MWK_STRING. */
-#define CHUNK_SIZE 4096
+#if APR_HAS_THREADS
+/*
+ * A per-thread request context.  The context is allocated in its own root
+ * pool so that it can be freed when the thread exits.
+ */
+struct thread_context {
+    apr_pool_t *pool;
+    struct webauth_context *ctx;
+};
+#endif
 
 
 /*
@@ -123,50 +133,178 @@ mwk_unlock_mutex(MWK_REQ_CTXT *rc, enum mwk_mutex_type type)
 }
 
 
+#if APR_HAS_THREADS
 /*
- * Given an APR pool, initialize an MWK_STRING structure and set its pool to
- * use that pool.
+ * Destructor for a per-thread request context, called on thread exit.
  */
-void
-mwk_init_string(MWK_STRING *string, apr_pool_t *pool)
+static void
+free_thread_context(void *data)
 {
-    memset(string, 0, sizeof(MWK_STRING));
-    string->pool = pool;
+    struct thread_context *tc = data;
+
+    apr_pool_destroy(tc->pool);
 }
+#endif
 
 
 /*
- * Given an MWA_STRING, append some new data to it.  The size of the data is
- * optional; if not given, it will be determined via strlen on in_data.  If
- * in_size is given, in_data may contain embedded nuls.  However, the string
- * is always nul-terminated.
+ * Validate the WebKDC and user information service configuration for a
+ * server and store it in the server WebAuth context, and then set up storage
+ * for the reusable request contexts that share it.  This is done once per
+ * child before any request threads start, so the configuration is read-only
+ * afterwards.  On failure, log the error and leave request_ok false so that
+ * requests to this server fail.
  */
 void
-mwk_append_string(MWK_STRING *string, const char *in_data, size_t in_size)
+mwk_init_context(server_rec *s, apr_pool_t *p)
 {
-    size_t needed_size;
+    struct config *sconf;
+    struct webauth_webkdc_config config;
+    int status;
+#if APR_HAS_THREADS
+    apr_status_t astatus;
+    char errbuff[512];
+#endif
+
+    sconf = ap_get_module_config(s->module_config, &webkdc_module);
+
+    /* Set up the WebKDC configuration. */
+    config.fast_armor_path  = sconf->fast_armor_path;
+    config.id_acl_path      = sconf->identity_acl_path;
+    config.keytab_path      = sconf->keytab_path;
+    config.principal        = sconf->keytab_principal;
+    config.proxy_lifetime   = sconf->proxy_lifetime;
+    config.login_time_limit = sconf->login_time_limit;
+    config.permitted_realms = sconf->permitted_realms;
+    config.local_realms     = sconf->local_realms;
+    status = webauth_webkdc_config(sconf->ctx, &config);
+    if (status != WA_ERR_NONE) {
+        ap_log_error(APLOG_MARK, APLOG_CRIT, 0, s,
+                     "mod_webkdc: webauth_webkdc_config failed: %s",
+                     webauth_error_message(sconf->ctx, status));
+        return;
+    }
+
+    /* Set up the user information service configuration. */
+    if (sconf->userinfo_config != NULL) {
+        struct webauth_user_config *user = sconf->userinfo_config;
+
+        user->identity       = sconf->userinfo_principal;
+        user->timeout        = sconf->userinfo_timeout;
+        user->ignore_failure = sconf->userinfo_ignore_fail;
+        user->json           = sconf->userinfo_json;
+        user->keytab         = sconf->keytab_path;
+        user->principal      = sconf->keytab_principal;
+        status = webauth_user_config(sconf->ctx, user);
+        if (status != WA_ERR_NONE) {
+            ap_log_error(APLOG_MARK, APLOG_CRIT, 0, s,
+                         "mod_webkdc: webauth_user_config failed: %s",
+                         webauth_error_message(sconf->ctx, status));
+            return;
+        }
+    }
+
+    /*
+     * Set up the cache of service tickets for cred tokens.  Failure only
+     * means that every ticket is requested from the KDC.
+     */
+    status = webauth_krb5_ticket_cache_new(sconf->ctx, TICKET_CACHE_SLOTS,
+                                           TICKET_CACHE_MINIMUM,
+                                           &sconf->tickets);
+    if (status != WA_ERR_NONE)
+        ap_log_error(APLOG_MARK, APLOG_WARNING, 0, s,
+                     "mod_webkdc: cannot create ticket cache: %s",
+                     webauth_error_message(sconf->ctx, status));
 
-    if (in_size == 0)
-        in_size = strlen(in_data);
-    needed_size = string->size + in_size;
+    /*
+     * With threads, each thread creates its context on first use.  Without
+     * them, there is only ever one request at a time in this child.
+     */
+#if APR_HAS_THREADS
+    astatus = apr_threadkey_private_create(&sconf->request_key,
+                                           free_thread_context, p);
+    if (astatus != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_CRIT, 0, s,
+                     "mod_webkdc: mwk_init_context: "
+                     "apr_threadkey_private_create: %s (%d)",
+                     apr_strerror(astatus, errbuff, sizeof(errbuff)),
+                     astatus);
+        return;
+    }
+#else
+    status = webauth_context_init_shared(&sconf->request_ctx, p, sconf->ctx);
+    if (status != WA_ERR_NONE) {
+        ap_log_error(APLOG_MARK, APLOG_CRIT, 0, s,
+                     "mod_webkdc: webauth_context_init failed: %s",
+                     webauth_error_message(NULL, status));
+        return;
+    }
+#endif
+    sconf->request_ok = true;
+}
 
-    if (string->data == NULL || needed_size > string->capacity) {
-        char *new_data;
 
-        while (string->capacity < needed_size + 1)
-            string->capacity += CHUNK_SIZE;
-        new_data = apr_palloc(string->pool, string->capacity);
-        if (string->data != NULL)
-            memcpy(new_data, string->data, string->size);
+/*
+ * Find the reusable WebAuth context for the current thread, creating it if
+ * this is the first request the thread has handled for this server, and
+ * reset it for the new request.  All per-request allocations then come from
+ * a subpool that is cleared rather than recreated on each request.
+ */
+int
+mwk_request_context(MWK_REQ_CTXT *rc)
+{
+#if APR_HAS_THREADS
+    struct thread_context *tc;
+    void *data;
+    apr_pool_t *pool;
+    int status;
 
-        /* We don't have to free existing data since it from a pool. */
-        string->data = new_data;
+    if (apr_threadkey_private_get(&data, rc->sconf->request_key)
+        != APR_SUCCESS)
+        return WA_ERR_APR;
+    tc = data;
+    if (tc == NULL) {
+        if (apr_pool_create(&pool, NULL) != APR_SUCCESS)
+            return WA_ERR_APR;
+        tc = apr_palloc(pool, sizeof(struct thread_context));
+        tc->pool = pool;
+        status = webauth_context_init_shared(&tc->ctx, pool, rc->sconf->ctx);
+        if (status != WA_ERR_NONE) {
+            apr_pool_destroy(pool);
+            return status;
+        }
+        if (apr_threadkey_private_set(tc, rc->sconf->request_key)
+            != APR_SUCCESS) {
+            apr_pool_destroy(pool);
+            return WA_ERR_APR;
+        }
     }
-    memcpy(string->data+string->size, in_data, in_size);
-    string->size = needed_size;
+    rc->ctx = tc->ctx;
+#else
+    rc->ctx = rc->sconf->request_ctx;
+#endif
+    return webauth_context_reset(rc->ctx);
+}
 
-    /* Always nul-terminate.  We have space becase of the +1 above. */
-    string->data[string->size] = '\0';
+
+/*
+ * Release everything the current request allocated from its WebAuth context,
+ * including Kerberos contexts and credential caches, and drop the logging
+ * callbacks pointing at the request, so that nothing from the request stays
+ * in the reused context while the thread waits for its next request.  This
+ * is called at the end of the handler rather than from a cleanup on the
+ * request pool, since with the event MPM that pool may be destroyed by
+ * another thread, which could be using its own context at the time.
+ */
+void
+mwk_request_context_release(MWK_REQ_CTXT *rc)
+{
+    webauth_log_callback(rc->ctx, WA_LOG_TRACE,  NULL, NULL);
+    webauth_log_callback(rc->ctx, WA_LOG_INFO,   NULL, NULL);
+    webauth_log_callback(rc->ctx, WA_LOG_NOTICE, NULL, NULL);
+    webauth_log_callback(rc->ctx, WA_LOG_WARN,   NULL, NULL);
+    webauth_context_reset(rc->ctx);
+    rc->ctx = NULL;
 }
 
 
@@ -250,6 +388,8 @@ mwk_cache_keyring(server_rec *serv, struct config *sconf)
                               "webauth_keyring_auto_update",
                               sconf->keyring_path);
     } else {
+        webauth_keyring_set_format(sconf->ring, sconf->token_format);
+
         /*
          * We have to make sure the Apache child processes have access to the
          * keyring file.
@@ -141,6 +141,7 @@ __END__
 =for stopwords
 WebAuth API keyring keyrings KEYRING CTX ATTRS login Allbery const
 Kerberos TGT SPRINC Canonicalization Kerberos-related decrypt decrypted
+WebKDC mod_webkdc remctl WebKdcUserInfoURL base64-decoded base64-encoded
 
 =head1 NAME
 
@@ -293,6 +294,12 @@ Create a new WebAuth::Krb5 object and return it.  This is used as a context
 for all Kerberos-related WebAuth calls.  See L<WebAuth::Krb5> for supported
 methods.
 
+=item replay_open (ARGS)
+
+Open a shared replay cache and return a new WebAuth::Replay object for it.
+ARGS is a reference to a hash of configuration.  See L<WebAuth::Replay>
+for the supported configuration keys and methods.
+
 =item token_decode (INPUT, KEYRING)
 
 Given an encrypted and base64-encoded token, decode and decrypt it using
@@ -325,6 +332,47 @@ not normally be used.  It's primarily available to aid in constructing
 test suites.  A WebAuth::Token subclass and its encode() method should
 normally be used instead.
 
+=item user_config (ARGS)
+
+Configure the user information service used by webkdc_login().  ARGS is a
+reference to a hash with the keys host, port, command, identity, keytab,
+principal, timeout, ignore_failure, and json, which correspond to the
+parts of the WebKdcUserInfoURL setting and the other mod_webkdc user
+information directives.  The only supported protocol is remctl.
+
+=item webkdc_config (ARGS)
+
+Configure this WebAuth context for WebKDC logins.  ARGS is a reference to
+a hash with the keys keytab, principal, id_acl, fast_armor_cache,
+proxy_lifetime, and login_time_limit, plus local_realms and
+permitted_realms, which must be references to arrays of realms.  These
+correspond to the mod_webkdc directives of the same names.  The context
+should be configured only once and then kept for the life of the process.
+
+=item webkdc_login (REQUEST, KEYRING)
+
+Process a WebKDC login, as mod_webkdc does for a <requestTokenRequest>,
+using the configuration set by webkdc_config() and user_config().  KEYRING
+is the WebKDC keyring.  The login is done in a temporary WebAuth context
+sharing this context's configuration, so memory used by the login is freed
+when it finishes.
+
+REQUEST is a reference to a hash with the keys service, request,
+authz_subject, login_state, client_ip, remote_user, local_ip, local_port,
+remote_ip, and remote_port, holding the encoded tokens and strings from
+the request, and wkproxies, wkfactors, and logins, which are references
+to arrays.  wkproxies holds hashes with type, token, and source keys, and
+the other two hold encoded tokens.  login_state must already be
+base64-decoded.
+
+The return value is a reference to a hash with the keys status and, if it
+isn't WA_ERR_NONE, error, the corresponding message.  Login failures are
+reported this way rather than as exceptions.  The other keys match the
+fields of the WebKDC login response in the C API: factors_wanted,
+factors_configured, and permitted_authz are arrays of strings; proxies,
+factor_tokens, logins, and devices are arrays of hashes; app_state and
+login_state are not base64-encoded.
+
 =back
 
 =head1 CONSTANTS
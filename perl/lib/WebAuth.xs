@@ -33,9 +33,12 @@
 #include <XSUB.h>
 
 #include <webauth/basic.h>
+#include <webauth/factors.h>
 #include <webauth/keys.h>
 #include <webauth/krb5.h>
+#include <webauth/replay.h>
 #include <webauth/tokens.h>
+#include <webauth/webkdc.h>
 
 /*
  * These typedefs are needed for xsubpp to work its magic with type
@@ -46,10 +49,11 @@ typedef const struct webauth_key *              WebAuth__Key;
 typedef const struct webauth_keyring_entry *    WebAuth__KeyringEntry;
 
 /*
- * For WebAuth::Keyring and WebAuth::Krb5, we need to stash a copy of the
- * parent context somewhere so that we don't require it as an argument to all
- * methods and so that we can keep a reference to it so that the context is
- * not garbage-collected until all of its objects are out of scope.
+ * For WebAuth::Keyring, WebAuth::Krb5, and WebAuth::Replay, we need to stash
+ * a copy of the parent context somewhere so that we don't require it as an
+ * argument to all methods and so that we can keep a reference to it so that
+ * the context is not garbage-collected until all of its objects are out of
+ * scope.
  */
 typedef struct {
     struct webauth_context *ctx;
@@ -59,6 +63,10 @@ typedef struct {
     SV *ctx;
     struct webauth_krb5 *kc;
 } *WebAuth__Krb5;
+typedef struct {
+    SV *ctx;
+    struct webauth_replay *replay;
+} *WebAuth__Replay;
 
 /* Used to generate the Perl glue for WebAuth constants. */
 #define IV_CONST(X) newCONSTSUB(stash, #X, newSViv(X))
@@ -382,6 +390,290 @@ webauth_croak(struct webauth_context *ctx, const char *detail, int s)
 }
 
 
+/*
+ * Fetch a string value from a hash of arguments, returning NULL if the key is
+ * not present or its value is undef.
+ */
+static const char *
+fetch_string(HV *hash, const char *key)
+{
+    SV **value;
+
+    value = hv_fetch(hash, key, strlen(key), 0);
+    if (value == NULL || !SvOK(*value))
+        return NULL;
+    return SvPV_nolen(*value);
+}
+
+
+/*
+ * Check that the value stored under the given key in a hash of arguments is
+ * missing, undef, or an array reference, croaking if not.  If proxies is
+ * true, also check that each element is a hash with type and token keys.
+ * This is done before allocating any memory that the croak would leak, so
+ * that fetch_strings and fetch_proxies can't fail.
+ */
+static void
+check_array(HV *hash, const char *key, bool proxies)
+{
+    SV **value;
+    AV *av;
+    HV *entry;
+    I32 i;
+
+    value = hv_fetch(hash, key, strlen(key), 0);
+    if (value == NULL || !SvOK(*value))
+        return;
+    if (!SvROK(*value) || SvTYPE(SvRV(*value)) != SVt_PVAV)
+        croak("%s argument is not an array reference", key);
+    if (!proxies)
+        return;
+    av = (AV *) SvRV(*value);
+    for (i = 0; i <= av_len(av); i++) {
+        value = av_fetch(av, i, 0);
+        if (value == NULL || !SvROK(*value)
+            || SvTYPE(SvRV(*value)) != SVt_PVHV)
+            croak("%s argument contains a non-hash", key);
+        entry = (HV *) SvRV(*value);
+        if (fetch_string(entry, "type") == NULL
+            || fetch_string(entry, "token") == NULL)
+            croak("%s argument entry missing type or token", key);
+    }
+}
+
+
+/*
+ * Convert the array reference stored under the given key in a hash of
+ * arguments to an APR array of strings allocated from the given pool.  A
+ * missing or undef value produces an empty array.  The value must already
+ * have been checked with check_array.  The strings point into the Perl
+ * scalars and are only valid as long as the hash is.
+ */
+static apr_array_header_t *
+fetch_strings(apr_pool_t *pool, HV *hash, const char *key)
+{
+    apr_array_header_t *array;
+    SV **value;
+    AV *av;
+    I32 i;
+
+    array = apr_array_make(pool, 1, sizeof(const char *));
+    value = hv_fetch(hash, key, strlen(key), 0);
+    if (value == NULL || !SvOK(*value))
+        return array;
+    av = (AV *) SvRV(*value);
+    for (i = 0; i <= av_len(av); i++) {
+        value = av_fetch(av, i, 0);
+        if (value != NULL && SvOK(*value))
+            APR_ARRAY_PUSH(array, const char *) = SvPV_nolen(*value);
+    }
+    return array;
+}
+
+
+/*
+ * Convert the array reference of webkdc-proxy token hashes stored under the
+ * given key in a hash of arguments to an APR array of struct
+ * webauth_webkdc_proxy_data allocated from the given pool.  Each hash has
+ * keys type, token, and source.  As with fetch_strings, the value must
+ * already have been checked with check_array, and the strings are only valid
+ * as long as the hash is.
+ */
+static apr_array_header_t *
+fetch_proxies(apr_pool_t *pool, HV *hash, const char *key)
+{
+    apr_array_header_t *array;
+    struct webauth_webkdc_proxy_data *pd;
+    SV **value;
+    AV *av;
+    HV *entry;
+    I32 i;
+
+    array = apr_array_make(pool, 1, sizeof(struct webauth_webkdc_proxy_data));
+    value = hv_fetch(hash, key, strlen(key), 0);
+    if (value == NULL || !SvOK(*value))
+        return array;
+    av = (AV *) SvRV(*value);
+    for (i = 0; i <= av_len(av); i++) {
+        value = av_fetch(av, i, 0);
+        entry = (HV *) SvRV(*value);
+        pd = &APR_ARRAY_PUSH(array, struct webauth_webkdc_proxy_data);
+        pd->type   = fetch_string(entry, "type");
+        pd->token  = fetch_string(entry, "token");
+        pd->source = fetch_string(entry, "source");
+    }
+    return array;
+}
+
+
+/*
+ * Store a string in a hash, doing nothing if the string is NULL.
+ */
+static void
+store_string(HV *hash, const char *key, const char *string)
+{
+    if (string == NULL)
+        return;
+    if (hv_store(hash, key, strlen(key), newSVpv(string, 0), 0) == NULL)
+        croak("cannot store %s in hash", key);
+}
+
+
+/*
+ * Store a reference to the given SV in a hash.  Takes over the reference
+ * count of the SV.
+ */
+static void
+store_ref(HV *hash, const char *key, SV *sv)
+{
+    if (hv_store(hash, key, strlen(key), newRV_noinc(sv), 0) == NULL)
+        croak("cannot store %s in hash", key);
+}
+
+
+/*
+ * Convert a set of factors to a Perl array of factor codes.
+ */
+static AV *
+factors_to_av(struct webauth_context *ctx,
+              const struct webauth_factors *factors)
+{
+    const apr_array_header_t *array;
+    AV *av;
+    int i;
+
+    array = webauth_factors_array(ctx, factors);
+    av = newAV();
+    for (i = 0; i < array->nelts; i++)
+        av_push(av, newSVpv(APR_ARRAY_IDX(array, i, const char *), 0));
+    return av;
+}
+
+
+/*
+ * Convert a webauth_webkdc_login_response struct and the status of the login
+ * into a Perl hash.  The hash keys match the struct members, with arrays of
+ * structs converted to arrays of hashes and sets of factors converted to
+ * arrays of factor codes.
+ */
+static HV *
+login_response_to_hv(struct webauth_context *ctx, int status,
+                     const struct webauth_webkdc_login_response *response)
+{
+    HV *hash, *entry;
+    AV *av;
+    int i;
+
+    hash = newHV();
+    if (hv_stores(hash, "status", newSViv(status)) == NULL)
+        croak("cannot store status in hash");
+    if (status != WA_ERR_NONE)
+        store_string(hash, "error", webauth_error_message(ctx, status));
+    if (response == NULL)
+        return hash;
+    store_string(hash, "user_message", response->user_message);
+    store_string(hash, "login_state", response->login_state);
+    if (response->factors_wanted != NULL)
+        store_ref(hash, "factors_wanted",
+                  (SV *) factors_to_av(ctx, response->factors_wanted));
+    if (response->factors_configured != NULL)
+        store_ref(hash, "factors_configured",
+                  (SV *) factors_to_av(ctx, response->factors_configured));
+    store_string(hash, "default_device", response->default_device);
+    store_string(hash, "default_factor", response->default_factor);
+    if (response->proxies != NULL) {
+        const struct webauth_webkdc_proxy_data *pd;
+
+        av = newAV();
+        for (i = 0; i < response->proxies->nelts; i++) {
+            pd = &APR_ARRAY_IDX(response->proxies, i,
+                                struct webauth_webkdc_proxy_data);
+            entry = newHV();
+            store_string(entry, "type", pd->type);
+            store_string(entry, "token", pd->token);
+            av_push(av, newRV_noinc((SV *) entry));
+        }
+        store_ref(hash, "proxies", (SV *) av);
+    }
+    if (response->factor_tokens != NULL) {
+        const struct webauth_webkdc_factor_data *fd;
+
+        av = newAV();
+        for (i = 0; i < response->factor_tokens->nelts; i++) {
+            fd = &APR_ARRAY_IDX(response->factor_tokens, i,
+                                struct webauth_webkdc_factor_data);
+            entry = newHV();
+            store_string(entry, "token", fd->token);
+            if (hv_stores(entry, "expiration", newSViv(fd->expiration))
+                == NULL)
+                croak("cannot store expiration in hash");
+            av_push(av, newRV_noinc((SV *) entry));
+        }
+        store_ref(hash, "factor_tokens", (SV *) av);
+    }
+    store_string(hash, "return_url", response->return_url);
+    store_string(hash, "requester", response->requester);
+    store_string(hash, "subject", response->subject);
+    store_string(hash, "authz_subject", response->authz_subject);
+    store_string(hash, "result", response->result);
+    store_string(hash, "result_type", response->result_type);
+    store_string(hash, "login_cancel", response->login_cancel);
+    if (response->app_state != NULL) {
+        SV *state;
+
+        state = newSVpvn(response->app_state, response->app_state_len);
+        if (hv_stores(hash, "app_state", state) == NULL)
+            croak("cannot store app_state in hash");
+    }
+    if (response->logins != NULL) {
+        const struct webauth_login *login;
+
+        av = newAV();
+        for (i = 0; i < response->logins->nelts; i++) {
+            login = &APR_ARRAY_IDX(response->logins, i, struct webauth_login);
+            entry = newHV();
+            store_string(entry, "ip", login->ip);
+            store_string(entry, "hostname", login->hostname);
+            if (login->timestamp != 0)
+                if (hv_stores(entry, "timestamp", newSViv(login->timestamp))
+                    == NULL)
+                    croak("cannot store timestamp in hash");
+            av_push(av, newRV_noinc((SV *) entry));
+        }
+        store_ref(hash, "logins", (SV *) av);
+    }
+    if (response->password_expires != 0)
+        if (hv_stores(hash, "password_expires",
+                      newSViv(response->password_expires)) == NULL)
+            croak("cannot store password_expires in hash");
+    if (response->permitted_authz != NULL) {
+        av = newAV();
+        for (i = 0; i < response->permitted_authz->nelts; i++)
+            av_push(av, newSVpv(APR_ARRAY_IDX(response->permitted_authz, i,
+                                              const char *), 0));
+        store_ref(hash, "permitted_authz", (SV *) av);
+    }
+    if (response->devices != NULL) {
+        const struct webauth_device *device;
+
+        av = newAV();
+        for (i = 0; i < response->devices->nelts; i++) {
+            device = &APR_ARRAY_IDX(response->devices, i,
+                                    struct webauth_device);
+            entry = newHV();
+            store_string(entry, "name", device->name);
+            store_string(entry, "id", device->id);
+            if (device->factors != NULL)
+                store_ref(entry, "factors",
+                          (SV *) factors_to_av(ctx, device->factors));
+            av_push(av, newRV_noinc((SV *) entry));
+        }
+        store_ref(hash, "devices", (SV *) av);
+    }
+    return hash;
+}
+
+
 /* XS code below this point. */
 
 MODULE = WebAuth        PACKAGE = WebAuth    PREFIX = webauth_
@@ -628,6 +920,51 @@ krb5_new(self)
     RETVAL
 
 
+WebAuth::Replay
+replay_open(self, args)
+    WebAuth self
+    HV *args
+  PREINIT:
+    WebAuth__Replay replay;
+    struct webauth_replay_config config;
+    int status;
+    SV **value;
+  CODE:
+{
+    CROAK_NULL_SELF(self, "WebAuth", "replay_open");
+    memset(&config, 0, sizeof(config));
+    value = hv_fetchs(args, "path", 0);
+    if (value == NULL)
+        croak("path argument required for WebAuth::replay_open");
+    config.path = SvPV_nolen(*value);
+    value = hv_fetchs(args, "slots", 0);
+    if (value != NULL)
+        config.slots = SvUV(*value);
+    value = hv_fetchs(args, "replay_timeout", 0);
+    if (value != NULL)
+        config.replay_timeout = SvUV(*value);
+    value = hv_fetchs(args, "limit_threshold", 0);
+    if (value != NULL)
+        config.limit_threshold = SvUV(*value);
+    value = hv_fetchs(args, "limit_interval", 0);
+    if (value != NULL)
+        config.limit_interval = SvUV(*value);
+    replay = malloc(sizeof(*replay));
+    if (replay == NULL)
+        croak("cannot allocate memory");
+    status = webauth_replay_open(self, &config, &replay->replay);
+    if (status != WA_ERR_NONE) {
+        free(replay);
+        webauth_croak(self, "webauth_replay_open", status);
+    }
+    replay->ctx = SvRV(ST(0));
+    SvREFCNT_inc_simple_void_NN(replay->ctx);
+    RETVAL = replay;
+}
+  OUTPUT:
+    RETVAL
+
+
 SV *
 token_decode(self, input, ring)
     WebAuth self
@@ -768,6 +1105,151 @@ token_encrypt(self, input, ring)
     RETVAL
 
 
+void
+user_config(self, args)
+    WebAuth self
+    HV *args
+  PREINIT:
+    struct webauth_user_config config;
+    const char *protocol;
+    int status;
+    SV **value;
+  CODE:
+{
+    CROAK_NULL_SELF(self, "WebAuth", "user_config");
+    memset(&config, 0, sizeof(config));
+    protocol = fetch_string(args, "protocol");
+    if (protocol == NULL || strcmp(protocol, "remctl") == 0)
+        config.protocol = WA_PROTOCOL_REMCTL;
+    else
+        croak("invalid user information protocol %s", protocol);
+    config.host      = fetch_string(args, "host");
+    config.identity  = fetch_string(args, "identity");
+    config.command   = fetch_string(args, "command");
+    config.keytab    = fetch_string(args, "keytab");
+    config.principal = fetch_string(args, "principal");
+    value = hv_fetchs(args, "port", 0);
+    if (value != NULL)
+        config.port = SvUV(*value);
+    value = hv_fetchs(args, "timeout", 0);
+    if (value != NULL)
+        config.timeout = SvUV(*value);
+    value = hv_fetchs(args, "ignore_failure", 0);
+    if (value != NULL)
+        config.ignore_failure = SvTRUE(*value);
+    value = hv_fetchs(args, "json", 0);
+    if (value != NULL)
+        config.json = SvTRUE(*value);
+    status = webauth_user_config(self, &config);
+    if (status != WA_ERR_NONE)
+        webauth_croak(self, "webauth_user_config", status);
+}
+
+
+void
+webkdc_config(self, args)
+    WebAuth self
+    HV *args
+  PREINIT:
+    struct webauth_webkdc_config config;
+    apr_pool_t *pool;
+    int status;
+    SV **value;
+  CODE:
+{
+    CROAK_NULL_SELF(self, "WebAuth", "webkdc_config");
+    check_array(args, "local_realms", false);
+    check_array(args, "permitted_realms", false);
+    if (apr_pool_create(&pool, NULL) != APR_SUCCESS)
+        croak("cannot create APR pool");
+    memset(&config, 0, sizeof(config));
+    config.keytab_path     = fetch_string(args, "keytab");
+    config.id_acl_path     = fetch_string(args, "id_acl");
+    config.principal       = fetch_string(args, "principal");
+    config.fast_armor_path = fetch_string(args, "fast_armor_cache");
+    value = hv_fetchs(args, "proxy_lifetime", 0);
+    if (value != NULL)
+        config.proxy_lifetime = SvUV(*value);
+    value = hv_fetchs(args, "login_time_limit", 0);
+    if (value != NULL)
+        config.login_time_limit = SvUV(*value);
+    config.local_realms     = fetch_strings(pool, args, "local_realms");
+    config.permitted_realms = fetch_strings(pool, args, "permitted_realms");
+
+    /* webauth_webkdc_config copies everything, so the pool can go. */
+    status = webauth_webkdc_config(self, &config);
+    apr_pool_destroy(pool);
+    if (status != WA_ERR_NONE)
+        webauth_croak(self, "webauth_webkdc_config", status);
+}
+
+
+SV *
+webkdc_login(self, args, ring)
+    WebAuth self
+    HV *args
+    WebAuth::Keyring ring
+  PREINIT:
+    struct webauth_context *ctx;
+    struct webauth_webkdc_login_request request;
+    struct webauth_webkdc_login_response *response;
+    apr_pool_t *pool;
+    int status;
+    HV *hash;
+  CODE:
+{
+    CROAK_NULL_SELF(self, "WebAuth", "webkdc_login");
+    CROAK_NULL(ring, "WebAuth::Keyring", "WebAuth::webkdc_login");
+
+    /* Check the arguments before allocating anything. */
+    memset(&request, 0, sizeof(request));
+    request.service       = fetch_string(args, "service");
+    request.authz_subject = fetch_string(args, "authz_subject");
+    request.login_state   = fetch_string(args, "login_state");
+    request.request       = fetch_string(args, "request");
+    request.client_ip     = fetch_string(args, "client_ip");
+    request.remote_user   = fetch_string(args, "remote_user");
+    request.local_ip      = fetch_string(args, "local_ip");
+    request.local_port    = fetch_string(args, "local_port");
+    request.remote_ip     = fetch_string(args, "remote_ip");
+    request.remote_port   = fetch_string(args, "remote_port");
+    if (request.service == NULL || request.request == NULL)
+        croak("service and request arguments required for"
+              " WebAuth::webkdc_login");
+    check_array(args, "wkproxies", true);
+    check_array(args, "wkfactors", false);
+    check_array(args, "logins", false);
+
+    /*
+     * Do the login in a new context, sharing the configuration of this one,
+     * whose memory is freed at the end of the call.  Otherwise, each login
+     * would grow the pool of a context that may live as long as the process.
+     */
+    if (apr_pool_create(&pool, NULL) != APR_SUCCESS)
+        croak("cannot create APR pool");
+    status = webauth_context_init_shared(&ctx, pool, self);
+    if (status != WA_ERR_NONE) {
+        apr_pool_destroy(pool);
+        webauth_croak(self, "webauth_context_init_shared", status);
+    }
+    request.wkproxies = fetch_proxies(pool, args, "wkproxies");
+    request.wkfactors = fetch_strings(pool, args, "wkfactors");
+    request.logins    = fetch_strings(pool, args, "logins");
+
+    /*
+     * Login failures are reported in the returned hash rather than as
+     * exceptions, since many of them are part of the normal login flow.
+     */
+    response = NULL;
+    status = webauth_webkdc_login(ctx, &request, &response, ring->ring);
+    hash = login_response_to_hv(ctx, status, response);
+    apr_pool_destroy(pool);
+    RETVAL = newRV_noinc((SV *) hash);
+}
+  OUTPUT:
+    RETVAL
+
+
 MODULE = WebAuth  PACKAGE = WebAuth::Key
 
 enum webauth_key_type
@@ -1306,6 +1788,129 @@ change_password(self, password, args = NULL)
 }
 
 
+MODULE = WebAuth  PACKAGE = WebAuth::Replay
+
+void
+DESTROY(self)
+    WebAuth::Replay self
+  CODE:
+{
+    if (self == NULL)
+        return;
+    SvREFCNT_dec(self->ctx);
+    free(self);
+}
+
+
+void
+add(self, token, now = 0)
+    WebAuth::Replay self
+    SV *token
+    time_t now
+  PREINIT:
+    struct webauth_context *ctx;
+    const char *data;
+    STRLEN length;
+    int status;
+  CODE:
+{
+    CROAK_NULL_SELF(self, "WebAuth::Replay", "add");
+    ctx = get_ctx(self->ctx, "WebAuth::Replay");
+    data = SvPV(token, length);
+    if (now == 0)
+        now = time(NULL);
+    status = webauth_replay_add(ctx, self->replay, data, length, now);
+    if (status != WA_ERR_NONE)
+        webauth_croak(ctx, "webauth_replay_add", status);
+}
+
+
+time_t
+check(self, token, now = 0)
+    WebAuth::Replay self
+    SV *token
+    time_t now
+  PREINIT:
+    struct webauth_context *ctx;
+    const char *data;
+    STRLEN length;
+    int status;
+  CODE:
+{
+    CROAK_NULL_SELF(self, "WebAuth::Replay", "check");
+    ctx = get_ctx(self->ctx, "WebAuth::Replay");
+    data = SvPV(token, length);
+    if (now == 0)
+        now = time(NULL);
+    status = webauth_replay_check(ctx, self->replay, data, length, now,
+                                  &RETVAL);
+    if (status != WA_ERR_NONE)
+        webauth_croak(ctx, "webauth_replay_check", status);
+}
+  OUTPUT:
+    RETVAL
+
+
+void
+clear(self, user)
+    WebAuth::Replay self
+    const char *user
+  PREINIT:
+    struct webauth_context *ctx;
+    int status;
+  CODE:
+{
+    CROAK_NULL_SELF(self, "WebAuth::Replay", "clear");
+    ctx = get_ctx(self->ctx, "WebAuth::Replay");
+    status = webauth_replay_clear(ctx, self->replay, user);
+    if (status != WA_ERR_NONE)
+        webauth_croak(ctx, "webauth_replay_clear", status);
+}
+
+
+void
+fail(self, user, now = 0)
+    WebAuth::Replay self
+    const char *user
+    time_t now
+  PREINIT:
+    struct webauth_context *ctx;
+    int status;
+  CODE:
+{
+    CROAK_NULL_SELF(self, "WebAuth::Replay", "fail");
+    ctx = get_ctx(self->ctx, "WebAuth::Replay");
+    if (now == 0)
+        now = time(NULL);
+    status = webauth_replay_fail(ctx, self->replay, user, now);
+    if (status != WA_ERR_NONE)
+        webauth_croak(ctx, "webauth_replay_fail", status);
+}
+
+
+bool
+limited(self, user, now = 0)
+    WebAuth::Replay self
+    const char *user
+    time_t now
+  PREINIT:
+    struct webauth_context *ctx;
+    int status, limited;
+  CODE:
+{
+    CROAK_NULL_SELF(self, "WebAuth::Replay", "limited");
+    ctx = get_ctx(self->ctx, "WebAuth::Replay");
+    if (now == 0)
+        now = time(NULL);
+    status = webauth_replay_limited(ctx, self->replay, user, now, &limited);
+    if (status != WA_ERR_NONE)
+        webauth_croak(ctx, "webauth_replay_limited", status);
+    RETVAL = limited;
+}
+  OUTPUT:
+    RETVAL
+
+
 MODULE = WebAuth        PACKAGE = WebAuth::Token
 
 const char *
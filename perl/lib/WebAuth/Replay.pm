@@ -0,0 +1,176 @@
+# Documentation and supplemental methods for the WebAuth replay cache.
+#
+# The primary implementation of the WebAuth::Replay class is done in the
+# WebAuth XS module since it's primarily implemented in C.  This file adds
+# the constructor and provides version and documentation information.
+#
+# Copyright 2014
+#     The Board of Trustees of the Leland Stanford Junior University
+#
+# See LICENSE for licensing terms.
+
+package WebAuth::Replay;
+
+require 5.006;
+use strict;
+use warnings;
+
+use Carp qw(croak);
+use WebAuth ();
+
+our $VERSION;
+
+# This version matches the version of WebAuth with which this module was
+# released, but with two digits for the minor and patch versions.
+BEGIN {
+    $VERSION = '4.0700';
+}
+
+# Constructor.  Takes a WebAuth context and a hash of configuration and
+# wraps a call to replay_open().  Note that subclasses are not supported
+# since the object is created by the XS module and will always be a
+# WebAuth::Replay object.
+sub new {
+    my ($type, $ctx, $args) = @_;
+    if ($type ne 'WebAuth::Replay') {
+        croak ('subclassing of WebAuth::Replay is not supported');
+    }
+    unless (ref ($ctx) eq 'WebAuth') {
+        croak ('second argument must be a WebAuth object');
+    }
+    return $ctx->replay_open ($args);
+}
+
+1;
+
+=for stopwords
+WebAuth WebLogin username
+
+=head1 NAME
+
+WebAuth::Replay - Shared replay cache and login rate limiting
+
+=head1 SYNOPSIS
+
+    use WebAuth;
+    use WebAuth::Replay;
+
+    my $wa = WebAuth->new;
+    my $replay = WebAuth::Replay->new ($wa, {
+        path            => '/var/lib/webkdc/replay',
+        replay_timeout  => 300,
+        limit_threshold => 5,
+        limit_interval  => 300,
+    });
+    if ($replay->check ($request_token)) {
+        # ... reject replayed request token ...
+    }
+    if ($replay->limited ($username)) {
+        # ... reject login attempt ...
+    }
+
+=head1 DESCRIPTION
+
+A WebAuth::Replay object is a handle to a replay cache of request tokens
+and per-user counts of failed logins, stored in a file that is mapped into
+shared memory.  Every process on the same host that opens the same file
+sees the same data, and updates never block other processes.  This is what
+WebLogin uses to reject replayed request tokens and to rate-limit password
+guessing.
+
+The tables in the file have a fixed size.  If they fill up, the oldest
+entries are discarded to make room for new ones.
+
+=head1 CLASS METHODS
+
+As with WebAuth module functions, failures are signaled by throwing
+WebAuth::Exception rather than by return status.
+
+=over 4
+
+=item new (WEBAUTH, ARGS)
+
+Open the replay cache described by ARGS, attached to the WebAuth context
+WEBAUTH.  This is a convenience wrapper around the WebAuth replay_open()
+method.  ARGS should be a reference to a hash with the following keys:
+
+=over 4
+
+=item path
+
+The path to the file holding the cache.  It will be created if it doesn't
+exist.  The directory containing it must be writable, since a lock file
+is created beside it while the cache is initialized.  Required.
+
+=item slots
+
+The number of entries in each table.  This is only used when creating the
+file.  The default is 65536.
+
+=item replay_timeout
+
+How long, in seconds, a request token is remembered after it was last
+seen.
+
+=item limit_threshold
+
+The number of failed logins within the limit interval at which a user is
+rate-limited.  If 0 or not given, rate limiting is disabled.
+
+=item limit_interval
+
+The length, in seconds, of the sliding window over which failed logins are
+counted.  Required if limit_threshold is set.
+
+=back
+
+=back
+
+=head1 INSTANCE METHODS
+
+As with WebAuth module functions, failures are signaled by throwing
+WebAuth::Exception rather than by return status.  The optional NOW
+argument to several methods is the time to use in place of the current
+time.
+
+=over 4
+
+=item add (TOKEN[, NOW])
+
+Record that the request token TOKEN was used for a successful
+authentication.
+
+=item check (TOKEN[, NOW])
+
+Returns the time TOKEN was last seen if it was seen within the replay
+timeout, and refreshes that time.  Otherwise, returns 0.
+
+=item clear (USER)
+
+Clear the count of failed logins for USER.
+
+=item fail (USER[, NOW])
+
+Record a failed login for USER.
+
+=item limited (USER[, NOW])
+
+Returns true if USER has reached the threshold of failed logins within the
+limit interval, false otherwise.
+
+=back
+
+=head1 CAVEATS
+
+A WebAuth::Replay object will retain a reference to the WebAuth object
+that was used to create it, and the file remains mapped until that WebAuth
+object is freed.
+
+=head1 SEE ALSO
+
+WebAuth(3), WebLogin(3)
+
+This module is part of WebAuth.  The current version is available from
+L<http://webauth.stanford.edu/>.
+
+=cut
@@ -29,6 +29,8 @@ use strict;
 use warnings;
 
 use LWP::UserAgent;
+use MIME::Base64 qw(decode_base64 encode_base64);
+use Time::HiRes ();
 
 use WebAuth qw(3.00 :const);
 use WebAuth::Keyring ();
@@ -99,6 +101,198 @@ sub throw {
     die WebKDC::WebKDCException->new ($code, $error, $pec, $data);
 }
 
+# The number of TLS sessions to remember for reuse when a new connection to
+# the WebKDC is needed.  Normally there is only one WebKDC.
+use constant SSL_SESSION_CACHE_SIZE => 4;
+
+# The user agent for requests to the WebKDC, its TLS session cache, and the
+# process that created them.  These are shared by all requests in a process
+# so that the connection to the WebKDC can be kept open between requests.
+# The session cache has to be a separate object passed to each connection,
+# since IO::Socket::SSL otherwise makes a new one for each SSL context.
+our ($USER_AGENT, $USER_AGENT_PID, $SSL_SESSION_CACHE);
+
+# Return the user agent for requests to the WebKDC, creating it on first use
+# or if this process was forked from the one that created it, since the
+# cached connection can't be shared with the parent.  IO::Socket::SSL is
+# only needed if the WebKDC URL uses https, so do without the session cache
+# if it isn't installed.
+sub user_agent {
+    if (!defined ($USER_AGENT) || $USER_AGENT_PID != $$) {
+        $SSL_SESSION_CACHE = eval {
+            require IO::Socket::SSL;
+            IO::Socket::SSL::Session_Cache->new (SSL_SESSION_CACHE_SIZE);
+        };
+        my %ssl_opts;
+        if ($SSL_SESSION_CACHE) {
+            $ssl_opts{SSL_session_cache} = $SSL_SESSION_CACHE;
+        }
+        $USER_AGENT = LWP::UserAgent->new (
+            keep_alive => $WebKDC::Config::WEBKDC_KEEP_ALIVE,
+            timeout    => $WebKDC::Config::WEBKDC_TIMEOUT,
+            ssl_opts   => \%ssl_opts,
+        );
+        $USER_AGENT_PID = $$;
+    }
+    return $USER_AGENT;
+}
+
+# The WebAuth context configured with the WebKDC settings for in-process
+# logins, created on first use and kept for the life of the process.
+our $LOCAL_CONTEXT;
+
+# The parsed token ACL and the modification time and size of the file it was
+# read from, so that the file is only parsed again when it changes.
+our ($TOKEN_ACL_RULES, $TOKEN_ACL_MTIME, $TOKEN_ACL_SIZE);
+
+# Return the WebAuth context for in-process logins, creating it from the
+# WebKDC settings in WebKDC::Config the first time.  This corresponds to the
+# server configuration of mod_webkdc.
+sub local_context {
+    return $LOCAL_CONTEXT if defined $LOCAL_CONTEXT;
+    my $wa = WebAuth->new;
+    $wa->webkdc_config ({
+        keytab           => $WebKDC::Config::WEBKDC_KEYTAB,
+        principal        => $WebKDC::Config::WEBKDC_PRINCIPAL,
+        id_acl           => $WebKDC::Config::WEBKDC_ID_ACL,
+        fast_armor_cache => $WebKDC::Config::WEBKDC_FAST_ARMOR_CACHE,
+        proxy_lifetime   => $WebKDC::Config::WEBKDC_PROXY_LIFETIME,
+        login_time_limit => $WebKDC::Config::WEBKDC_LOGIN_TIME_LIMIT,
+        local_realms     => [ @WebKDC::Config::WEBKDC_LOCAL_REALMS ],
+        permitted_realms => [ @WebKDC::Config::WEBKDC_PERMITTED_REALMS ],
+    });
+    if ($WebKDC::Config::WEBKDC_USERINFO_URL) {
+        my $url = $WebKDC::Config::WEBKDC_USERINFO_URL;
+        my ($host, $port, $command) = ($url =~ m{
+            \A remctl:// ([^:/]+) (?: : (\d+) )? / (.+) \z
+        }xms);
+        unless (defined $host) {
+            throw (WK_ERR_UNRECOVERABLE_ERROR,
+                   "invalid user information service URL $url");
+        }
+        $wa->user_config ({
+            host           => $host,
+            port           => $port || 0,
+            command        => $command,
+            identity       => $WebKDC::Config::WEBKDC_USERINFO_PRINCIPAL,
+            keytab         => $WebKDC::Config::WEBKDC_KEYTAB,
+            principal      => $WebKDC::Config::WEBKDC_PRINCIPAL,
+            timeout        => $WebKDC::Config::WEBKDC_USERINFO_TIMEOUT,
+            ignore_failure => $WebKDC::Config::WEBKDC_USERINFO_IGNORE_FAIL,
+            json           => $WebKDC::Config::WEBKDC_USERINFO_JSON,
+        });
+    }
+    $LOCAL_CONTEXT = $wa;
+    return $wa;
+}
+
+# Parse the token ACL at the given path into a list of rules, each an
+# anonymous array of a compiled subject pattern, the entry type, and for cred
+# entries the proxy type.  Like mod_webkdc, reject the whole file if any line
+# is malformed: warn and return undef.
+sub read_token_acl {
+    my ($path) = @_;
+    my $acl;
+    unless (open ($acl, '<', $path)) {
+        warn "cannot open token ACL $path: $!\n";
+        return;
+    }
+    my @rules;
+    local $_;
+    while (<$acl>) {
+        next if /^\#/;
+        my @fields = split;
+        next unless @fields;
+        my ($pattern, $kind, $ptype, $cred) = @fields;
+        my $error;
+        if (!defined $kind) {
+            $error = 'missing ACL type';
+        } elsif ($kind eq 'cred') {
+            if (!defined ($ptype) || $ptype ne 'krb5') {
+                $error = 'invalid proxy type '
+                    . (defined ($ptype) ? $ptype : 'null');
+            } elsif (!defined $cred) {
+                $error = 'missing cred';
+            }
+        } elsif ($kind ne 'id') {
+            $error = "unknown ACL type $kind";
+        }
+        if (defined $error) {
+            warn "$error in token ACL $path, line $.\n";
+            close $acl;
+            return;
+        }
+        $pattern = quotemeta $pattern;
+        $pattern =~ s/\\\*/.*/g;
+        $pattern =~ s/\\\?/./g;
+        push (@rules, [ qr/\A$pattern\z/, $kind, $ptype ]);
+    }
+    close $acl;
+    return \@rules;
+}
+
+# Check the token ACL to see whether a WAS may obtain a token.  Takes the
+# subject of the WAS's webkdc-service token, the type of token requested (id
+# or proxy), and, for proxy tokens, the proxy type.  This applies the same
+# rules as mod_webkdc: id tokens need an id entry, proxy tokens need a cred
+# entry for that proxy type, and * and ? in subjects are wildcards.
+sub token_acl_permits {
+    my ($subject, $type, $proxy_type) = @_;
+    my $path = $WebKDC::Config::TOKEN_ACL;
+    return unless $path;
+
+    # Reread the ACL if its size or its modification time, at the full
+    # resolution of the file system, has changed since we last parsed it.  If
+    # it can't be read or parsed, keep using the rules we have, as mod_webkdc
+    # does, and permit nothing if we have none.
+    my ($size, $mtime) = (Time::HiRes::stat ($path))[7, 9];
+    if (!defined $mtime) {
+        warn "cannot stat token ACL $path: $!\n";
+    } elsif (!defined ($TOKEN_ACL_RULES) || $mtime != $TOKEN_ACL_MTIME
+             || $size != $TOKEN_ACL_SIZE) {
+        my $rules = read_token_acl ($path);
+        if (defined $rules) {
+            $TOKEN_ACL_RULES = $rules;
+            ($TOKEN_ACL_MTIME, $TOKEN_ACL_SIZE) = ($mtime, $size);
+        } elsif (defined $TOKEN_ACL_RULES) {
+            warn "using previously loaded token ACL\n";
+        }
+    }
+    return unless defined $TOKEN_ACL_RULES;
+
+    # Look for a matching rule.
+    for my $rule (@$TOKEN_ACL_RULES) {
+        my ($pattern, $kind, $ptype) = @$rule;
+        next unless $subject =~ $pattern;
+        return 1 if ($type eq 'id' && $kind eq 'id');
+        if ($type eq 'proxy' && $kind eq 'cred') {
+            return 1 if $ptype eq $proxy_type;
+        }
+    }
+    return;
+}
+
+# Create and encode a login token from the username and password or OTP in a
+# WebKDC::WebRequest, or return undef if it doesn't contain one.
+sub login_token {
+    my ($wa, $wreq) = @_;
+    my ($user, $pass, $otp) = ($wreq->user, $wreq->pass, $wreq->otp);
+    return unless (defined ($user) && (defined ($pass) || defined ($otp)));
+    my $login_token = WebAuth::Token::Login->new ($wa);
+    $login_token->username ($user);
+    $login_token->creation (time);
+    if (defined $otp) {
+        $login_token->otp ($otp);
+        $login_token->otp_type ($wreq->otp_type);
+    } else {
+        $login_token->password ($pass);
+    }
+    if (defined $wreq->device_id) {
+        $login_token->device_id ($wreq->device_id);
+    }
+    return $login_token->encode (get_keyring ($wa));
+}
+
 # Get the value of the given child of an element or throw an exception if
 # the child can't be found.
 sub get_child_value {
@@ -161,7 +355,7 @@ sub proxy_token_request {
     $webkdc_doc->end ('webkdcProxyTokenRequest');
 
     # Send the request to the WebKDC.
-    my $ua = LWP::UserAgent->new;
+    my $ua = user_agent ();
     my $http_req = HTTP::Request->new (POST => $WebKDC::Config::URL);
     $http_req->content_type ('text/xml');
     $http_req->content ($webkdc_doc->root->to_string);
@@ -202,8 +396,9 @@ sub proxy_token_request {
 # on success.  Throws an exception on failure.
 sub request_token_request {
     my ($wreq, $wresp) = @_;
-    my ($user, $pass, $otp) = ($wreq->user, $wreq->pass, $wreq->otp);
-    my ($otp_type, $device_id) = ($wreq->otp_type, $wreq->device_id);
+    if ($WebKDC::Config::WEBKDC_IN_PROCESS) {
+        return local_request_token_request ($wreq, $wresp);
+    }
     my $request_token = $wreq->request_token;
     my $service_token = $wreq->service_token;
     my $factor_token = $wreq->factor_token;
@@ -221,20 +416,8 @@ sub request_token_request {
     # still go ahead to validate the request token and to get a login cancel
     # token, if any.
     $webkdc_doc->start ('subjectCredential');
-    if (defined ($user) && (defined ($pass) || defined ($otp))) {
-        my $login_token = WebAuth::Token::Login->new ($wa);
-        $login_token->username ($user);
-        $login_token->creation (time);
-        if (defined $otp) {
-            $login_token->otp ($otp);
-            $login_token->otp_type ($otp_type);
-        } else {
-            $login_token->password ($pass);
-        }
-        if (defined $device_id) {
-            $login_token->device_id ($device_id);
-        }
-        my $login_token_str = $login_token->encode (get_keyring ($wa));
+    my $login_token_str = login_token ($wa, $wreq);
+    if (defined $login_token_str) {
         $webkdc_doc->start ('loginToken', undef, $login_token_str)->end;
     }
     if (defined $proxy_cookies) {
@@ -280,9 +463,10 @@ sub request_token_request {
     # Send the request to the WebKDC.  If this fails, retry once.  It's common
     # for this to fail due to EINTR because the FastCGI process manager is
     # trying to shut down the login.fcgi process, in which case it should only
-    # fail once and the second try should succeed.
+    # fail once and the second try should succeed.  The retry also covers the
+    # WebKDC closing a kept-alive connection just as we send the request.
     my $xml = $webkdc_doc->root->to_string (1);
-    my $ua = LWP::UserAgent->new;
+    my $ua = user_agent ();
     my $http_req = HTTP::Request->new (POST => $WebKDC::Config::URL);
     $http_req->content_type ('text/xml');
     $http_req->content ($webkdc_doc->root->to_string);
@@ -476,6 +660,207 @@ sub request_token_request {
     }
 }
 
+# The statuses from webauth_webkdc_login that still produce a full response,
+# with the status as the login error, rather than only an error.  This
+# matches the <requestTokenResponse> and <errorResponse> split in mod_webkdc.
+our %LOGIN_ERRORS = map { $_ => 1 } (
+    WA_PEC_AUTH_REJECTED,
+    WA_PEC_LOA_UNAVAILABLE,
+    WA_PEC_LOGIN_REJECTED,
+    WA_PEC_MULTIFACTOR_REQUIRED,
+    WA_PEC_MULTIFACTOR_UNAVAILABLE,
+    WA_PEC_PROXY_TOKEN_REQUIRED,
+);
+
+# Throw the exception for an error that mod_webkdc would report with an
+# <errorResponse>.  Takes the WebKDC::WebRequest and WebKDC::WebResponse, the
+# protocol error code, and the error message.
+sub throw_webkdc_error {
+    my ($wreq, $wresp, $error_code, $error_message) = @_;
+    my $wk_err = $pec_mapping{$error_code} || WK_ERR_UNRECOVERABLE_ERROR;
+
+    # Dump any existing webkdc-proxy tokens if we are logging in.
+    if ($wk_err == WK_ERR_USER_AND_PASS_REQUIRED) {
+        my $proxy_cookies = $wreq->proxy_cookies;
+        if (defined $proxy_cookies) {
+            for my $name (keys %{$proxy_cookies}) {
+                $wresp->cookie ($name, '');
+            }
+        }
+    }
+    throw ($wk_err, "WebKDC error: $error_message ($error_code)",
+           $error_code);
+}
+
+# The in-process version of request_token_request, used if
+# WEBKDC_IN_PROCESS is set.  Does the checks that mod_webkdc does before
+# calling webauth_webkdc_login, calls it directly via the WebAuth XS
+# bindings, and then fills in the response in the same way as the parsing of
+# the XML response.  Throws an exception on failure.
+sub local_request_token_request {
+    my ($wreq, $wresp) = @_;
+    my $request_token = $wreq->request_token;
+    my $service_token = $wreq->service_token;
+    my $wa = WebAuth->new;
+    my $keyring = get_keyring ($wa);
+
+    # Decode the webkdc-service token and the request token to find the
+    # requester and the type of token requested.
+    my $service = eval { $wa->token_decode ($service_token, $keyring) };
+    if ($@ || !$service->isa ('WebAuth::Token::WebKDCService')) {
+        my $status = ref ($@) ? $@->status : WA_ERR_CORRUPT;
+        my $error_code = ($status == WA_ERR_TOKEN_EXPIRED)
+            ? WA_PEC_SERVICE_TOKEN_EXPIRED
+            : WA_PEC_SERVICE_TOKEN_INVALID;
+        throw_webkdc_error ($wreq, $wresp, $error_code,
+                            'cannot decode service token');
+    }
+    my $request = eval {
+        my $key = $wa->key_create (WA_KEY_AES,
+                                   length ($service->session_key),
+                                   $service->session_key);
+        my $ring = WebAuth::Keyring->new ($wa, $key);
+        $wa->token_decode ($request_token, $ring);
+    };
+    if ($@ || !$request->isa ('WebAuth::Token::Request')) {
+        throw_webkdc_error ($wreq, $wresp, WA_PEC_REQUEST_TOKEN_INVALID,
+                            'cannot decode request token');
+    }
+    my $max_ttl = $WebKDC::Config::WEBKDC_TOKEN_MAX_TTL;
+    if ($request->creation + $max_ttl < time) {
+        throw_webkdc_error ($wreq, $wresp, WA_PEC_REQUEST_TOKEN_STALE,
+                            'request token was stale');
+    }
+
+    # Check that the requesting WAS is permitted to get that type of token.
+    my $type = $request->type || '';
+    my $requester = $service->subject;
+    if ($type eq 'id') {
+        unless (token_acl_permits ($requester, 'id')) {
+            throw_webkdc_error ($wreq, $wresp, WA_PEC_UNAUTHORIZED,
+                                'not authorized to get an id token');
+        }
+    } elsif ($type eq 'proxy') {
+        my $proxy_type = $request->proxy_type;
+        unless (token_acl_permits ($requester, 'proxy', $proxy_type)) {
+            throw_webkdc_error ($wreq, $wresp, WA_PEC_UNAUTHORIZED,
+                                'not authorized to get a proxy token');
+        }
+    }
+
+    # Build the login request.
+    my @proxies;
+    my $proxy_cookies = $wreq->proxy_cookies_rich;
+    if (defined $proxy_cookies) {
+        for my $proxy_type (keys %$proxy_cookies) {
+            my $cookie = $proxy_cookies->{$proxy_type};
+            push (@proxies, {
+                type   => $proxy_type,
+                token  => $cookie->{cookie},
+                source => $cookie->{session_factor},
+            });
+        }
+    }
+    my $login_token = login_token ($wa, $wreq);
+    my $factor_token = $wreq->factor_token;
+    my $login_state = $wreq->login_state;
+    my %login = (
+        service       => $service_token,
+        request       => $request_token,
+        authz_subject => $wreq->authz_subject,
+        wkproxies     => \@proxies,
+        wkfactors     => [ defined ($factor_token) ? $factor_token : () ],
+        logins        => [ defined ($login_token) ? $login_token : () ],
+        client_ip     => $wreq->local_ip_addr,
+        local_ip      => $wreq->local_ip_addr,
+        local_port    => $wreq->local_ip_port,
+        remote_ip     => $wreq->remote_ip_addr,
+        remote_port   => $wreq->remote_ip_port,
+        remote_user   => $wreq->remote_user,
+    );
+    if ($login_state) {
+        $login{login_state} = decode_base64 ($login_state);
+    }
+
+    # Do the login.
+    my $result = local_context ()->webkdc_login (\%login, $keyring);
+    my $status = $result->{status};
+    if ($status != WA_ERR_NONE && !$LOGIN_ERRORS{$status}) {
+        throw_webkdc_error ($wreq, $wresp, $status, $result->{error});
+    }
+
+    # Set the webkdc-proxy and webkdc-factor token cookies.
+    for my $proxy (@{ $result->{proxies} || [] }) {
+        $wresp->cookie ("webauth_wpt_$proxy->{type}", $proxy->{token});
+    }
+    if ($result->{factor_tokens} && @{ $result->{factor_tokens} }) {
+        my $factor = $result->{factor_tokens}[0];
+        $wresp->cookie ('webauth_wft', $factor->{token},
+                        $factor->{expiration});
+    }
+
+    # Multifactor information is only returned if the user has factors
+    # configured, matching <multifactorRequired>.
+    if ($result->{factors_configured}) {
+        for my $factor (@{ $result->{factors_wanted} || [] }) {
+            $wresp->factor_needed ($factor);
+        }
+        for my $factor (@{ $result->{factors_configured} }) {
+            $wresp->factor_configured ($factor);
+        }
+        $wresp->default_device ($result->{default_device})
+            if defined $result->{default_device};
+        $wresp->default_factor ($result->{default_factor})
+            if defined $result->{default_factor};
+        for my $device (@{ $result->{devices} || [] }) {
+            $wresp->devices ($device);
+        }
+    }
+    if ($result->{permitted_authz}) {
+        $wresp->permitted_authz (@{ $result->{permitted_authz} });
+    }
+    for my $login (@{ $result->{logins} || [] }) {
+        my %hist;
+        $hist{timestamp} = $login->{timestamp};
+        $hist{hostname} = $login->{hostname};
+        $hist{ip} = defined ($login->{ip}) ? $login->{ip} : '';
+        $wresp->login_history (\%hist);
+    }
+
+    # Set all of the simple response elements.
+    $wresp->return_url ($result->{return_url});
+    $wresp->response_token ($result->{result});
+    $wresp->response_token_type ($result->{result_type});
+    $wresp->requester_subject ($result->{requester});
+    $wresp->app_state (encode_base64 ($result->{app_state}, ''))
+        if defined $result->{app_state};
+    $wresp->login_canceled_token ($result->{login_cancel})
+        if defined $result->{login_cancel};
+    $wresp->subject ($result->{subject}) if defined $result->{subject};
+    $wresp->authz_subject ($result->{authz_subject})
+        if defined $result->{authz_subject};
+    $wresp->password_expiration ($result->{password_expires})
+        if defined $result->{password_expires};
+    $wresp->user_message ($result->{user_message})
+        if defined $result->{user_message};
+    $wresp->login_state (encode_base64 ($result->{login_state}, ''))
+        if defined $result->{login_state};
+
+    # As with the XML response, check that we got a token if the login
+    # succeeded, and otherwise translate the error into an exception after
+    # setting all of the state.
+    if ($status == WA_ERR_NONE && !defined $result->{result}) {
+        throw (WK_ERR_UNRECOVERABLE_ERROR,
+               'WebKDC login failed: no token returned');
+    }
+    if ($status != WA_ERR_NONE) {
+        my $wk_err = $pec_mapping{$status} || WK_ERR_UNRECOVERABLE_ERROR;
+        throw ($wk_err, "Login error: $result->{error} ($status)", $status,
+               $result->{user_message});
+    }
+    return;
+}
+
 1;
 
 __END__
@@ -483,7 +868,7 @@ __END__
 =for stopwords
 WebAuth webkdc-proxy authenticator WebKDC WebKDC's WebLogin AUTH TGT
 Allbery PEC keyring WebKDCException requestTokenRequest
-webkdcProxyTokenRequest
+webkdcProxyTokenRequest ACL
 
 =head1 NAME
 
@@ -510,6 +895,11 @@ the XML protocol and HTTP requests.  This module is primarily intended for
 use by the WebLogin server to process requests from WebAuth Application
 Servers.
 
+If WEBKDC_IN_PROCESS is set in WebKDC::Config, <requestToken> calls are
+instead handled in the WebLogin process by calling the WebKDC login code
+in the WebAuth library directly, without going through HTTP or XML.
+<webkdcProxyToken> calls always go to the WebKDC.
+
 =head1 FUNCTIONS
 
 =over 4
@@ -569,6 +959,38 @@ communicate with the WebKDC, pass it along, then parse the response.
 The return value is a list of the returned proxy token and subject.  On
 any failure, we throw an exception with a specific error code.
 
+=item local_context ()
+
+Returns the WebAuth context used for in-process logins, configured with
+the WebKDC settings from WebKDC::Config.  The context is created on the
+first call and reused for the life of the process.
+
+=item local_request_token_request (REQUEST, RESPONSE)
+
+The in-process version of request_token_request, used instead of it if
+WEBKDC_IN_PROCESS is set.  It does the same checks of the service and
+request tokens and the token ACL that mod_webkdc does, calls the WebAuth
+webkdc_login() method, and fills in the WebKDC::WebResponse object and
+throws exceptions in the same way as request_token_request.
+
+=item token_acl_permits (SUBJECT, TYPE[, PROXY_TYPE])
+
+Returns true if the token ACL configured in WebKDC::Config allows the WAS
+identified by SUBJECT to obtain a token of TYPE, either C<id> or C<proxy>.
+For proxy tokens, PROXY_TYPE is the requested proxy type.  The ACL is
+parsed once and parsed again only when the file changes.  As with
+mod_webkdc, a file with any malformed line is rejected as a whole, and the
+previously loaded ACL is used instead, or nothing is permitted if no ACL
+has been loaded.
+
+=item user_agent ()
+
+Returns the LWP::UserAgent object used for requests to the WebKDC.  It is
+created on the first call, with the keep-alive and timeout settings from
+WebKDC::Config, and reused by later calls in the same process so that the
+connection to the WebKDC stays open between requests.  A new one is
+created after a fork.
+
 =item get_keyring (WA)
 
 Returns a keyring object from the configured WebLogin keyring path.
@@ -41,6 +41,8 @@ our $KEYRING_PATH = "../conf/webkdc/keyring";
 our $TEMPLATE_PATH = "/usr/local/share/weblogin/generic/templates";
 our $TEMPLATE_COMPILE_PATH = "/usr/local/share/weblogin/generic/templates/ttc";
 our $URL = "https://localhost/webkdc-service/";
+our $WEBKDC_KEEP_ALIVE = 1;
+our $WEBKDC_TIMEOUT = 3 * 60;
 
 our $BYPASS_CONFIRM;
 our $DEFAULT_REALM;
@@ -50,9 +52,25 @@ our @SHIBBOLETH_IDPS;
 our $TOKEN_ACL;
 our $WEBKDC_PRINCIPAL;
 
+our $WEBKDC_IN_PROCESS;
+our $WEBKDC_KEYTAB;
+our $WEBKDC_ID_ACL;
+our $WEBKDC_FAST_ARMOR_CACHE;
+our $WEBKDC_LOGIN_TIME_LIMIT = 5 * 60;
+our $WEBKDC_PROXY_LIFETIME = 0;
+our $WEBKDC_TOKEN_MAX_TTL = 5 * 60;
+our @WEBKDC_LOCAL_REALMS;
+our @WEBKDC_PERMITTED_REALMS;
+our $WEBKDC_USERINFO_URL;
+our $WEBKDC_USERINFO_PRINCIPAL;
+our $WEBKDC_USERINFO_TIMEOUT = 30;
+our $WEBKDC_USERINFO_IGNORE_FAIL;
+our $WEBKDC_USERINFO_JSON;
+
 our @MEMCACHED_SERVERS;
 our $RATE_LIMIT_THRESHOLD;
 our $RATE_LIMIT_INTERVAL = 5 * 60;
+our $REPLAY_CACHE;
 our $REPLAY_TIMEOUT;
 
 our $EXPIRING_PW_WARNING;
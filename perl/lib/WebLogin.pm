@@ -53,8 +53,9 @@ use WebKDC 2.06;
 use WebKDC::Config 1.00;
 use WebKDC::WebKDCException 1.05;
 
-# Required only if we're going to do replay caching or rate limiting.
-if (@WebKDC::Config::MEMCACHED_SERVERS) {
+# Required only if we're going to do replay caching or rate limiting in
+# memcached rather than in the local shared replay cache.
+if (!$WebKDC::Config::REPLAY_CACHE && @WebKDC::Config::MEMCACHED_SERVERS) {
     require Cache::Memcached;
     require Digest::SHA;
 }
@@ -155,9 +156,18 @@ sub setup {
         $self->param ('test_cookie', $TEST_COOKIE);
     }
 
-    # If rate limiting or replay caching is enabled, connect to the memcached
-    # server.
-    if (@WebKDC::Config::MEMCACHED_SERVERS) {
+    # If rate limiting or replay caching is enabled, open the shared replay
+    # cache or connect to the memcached server.  The replay cache keeps its
+    # own WebAuth context alive, since the main one is replaced per query.
+    if ($WebKDC::Config::REPLAY_CACHE) {
+        my $wa = WebAuth->new;
+        $self->{replay} = $wa->replay_open ({
+            path            => $WebKDC::Config::REPLAY_CACHE,
+            replay_timeout  => $WebKDC::Config::REPLAY_TIMEOUT || 0,
+            limit_threshold => $WebKDC::Config::RATE_LIMIT_THRESHOLD || 0,
+            limit_interval  => $WebKDC::Config::RATE_LIMIT_INTERVAL,
+        });
+    } elsif (@WebKDC::Config::MEMCACHED_SERVERS) {
         $self->{memcache} = Cache::Memcached->new ({
             servers => [ @WebKDC::Config::MEMCACHED_SERVERS ]
         });
@@ -1541,22 +1551,29 @@ sub error_invalid_pwchange_fields {
 # checking for replays).
 sub is_replay {
     my ($self, $rt) = @_;
-    if (!$self->{memcache} || !$WebKDC::Config::REPLAY_TIMEOUT) {
+    if (!$WebKDC::Config::REPLAY_TIMEOUT) {
         return;
     }
-    my $hash = Digest::SHA::sha512_base64 ($rt);
-    print STDERR "Looking up request token hash $hash\n"
-        if $self->param ('debug');
-    my $seen = $self->{memcache}->get ("rt:$hash");
+    my $seen;
+    if ($self->{replay}) {
+        $seen = $self->{replay}->check ($rt);
+    } elsif ($self->{memcache}) {
+        my $hash = Digest::SHA::sha512_base64 ($rt);
+        print STDERR "Looking up request token hash $hash\n"
+            if $self->param ('debug');
+        $seen = $self->{memcache}->get ("rt:$hash");
+        if ($seen) {
+            print STDERR "Replacing request token hash $hash\n"
+                if $self->param ('debug');
+            my $now = time;
+            my $expires = $now + $WebKDC::Config::REPLAY_TIMEOUT;
+            $self->{memcache}->replace ("rt:$hash", $now, $expires);
+        }
+    }
     if ($seen) {
         print STDERR "Rejecting request token $rt as a replay, last seen "
             . strftime ('%Y-%m-%d %T', localtime $seen) . "\n"
             if $self->param ('logging');
-        print STDERR "Replacing request token hash $hash\n"
-            if $self->param ('debug');
-        my $now = time;
-        my $expires = $now + $WebKDC::Config::REPLAY_TIMEOUT;
-        $self->{memcache}->replace ("rt:$hash", $now, $expires);
         return 1;
     }
     return;
@@ -1567,11 +1584,18 @@ sub is_replay {
 # limiting).
 sub is_rate_limited {
     my ($self, $username) = @_;
-    if (!$self->{memcache} || !$WebKDC::Config::RATE_LIMIT_THRESHOLD) {
+    if (!$WebKDC::Config::RATE_LIMIT_THRESHOLD) {
         return;
     }
-    my $count = $self->{memcache}->get ("fail:$username");
-    if (defined $count && $count >= $WebKDC::Config::RATE_LIMIT_THRESHOLD) {
+    my $limited;
+    if ($self->{replay}) {
+        $limited = $self->{replay}->limited ($username);
+    } elsif ($self->{memcache}) {
+        my $count = $self->{memcache}->get ("fail:$username");
+        $limited = (defined ($count)
+                    && $count >= $WebKDC::Config::RATE_LIMIT_THRESHOLD);
+    }
+    if ($limited) {
         print STDERR "Rate limited authentication for $username\n"
             if $self->param ('logging');
         return 1;
@@ -1583,35 +1607,48 @@ sub is_rate_limited {
 # detect if it is replayed.  Takes the request token and the username.
 sub register_auth {
     my ($self, $rt, $username) = @_;
-    if (!$self->{memcache} || !$WebKDC::Config::REPLAY_TIMEOUT) {
+    if (!$WebKDC::Config::REPLAY_TIMEOUT) {
         return;
     }
-    my $hash = Digest::SHA::sha512_base64 ($rt);
-    print STDERR "Storing request token hash $hash\n"
-        if $self->param ('debug');
-    my $now = time;
-    my $timeout = $now + $WebKDC::Config::REPLAY_TIMEOUT;
-    $self->{memcache}->set ("rt:$hash", $now, $timeout);
-    if ($WebKDC::Config::RATE_LIMIT_THRESHOLD) {
-        $self->{memcache}->delete ("fail:$username");
+    if ($self->{replay}) {
+        print STDERR "Storing request token in replay cache\n"
+            if $self->param ('debug');
+        $self->{replay}->add ($rt);
+        if ($WebKDC::Config::RATE_LIMIT_THRESHOLD) {
+            $self->{replay}->clear ($username);
+        }
+    } elsif ($self->{memcache}) {
+        my $hash = Digest::SHA::sha512_base64 ($rt);
+        print STDERR "Storing request token hash $hash\n"
+            if $self->param ('debug');
+        my $now = time;
+        my $timeout = $now + $WebKDC::Config::REPLAY_TIMEOUT;
+        $self->{memcache}->set ("rt:$hash", $now, $timeout);
+        if ($WebKDC::Config::RATE_LIMIT_THRESHOLD) {
+            $self->{memcache}->delete ("fail:$username");
+        }
     }
 }
 
 # Register a failed authentication for rate limiting.  Takes the username.
 sub register_auth_fail {
     my ($self, $username) = @_;
-    if (!$self->{memcache} || !$WebKDC::Config::RATE_LIMIT_THRESHOLD) {
+    if (!$WebKDC::Config::RATE_LIMIT_THRESHOLD) {
         return;
     }
     print STDERR "Storing $username authentication failure for rate limit\n"
         if $self->param ('debug');
-    my $expires = time + $WebKDC::Config::RATE_LIMIT_INTERVAL;
-    my $count = $self->{memcache}->get ("fail:$username");
-    if (!defined $count) {
-        $count = 0;
+    if ($self->{replay}) {
+        $self->{replay}->fail ($username);
+    } elsif ($self->{memcache}) {
+        my $expires = time + $WebKDC::Config::RATE_LIMIT_INTERVAL;
+        my $count = $self->{memcache}->get ("fail:$username");
+        if (!defined $count) {
+            $count = 0;
+        }
+        $count++;
+        $self->{memcache}->set ("fail:$username", $count, $expires);
     }
-    $count++;
-    $self->{memcache}->set ("fail:$username", $count, $expires);
 }
 
 ##############################################################################
@@ -2403,8 +2440,9 @@ any other scripts and does not currently have a documented API.
 
 Overridden CGI::Application setup function.  This is used for all
 initialization of data needed for our WebLogin object.  It sets various
-defaults, sets up our Template Toolkit options, creates memcached
-caches, and other needed setup items to prepare.
+defaults, sets up our Template Toolkit options, opens the shared replay
+cache or creates memcached caches, and other needed setup items to
+prepare.
 
 =item cgiapp_prerun
 
@@ -2606,26 +2644,26 @@ missing or incorrect fields.
 
 =item is_replay (RT)
 
-Checks against memcached to see if the given request token has been
-recently used, in order to detect a replay attack.  Returns 1 if the
-request token was found.
+Checks against the replay cache or memcached to see if the given request
+token has been recently used, in order to detect a replay attack.  Returns
+1 if the request token was found.
 
 =item is_rate_limited (USERNAME)
 
-Checks against memcached to see if the given user has exceeded a
-certain number of failed logins.  Returns 1 if the user has exceeded
-the number (set in WebKDC::Config).
+Checks against the replay cache or memcached to see if the given user has
+exceeded a certain number of failed logins.  Returns 1 if the user has
+exceeded the number (set in WebKDC::Config).
 
 =item register_auth (RT, USERNAME)
 
-Registers a successful authentication for the given user in memcached,
-with the request token for the authentication.  This is used to detect
-replay attacks.
+Registers a successful authentication for the given user in the replay
+cache or memcached, with the request token for the authentication.  This
+is used to detect replay attacks.
 
 =item register_auth_fail (USERNAME)
 
-Registers a failed authentication for the given user in memcached.  This
-is used for rate limiting users on failed logins.
+Registers a failed authentication for the given user in the replay cache
+or memcached.  This is used for rate limiting users on failed logins.
 
 =item setup_kdc_request (COOKIES)
 
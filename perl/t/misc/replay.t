@@ -0,0 +1,61 @@
+#!/usr/bin/perl -w
+#
+# Test suite for the WebAuth::Replay shared replay cache.
+#
+# Copyright 2014
+#     The Board of Trustees of the Leland Stanford Junior University
+#
+# See LICENSE for licensing terms.
+
+use strict;
+
+use File::Temp qw(tempdir);
+use Test::More tests => 14;
+
+use lib ('t/lib', 'lib', 'blib/arch');
+use WebAuth qw(:const);
+use WebAuth::Replay;
+
+# The cache file goes in a temporary directory, since a lock file is created
+# beside it.
+my $tmpdir = tempdir (CLEANUP => 1);
+my $path = "$tmpdir/replay";
+my $wa = WebAuth->new;
+
+# Missing required configuration is rejected.
+eval { WebAuth::Replay->new ($wa, { path => $path, limit_threshold => 3 }) };
+isa_ok ($@, 'WebAuth::Exception', 'Exception with no limit interval');
+is ($@->status, WA_ERR_INVALID, '... with the right status');
+
+# Open a cache.
+my $replay = WebAuth::Replay->new ($wa, {
+    path            => $path,
+    slots           => 1024,
+    replay_timeout  => 300,
+    limit_threshold => 3,
+    limit_interval  => 300,
+});
+isa_ok ($replay, 'WebAuth::Replay');
+
+# Replay detection.
+my $now = time;
+is ($replay->check ('token', $now), 0, 'Unseen token is not a replay');
+$replay->add ('token', $now);
+is ($replay->check ('token', $now), $now, '... but is after being added');
+is ($replay->check ('token', $now + 10), $now, '... and is refreshed');
+is ($replay->check ('token', $now + 1000), 0, '... until it expires');
+ok ($replay->check ('token'), 'Check defaults to the current time');
+
+# Rate limiting.
+ok (!$replay->limited ('user'), 'New user is not rate limited');
+$replay->fail ('user') for 1 .. 2;
+ok (!$replay->limited ('user'), '... nor after two failures');
+$replay->fail ('user');
+ok ($replay->limited ('user'), '... but is after three');
+ok (!$replay->limited ('other'), '... and another user is not');
+$replay->clear ('user');
+ok (!$replay->limited ('user'), 'Clearing failures removes the limit');
+
+# A second handle on the same file sees the same data.
+my $other = WebAuth->new->replay_open ({ path => $path });
+ok ($other->check ('token'), 'A second handle sees the same tokens');
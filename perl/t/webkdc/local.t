@@ -0,0 +1,476 @@
+#!/usr/bin/perl -w
+#
+# Tests for the support for in-process WebKDC logins in WebKDC.
+#
+# Copyright 2014
+#     The Board of Trustees of the Leland Stanford Junior University
+#
+# See LICENSE for licensing terms.
+
+use strict;
+use Test::More tests => 49;
+
+use File::Temp qw(tempdir);
+use MIME::Base64 qw(decode_base64 encode_base64);
+use Time::HiRes ();
+use WebAuth qw(:const);
+use WebAuth::Keyring;
+use WebAuth::Token::Request;
+use WebAuth::Token::WebKDCService;
+use WebKDC::WebKDCException;
+use WebKDC::WebRequest;
+use WebKDC::WebResponse;
+
+BEGIN {
+    use_ok ('WebKDC');
+    use_ok ('WebKDC::Config');
+}
+
+# Token ACL checks, using the same token.acl as mod_webkdc's tests.
+$WebKDC::Config::TOKEN_ACL = 't/data/token.acl';
+my $server = 'krb5:webauth/a.testrealm.org@testrealm.org';
+my $test1 = 'krb5:webauth/test1.testrealm.org@testrealm.org';
+my $test3 = 'krb5:webauth/test3.testrealm.org@testrealm.org';
+ok (WebKDC::token_acl_permits ($server, 'id'),
+    'Wildcard id entry permits an id token');
+ok (!WebKDC::token_acl_permits ('krb5:webauth/a.testrealm.org@example.org',
+                                'id'),
+    '... but only for matching subjects');
+ok (!WebKDC::token_acl_permits ($server, 'proxy', 'krb5'),
+    '... and not a proxy token');
+ok (WebKDC::token_acl_permits ($test1, 'proxy', 'krb5'),
+    'cred entry permits a proxy token of that type');
+ok (!WebKDC::token_acl_permits ($test1, 'proxy', 'remuser'),
+    '... but not of another type');
+ok (!WebKDC::token_acl_permits ($test3, 'proxy', 'krb5'),
+    '... or for another subject');
+$WebKDC::Config::TOKEN_ACL = undef;
+ok (!WebKDC::token_acl_permits ($server, 'id'),
+    'Nothing is permitted without a token ACL');
+
+# Write a token ACL file in a temporary directory.
+my $dir = tempdir (CLEANUP => 1);
+my $acl = "$dir/token.acl";
+sub write_acl {
+    my (@lines) = @_;
+    open (my $fh, '>', $acl) or BAIL_OUT ("cannot create $acl: $!");
+    print {$fh} map { "$_\n" } @lines;
+    close $fh;
+}
+
+# Like mod_webkdc, a file with any malformed line is rejected as a whole, so
+# nothing is permitted if no ACL was loaded before.
+my @warnings;
+local $SIG{__WARN__} = sub { push (@warnings, @_) };
+$WebKDC::Config::TOKEN_ACL = $acl;
+my %malformed = (
+    'unknown entry type'       => "$server proxy",
+    'cred with another type'   => "$test1 cred remuser afs/testrealm.org",
+    'cred with no service'     => "$test1 cred krb5",
+    'missing entry type'       => $server,
+);
+for my $problem (sort keys %malformed) {
+    $WebKDC::TOKEN_ACL_RULES = undef;
+    write_acl ("$server id", $malformed{$problem});
+    ok (!WebKDC::token_acl_permits ($server, 'id'),
+        "ACL with $problem is rejected");
+}
+like ($warnings[0], qr{, line 2$}ms, '... with a warning naming the line');
+
+# If an ACL was already loaded, a malformed replacement is ignored.
+$WebKDC::TOKEN_ACL_RULES = undef;
+write_acl ("$server id");
+ok (WebKDC::token_acl_permits ($server, 'id'), 'Valid ACL is loaded');
+write_acl ("$test1 id", "$test1 cred");
+ok (WebKDC::token_acl_permits ($server, 'id'),
+    '... and kept when the file becomes malformed');
+ok (!WebKDC::token_acl_permits ($test1, 'id'),
+    '... without using any of the new file');
+
+# A change in the same second as the last read is noticed, even if the file
+# size doesn't change, provided the file system has subsecond timestamps.
+SKIP: {
+    my $time = int (time) - 10;
+    write_acl ("$test1 id");
+    Time::HiRes::utime ($time, $time + 0.25, $acl);
+    my $mtime = (Time::HiRes::stat ($acl))[9];
+    skip 'no subsecond file timestamps', 2 if $mtime == int $mtime;
+    ok (WebKDC::token_acl_permits ($test1, 'id'), 'ACL is reloaded');
+    write_acl ("$test3 id");
+    Time::HiRes::utime ($time, $time + 0.75, $acl);
+    ok (WebKDC::token_acl_permits ($test3, 'id'),
+        '... and reloaded after a change in the same second');
+}
+$WebKDC::Config::TOKEN_ACL = undef;
+
+# Configure a context for WebKDC logins.
+my $wa = WebAuth->new;
+eval {
+    $wa->webkdc_config ({
+        keytab           => 't/data/test.keytab',
+        principal        => 'service/webkdc@testrealm.org',
+        local_realms     => [ 'testrealm.org' ],
+        permitted_realms => [],
+    });
+};
+is ($@, '', 'webkdc_config succeeds');
+
+# A login with an invalid service token is reported in the result rather
+# than as an exception.  This doesn't need Kerberos.
+my $key = $wa->key_create (WA_KEY_AES, WA_AES_128);
+my $keyring = WebAuth::Keyring->new ($wa, $key);
+my $result = eval {
+    $wa->webkdc_login ({ service => 'invalid', request => 'invalid' },
+                       $keyring);
+};
+is ($@, '', 'webkdc_login with an invalid service token succeeds');
+is ($result->{status}, WA_PEC_SERVICE_TOKEN_INVALID, '... with that error');
+ok ($result->{error}, '... and an error message');
+
+# The service and request tokens are required.
+eval { $wa->webkdc_login ({ service => 'invalid' }, $keyring) };
+like ($@, qr/service and request arguments required/,
+      'webkdc_login requires a request token');
+eval {
+    $wa->webkdc_login ({ service => 'a', request => 'b', logins => 'c' },
+                       $keyring);
+};
+like ($@, qr/logins argument is not an array reference/,
+      '... and array references for arrays');
+
+# The rest of the tests run logins through request_token_request both in
+# process and via the XML protocol, with webkdc_login and the WebKDC replaced
+# by stand-ins that return the same result, and check that both produce the
+# same WebKDC::WebResponse and exception.
+package Test::LocalContext;
+
+# Takes the result that webkdc_login should return.
+sub new {
+    my ($class, $result) = @_;
+    return bless ({ result => $result }, $class);
+}
+
+# Remember the login request and return a copy of the result.
+sub webkdc_login {
+    my ($self, $login, $keyring) = @_;
+    $self->{login} = $login;
+    return { %{ $self->{result} } };
+}
+
+package Test::UserAgent;
+
+# Takes the XML document that the WebKDC should return.
+sub new {
+    my ($class, $xml) = @_;
+    return bless ({ xml => $xml }, $class);
+}
+
+# Return a successful HTTP response containing the XML document.
+sub request {
+    my ($self, $request) = @_;
+    return bless ({ content => $self->{xml} }, 'Test::Response');
+}
+
+package Test::Response;
+
+sub is_success { return 1 }
+sub content    { my ($self) = @_; return $self->{content} }
+
+package main;
+
+# Quote a string for inclusion in XML.
+sub xml_quote {
+    my ($string) = @_;
+    $string =~ s{&}{&amp;}xmsg;
+    $string =~ s{<}{&lt;}xmsg;
+    $string =~ s{>}{&gt;}xmsg;
+    $string =~ s{\"}{&quot;}xmsg;
+    return $string;
+}
+
+# Build the XML response that mod_webkdc sends for a webkdc_login result:
+# an <errorResponse> for statuses other than those in %LOGIN_ERRORS and
+# otherwise a <requestTokenResponse>.
+sub result_xml {
+    my ($result) = @_;
+    my $status = $result->{status};
+    if ($status != WA_ERR_NONE && !$WebKDC::LOGIN_ERRORS{$status}) {
+        return error_xml ($status, $result->{error});
+    }
+    my $xml = '<requestTokenResponse>';
+    if ($status != WA_ERR_NONE) {
+        $xml .= "<loginErrorCode>$status</loginErrorCode>";
+        $xml .= '<loginErrorMessage>' . xml_quote ($result->{error})
+            . '</loginErrorMessage>';
+    }
+    if (defined $result->{user_message}) {
+        $xml .= '<userMessage>' . xml_quote ($result->{user_message})
+            . '</userMessage>';
+    }
+    if (defined $result->{login_state}) {
+        $xml .= '<loginState>' . encode_base64 ($result->{login_state}, '')
+            . '</loginState>';
+    }
+    if ($result->{factors_configured}) {
+        $xml .= '<multifactorRequired>';
+        $xml .= join ('', map { "<factor>$_</factor>" }
+                      @{ $result->{factors_wanted} });
+        $xml .= join ('', map { "<configuredFactor>$_</configuredFactor>" }
+                      @{ $result->{factors_configured} });
+        $xml .= '<defaultFactor>';
+        $xml .= "<id>$result->{default_device}</id>";
+        $xml .= "<factor>$result->{default_factor}</factor>";
+        $xml .= '</defaultFactor><devices>';
+        for my $device (@{ $result->{devices} }) {
+            $xml .= "<device><name>$device->{name}</name>";
+            $xml .= "<id>$device->{id}</id>";
+            $xml .= join ('', map { "<factor>$_</factor>" }
+                          @{ $device->{factors} });
+            $xml .= '</device>';
+        }
+        $xml .= '</devices></multifactorRequired>';
+    }
+    if ($result->{proxies}) {
+        $xml .= '<proxyTokens>';
+        for my $proxy (@{ $result->{proxies} }) {
+            $xml .= qq{<proxyToken type="$proxy->{type}">}
+                . "$proxy->{token}</proxyToken>";
+        }
+        $xml .= '</proxyTokens>';
+    }
+    if ($result->{factor_tokens}) {
+        $xml .= '<factorTokens>';
+        for my $factor (@{ $result->{factor_tokens} }) {
+            $xml .= qq{<factorToken expires="$factor->{expiration}">}
+                . "$factor->{token}</factorToken>";
+        }
+        $xml .= '</factorTokens>';
+    }
+    $xml .= '<returnUrl>' . xml_quote ($result->{return_url}) . '</returnUrl>';
+    $xml .= '<requesterSubject>' . xml_quote ($result->{requester})
+        . '</requesterSubject>';
+    if (defined $result->{subject}) {
+        $xml .= '<subject>' . xml_quote ($result->{subject}) . '</subject>';
+    }
+    if (defined $result->{authz_subject}) {
+        $xml .= '<authzSubject>' . xml_quote ($result->{authz_subject})
+            . '</authzSubject>';
+    }
+    if ($result->{permitted_authz}) {
+        $xml .= '<permittedAuthzSubjects>';
+        $xml .= join ('', map { '<authzSubject>' . xml_quote ($_)
+                                    . '</authzSubject>' }
+                      @{ $result->{permitted_authz} });
+        $xml .= '</permittedAuthzSubjects>';
+    }
+    if (defined $result->{result}) {
+        $xml .= "<requestedToken>$result->{result}</requestedToken>";
+        $xml .= "<requestedTokenType>$result->{result_type}"
+            . '</requestedTokenType>';
+    }
+    if (defined $result->{login_cancel}) {
+        $xml .= "<loginCanceledToken>$result->{login_cancel}"
+            . '</loginCanceledToken>';
+    }
+    if (defined $result->{app_state}) {
+        $xml .= '<appState>' . encode_base64 ($result->{app_state}, '')
+            . '</appState>';
+    }
+    if ($result->{logins}) {
+        $xml .= '<loginHistory>';
+        for my $login (@{ $result->{logins} }) {
+            $xml .= '<loginLocation';
+            if (defined $login->{hostname}) {
+                $xml .= qq{ name="$login->{hostname}"};
+            }
+            if (defined $login->{timestamp}) {
+                $xml .= qq{ time="$login->{timestamp}"};
+            }
+            $xml .= ">$login->{ip}</loginLocation>";
+        }
+        $xml .= '</loginHistory>';
+    }
+    if ($result->{password_expires}) {
+        $xml .= "<passwordExpires>$result->{password_expires}"
+            . '</passwordExpires>';
+    }
+    $xml .= '</requestTokenResponse>';
+    return $xml;
+}
+
+# Build the <errorResponse> that mod_webkdc sends for an error.
+sub error_xml {
+    my ($code, $message) = @_;
+    return "<errorResponse><errorCode>$code</errorCode><errorMessage>"
+        . xml_quote ($message) . '</errorMessage></errorResponse>';
+}
+
+# Run request_token_request in process or via XML.  Returns the
+# WebKDC::WebResponse and a reference to a list of the status, message,
+# protocol error code, and data of the exception, or undef if there was none.
+sub run_request {
+    my ($in_process, $wreq) = @_;
+    local $WebKDC::Config::WEBKDC_IN_PROCESS = $in_process;
+    my $wresp = WebKDC::WebResponse->new;
+    eval { WebKDC::request_token_request ($wreq, $wresp) };
+    my $e = $@;
+    return ($wresp, undef) unless $e;
+    if (!ref ($e) || !$e->isa ('WebKDC::WebKDCException')) {
+        return ($wresp, [ "$e" ]);
+    }
+    return ($wresp, [ $e->status, $e->message, $e->error_code, $e->data ]);
+}
+
+# Run a request both ways, with webkdc_login returning the given result and
+# the WebKDC returning the given XML, and check that the responses and
+# exceptions match.  Returns the response, the exception, and the login
+# request that was passed to webkdc_login.
+sub compare_request {
+    my ($wreq, $result, $xml, $message) = @_;
+    local $WebKDC::LOCAL_CONTEXT = Test::LocalContext->new ($result);
+    local $WebKDC::USER_AGENT = Test::UserAgent->new ($xml);
+    local $WebKDC::USER_AGENT_PID = $$;
+    my ($local, $local_error) = run_request (1, $wreq);
+    my ($remote, $remote_error) = run_request (0, $wreq);
+    is_deeply ($local, $remote, "$message: same response");
+    is_deeply ($local_error, $remote_error, '... and same exception');
+    return ($local, $local_error, $WebKDC::LOCAL_CONTEXT->{login});
+}
+
+# The WebKDC keyring, and a token ACL that lets $server get id tokens.
+$keyring->write ("$dir/keyring");
+$WebKDC::Config::KEYRING_PATH = "$dir/keyring";
+$WebKDC::TOKEN_ACL_RULES = undef;
+$WebKDC::Config::TOKEN_ACL = $acl;
+write_acl ("$server id");
+
+# Build a login request from the given requester for an id token, created at
+# the given time.
+my $session = 'b' x WA_AES_128;
+sub make_wreq {
+    my ($requester, $creation) = @_;
+    my $st = WebAuth::Token::WebKDCService->new ($wa);
+    $st->subject ($requester);
+    $st->session_key ($session);
+    $st->creation (time);
+    $st->expiration (time + 3600);
+    my $session_key = $wa->key_create (WA_KEY_AES, WA_AES_128, $session);
+    my $rt = WebAuth::Token::Request->new ($wa);
+    $rt->type ('id');
+    $rt->auth ('webkdc');
+    $rt->return_url ('https://example.org/');
+    $rt->creation ($creation);
+    my $wreq = WebKDC::WebRequest->new;
+    $wreq->service_token ($st->encode ($keyring));
+    $wreq->request_token ($rt->encode (WebAuth::Keyring->new ($wa,
+                                                              $session_key)));
+    $wreq->local_ip_addr ('127.0.0.1');
+    $wreq->local_ip_port (443);
+    $wreq->remote_ip_addr ('192.0.2.1');
+    $wreq->remote_ip_port (12345);
+    $wreq->login_state (encode_base64 ('state from the client', ''));
+    $wreq->proxy_cookies_rich ({
+        krb5 => { cookie => 'old-proxy', session_factor => 'p' },
+    });
+    return $wreq;
+}
+
+# A successful login fills in every part of the response.
+my %result = (
+    status           => WA_ERR_NONE,
+    user_message     => 'Welcome back',
+    login_state      => "state \x{1} for the client",
+    proxies          => [ { type => 'krb5', token => 'new-proxy' } ],
+    factor_tokens    => [
+        { token => 'factor-token', expiration => 1400000000 },
+    ],
+    return_url       => 'https://example.org/?a=1&b=2',
+    requester        => $server,
+    subject          => 'user',
+    authz_subject    => 'other',
+    permitted_authz  => [ 'other', 'another' ],
+    result           => 'result-token',
+    result_type      => 'id',
+    login_cancel     => 'cancel-token',
+    app_state        => "app\0state\xff",
+    logins           => [
+        { ip => '192.0.2.2', hostname => 'host.example.org',
+          timestamp => 1300000000 },
+        { ip => '192.0.2.3' },
+    ],
+    password_expires => 1500000000,
+);
+my ($wresp, $error, $login)
+    = compare_request (make_wreq ($server, time), \%result,
+                       result_xml (\%result), 'Successful login');
+is ($error, undef, '... with no exception');
+is ($login->{login_state}, 'state from the client',
+    '... and the login state was decoded for webkdc_login');
+is_deeply ($login->{wkproxies},
+           [ { type => 'krb5', token => 'old-proxy', source => 'p' } ],
+           '... and the proxy cookies passed as webkdc-proxy tokens');
+is_deeply ($wresp->cookies,
+           { webauth_wpt_krb5 => { value => 'new-proxy', expiration => 0 },
+             webauth_wft => { value => 'factor-token',
+                              expiration => 1400000000 } },
+           '... and the cookies are set');
+is (decode_base64 ($wresp->app_state), "app\0state\xff",
+    '... and app_state is base64-encoded');
+is (decode_base64 ($wresp->login_state), "state \x{1} for the client",
+    '... as is login_state');
+
+# A login error in %LOGIN_ERRORS returns the multifactor information and
+# state along with the exception.
+%result = (
+    status             => WA_PEC_MULTIFACTOR_REQUIRED,
+    error              => 'multifactor login required',
+    login_state        => 'state',
+    factors_wanted     => [ 'o', 'm' ],
+    factors_configured => [ 'p', 'o', 'o1' ],
+    default_device     => 'device1',
+    default_factor     => 'o1',
+    devices            => [
+        { name => 'phone', id => 'device1', factors => [ 'o', 'o1' ] },
+    ],
+    return_url         => 'https://example.org/',
+    requester          => $server,
+    login_cancel       => 'cancel-token',
+);
+($wresp, $error) = compare_request (make_wreq ($server, time), \%result,
+                                    result_xml (\%result),
+                                    'Multifactor required');
+is ($error->[0], WK_ERR_MULTIFACTOR_REQUIRED, '... with the right status');
+is_deeply ($wresp->factor_needed, [ 'o', 'm' ], '... and factors needed');
+is_deeply ($wresp->devices,
+           [ { name => 'phone', id => 'device1', factors => [ 'o', 'o1' ] } ],
+           '... and devices');
+is ($wresp->login_canceled_token, 'cancel-token',
+    '... and the login canceled token');
+
+# Other errors are only an exception, as with <errorResponse>, and clear the
+# proxy cookies if the user has to log in again.
+%result = (
+    status => WA_PEC_PROXY_TOKEN_INVALID,
+    error  => 'webkdc-proxy token invalid',
+);
+($wresp, $error) = compare_request (make_wreq ($server, time), \%result,
+                                    result_xml (\%result), 'Invalid proxy');
+is ($error->[0], WK_ERR_USER_AND_PASS_REQUIRED, '... with the right status');
+is ($wresp->cookie ('krb5'), '', '... and the proxy cookie is cleared');
+
+# Requests that the WAS may not make are rejected before webkdc_login.
+my $message = 'not authorized to get an id token';
+($wresp, $error) = compare_request (make_wreq ($test3, time), \%result,
+                                    error_xml (WA_PEC_UNAUTHORIZED, $message),
+                                    'Request rejected by the token ACL');
+is ($error->[2], WA_PEC_UNAUTHORIZED, '... with the right error code');
+
+# So are stale request tokens.
+my $stale = time - $WebKDC::Config::WEBKDC_TOKEN_MAX_TTL - 60;
+$message = 'request token was stale';
+($wresp, $error)
+    = compare_request (make_wreq ($server, $stale), \%result,
+                       error_xml (WA_PEC_REQUEST_TOKEN_STALE, $message),
+                       'Stale request token');
+is ($error->[0], WK_ERR_REQUEST_TOKEN_STALE, '... with the right status');
+$WebKDC::Config::TOKEN_ACL = undef;
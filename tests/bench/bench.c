@@ -0,0 +1,297 @@
+/*
+ * Helper functions for WebAuth benchmarks.
+ *
+ * A minimal harness for timing WebAuth library operations.  Each benchmark
+ * is run in batches of increasing size until a batch takes long enough to
+ * give a stable measurement, and then the average time per operation in that
+ * batch is reported.
+ *
+ * Where the platform can look up the next definition of a symbol, the
+ * harness also defines its own apr_palloc, which takes precedence over APR's
+ * for every caller, including libwebauth and APR itself.  It counts the pool
+ * allocations made while a benchmark runs and passes them on to APR, so the
+ * allocations and bytes allocated per operation are reported as well.
+ * apr_pcalloc and the APR string functions allocate through apr_palloc, so
+ * they're included.
+ *
+ * Results are reported as a line of text for each benchmark, or as a line
+ * with a JSON object for each benchmark if BENCH_FORMAT is set to json in
+ * the environment.  The JSON keys and benchmark names are kept stable so that
+ * the results can be compared across versions.
+ *
+ * Copyright 2014
+ *     The Board of Trustees of the Leland Stanford Junior University
+ *
+ * See LICENSE for licensing terms.
+ */
+
+#include <config.h>
+#include <portable/apr.h>
+#include <portable/system.h>
+
+#include <apr_thread_proc.h>
+#include <apr_time.h>
+#ifdef HAVE_DLFCN_H
+# include <dlfcn.h>
+#endif
+
+#include <tests/bench/bench.h>
+#include <tests/tap/basic.h>
+#include <webauth/basic.h>
+
+/* Minimum length of a measured batch in microseconds. */
+#define BENCH_MIN_TIME (500 * 1000)
+
+/* Number of operations after which the scratch pool is cleared. */
+#define BENCH_POOL_CLEAR 100
+
+/* The arguments to each thread of a multi-threaded batch. */
+struct bench_thread {
+    bench_func func;
+    void *data;
+    unsigned long count;
+};
+
+/* Whether to report the results as JSON, set by bench_init. */
+static bool bench_json = false;
+
+/* The setup context, whose configuration the benchmark contexts share. */
+static struct webauth_context *bench_source = NULL;
+
+/*
+ * Whether to count allocations and the counts for the benchmark being run.
+ * Only single-threaded benchmarks are counted, and the threads of the others
+ * never touch these, so they need no locking.
+ */
+static bool bench_counting = false;
+static unsigned long bench_allocs = 0;
+static unsigned long bench_bytes = 0;
+
+/* Allocations can only be counted if APR's apr_palloc can be found. */
+#if defined(HAVE_DLFCN_H) && defined(RTLD_NEXT)
+# define BENCH_COUNT_ALLOCS 1
+#endif
+
+
+#ifdef BENCH_COUNT_ALLOCS
+
+/*
+ * Count a pool allocation if a benchmark is being counted, and then make it
+ * with the apr_palloc this one replaces.
+ */
+void *
+apr_palloc(apr_pool_t *pool, apr_size_t size)
+{
+    static void *(*next)(apr_pool_t *, apr_size_t) = NULL;
+
+    if (next == NULL) {
+        *(void **) &next = dlsym(RTLD_NEXT, "apr_palloc");
+        if (next == NULL)
+            abort();
+    }
+    if (bench_counting) {
+        bench_allocs++;
+        bench_bytes += size;
+    }
+    return next(pool, size);
+}
+
+#endif /* BENCH_COUNT_ALLOCS */
+
+
+/*
+ * Initialize APR and return a WebAuth context for benchmark setup, which is
+ * also remembered as the source of the configuration of the benchmark
+ * contexts.  Any failure is fatal.
+ */
+struct webauth_context *
+bench_init(void)
+{
+    struct webauth_context *ctx;
+    const char *format;
+
+    if (webauth_context_init(&ctx, NULL) != WA_ERR_NONE)
+        bail("cannot initialize WebAuth context");
+    format = getenv("BENCH_FORMAT");
+    bench_json = (format != NULL && strcmp(format, "json") == 0);
+    bench_source = ctx;
+    return ctx;
+}
+
+
+/*
+ * Report the results of a benchmark: the total number of operations, the
+ * elapsed time in microseconds, and whether allocations were counted.
+ */
+static void
+bench_report(const char *name, unsigned long count, apr_time_t elapsed,
+             bool counted)
+{
+    double ns, allocs, bytes;
+
+    ns = (double) elapsed * 1000.0 / (double) count;
+    allocs = (double) bench_allocs / (double) count;
+    bytes = (double) bench_bytes / (double) count;
+    if (bench_json) {
+        printf("{\"name\": \"%s\", \"iterations\": %lu, "
+               "\"ns_per_op\": %.1f", name, count, ns);
+        if (counted)
+            printf(", \"allocs_per_op\": %.2f, \"bytes_per_op\": %.1f}\n",
+                   allocs, bytes);
+        else
+            printf(", \"allocs_per_op\": null, \"bytes_per_op\": null}\n");
+    } else {
+        printf("%-40s %10lu %12.1f ns/op", name, count, ns);
+        if (counted)
+            printf(" %8.2f allocs/op %10.1f B/op", allocs, bytes);
+        putchar('\n');
+    }
+}
+
+
+/*
+ * Run a batch of the given number of operations and return the elapsed time
+ * in microseconds.  Each operation gets a context allocated from a scratch
+ * pool that is cleared every BENCH_POOL_CLEAR operations, which is roughly
+ * how the library is used inside a request.  Like the per-request contexts
+ * of the modules, these share the WebKDC, user information service, and
+ * metrics configuration of the setup context.  If counting is true, count the
+ * allocations made by the operations themselves, but not those for the
+ * contexts.
+ */
+static apr_time_t
+bench_batch(bench_func func, void *data, unsigned long count, bool counting)
+{
+    apr_pool_t *pool;
+    struct webauth_context *ctx;
+    apr_time_t start;
+    unsigned long i;
+
+    if (apr_pool_create(&pool, NULL) != APR_SUCCESS)
+        bail("cannot create memory pool");
+    if (webauth_context_init_shared(&ctx, pool, bench_source) != WA_ERR_NONE)
+        bail("cannot initialize WebAuth context");
+    start = apr_time_now();
+    for (i = 0; i < count; i++) {
+        if (i > 0 && i % BENCH_POOL_CLEAR == 0) {
+            apr_pool_clear(pool);
+            if (webauth_context_init_shared(&ctx, pool, bench_source)
+                != WA_ERR_NONE)
+                bail("cannot initialize WebAuth context");
+        }
+        if (counting)
+            bench_counting = true;
+        func(ctx, data);
+        if (counting)
+            bench_counting = false;
+    }
+    start = apr_time_now() - start;
+    apr_pool_destroy(pool);
+    return start;
+}
+
+
+#if APR_HAS_THREADS
+
+/*
+ * The body of each thread of a multi-threaded batch, which runs a batch of
+ * its own.
+ */
+static void * APR_THREAD_FUNC
+bench_thread(apr_thread_t *thread, void *arg)
+{
+    struct bench_thread *bt = arg;
+
+    bench_batch(bt->func, bt->data, bt->count, false);
+    apr_thread_exit(thread, APR_SUCCESS);
+    return NULL;
+}
+
+
+/*
+ * Run a batch of the given number of operations in each of the given number
+ * of threads at once and return the elapsed time in microseconds.
+ */
+static apr_time_t
+bench_batch_threads(bench_func func, void *data, unsigned long count,
+                    unsigned int threads)
+{
+    apr_pool_t *pool;
+    apr_thread_t **ids;
+    apr_status_t status;
+    struct bench_thread bt;
+    apr_time_t start;
+    unsigned int i;
+
+    if (apr_pool_create(&pool, NULL) != APR_SUCCESS)
+        bail("cannot create memory pool");
+    ids = apr_palloc(pool, threads * sizeof(apr_thread_t *));
+    bt.func = func;
+    bt.data = data;
+    bt.count = count;
+    start = apr_time_now();
+    for (i = 0; i < threads; i++)
+        if (apr_thread_create(&ids[i], NULL, bench_thread, &bt, pool)
+            != APR_SUCCESS)
+            bail("cannot create thread");
+    for (i = 0; i < threads; i++)
+        apr_thread_join(&status, ids[i]);
+    start = apr_time_now() - start;
+    apr_pool_destroy(pool);
+    return start;
+}
+
+#endif /* APR_HAS_THREADS */
+
+
+/*
+ * Run a benchmark, doubling the number of operations until a batch takes at
+ * least BENCH_MIN_TIME, and report the average time per operation.
+ */
+void
+bench_run(const char *name, bench_func func, void *data)
+{
+    unsigned long count = 1;
+    apr_time_t elapsed;
+    bool counted = false;
+
+#ifdef BENCH_COUNT_ALLOCS
+    counted = true;
+#endif
+    for (;;) {
+        bench_allocs = 0;
+        bench_bytes = 0;
+        elapsed = bench_batch(func, data, count, counted);
+        if (elapsed >= BENCH_MIN_TIME)
+            break;
+        count *= 2;
+    }
+    bench_report(name, count, elapsed, counted);
+}
+
+
+/*
+ * Run a benchmark in several threads at once, doubling the number of
+ * operations per thread until a batch takes at least BENCH_MIN_TIME, and
+ * report the elapsed time per operation across all threads.  Allocations
+ * aren't counted, since the counts aren't protected by a lock.
+ */
+void
+bench_run_threads(const char *name, bench_func func, void *data,
+                  unsigned int threads)
+{
+#if APR_HAS_THREADS
+    unsigned long count = 1;
+    apr_time_t elapsed;
+
+    for (;;) {
+        elapsed = bench_batch_threads(func, data, count, threads);
+        if (elapsed >= BENCH_MIN_TIME)
+            break;
+        count *= 2;
+    }
+    bench_report(name, count * threads, elapsed, false);
+#else
+    bench_run(name, func, data);
+#endif
+}
@@ -0,0 +1,58 @@
+/*
+ * Helper functions for WebAuth benchmarks.
+ *
+ * A minimal harness for timing WebAuth library operations.  Each benchmark
+ * is a function that performs one operation, which the harness runs
+ * repeatedly until enough time has passed to get a stable measurement.
+ * Results are printed as text, or as one JSON object per line if
+ * BENCH_FORMAT is set to json.
+ *
+ * Copyright 2014
+ *     The Board of Trustees of the Leland Stanford Junior University
+ *
+ * See LICENSE for licensing terms.
+ */
+
+#ifndef BENCH_BENCH_H
+#define BENCH_BENCH_H 1
+
+#include <config.h>
+#include <tests/tap/macros.h>
+
+struct webauth_context;
+
+/*
+ * A benchmark operation.  It is called with a WebAuth context whose pool is
+ * periodically cleared and the opaque data pointer passed to bench_run.
+ */
+typedef void (*bench_func)(struct webauth_context *, void *);
+
+BEGIN_DECLS
+
+/*
+ * Initialize APR and return a long-lived WebAuth context that can be used to
+ * set up the data for the benchmarks.  Any WebKDC, user information service,
+ * or metrics configuration set in it is shared by the benchmark contexts.
+ */
+struct webauth_context *bench_init(void);
+
+/*
+ * Run a benchmark and report the average time per operation and, where the
+ * platform allows it, the pool allocations and bytes allocated per operation.
+ */
+void bench_run(const char *name, bench_func, void *data)
+    __attribute__((__nonnull__(1, 2)));
+
+/*
+ * Run a benchmark in the given number of threads at once, each with its own
+ * context, and report the elapsed time divided by the total number of
+ * operations.  Allocations are not counted.  Without APR thread support, this
+ * is the same as bench_run.
+ */
+void bench_run_threads(const char *name, bench_func, void *data,
+                       unsigned int threads)
+    __attribute__((__nonnull__(1, 2)));
+
+END_DECLS
+
+#endif /* !BENCH_BENCH_H */
@@ -0,0 +1,179 @@
+/*
+ * Benchmarks for collecting response bodies.
+ *
+ * Times collecting WebKDC responses of typical sizes, as delivered by cURL
+ * in pieces, into a struct webauth_buffer as the Apache modules now do.  The
+ * same responses are also collected the way mod_webauth and mod_webkdc used
+ * to, growing a single string 4KB at a time, for comparison.  The pool
+ * memory used per response by each method is reported before the timings.
+ *
+ * Copyright 2014
+ *     The Board of Trustees of the Leland Stanford Junior University
+ *
+ * See LICENSE for licensing terms.
+ */
+
+#include <config.h>
+#include <portable/apr.h>
+#include <portable/system.h>
+
+#include <lib/internal.h>
+#include <tests/bench/bench.h>
+#include <tests/tap/basic.h>
+#include <webauth/buffer.h>
+
+/* Size of each piece of the response handed to the write callback. */
+#define PIECE_SIZE 1400
+
+/* The increment the modules used to grow their strings by. */
+#define CHUNK_SIZE 4096
+
+/*
+ * A response to collect and a scratch pool.  memory is set by the collection
+ * functions to the pool memory they used for the last response.
+ */
+struct body_data {
+    char *response;
+    size_t length;
+    apr_pool_t *pool;
+    size_t memory;
+};
+
+/* The string the modules used to collect data in. */
+struct fixed_string {
+    char *data;
+    size_t size;
+    size_t capacity;
+    apr_pool_t *pool;
+};
+
+
+/*
+ * Append data to a fixed_string the way the modules' append_string functions
+ * did, also keeping track of the memory allocated.
+ */
+static void
+fixed_append(struct fixed_string *string, const char *in_data,
+             size_t in_size, size_t *memory)
+{
+    size_t needed_size;
+    char *new_data;
+
+    needed_size = string->size + in_size;
+    if (string->data == NULL || needed_size > string->capacity) {
+        while (string->capacity < needed_size + 1)
+            string->capacity += CHUNK_SIZE;
+        new_data = apr_palloc(string->pool, string->capacity);
+        *memory += string->capacity;
+        if (string->data != NULL)
+            memcpy(new_data, string->data, string->size);
+        string->data = new_data;
+    }
+    memcpy(string->data + string->size, in_data, in_size);
+    string->size = needed_size;
+    string->data[string->size] = '\0';
+}
+
+
+static void
+bench_fixed(struct webauth_context *ctx UNUSED, void *data)
+{
+    struct body_data *bd = data;
+    struct fixed_string string;
+    size_t i, length;
+
+    apr_pool_clear(bd->pool);
+    memset(&string, 0, sizeof(string));
+    string.pool = bd->pool;
+    bd->memory = 0;
+    for (i = 0; i < bd->length; i += PIECE_SIZE) {
+        length = bd->length - i;
+        if (length > PIECE_SIZE)
+            length = PIECE_SIZE;
+        fixed_append(&string, bd->response + i, length, &bd->memory);
+    }
+}
+
+
+static void
+bench_buffer(struct webauth_context *ctx UNUSED, void *data)
+{
+    struct body_data *bd = data;
+    struct webauth_buffer *body;
+    size_t i, length;
+
+    apr_pool_clear(bd->pool);
+    body = webauth_buffer_new(bd->pool);
+    for (i = 0; i < bd->length; i += PIECE_SIZE) {
+        length = bd->length - i;
+        if (length > PIECE_SIZE)
+            length = PIECE_SIZE;
+        webauth_buffer_append(body, bd->response + i, length);
+    }
+    bd->memory = body->buffer->allocated;
+}
+
+
+/*
+ * Build a getTokensResponse of at least the given size, padded with cred
+ * tokens.
+ */
+static void
+build_response(struct body_data *bd, size_t size)
+{
+    size_t used, i;
+
+    bd->response = bmalloc(size + 512);
+    used = snprintf(bd->response, size + 512, "<getTokensResponse><tokens>");
+    while (used < size) {
+        used += snprintf(bd->response + used, size + 512 - used,
+                         "<token id='%lu'><tokenData>", (unsigned long) used);
+        for (i = 0; i < 256 && used < size + 400; i++)
+            bd->response[used++] = "ABCDEFGHIJKLMNOP"[i % 16];
+        used += snprintf(bd->response + used, size + 512 - used,
+                         "</tokenData></token>");
+    }
+    bd->length = used;
+}
+
+
+/*
+ * Report the memory used by each method for a response.
+ */
+static void
+report_memory(const char *name, struct body_data *bd)
+{
+    bench_fixed(NULL, bd);
+    printf("%-40s %10lu %12lu bytes (fixed)\n", name,
+           (unsigned long) bd->length, (unsigned long) bd->memory);
+    bench_buffer(NULL, bd);
+    printf("%-40s %10lu %12lu bytes (buffer)\n", name,
+           (unsigned long) bd->length, (unsigned long) bd->memory);
+}
+
+
+int
+main(void)
+{
+    struct body_data small, large;
+    apr_pool_t *pool;
+
+    bench_init();
+    if (apr_pool_create(&pool, NULL) != APR_SUCCESS)
+        bail("cannot create memory pool");
+    small.pool = pool;
+    large.pool = pool;
+    build_response(&small, 4 * 1024);
+    build_response(&large, 64 * 1024);
+
+    report_memory("body/memory-4k", &small);
+    report_memory("body/memory-64k", &large);
+    bench_run("body/fixed-4k", bench_fixed, &small);
+    bench_run("body/buffer-4k", bench_buffer, &small);
+    bench_run("body/fixed-64k", bench_fixed, &large);
+    bench_run("body/buffer-64k", bench_buffer, &large);
+    apr_pool_destroy(pool);
+    free(small.response);
+    free(large.response);
+    return 0;
+}
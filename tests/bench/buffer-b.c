@@ -0,0 +1,202 @@
+/*
+ * Benchmarks for the internal buffer code.
+ *
+ * Times accumulating the large outputs that libwebauth builds up piece by
+ * piece in a struct wai_buffer: a user information service reply read from
+ * remctl in small pieces, with plain and chunked buffers, and the attribute
+ * encoding of a cred token with a large Kerberos credential.  The public
+ * encoding of the same cred token is timed for comparison.
+ *
+ * Copyright 2014
+ *     The Board of Trustees of the Leland Stanford Junior University
+ *
+ * See LICENSE for licensing terms.
+ */
+
+#include <config.h>
+#include <portable/apr.h>
+#include <portable/system.h>
+
+#include <time.h>
+
+#include <lib/internal.h>
+#include <tests/bench/bench.h>
+#include <tests/tap/basic.h>
+#include <webauth/basic.h>
+#include <webauth/keys.h>
+#include <webauth/tokens.h>
+
+/* Size of the user information reply and of each piece read from remctl. */
+#define USERINFO_SIZE  (64 * 1024)
+#define USERINFO_PIECE 512
+
+/* Size of the fake Kerberos credential in the cred token. */
+#define CRED_SIZE (16 * 1024)
+
+/* Shared data for the benchmarks, with a scratch pool for the buffers. */
+struct buffer_data {
+    apr_pool_t *pool;
+    char *userinfo;
+    char *cred;
+    struct webauth_keyring *ring;
+    struct webauth_token token;
+};
+
+
+/*
+ * Build a user information reply with many multifactor devices, which is
+ * what makes them large.
+ */
+static char *
+build_userinfo(void)
+{
+    char *reply;
+    size_t used = 0;
+    unsigned long i;
+
+    reply = bmalloc(USERINFO_SIZE + 1);
+    used = snprintf(reply, USERINFO_SIZE, "<authdata user=\"testuser\">"
+                    "<factors><factor>p</factor><factor>m</factor>"
+                    "</factors><multifactor-required/>");
+    for (i = 0; used < USERINFO_SIZE - 128; i++)
+        used += snprintf(reply + used, USERINFO_SIZE - used,
+                         "<device><name>phone %lu</name><id>%08lu</id>"
+                         "<factor>o3</factor></device>", i, i);
+    memset(reply + used, ' ', USERINFO_SIZE - used);
+    reply[USERINFO_SIZE] = '\0';
+    return reply;
+}
+
+
+/*
+ * Accumulate the user information reply the way wai_user_remctl does.
+ */
+static void
+read_userinfo(struct wai_buffer *buffer, const char *reply)
+{
+    size_t i;
+
+    for (i = 0; i < USERINFO_SIZE; i += USERINFO_PIECE)
+        wai_buffer_append(buffer, reply + i, USERINFO_PIECE);
+}
+
+
+static void
+bench_userinfo(struct webauth_context *ctx UNUSED, void *data)
+{
+    struct buffer_data *bd = data;
+
+    apr_pool_clear(bd->pool);
+    read_userinfo(wai_buffer_new(bd->pool), bd->userinfo);
+}
+
+
+static void
+bench_userinfo_chunked(struct webauth_context *ctx UNUSED, void *data)
+{
+    struct buffer_data *bd = data;
+
+    apr_pool_clear(bd->pool);
+    read_userinfo(wai_buffer_new_chunked(bd->pool), bd->userinfo);
+}
+
+
+/*
+ * Build the attribute encoding of a cred token the way encode_to_attrs does:
+ * short attributes with sprintf and the credential, escaped, by resizing and
+ * writing directly into the buffer.
+ */
+static void
+bench_cred_attrs(struct webauth_context *ctx UNUSED, void *data)
+{
+    struct buffer_data *bd = data;
+    struct wai_buffer *buffer;
+    const char *p;
+    char *q;
+    size_t i;
+
+    apr_pool_clear(bd->pool);
+    buffer = wai_buffer_new(bd->pool);
+    wai_buffer_append_sprintf(buffer, "t=%s;", "cred");
+    wai_buffer_append_sprintf(buffer, "s=%s;", "testuser");
+    wai_buffer_append_sprintf(buffer, "crt=%s;", "krb5");
+    wai_buffer_append_sprintf(buffer, "crs=%s;",
+                              "host/example.com@EXAMPLE.COM");
+    wai_buffer_append_sprintf(buffer, "crd=");
+    wai_buffer_resize(buffer, buffer->used + CRED_SIZE * 2 + 1);
+    q = buffer->data + buffer->used;
+    for (i = 0, p = bd->cred; i < CRED_SIZE; i++, p++) {
+        if (*p == ';')
+            *q++ = ';';
+        *q++ = *p;
+    }
+    buffer->used = q - buffer->data;
+    wai_buffer_append(buffer, ";", 1);
+    wai_buffer_append_sprintf(buffer, "ct=%lu;", 1400000000UL);
+    wai_buffer_append_sprintf(buffer, "et=%lu;", 1400003600UL);
+}
+
+
+static void
+bench_cred_encode(struct webauth_context *ctx, void *data)
+{
+    struct buffer_data *bd = data;
+    const char *token;
+
+    if (webauth_token_encode(ctx, &bd->token, bd->ring, &token)
+        != WA_ERR_NONE)
+        bail("cannot encode cred token");
+}
+
+
+int
+main(void)
+{
+    struct webauth_context *ctx;
+    struct webauth_key *key;
+    struct buffer_data data;
+    struct wai_buffer *buffer;
+    time_t now;
+    size_t i;
+
+    ctx = bench_init();
+    if (apr_pool_create(&data.pool, NULL) != APR_SUCCESS)
+        bail("cannot create memory pool");
+    data.userinfo = build_userinfo();
+    data.cred = bmalloc(CRED_SIZE);
+    for (i = 0; i < CRED_SIZE; i++)
+        data.cred[i] = (char) (i % 251);
+
+    /* Make sure chunked buffers keep the data intact. */
+    buffer = wai_buffer_new_chunked(data.pool);
+    read_userinfo(buffer, data.userinfo);
+    wai_buffer_flatten(buffer);
+    if (buffer->used != USERINFO_SIZE
+        || memcmp(buffer->data, data.userinfo, USERINFO_SIZE) != 0)
+        bail("chunked buffer data does not match");
+
+    /* Set up the cred token for the encoding benchmark. */
+    if (webauth_key_create(ctx, WA_KEY_AES, WA_AES_128, NULL, &key)
+        != WA_ERR_NONE)
+        bail("cannot create key");
+    data.ring = webauth_keyring_from_key(ctx, key);
+    now = time(NULL);
+    memset(&data.token, 0, sizeof(data.token));
+    data.token.type = WA_TOKEN_CRED;
+    data.token.token.cred.subject    = "testuser";
+    data.token.token.cred.type       = "krb5";
+    data.token.token.cred.service    = "host/example.com@EXAMPLE.COM";
+    data.token.token.cred.data       = data.cred;
+    data.token.token.cred.data_len   = CRED_SIZE;
+    data.token.token.cred.creation   = now;
+    data.token.token.cred.expiration = now + 60 * 60;
+
+    bench_run("buffer/userinfo-64k", bench_userinfo, &data);
+    bench_run("buffer/userinfo-64k-chunked", bench_userinfo_chunked, &data);
+    bench_run("buffer/cred-attrs-16k", bench_cred_attrs, &data);
+    bench_run("buffer/cred-encode-16k", bench_cred_encode, &data);
+    apr_pool_destroy(data.pool);
+    free(data.userinfo);
+    free(data.cred);
+    return 0;
+}
@@ -0,0 +1,125 @@
+/*
+ * Benchmarks for WebAuth context setup.
+ *
+ * Compares the per-request setup mod_webkdc used to do, creating a new
+ * context and configuring it from scratch, with resetting a reusable context
+ * that shares an already-validated configuration.
+ *
+ * Copyright 2014
+ *     The Board of Trustees of the Leland Stanford Junior University
+ *
+ * See LICENSE for licensing terms.
+ */
+
+#include <config.h>
+#include <portable/apr.h>
+#include <portable/system.h>
+
+#include <tests/bench/bench.h>
+#include <tests/tap/basic.h>
+#include <webauth/basic.h>
+#include <webauth/webkdc.h>
+
+/* Configuration shared by the benchmarks. */
+struct context_data {
+    struct webauth_webkdc_config webkdc;
+    struct webauth_user_config user;
+    struct webauth_context *reused;
+};
+
+
+/* A logging callback that does nothing. */
+static void
+log_nothing(struct webauth_context *ctx UNUSED, void *data UNUSED,
+            const char *message UNUSED)
+{
+}
+
+
+/* Register the four logging callbacks the way mod_webkdc does. */
+static void
+set_callbacks(struct webauth_context *ctx, void *data)
+{
+    webauth_log_callback(ctx, WA_LOG_TRACE,  log_nothing, data);
+    webauth_log_callback(ctx, WA_LOG_INFO,   log_nothing, data);
+    webauth_log_callback(ctx, WA_LOG_NOTICE, log_nothing, data);
+    webauth_log_callback(ctx, WA_LOG_WARN,   log_nothing, data);
+}
+
+
+/*
+ * Create and configure a new context, as mod_webkdc did for every request
+ * before contexts were reused.
+ */
+static void
+bench_fresh(struct webauth_context *ctx, void *data)
+{
+    struct context_data *cd = data;
+    struct webauth_context *fresh;
+    apr_pool_t *pool;
+
+    if (apr_pool_create(&pool, NULL) != APR_SUCCESS)
+        bail("cannot create memory pool");
+    if (webauth_context_init_apr(&fresh, pool) != WA_ERR_NONE)
+        bail("cannot initialize WebAuth context");
+    set_callbacks(fresh, ctx);
+    if (webauth_webkdc_config(fresh, &cd->webkdc) != WA_ERR_NONE)
+        bail("cannot configure WebKDC");
+    if (webauth_user_config(fresh, &cd->user) != WA_ERR_NONE)
+        bail("cannot configure user information service");
+    apr_pool_destroy(pool);
+}
+
+
+/* Reset a context that shares a configuration validated once. */
+static void
+bench_reset(struct webauth_context *ctx, void *data)
+{
+    struct context_data *cd = data;
+
+    if (webauth_context_reset(cd->reused) != WA_ERR_NONE)
+        bail("cannot reset WebAuth context");
+    set_callbacks(cd->reused, ctx);
+}
+
+
+int
+main(void)
+{
+    struct webauth_context *ctx;
+    struct context_data data;
+    apr_pool_t *pool;
+    apr_array_header_t *realms;
+
+    ctx = bench_init();
+    if (apr_pool_create(&pool, NULL) != APR_SUCCESS)
+        bail("cannot create memory pool");
+    memset(&data, 0, sizeof(data));
+    realms = apr_array_make(pool, 1, sizeof(const char *));
+    APR_ARRAY_PUSH(realms, const char *) = "EXAMPLE.COM";
+    data.webkdc.keytab_path      = "/etc/webkdc/keytab";
+    data.webkdc.id_acl_path      = "/etc/webkdc/id.acl";
+    data.webkdc.principal        = "service/webkdc";
+    data.webkdc.proxy_lifetime   = 60 * 60 * 10;
+    data.webkdc.login_time_limit = 5 * 60;
+    data.webkdc.local_realms     = realms;
+    data.webkdc.permitted_realms = realms;
+    data.user.protocol  = WA_PROTOCOL_REMCTL;
+    data.user.host      = "userinfo.example.com";
+    data.user.command   = "webkdc";
+    data.user.keytab    = "/etc/webkdc/keytab";
+    data.user.principal = "service/webkdc";
+    data.user.timeout   = 5;
+
+    /* Set up the reusable context the way mod_webkdc child_init does. */
+    if (webauth_webkdc_config(ctx, &data.webkdc) != WA_ERR_NONE)
+        bail("cannot configure WebKDC");
+    if (webauth_user_config(ctx, &data.user) != WA_ERR_NONE)
+        bail("cannot configure user information service");
+    if (webauth_context_init_shared(&data.reused, pool, ctx) != WA_ERR_NONE)
+        bail("cannot initialize shared WebAuth context");
+
+    bench_run("context/fresh", bench_fresh, &data);
+    bench_run("context/reset", bench_reset, &data);
+    return 0;
+}
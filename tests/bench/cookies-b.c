@@ -0,0 +1,224 @@
+/*
+ * Benchmarks for Cookie header parsing in mod_webauth.
+ *
+ * Builds Cookie headers of the size seen from browsers with large cookie
+ * jars, with the WebAuth cookies mixed in among many unrelated ones, and
+ * times the lookups mod_webauth does for a request that checks the app
+ * cookie, a proxy cookie, and several cred cookies.  The scan benchmarks
+ * repeat the same lookups by searching the raw header once per cookie,
+ * which is what mod_webauth used to do, for comparison.  The subrequest
+ * benchmarks do the lookups again for each of several subrequests, which
+ * now share the cookies parsed for the main request.
+ *
+ * Copyright 2014
+ *     The Board of Trustees of the Leland Stanford Junior University
+ *
+ * See LICENSE for licensing terms.
+ */
+
+#include <config.h>
+#include <portable/apr.h>
+#include <portable/system.h>
+
+#include <modules/webauth/cookies.h>
+#include <tests/bench/bench.h>
+#include <tests/tap/basic.h>
+
+/* The cookies looked up by a request using Kerberos proxy credentials. */
+static const char *const lookups[] = {
+    "webauth_at", "webauth_pt_krb5", "webauth_ct_krb5_host/a.example.com",
+    "webauth_ct_krb5_host/b.example.com", "webauth_ct_krb5_ldap/c.example.com"
+};
+#define LOOKUP_COUNT (sizeof(lookups) / sizeof(lookups[0]))
+
+/* Number of subrequests, such as SSI includes, made by a page. */
+#define SUBREQUESTS 10
+
+/* A Cookie header and a scratch pool for the results. */
+struct cookies_data {
+    const char *header;
+    apr_pool_t *pool;
+};
+
+
+/*
+ * Append a cookie with a pseudo-random base64-like value of the given length
+ * to the header being built.
+ */
+static char *
+add_cookie(apr_pool_t *pool, char *header, const char *name, size_t length)
+{
+    static const char chars[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    static unsigned long seed = 1;
+    char *value;
+    size_t i;
+
+    value = apr_palloc(pool, length + 1);
+    for (i = 0; i < length; i++) {
+        seed = seed * 1103515245UL + 12345UL;
+        value[i] = chars[(seed >> 16) % 64];
+    }
+    value[length] = '\0';
+    if (header == NULL)
+        return apr_psprintf(pool, "%s=%s", name, value);
+    return apr_psprintf(pool, "%s; %s=%s", header, name, value);
+}
+
+
+/*
+ * Build a Cookie header of at least the given size.  Unrelated cookies
+ * typical of analytics and single sign-on products are added until the
+ * header is big enough, with the WebAuth cookies scattered among them.
+ */
+static const char *
+build_header(apr_pool_t *pool, size_t size)
+{
+    char *header = NULL;
+    char *name;
+    size_t i;
+
+    for (i = 0; header == NULL || strlen(header) < size; i++) {
+        name = apr_psprintf(pool, "_site_cookie_%lu", (unsigned long) i);
+        header = add_cookie(pool, header, name, 20 + (i * 37) % 180);
+        if (i == 3)
+            header = add_cookie(pool, header, lookups[0], 300);
+        else if (i == 10)
+            header = add_cookie(pool, header, lookups[1], 900);
+        else if (i >= 15 && i < 15 + LOOKUP_COUNT - 2)
+            header = add_cookie(pool, header, lookups[i - 13], 1100);
+    }
+    return header;
+}
+
+
+/*
+ * Find a cookie by searching the raw header, as mod_webauth's find_cookie
+ * used to.
+ */
+static char *
+scan_cookie(apr_pool_t *pool, const char *c, const char *name)
+{
+    const char *cs, *ce;
+    size_t len;
+
+    len = strlen(name);
+    while ((cs = strstr(c, name)) != NULL) {
+        if (cs[len] == '=') {
+            cs += len + 1;
+            break;
+        }
+        c += len;
+    }
+    if (cs == NULL)
+        return NULL;
+    ce = strchr(cs, ';');
+    if (ce == NULL)
+        return apr_pstrdup(pool, cs);
+    return apr_pstrmemdup(pool, cs, ce - cs);
+}
+
+
+static void
+bench_parse(struct webauth_context *ctx UNUSED, void *data)
+{
+    struct cookies_data *cd = data;
+
+    apr_pool_clear(cd->pool);
+    mwa_cookies_parse(cd->pool, cd->header);
+}
+
+
+static void
+bench_request(struct webauth_context *ctx UNUSED, void *data)
+{
+    struct cookies_data *cd = data;
+    MWA_COOKIES *cookies;
+    size_t i;
+
+    apr_pool_clear(cd->pool);
+    cookies = mwa_cookies_parse(cd->pool, cd->header);
+    for (i = 0; i < LOOKUP_COUNT; i++)
+        mwa_cookies_get(cd->pool, cookies, lookups[i]);
+}
+
+
+static void
+bench_scan(struct webauth_context *ctx UNUSED, void *data)
+{
+    struct cookies_data *cd = data;
+    size_t i;
+
+    apr_pool_clear(cd->pool);
+    for (i = 0; i < LOOKUP_COUNT; i++)
+        scan_cookie(cd->pool, cd->header, lookups[i]);
+}
+
+
+static void
+bench_subrequests(struct webauth_context *ctx UNUSED, void *data)
+{
+    struct cookies_data *cd = data;
+    MWA_COOKIES *cookies;
+    size_t i, j;
+
+    apr_pool_clear(cd->pool);
+    cookies = mwa_cookies_parse(cd->pool, cd->header);
+    for (i = 0; i <= SUBREQUESTS; i++)
+        for (j = 0; j < LOOKUP_COUNT; j++)
+            mwa_cookies_get(cd->pool, cookies, lookups[j]);
+}
+
+
+static void
+bench_scan_subrequests(struct webauth_context *ctx UNUSED, void *data)
+{
+    struct cookies_data *cd = data;
+    size_t i, j;
+
+    apr_pool_clear(cd->pool);
+    for (i = 0; i <= SUBREQUESTS; i++)
+        for (j = 0; j < LOOKUP_COUNT; j++)
+            scan_cookie(cd->pool, cd->header, lookups[j]);
+}
+
+
+int
+main(void)
+{
+    struct cookies_data small, large;
+    apr_pool_t *pool;
+    MWA_COOKIES *cookies;
+    size_t i;
+
+    bench_init();
+    if (apr_pool_create(&pool, NULL) != APR_SUCCESS)
+        bail("cannot create memory pool");
+    small.header = build_header(pool, 4096);
+    large.header = build_header(pool, 8192);
+    if (apr_pool_create(&small.pool, NULL) != APR_SUCCESS)
+        bail("cannot create memory pool");
+    large.pool = small.pool;
+
+    /* Make sure the parser finds what the scan finds. */
+    cookies = mwa_cookies_parse(pool, large.header);
+    for (i = 0; i < LOOKUP_COUNT; i++) {
+        char *value = mwa_cookies_get(pool, cookies, lookups[i]);
+        char *expected = scan_cookie(pool, large.header, lookups[i]);
+
+        if (value == NULL || expected == NULL || strcmp(value, expected) != 0)
+            bail("parsed value of %s does not match", lookups[i]);
+    }
+
+    bench_run("cookies/parse-4k", bench_parse, &small);
+    bench_run("cookies/parse-8k", bench_parse, &large);
+    bench_run("cookies/request-4k", bench_request, &small);
+    bench_run("cookies/request-8k", bench_request, &large);
+    bench_run("cookies/scan-4k", bench_scan, &small);
+    bench_run("cookies/scan-8k", bench_scan, &large);
+    bench_run("cookies/subrequests-8k", bench_subrequests, &large);
+    bench_run("cookies/scan-subrequests-8k", bench_scan_subrequests, &large);
+    apr_pool_destroy(small.pool);
+    apr_pool_destroy(pool);
+    return 0;
+}
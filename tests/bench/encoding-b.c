@@ -0,0 +1,223 @@
+/*
+ * Benchmarks for attribute encoding.
+ *
+ * Times encoding and decoding a typical app token, the most frequently
+ * handled token, and a keyring with the specialized functions generated
+ * from the encoding rules and with the table-driven encoder and decoder
+ * that interpret the rules directly.  Also times the specialized functions
+ * for a typical token of every other type, with binary data of the sizes
+ * seen in practice.
+ *
+ * Copyright 2014
+ *     The Board of Trustees of the Leland Stanford Junior University
+ *
+ * See LICENSE for licensing terms.
+ */
+
+#include <config.h>
+#include <portable/apr.h>
+#include <portable/system.h>
+
+#include <lib/internal.h>
+#include <tests/bench/bench.h>
+#include <tests/tap/basic.h>
+#include <tests/tap/string.h>
+#include <webauth/basic.h>
+#include <webauth/keys.h>
+#include <webauth/tokens.h>
+
+/* Sizes of a Kerberos authenticator and a Kerberos credential. */
+#define AUTH_SIZE  700
+#define CRED_SIZE 1200
+
+/* Size of an encrypted webkdc-proxy token with a Kerberos credential. */
+#define PROXY_SIZE 1500
+
+/* Binary data for the tokens, filled in by main. */
+static char blob[PROXY_SIZE];
+
+/* The data to encode and its encoded form, for one codec. */
+struct encoding_data {
+    const struct wai_codec *codec;
+    const void *data;
+    size_t size;
+    void *encoded;
+    size_t length;
+};
+
+/* An app token as mod_webauth creates it after authentication. */
+static const struct webauth_token_app app = {
+    "testuser", NULL, 0, NULL, 0, "p,o1", "p", 1, 1364943745, 1893484800
+};
+
+/* Typical tokens of the other types. */
+static const struct webauth_token_cred cred = {
+    "testuser", "krb5", "host/example.com@EXAMPLE.COM", blob, CRED_SIZE,
+    1364943745, 1893484800
+};
+static const struct webauth_token_error error = {
+    WA_PEC_LOGIN_FAILED, "login failed", 1364943745
+};
+static const struct webauth_token_id id = {
+    "testuser", NULL, "krb5", blob, AUTH_SIZE, "p,o1", "p", 1, 1364943745,
+    1893484800
+};
+static const struct webauth_token_login login = {
+    "testuser", "password", NULL, NULL, NULL, 1364943745
+};
+static const struct webauth_token_proxy proxy = {
+    "testuser", NULL, "krb5", blob, PROXY_SIZE, "p,o1", "p", 1, 1364943745,
+    1893484800
+};
+static const struct webauth_token_request request = {
+    "id", "webkdc", NULL, blob, 64, "https://example.com/", NULL, "o",
+    NULL, 0, NULL, 1364943745
+};
+static const struct webauth_token_webkdc_factor webkdc_factor = {
+    "testuser", "d", 1364943745, 1893484800
+};
+static const struct webauth_token_webkdc_proxy webkdc_proxy = {
+    "testuser", "krb5", "WEBKDC:krb5:testuser", blob, CRED_SIZE, "p", 1,
+    1364943745, 1893484800, NULL
+};
+static const struct webauth_token_webkdc_service webkdc_service = {
+    "krb5:webauth/example.com@EXAMPLE.COM", blob, 16, 1364943745, 1893484800
+};
+
+/* The other token types, named as in the benchmark names. */
+static const struct {
+    const char *name;
+    const struct wai_codec *codec;
+    const void *data;
+    size_t size;
+} tokens[] = {
+    { "cred", &wai_token_cred_codec, &cred, sizeof(cred) },
+    { "error", &wai_token_error_codec, &error, sizeof(error) },
+    { "id", &wai_token_id_codec, &id, sizeof(id) },
+    { "login", &wai_token_login_codec, &login, sizeof(login) },
+    { "proxy", &wai_token_proxy_codec, &proxy, sizeof(proxy) },
+    { "request", &wai_token_request_codec, &request, sizeof(request) },
+    { "webkdc-factor", &wai_token_webkdc_factor_codec, &webkdc_factor,
+      sizeof(webkdc_factor) },
+    { "webkdc-proxy", &wai_token_webkdc_proxy_codec, &webkdc_proxy,
+      sizeof(webkdc_proxy) },
+    { "webkdc-service", &wai_token_webkdc_service_codec, &webkdc_service,
+      sizeof(webkdc_service) }
+};
+
+/* A keyring with the three keys of a typical rotated keyring. */
+static struct wai_keyring_entry entries[] = {
+    { 1364943745, 1364943745, WA_KEY_AES, (void *) "0123456789abcdef", 16 },
+    { 1364857345, 1364857345, WA_KEY_AES, (void *) "fedcba9876543210", 16 },
+    { 1364770945, 1364770945, WA_KEY_AES, (void *) "0011223344556677", 16 }
+};
+static const struct wai_keyring keyring = { 1, 3, entries };
+
+
+static void
+bench_encode_codec(struct webauth_context *ctx, void *data)
+{
+    struct encoding_data *ed = data;
+    void *output;
+    size_t length;
+
+    if (wai_encode(ctx, ed->codec, ed->data, &output, &length) != WA_ERR_NONE)
+        bail("cannot encode data");
+}
+
+
+static void
+bench_encode_rules(struct webauth_context *ctx, void *data)
+{
+    struct encoding_data *ed = data;
+    void *output;
+    size_t length;
+
+    if (wai_encode_rules(ctx, ed->codec->rules, ed->data, &output, &length)
+        != WA_ERR_NONE)
+        bail("cannot encode data");
+}
+
+
+static void
+bench_decode_codec(struct webauth_context *ctx, void *data)
+{
+    struct encoding_data *ed = data;
+    void *output;
+
+    output = apr_pcalloc(ctx->pool, ed->size);
+    if (wai_decode(ctx, ed->codec, ed->encoded, ed->length, output)
+        != WA_ERR_NONE)
+        bail("cannot decode data");
+}
+
+
+static void
+bench_decode_rules(struct webauth_context *ctx, void *data)
+{
+    struct encoding_data *ed = data;
+    void *output;
+
+    output = apr_pcalloc(ctx->pool, ed->size);
+    if (wai_decode_rules(ctx, ed->codec->rules, ed->encoded, ed->length,
+                         output) != WA_ERR_NONE)
+        bail("cannot decode data");
+}
+
+
+/*
+ * Set up the data for one codec, encoding it for the decoding benchmarks.
+ */
+static void
+setup(struct webauth_context *ctx, struct encoding_data *ed,
+      const struct wai_codec *codec, const void *data, size_t size)
+{
+    ed->codec = codec;
+    ed->data = data;
+    ed->size = size;
+    if (wai_encode(ctx, codec, data, &ed->encoded, &ed->length)
+        != WA_ERR_NONE)
+        bail("cannot encode data");
+}
+
+
+int
+main(void)
+{
+    struct webauth_context *ctx;
+    struct encoding_data app_data, keyring_data;
+    struct encoding_data data[ARRAY_SIZE(tokens)];
+    char *name;
+    size_t i;
+
+    ctx = bench_init();
+    for (i = 0; i < sizeof(blob); i++)
+        blob[i] = i % 256;
+    setup(ctx, &app_data, &wai_token_app_codec, &app, sizeof(app));
+    setup(ctx, &keyring_data, &wai_keyring_codec, &keyring, sizeof(keyring));
+
+    bench_run("encoding/app-encode-rules", bench_encode_rules, &app_data);
+    bench_run("encoding/app-encode-codec", bench_encode_codec, &app_data);
+    bench_run("encoding/app-decode-rules", bench_decode_rules, &app_data);
+    bench_run("encoding/app-decode-codec", bench_decode_codec, &app_data);
+    bench_run("encoding/keyring-encode-rules", bench_encode_rules,
+              &keyring_data);
+    bench_run("encoding/keyring-encode-codec", bench_encode_codec,
+              &keyring_data);
+    bench_run("encoding/keyring-decode-rules", bench_decode_rules,
+              &keyring_data);
+    bench_run("encoding/keyring-decode-codec", bench_decode_codec,
+              &keyring_data);
+
+    /* Run the specialized functions for the other token types. */
+    for (i = 0; i < ARRAY_SIZE(tokens); i++) {
+        setup(ctx, &data[i], tokens[i].codec, tokens[i].data, tokens[i].size);
+        basprintf(&name, "encoding/%s-encode-codec", tokens[i].name);
+        bench_run(name, bench_encode_codec, &data[i]);
+        free(name);
+        basprintf(&name, "encoding/%s-decode-codec", tokens[i].name);
+        bench_run(name, bench_decode_codec, &data[i]);
+        free(name);
+    }
+    return 0;
+}
@@ -0,0 +1,118 @@
+/*
+ * Benchmarks for factor code manipulation.
+ *
+ * Times the individual factor operations and a sequence of them that mirrors
+ * what the WebKDC does when checking a multifactor login against a
+ * webkdc-proxy token, user information, and a WAS request.
+ *
+ * Copyright 2014
+ *     The Board of Trustees of the Leland Stanford Junior University
+ *
+ * See LICENSE for licensing terms.
+ */
+
+#include <config.h>
+#include <portable/apr.h>
+#include <portable/system.h>
+
+#include <tests/bench/bench.h>
+#include <webauth/basic.h>
+#include <webauth/factors.h>
+
+/* Pre-parsed factors shared by the benchmarks. */
+struct factors_data {
+    struct webauth_factors *have;
+    struct webauth_factors *want;
+    struct webauth_factors *configured;
+    struct webauth_factors *required;
+};
+
+
+static void
+bench_parse(struct webauth_context *ctx, void *data UNUSED)
+{
+    webauth_factors_parse(ctx, "p,o,o1,m,d,k");
+}
+
+
+static void
+bench_union(struct webauth_context *ctx, void *data)
+{
+    struct factors_data *fd = data;
+
+    webauth_factors_union(ctx, fd->have, fd->configured);
+}
+
+
+static void
+bench_satisfies(struct webauth_context *ctx, void *data)
+{
+    struct factors_data *fd = data;
+
+    webauth_factors_satisfies(ctx, fd->configured, fd->want);
+}
+
+
+static void
+bench_subtract(struct webauth_context *ctx, void *data)
+{
+    struct factors_data *fd = data;
+
+    webauth_factors_subtract(ctx, fd->want, fd->have);
+}
+
+
+/*
+ * The factor work done for a user who has a password single sign-on cookie
+ * and is asked for OTP by a WAS.  This follows the webkdc-proxy factor merge
+ * and check_factors_proxy in lib/webkdc-login.c.
+ */
+static void
+bench_login(struct webauth_context *ctx, void *data)
+{
+    struct factors_data *fd = data;
+    struct webauth_factors *wanted, *swanted, *have, *shave, *extra;
+
+    /* Merge the webkdc-factor token into the webkdc-proxy factors. */
+    extra = webauth_factors_parse(ctx, "d");
+    have  = webauth_factors_parse(ctx, "p,k");
+    shave = webauth_factors_parse(ctx, "p,k");
+    have  = webauth_factors_union(ctx, have, extra);
+    shave = webauth_factors_union(ctx, shave, extra);
+    webauth_factors_string(ctx, have);
+    webauth_factors_string(ctx, shave);
+
+    /* Check the WAS request against what the user has. */
+    wanted  = webauth_factors_parse(ctx, "o");
+    swanted = webauth_factors_parse(ctx, "o,rm");
+    wanted  = webauth_factors_union(ctx, wanted, fd->required);
+    if (!webauth_factors_satisfies(ctx, have, wanted))
+        webauth_factors_contains(ctx, have, WA_FA_PASSWORD);
+    webauth_factors_satisfies(ctx, shave, swanted);
+    wanted  = webauth_factors_subtract(ctx, wanted, have);
+    swanted = webauth_factors_subtract(ctx, swanted, shave);
+    webauth_factors_union(ctx, wanted, swanted);
+    webauth_factors_satisfies(ctx, fd->configured, wanted);
+    webauth_factors_satisfies(ctx, fd->configured, swanted);
+}
+
+
+int
+main(void)
+{
+    struct webauth_context *ctx;
+    struct factors_data data;
+
+    ctx = bench_init();
+    data.have       = webauth_factors_parse(ctx, "p,d,k");
+    data.want       = webauth_factors_parse(ctx, "p,o,rm");
+    data.configured = webauth_factors_parse(ctx, "p,o,o1,o3,v,x1");
+    data.required   = webauth_factors_parse(ctx, "m");
+
+    bench_run("factors/parse", bench_parse, &data);
+    bench_run("factors/union", bench_union, &data);
+    bench_run("factors/satisfies", bench_satisfies, &data);
+    bench_run("factors/subtract", bench_subtract, &data);
+    bench_run("factors/multifactor-login", bench_login, &data);
+    return 0;
+}
@@ -0,0 +1,167 @@
+/*
+ * Benchmarks for reading keyrings.
+ *
+ * Times reading a keyring file the way the Apache modules do whenever it
+ * may have changed: a keyring in the binary format, which is mapped and
+ * decoded in place, and the same keyring in the attribute encoding written
+ * by default, which has to be copied and parsed.  Decoding the binary keyring
+ * from memory is timed as well to show the cost of the file access alone.
+ * Also times finding the encryption key and the hinted decryption key in a
+ * keyring with a long history of keys.
+ *
+ * Copyright 2014
+ *     The Board of Trustees of the Leland Stanford Junior University
+ *
+ * See LICENSE for licensing terms.
+ */
+
+#include <config.h>
+#include <portable/apr.h>
+#include <portable/system.h>
+
+#include <time.h>
+
+#include <tests/bench/bench.h>
+#include <tests/tap/basic.h>
+#include <tests/tap/string.h>
+#include <webauth/basic.h>
+#include <webauth/keys.h>
+
+/* Number of keys in the keyring, about what a rotated keyring holds. */
+#define KEYRING_KEYS 3
+
+/* Number of keys in a keyring whose old keys are kept for a long time. */
+#define HISTORY_KEYS 64
+
+/* Paths to the keyring in both formats and the binary keyring in memory. */
+struct keyring_data {
+    char *binary;
+    char *attr;
+    char *encoded;
+    size_t length;
+    struct webauth_keyring *history;
+    time_t hint;
+};
+
+
+static void
+bench_read_binary(struct webauth_context *ctx, void *data)
+{
+    struct keyring_data *kd = data;
+    struct webauth_keyring *ring;
+
+    if (webauth_keyring_read(ctx, kd->binary, &ring) != WA_ERR_NONE)
+        bail("cannot read binary keyring");
+}
+
+
+static void
+bench_read_attr(struct webauth_context *ctx, void *data)
+{
+    struct keyring_data *kd = data;
+    struct webauth_keyring *ring;
+
+    if (webauth_keyring_read(ctx, kd->attr, &ring) != WA_ERR_NONE)
+        bail("cannot read attribute-encoded keyring");
+}
+
+
+static void
+bench_decode_binary(struct webauth_context *ctx, void *data)
+{
+    struct keyring_data *kd = data;
+    struct webauth_keyring *ring;
+
+    if (webauth_keyring_decode(ctx, kd->encoded, kd->length, &ring)
+        != WA_ERR_NONE)
+        bail("cannot decode binary keyring");
+}
+
+
+static void
+bench_best_encrypt(struct webauth_context *ctx, void *data)
+{
+    struct keyring_data *kd = data;
+    const struct webauth_key *key;
+
+    if (webauth_keyring_best_key(ctx, kd->history, WA_KEY_ENCRYPT, 0, &key)
+        != WA_ERR_NONE)
+        bail("cannot find encryption key");
+}
+
+
+static void
+bench_best_decrypt(struct webauth_context *ctx, void *data)
+{
+    struct keyring_data *kd = data;
+    const struct webauth_key *key;
+
+    if (webauth_keyring_best_key(ctx, kd->history, WA_KEY_DECRYPT, kd->hint,
+                                 &key) != WA_ERR_NONE)
+        bail("cannot find decryption key");
+}
+
+
+int
+main(void)
+{
+    struct webauth_context *ctx;
+    struct webauth_keyring *ring;
+    struct webauth_key *key;
+    struct keyring_data data;
+    char *tmpdir;
+    time_t now;
+    int i;
+
+    ctx = bench_init();
+    now = time(NULL);
+    ring = webauth_keyring_new(ctx, KEYRING_KEYS);
+    for (i = 0; i < KEYRING_KEYS; i++) {
+        if (webauth_key_create(ctx, WA_KEY_AES, WA_AES_128, NULL, &key)
+            != WA_ERR_NONE)
+            bail("cannot create key");
+        webauth_keyring_add(ctx, ring, now - i * 86400, now - i * 86400, key);
+    }
+
+    /*
+     * Build a keyring with a key per day going back HISTORY_KEYS days, and
+     * use a hint from a token made yesterday.
+     */
+    data.history = webauth_keyring_new(ctx, 1);
+    for (i = 0; i < HISTORY_KEYS; i++)
+        webauth_keyring_add(ctx, data.history, now - i * 86400,
+                            now - i * 86400, key);
+    data.hint = now - 86400 + 60;
+
+    /* Write the keyring out in both formats. */
+    tmpdir = test_tmpdir();
+    basprintf(&data.binary, "%s/keyring-binary", tmpdir);
+    basprintf(&data.attr, "%s/keyring-attr", tmpdir);
+    if (webauth_keyring_write_format(ctx, ring, WA_FILE_FORMAT_BINARY,
+                                     data.binary) != WA_ERR_NONE)
+        bail("cannot write %s", data.binary);
+    if (webauth_keyring_write(ctx, ring, data.attr) != WA_ERR_NONE)
+        bail("cannot write %s", data.attr);
+    if (webauth_keyring_encode_format(ctx, ring, WA_FILE_FORMAT_BINARY,
+                                      &data.encoded, &data.length)
+        != WA_ERR_NONE)
+        bail("cannot encode keyring");
+
+    bench_run("keyring/read-binary", bench_read_binary, &data);
+    bench_run("keyring/read-attr", bench_read_attr, &data);
+    bench_run("keyring/decode-binary", bench_decode_binary, &data);
+    bench_run("keyring/best-encrypt", bench_best_encrypt, &data);
+    bench_run("keyring/best-decrypt", bench_best_decrypt, &data);
+    unlink(data.binary);
+    unlink(data.attr);
+    free(data.binary);
+    free(data.attr);
+    basprintf(&data.binary, "%s/keyring-binary.lock", tmpdir);
+    basprintf(&data.attr, "%s/keyring-attr.lock", tmpdir);
+    unlink(data.binary);
+    unlink(data.attr);
+    free(data.binary);
+    free(data.attr);
+    test_tmpdir_free(tmpdir);
+    return 0;
+}
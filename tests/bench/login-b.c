@@ -0,0 +1,359 @@
+/*
+ * Benchmarks for WebKDC logins.
+ *
+ * Times webauth_webkdc_login, the most expensive thing the WebKDC does, for
+ * single sign-on with a webkdc-proxy token for each kind of request, for a
+ * password login, and, if built with remctl support, for single sign-on with
+ * a user information service, both in one thread and in several threads at
+ * once.  The requests and their tokens are generated once up front with a
+ * fresh WebKDC key.  The Kerberos and remctl calls are replaced with the ones
+ * in tests/bench/stubs.c, so this needs neither a KDC nor a user information
+ * service.
+ *
+ * After each benchmark, the time per login spent in each phase of the login
+ * is printed to standard error, taken from the metrics the WebKDC code keeps.
+ *
+ * Usage: login-b [<threads>]
+ *
+ * Copyright 2014
+ *     The Board of Trustees of the Leland Stanford Junior University
+ *
+ * See LICENSE for licensing terms.
+ */
+
+#include <config.h>
+#include <portable/apr.h>
+#include <portable/stdbool.h>
+#include <portable/system.h>
+
+#include <time.h>
+
+#include <lib/internal.h>
+#include <tests/bench/bench.h>
+#include <tests/bench/stubs.h>
+#include <tests/tap/basic.h>
+#include <webauth/basic.h>
+#include <webauth/keys.h>
+#include <webauth/metrics.h>
+#include <webauth/tokens.h>
+#include <webauth/webkdc.h>
+
+/* Default number of threads for the multi-threaded benchmarks. */
+#define THREADS 4
+
+/* Size of the stub Kerberos credentials in the webkdc-proxy tokens. */
+#define CRED_SIZE 1200
+
+/* The requesting WebAuth Application Server and the WebKDC principal. */
+#define REQUESTER "krb5:webauth/example.com@" BENCH_STUB_REALM
+#define WEBKDC    "WEBKDC:krb5:service/webkdc@" BENCH_STUB_REALM
+
+/* Prefixes of the metrics lines used for the phase breakdown. */
+#define LOGIN_COUNT "webauth_webkdc_login_seconds_count "
+#define PHASE_SUM   "webauth_webkdc_login_phase_seconds_sum{phase=\""
+
+/*
+ * A login scenario.  factors is the factors of the webkdc-proxy token from
+ * the single sign-on cookie, or NULL for no cookie, and password says
+ * whether to include a login token with a username and password.
+ */
+struct scenario {
+    const char *name;
+    const char *type;
+    const char *auth;
+    const char *proxy_type;
+    const char *factors;
+    bool password;
+};
+
+/* The scenarios without a user information service. */
+static const struct scenario scenarios[] = {
+    { "login/sso-id-webkdc",  "id",    "webkdc", NULL,   "p",  false },
+    { "login/sso-id-krb5",    "id",    "krb5",   NULL,   "p",  false },
+    { "login/sso-proxy-krb5", "proxy", NULL,     "krb5", "p",  false },
+    { "login/password",       "id",    "webkdc", NULL,   NULL, true  },
+};
+
+/*
+ * The scenario with a user information service, which needs remctl support.
+ * The canned reply requires multifactor, so the single sign-on cookie is from
+ * an OTP login.
+ */
+#ifdef HAVE_REMCTL
+static const struct scenario userinfo =
+    { "login/sso-userinfo", "id", "webkdc", NULL, "p,m,o,o3", false };
+#endif
+
+/* The data for one login benchmark. */
+struct login_data {
+    const struct webauth_keyring *ring;
+    struct webauth_webkdc_login_request request;
+};
+
+
+static void
+bench_login(struct webauth_context *ctx, void *data)
+{
+    struct login_data *ld = data;
+    struct webauth_webkdc_login_response *response;
+    int s;
+
+    s = webauth_webkdc_login(ctx, &ld->request, &response, ld->ring);
+    if (s != WA_ERR_NONE)
+        bail("login failed: %s", webauth_error_message(ctx, s));
+}
+
+
+/*
+ * Encode a token with the given keyring, returning the encoded form.
+ */
+static const char *
+encode(struct webauth_context *ctx, const struct webauth_token *token,
+       const struct webauth_keyring *ring)
+{
+    const char *encoded;
+    int s;
+
+    s = webauth_token_encode(ctx, token, ring, &encoded);
+    if (s != WA_ERR_NONE)
+        bail("cannot encode token: %s", webauth_error_message(ctx, s));
+    return encoded;
+}
+
+
+/*
+ * Build the login request for a scenario, encoding all of its tokens, in the
+ * provided login data.
+ */
+static void
+build_request(struct webauth_context *ctx, const struct scenario *scenario,
+              const struct webauth_keyring *ring, struct login_data *ld)
+{
+    struct webauth_key *key;
+    struct webauth_keyring *session;
+    struct webauth_token token;
+    struct webauth_webkdc_proxy_data *pd;
+    apr_array_header_t *wkproxies, *wkfactors, *logins;
+    void *cred;
+    time_t now;
+    size_t size;
+    int s;
+
+    now = time(NULL);
+    memset(ld, 0, sizeof(*ld));
+    ld->ring = ring;
+
+    /* The webkdc-service token, with a fresh session key. */
+    s = webauth_key_create(ctx, WA_KEY_AES, WA_AES_128, NULL, &key);
+    if (s != WA_ERR_NONE)
+        bail("cannot create key: %s", webauth_error_message(ctx, s));
+    session = webauth_keyring_from_key(ctx, key);
+    memset(&token, 0, sizeof(token));
+    token.type = WA_TOKEN_WEBKDC_SERVICE;
+    token.token.webkdc_service.subject         = REQUESTER;
+    token.token.webkdc_service.session_key     = key->data;
+    token.token.webkdc_service.session_key_len = key->length;
+    token.token.webkdc_service.creation        = now;
+    token.token.webkdc_service.expiration      = now + 60 * 60;
+    ld->request.service = encode(ctx, &token, ring);
+
+    /* The webkdc-proxy token from the single sign-on cookie, if any. */
+    size = sizeof(struct webauth_webkdc_proxy_data);
+    wkproxies = apr_array_make(ctx->pool, 1, size);
+    if (scenario->factors != NULL) {
+        cred = apr_pcalloc(ctx->pool, CRED_SIZE);
+        memset(&token, 0, sizeof(token));
+        token.type = WA_TOKEN_WEBKDC_PROXY;
+        token.token.webkdc_proxy.subject         = "testuser";
+        token.token.webkdc_proxy.proxy_type      = "krb5";
+        token.token.webkdc_proxy.proxy_subject   = WEBKDC;
+        token.token.webkdc_proxy.data            = cred;
+        token.token.webkdc_proxy.data_len        = CRED_SIZE;
+        token.token.webkdc_proxy.initial_factors = scenario->factors;
+        token.token.webkdc_proxy.loa             = 1;
+        token.token.webkdc_proxy.creation        = now - 10 * 60;
+        token.token.webkdc_proxy.expiration      = now + 10 * 60 * 60;
+        pd = apr_array_push(wkproxies);
+        pd->type   = "krb5";
+        pd->token  = encode(ctx, &token, ring);
+        pd->source = "c";
+    }
+    ld->request.wkproxies = wkproxies;
+
+    /* The webkdc-factor token from the device cookie. */
+    wkfactors = apr_array_make(ctx->pool, 1, sizeof(const char *));
+    memset(&token, 0, sizeof(token));
+    token.type = WA_TOKEN_WEBKDC_FACTOR;
+    token.token.webkdc_factor.subject    = "testuser";
+    token.token.webkdc_factor.factors    = "d";
+    token.token.webkdc_factor.creation   = now - 24 * 60 * 60;
+    token.token.webkdc_factor.expiration = now + 30 * 24 * 60 * 60;
+    APR_ARRAY_PUSH(wkfactors, const char *) = encode(ctx, &token, ring);
+    ld->request.wkfactors = wkfactors;
+
+    /* The login token, if the user entered a password. */
+    logins = apr_array_make(ctx->pool, 1, sizeof(const char *));
+    if (scenario->password) {
+        memset(&token, 0, sizeof(token));
+        token.type = WA_TOKEN_LOGIN;
+        token.token.login.username = "testuser";
+        token.token.login.password = "password";
+        token.token.login.creation = now;
+        APR_ARRAY_PUSH(logins, const char *) = encode(ctx, &token, ring);
+    }
+    ld->request.logins = logins;
+
+    /* The request token from the WAS, encrypted in the session key. */
+    memset(&token, 0, sizeof(token));
+    token.type = WA_TOKEN_REQUEST;
+    token.token.request.type       = scenario->type;
+    token.token.request.auth       = scenario->auth;
+    token.token.request.proxy_type = scenario->proxy_type;
+    token.token.request.state      = "data";
+    token.token.request.state_len  = strlen("data");
+    token.token.request.return_url = "https://example.com/";
+    token.token.request.creation   = now;
+    ld->request.request = encode(ctx, &token, session);
+
+    /* Information about the WebLogin server, used for logging. */
+    ld->request.client_ip   = "127.0.0.1";
+    ld->request.remote_user = "testuser";
+    ld->request.remote_ip   = "127.0.0.2";
+    ld->request.remote_port = "443";
+}
+
+
+/*
+ * Print the average time per login spent in each phase of the login, taken
+ * from the metrics in Prometheus format.  The phase histograms record one
+ * observation per login for each phase reached.
+ */
+static void
+report_phases(struct webauth_context *ctx, const char *name,
+              const struct webauth_metrics *metrics)
+{
+    char *output, *line, *last;
+    char phases[WA_TIMER_MAX][32];
+    double seconds[WA_TIMER_MAX];
+    unsigned long logins = 0;
+    size_t count = 0, i;
+    int s;
+
+    s = webauth_metrics_format(ctx, metrics, &output);
+    if (s != WA_ERR_NONE)
+        bail("cannot format metrics: %s", webauth_error_message(ctx, s));
+    for (line = apr_strtok(output, "\n", &last); line != NULL;
+         line = apr_strtok(NULL, "\n", &last)) {
+        if (strncmp(line, LOGIN_COUNT, strlen(LOGIN_COUNT)) == 0)
+            logins = strtoul(line + strlen(LOGIN_COUNT), NULL, 10);
+        else if (strncmp(line, PHASE_SUM, strlen(PHASE_SUM)) == 0
+                 && count < ARRAY_SIZE(phases)
+                 && sscanf(line + strlen(PHASE_SUM), "%31[^\"]\"} %lf",
+                           phases[count], &seconds[count]) == 2)
+            count++;
+    }
+    if (logins == 0)
+        return;
+    for (i = 0; i < count; i++)
+        fprintf(stderr, "%-40s %10.1f us/login\n",
+                apr_psprintf(ctx->pool, "%s/%s", name, phases[i]),
+                seconds[i] * 1e6 / logins);
+}
+
+
+/*
+ * Run a scenario in one thread and then in several threads at once, each
+ * with a fresh set of metrics attached to the setup context, and report the
+ * phase breakdown after each.
+ */
+static void
+run_scenario(struct webauth_context *ctx, const struct scenario *scenario,
+             const struct webauth_keyring *ring, int threads)
+{
+    struct login_data data;
+    struct webauth_metrics *metrics;
+    const char *name;
+    void *memory;
+    size_t size;
+
+    build_request(ctx, scenario, ring, &data);
+    size = webauth_metrics_size();
+    memory = bmalloc(size);
+
+    /* One thread. */
+    if (webauth_metrics_init(ctx, memory, size, &metrics) != WA_ERR_NONE)
+        bail("cannot initialize metrics");
+    webauth_metrics_set(ctx, metrics);
+    bench_run(scenario->name, bench_login, &data);
+    report_phases(ctx, scenario->name, metrics);
+
+    /* Several threads at once. */
+    if (webauth_metrics_init(ctx, memory, size, &metrics) != WA_ERR_NONE)
+        bail("cannot initialize metrics");
+    name = apr_psprintf(ctx->pool, "%s-threads", scenario->name);
+    bench_run_threads(name, bench_login, &data, threads);
+    report_phases(ctx, name, metrics);
+
+    webauth_metrics_set(ctx, NULL);
+    free(memory);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    struct webauth_context *ctx;
+    struct webauth_key *key;
+    struct webauth_keyring *ring;
+    struct webauth_webkdc_config config;
+#ifdef HAVE_REMCTL
+    struct webauth_user_config user;
+#endif
+    apr_array_header_t *local, *permitted;
+    int threads = THREADS;
+    size_t i;
+
+    if (argc > 2)
+        bail("Usage: login-b [<threads>]");
+    if (argc == 2) {
+        threads = atoi(argv[1]);
+        if (threads <= 0)
+            bail("invalid number of threads: %s", argv[1]);
+    }
+    ctx = bench_init();
+
+    /* The WebKDC configuration, with a fresh WebKDC key. */
+    if (webauth_key_create(ctx, WA_KEY_AES, WA_AES_128, NULL, &key)
+        != WA_ERR_NONE)
+        bail("cannot create key");
+    ring = webauth_keyring_from_key(ctx, key);
+    memset(&config, 0, sizeof(config));
+    config.keytab_path      = "keytab";
+    config.principal        = "service/webkdc";
+    config.proxy_lifetime   = 10 * 60 * 60;
+    config.login_time_limit = 5 * 60;
+    local = apr_array_make(ctx->pool, 1, sizeof(const char *));
+    APR_ARRAY_PUSH(local, const char *) = BENCH_STUB_REALM;
+    permitted = apr_array_make(ctx->pool, 1, sizeof(const char *));
+    config.local_realms     = local;
+    config.permitted_realms = permitted;
+    if (webauth_webkdc_config(ctx, &config) != WA_ERR_NONE)
+        bail("cannot configure WebKDC");
+
+    /* Logins without a user information service. */
+    for (i = 0; i < ARRAY_SIZE(scenarios); i++)
+        run_scenario(ctx, &scenarios[i], ring, threads);
+
+    /* Logins with a user information service using the XML protocol. */
+#ifdef HAVE_REMCTL
+    memset(&user, 0, sizeof(user));
+    user.protocol = WA_PROTOCOL_REMCTL;
+    user.host     = "localhost";
+    user.command  = "test";
+    user.keytab   = "keytab";
+    if (webauth_user_config(ctx, &user) != WA_ERR_NONE)
+        bail("cannot configure user information service");
+    run_scenario(ctx, &userinfo, ring, threads);
+#endif
+    return 0;
+}
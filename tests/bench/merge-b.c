@@ -0,0 +1,178 @@
+/*
+ * Benchmarks for token merging.
+ *
+ * Times the merges the WebKDC does for each login: merging the webkdc-proxy
+ * tokens from the single sign-on cookie with one from a fresh login, merging
+ * the webkdc-factor tokens from the device cookies, and merging the result
+ * of the latter into the former.  The single webkdc-proxy token case, the
+ * most common, is timed on its own.
+ *
+ * Copyright 2014
+ *     The Board of Trustees of the Leland Stanford Junior University
+ *
+ * See LICENSE for licensing terms.
+ */
+
+#include <config.h>
+#include <portable/apr.h>
+#include <portable/system.h>
+
+#include <time.h>
+
+#include <lib/internal.h>
+#include <tests/bench/bench.h>
+#include <tests/tap/basic.h>
+#include <webauth/basic.h>
+#include <webauth/tokens.h>
+
+/* How long initial factors count as session factors, as the WebKDC uses. */
+#define SESSION_LIMIT (60 * 60)
+
+/* The tokens to merge. */
+struct merge_data {
+    apr_array_header_t *single;
+    apr_array_header_t *proxies;
+    apr_array_header_t *factors;
+    struct webauth_token *proxy;
+    struct webauth_token *factor;
+};
+
+
+static void
+bench_proxy_single(struct webauth_context *ctx, void *data)
+{
+    struct merge_data *md = data;
+    struct webauth_token *result;
+
+    if (wai_token_merge_webkdc_proxy(ctx, md->single, SESSION_LIMIT, &result)
+        != WA_ERR_NONE)
+        bail("cannot merge webkdc-proxy token");
+}
+
+
+static void
+bench_proxy(struct webauth_context *ctx, void *data)
+{
+    struct merge_data *md = data;
+    struct webauth_token *result;
+
+    if (wai_token_merge_webkdc_proxy(ctx, md->proxies, SESSION_LIMIT,
+                                     &result) != WA_ERR_NONE)
+        bail("cannot merge webkdc-proxy tokens");
+}
+
+
+static void
+bench_factor(struct webauth_context *ctx, void *data)
+{
+    struct merge_data *md = data;
+    struct webauth_token *result;
+
+    if (wai_token_merge_webkdc_factor(ctx, md->factors, &result)
+        != WA_ERR_NONE)
+        bail("cannot merge webkdc-factor tokens");
+}
+
+
+static void
+bench_proxy_factor(struct webauth_context *ctx, void *data)
+{
+    struct merge_data *md = data;
+    struct webauth_token *result;
+
+    if (wai_token_merge_webkdc_proxy_factor(ctx, md->proxy, md->factor,
+                                            &result) != WA_ERR_NONE)
+        bail("cannot merge webkdc-factor token into webkdc-proxy token");
+}
+
+
+/*
+ * Create a webkdc-proxy token for testuser with the given proxy type,
+ * factors, and creation time.
+ */
+static struct webauth_token *
+make_proxy(struct webauth_context *ctx, const char *type, const char *factors,
+           time_t creation)
+{
+    struct webauth_token *token;
+    struct webauth_token_webkdc_proxy *wkproxy;
+
+    token = apr_pcalloc(ctx->pool, sizeof(struct webauth_token));
+    token->type = WA_TOKEN_WEBKDC_PROXY;
+    wkproxy = &token->token.webkdc_proxy;
+    wkproxy->subject         = "testuser";
+    wkproxy->proxy_type      = type;
+    wkproxy->proxy_subject   = apr_psprintf(ctx->pool, "WEBKDC:%s", type);
+    wkproxy->data            = "testuser";
+    wkproxy->data_len        = strlen("testuser");
+    wkproxy->initial_factors = factors;
+    wkproxy->session_factors = factors;
+    wkproxy->loa             = 1;
+    wkproxy->creation        = creation;
+    wkproxy->expiration      = creation + 10 * 60 * 60;
+    return token;
+}
+
+
+/*
+ * Create a webkdc-factor token for testuser with the given factors and
+ * creation time.
+ */
+static struct webauth_token *
+make_factor(struct webauth_context *ctx, const char *factors, time_t creation)
+{
+    struct webauth_token *token;
+
+    token = apr_pcalloc(ctx->pool, sizeof(struct webauth_token));
+    token->type = WA_TOKEN_WEBKDC_FACTOR;
+    token->token.webkdc_factor.subject    = "testuser";
+    token->token.webkdc_factor.factors    = factors;
+    token->token.webkdc_factor.creation   = creation;
+    token->token.webkdc_factor.expiration = creation + 30 * 24 * 60 * 60;
+    return token;
+}
+
+
+int
+main(void)
+{
+    struct webauth_context *ctx;
+    struct merge_data data;
+    time_t now;
+
+    ctx = bench_init();
+    now = time(NULL);
+
+    /*
+     * A krb5 webkdc-proxy token from a password login two hours ago, as
+     * found in the single sign-on cookie, and one from an OTP login just
+     * now.
+     */
+    data.single = apr_array_make(ctx->pool, 1, sizeof(struct webauth_token *));
+    data.proxy = make_proxy(ctx, "krb5", "p", now - 2 * 60 * 60);
+    APR_ARRAY_PUSH(data.single, struct webauth_token *) = data.proxy;
+    data.proxies = apr_array_make(ctx->pool, 2,
+                                  sizeof(struct webauth_token *));
+    APR_ARRAY_PUSH(data.proxies, struct webauth_token *) = data.proxy;
+    APR_ARRAY_PUSH(data.proxies, struct webauth_token *)
+        = make_proxy(ctx, "otp", "o,o3", now);
+
+    /*
+     * webkdc-factor tokens from device cookies set on two earlier logins
+     * and from this one.
+     */
+    data.factors = apr_array_make(ctx->pool, 3,
+                                  sizeof(struct webauth_token *));
+    APR_ARRAY_PUSH(data.factors, struct webauth_token *)
+        = make_factor(ctx, "d", now - 7 * 24 * 60 * 60);
+    APR_ARRAY_PUSH(data.factors, struct webauth_token *)
+        = make_factor(ctx, "d,k", now - 24 * 60 * 60);
+    data.factor = make_factor(ctx, "d", now);
+    APR_ARRAY_PUSH(data.factors, struct webauth_token *) = data.factor;
+
+    bench_run("merge/webkdc-proxy-single", bench_proxy_single, &data);
+    bench_run("merge/webkdc-proxy", bench_proxy, &data);
+    bench_run("merge/webkdc-factor", bench_factor, &data);
+    bench_run("merge/webkdc-proxy-factor", bench_proxy_factor, &data);
+    return 0;
+}
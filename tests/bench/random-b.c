@@ -0,0 +1,93 @@
+/*
+ * Benchmarks for random nonces.
+ *
+ * Times getting a token nonce directly from OpenSSL and from the per-thread
+ * block of random data, both in one thread and in several threads at once,
+ * where OpenSSL's lock around its random number generator is contended.
+ * Also times encoding an app token, which needs a nonce, in several threads
+ * at once.
+ *
+ * Copyright 2014
+ *     The Board of Trustees of the Leland Stanford Junior University
+ *
+ * See LICENSE for licensing terms.
+ */
+
+#include <config.h>
+#include <portable/apr.h>
+#include <portable/system.h>
+
+#include <openssl/rand.h>
+#include <time.h>
+
+#include <lib/internal.h>
+#include <tests/bench/bench.h>
+#include <tests/tap/basic.h>
+#include <webauth/basic.h>
+#include <webauth/keys.h>
+#include <webauth/tokens.h>
+
+/* Number of threads for the multi-threaded benchmarks. */
+#define THREADS 8
+
+/* Size of the nonce in a token. */
+#define NONCE_SIZE 16
+
+
+static void
+bench_openssl(struct webauth_context *ctx UNUSED, void *data UNUSED)
+{
+    unsigned char nonce[NONCE_SIZE];
+
+    if (RAND_bytes(nonce, sizeof(nonce)) <= 0)
+        bail("cannot get random data");
+}
+
+
+static void
+bench_nonce(struct webauth_context *ctx, void *data UNUSED)
+{
+    unsigned char nonce[NONCE_SIZE];
+
+    if (wai_random_nonce(ctx, nonce, sizeof(nonce)) != WA_ERR_NONE)
+        bail("cannot get random nonce");
+}
+
+
+static void
+bench_encode(struct webauth_context *ctx, void *data)
+{
+    struct webauth_token token;
+    const char *encoded;
+
+    memset(&token, 0, sizeof(token));
+    token.type = WA_TOKEN_APP;
+    token.token.app.subject = "testuser";
+    token.token.app.expiration = time(NULL) + 3600;
+    if (webauth_token_encode(ctx, &token, data, &encoded) != WA_ERR_NONE)
+        bail("cannot encode token");
+}
+
+
+int
+main(void)
+{
+    struct webauth_context *ctx;
+    struct webauth_keyring *ring;
+    struct webauth_key *key;
+
+    ctx = bench_init();
+    if (webauth_key_create(ctx, WA_KEY_AES, WA_AES_128, NULL, &key)
+        != WA_ERR_NONE)
+        bail("cannot create key");
+    ring = webauth_keyring_from_key(ctx, key);
+
+    bench_run("random/openssl", bench_openssl, NULL);
+    bench_run("random/nonce", bench_nonce, NULL);
+    bench_run_threads("random/openssl-threads", bench_openssl, NULL, THREADS);
+    bench_run_threads("random/nonce-threads", bench_nonce, NULL, THREADS);
+    bench_run("random/encode-app", bench_encode, ring);
+    bench_run_threads("random/encode-app-threads", bench_encode, ring,
+                      THREADS);
+    return 0;
+}
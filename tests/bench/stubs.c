@@ -0,0 +1,252 @@
+/*
+ * In-process replacements for the Kerberos and remctl calls.
+ *
+ * Benchmarks of the WebKDC code that link this file get these definitions
+ * instead of the ones in libwebauth, so that they can run without a KDC or
+ * a user information service and measure only the WebAuth processing.  The
+ * library sources that make the calls have to be compiled into the
+ * benchmark, since wai_user_remctl is internal to the library.
+ *
+ * The Kerberos functions accept any password except BENCH_STUB_BAD_PASSWORD
+ * and any credential, and return fixed data of realistic sizes in place of
+ * credentials and authenticators.  The remctl call returns a canned reply for
+ * a user with multifactor devices and a login history in the protocol
+ * configured in the context.
+ *
+ * Copyright 2014
+ *     The Board of Trustees of the Leland Stanford Junior University
+ *
+ * See LICENSE for licensing terms.
+ */
+
+#include <config.h>
+#include <portable/apr.h>
+#include <portable/system.h>
+
+#include <lib/internal.h>
+#include <tests/bench/stubs.h>
+#include <webauth/basic.h>
+#include <webauth/krb5.h>
+#include <webauth/webkdc.h>
+#include <util/macros.h>
+
+/* Sizes of an exported ticket-granting ticket and of an authenticator. */
+#define STUB_CRED_SIZE 1200
+#define STUB_AUTH_SIZE  700
+
+/* Lifetime of the stub ticket-granting ticket. */
+#define STUB_CRED_LIFETIME (10 * 60 * 60)
+
+/* The stub Kerberos context, which only remembers the principal. */
+struct webauth_krb5 {
+    const char *principal;
+};
+
+/* The reply to webkdc-userinfo with the XML protocol. */
+static const char xml_reply[] =
+    "<authdata user=\"testuser\">\n"
+    "  <factors>\n"
+    "    <factor>p</factor>\n"
+    "    <factor>m</factor>\n"
+    "    <factor>o</factor>\n"
+    "    <factor>o3</factor>\n"
+    "  </factors>\n"
+    "  <required-factors>\n"
+    "    <factor>p</factor>\n"
+    "    <factor>m</factor>\n"
+    "    <factor>o</factor>\n"
+    "    <factor>o3</factor>\n"
+    "  </required-factors>\n"
+    "  <persistent-factors>\n"
+    "    <valid-threshold>1365630519</valid-threshold>\n"
+    "  </persistent-factors>\n"
+    "  <login-history>\n"
+    "    <host name=\"example.com\" timestamp=\"1335373919\">"
+    "127.0.0.2</host>\n"
+    "    <host name=\"www.example.com\">127.0.0.3</host>\n"
+    "  </login-history>\n"
+    "  <max-loa>3</max-loa>\n"
+    "  <password-expires>1310675733</password-expires>\n"
+    "</authdata>\n";
+
+/* The reply to webkdc-userinfo with the JSON protocol. */
+static const char json_reply[] =
+    "{\n"
+    "    \"success\": true,\n"
+    "    \"response\": {\n"
+    "        \"available_factors\": [\"p\", \"m\", \"o\", \"o3\"],\n"
+    "        \"required_factors\": [\"p\", \"m\", \"o\", \"o3\"],\n"
+    "        \"persistent_threshold\": 1365630519,\n"
+    "        \"logins\": [\n"
+    "            {\n"
+    "                \"hostname\": \"example.com\",\n"
+    "                \"ip\": \"127.0.0.2\",\n"
+    "                \"timestamp\": 1335373919\n"
+    "            },\n"
+    "            {\n"
+    "                \"hostname\": \"www.example.com\",\n"
+    "                \"ip\": \"127.0.0.3\"\n"
+    "            }\n"
+    "        ],\n"
+    "        \"max_level_of_assurance\": 3,\n"
+    "        \"password_expires\": 1310675733,\n"
+    "        \"default\": {\n"
+    "            \"id\": \"VAERQ235F5QFA561\",\n"
+    "            \"factor\": \"v\"\n"
+    "        },\n"
+    "        \"devices\": [\n"
+    "            {\n"
+    "                \"name\": \"Name of a phone\",\n"
+    "                \"factors\": [ \"o30\", \"v\" ],\n"
+    "                \"id\": \"VAERQ235F5QFA561\"\n"
+    "            },\n"
+    "            {\n"
+    "                \"name\": \"Name of a token\",\n"
+    "                \"factors\": [ \"o50\" ],\n"
+    "                \"id\": \"15FQER515114QFQFABG\"\n"
+    "            }\n"
+    "        ]\n"
+    "    }\n"
+    "}\n";
+
+/* Fixed contents of the stub credentials and authenticators. */
+static char stub_data[STUB_CRED_SIZE];
+
+
+/*
+ * Replaces the remctl call to the user information service, returning the
+ * canned reply for the protocol in use.
+ */
+int
+wai_user_remctl(struct webauth_context *ctx, const char **command UNUSED,
+                struct wai_buffer *output)
+{
+    if (ctx->user->json)
+        wai_buffer_append(output, json_reply, sizeof(json_reply) - 1);
+    else
+        wai_buffer_append(output, xml_reply, sizeof(xml_reply) - 1);
+    return WA_ERR_NONE;
+}
+
+
+int
+webauth_krb5_new(struct webauth_context *ctx, struct webauth_krb5 **kc)
+{
+    *kc = apr_pcalloc(ctx->pool, sizeof(struct webauth_krb5));
+    return WA_ERR_NONE;
+}
+
+
+void
+webauth_krb5_free(struct webauth_context *ctx UNUSED,
+                  struct webauth_krb5 *kc UNUSED)
+{
+    return;
+}
+
+
+int
+webauth_krb5_set_fast_armor_path(struct webauth_context *ctx UNUSED,
+                                 struct webauth_krb5 *kc UNUSED,
+                                 const char *path UNUSED)
+{
+    return WA_ERR_NONE;
+}
+
+
+/*
+ * Authenticate the user, qualifying the username with BENCH_STUB_REALM if it
+ * has no realm.  The WebKDC principal is returned as the server principal.
+ */
+int
+webauth_krb5_init_via_password(struct webauth_context *ctx,
+                               struct webauth_krb5 *kc, const char *username,
+                               const char *password,
+                               const char *get_principal UNUSED,
+                               const char *keytab UNUSED,
+                               const char *server_principal,
+                               const char *cache UNUSED,
+                               char **server_principal_out)
+{
+    if (strcmp(password, BENCH_STUB_BAD_PASSWORD) == 0)
+        return wai_error_set(ctx, WA_PEC_LOGIN_FAILED, "bad password");
+    if (strchr(username, '@') != NULL)
+        kc->principal = apr_pstrdup(ctx->pool, username);
+    else
+        kc->principal = apr_psprintf(ctx->pool, "%s@%s", username,
+                                     BENCH_STUB_REALM);
+    if (server_principal_out != NULL) {
+        if (server_principal == NULL)
+            server_principal = "service/webkdc@" BENCH_STUB_REALM;
+        *server_principal_out = apr_pstrdup(ctx->pool, server_principal);
+    }
+    return WA_ERR_NONE;
+}
+
+
+int
+webauth_krb5_export_cred(struct webauth_context *ctx,
+                         struct webauth_krb5 *kc UNUSED,
+                         const char *principal UNUSED, void **cred,
+                         size_t *cred_len, time_t *expiration)
+{
+    *cred = apr_pmemdup(ctx->pool, stub_data, STUB_CRED_SIZE);
+    *cred_len = STUB_CRED_SIZE;
+    if (expiration != NULL)
+        *expiration = time(NULL) + STUB_CRED_LIFETIME;
+    return WA_ERR_NONE;
+}
+
+
+/*
+ * Import a credential.  The stub credentials don't name their principal, so
+ * this always uses testuser in BENCH_STUB_REALM.
+ */
+int
+webauth_krb5_import_cred(struct webauth_context *ctx UNUSED,
+                         struct webauth_krb5 *kc, const void *cred UNUSED,
+                         size_t cred_len UNUSED, const char *cache UNUSED)
+{
+    kc->principal = "testuser@" BENCH_STUB_REALM;
+    return WA_ERR_NONE;
+}
+
+
+int
+webauth_krb5_get_principal(struct webauth_context *ctx,
+                           struct webauth_krb5 *kc, char **principal,
+                           enum webauth_krb5_canon canon)
+{
+    char *p;
+
+    *principal = apr_pstrdup(ctx->pool, kc->principal);
+    if (canon != WA_KRB5_CANON_NONE) {
+        p = strchr(*principal, '@');
+        if (p != NULL)
+            *p = '\0';
+    }
+    return WA_ERR_NONE;
+}
+
+
+int
+webauth_krb5_get_realm(struct webauth_context *ctx, struct webauth_krb5 *kc,
+                       char **realm)
+{
+    const char *p;
+
+    p = strchr(kc->principal, '@');
+    *realm = apr_pstrdup(ctx->pool, p == NULL ? BENCH_STUB_REALM : p + 1);
+    return WA_ERR_NONE;
+}
+
+
+int
+webauth_krb5_make_auth(struct webauth_context *ctx,
+                       struct webauth_krb5 *kc UNUSED,
+                       const char *server UNUSED, void **req, size_t *length)
+{
+    *req = apr_pmemdup(ctx->pool, stub_data, STUB_AUTH_SIZE);
+    *length = STUB_AUTH_SIZE;
+    return WA_ERR_NONE;
+}
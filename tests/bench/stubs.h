@@ -0,0 +1,23 @@
+/*
+ * Constants for the in-process Kerberos and remctl stubs.
+ *
+ * tests/bench/stubs.c replaces the Kerberos and remctl calls made by the
+ * WebKDC code.  It defines no new functions, only the library ones, so this
+ * header only documents how the stubs behave.
+ *
+ * Copyright 2014
+ *     The Board of Trustees of the Leland Stanford Junior University
+ *
+ * See LICENSE for licensing terms.
+ */
+
+#ifndef BENCH_STUBS_H
+#define BENCH_STUBS_H 1
+
+/* The realm of the principals the Kerberos stubs authenticate. */
+#define BENCH_STUB_REALM "EXAMPLE.COM"
+
+/* The one password the Kerberos stubs reject. */
+#define BENCH_STUB_BAD_PASSWORD "badpassword"
+
+#endif /* !BENCH_STUBS_H */
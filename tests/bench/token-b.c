@@ -0,0 +1,207 @@
+/*
+ * Benchmarks for token decoding.
+ *
+ * Times decoding the tokens the WebKDC handles on every request that carry
+ * large binary payloads: webkdc-proxy tokens with an embedded Kerberos
+ * credential and cred tokens.  Also times decrypting a token encrypted with
+ * the oldest key of a keyring with a long history of keys, as happens with
+ * tokens from a server with a skewed clock, both when the token carries a
+ * key hint and when it carries a key identifier.  Also times the base64
+ * encoding and decoding of an encrypted cred token on its own.
+ *
+ * Copyright 2014
+ *     The Board of Trustees of the Leland Stanford Junior University
+ *
+ * See LICENSE for licensing terms.
+ */
+
+#include <config.h>
+#include <portable/apr.h>
+#include <portable/system.h>
+
+#include <apr_base64.h>
+#include <time.h>
+
+#include <tests/bench/bench.h>
+#include <tests/tap/basic.h>
+#include <webauth/basic.h>
+#include <webauth/keys.h>
+#include <webauth/tokens.h>
+
+/* Size of the fake Kerberos credential embedded in the tokens. */
+#define CRED_SIZE 1200
+
+/* Number of keys in the keyring for the decryption benchmarks. */
+#define HISTORY_KEYS 20
+
+/* Size of the data in the encrypted tokens, about that of an app token. */
+#define DATA_SIZE 100
+
+/* Encoded tokens and the keyring to decode them with. */
+struct token_data {
+    struct webauth_keyring *ring;
+    const char *webkdc_proxy;
+    const char *cred;
+    char *cred_raw;
+    int cred_length;
+    char *buffer;
+    struct webauth_keyring *history;
+    void *hint_token;
+    size_t hint_length;
+    void *id_token;
+    size_t id_length;
+};
+
+
+static void
+bench_webkdc_proxy(struct webauth_context *ctx, void *data)
+{
+    struct token_data *td = data;
+    struct webauth_token *token;
+
+    if (webauth_token_decode(ctx, WA_TOKEN_WEBKDC_PROXY, td->webkdc_proxy,
+                             td->ring, &token) != WA_ERR_NONE)
+        bail("cannot decode webkdc-proxy token");
+}
+
+
+static void
+bench_cred(struct webauth_context *ctx, void *data)
+{
+    struct token_data *td = data;
+    struct webauth_token *token;
+
+    if (webauth_token_decode(ctx, WA_TOKEN_CRED, td->cred, td->ring, &token)
+        != WA_ERR_NONE)
+        bail("cannot decode cred token");
+}
+
+
+static void
+bench_base64_encode(struct webauth_context *ctx UNUSED, void *data)
+{
+    struct token_data *td = data;
+
+    apr_base64_encode(td->buffer, td->cred_raw, td->cred_length);
+}
+
+
+static void
+bench_base64_decode(struct webauth_context *ctx UNUSED, void *data)
+{
+    struct token_data *td = data;
+
+    apr_base64_decode(td->buffer, td->cred);
+}
+
+
+static void
+bench_decrypt_hint(struct webauth_context *ctx, void *data)
+{
+    struct token_data *td = data;
+    void *output;
+    size_t length;
+
+    if (webauth_token_decrypt(ctx, td->hint_token, td->hint_length, &output,
+                              &length, td->history) != WA_ERR_NONE)
+        bail("cannot decrypt token with hint");
+}
+
+
+static void
+bench_decrypt_key_id(struct webauth_context *ctx, void *data)
+{
+    struct token_data *td = data;
+    void *output;
+    size_t length;
+
+    if (webauth_token_decrypt(ctx, td->id_token, td->id_length, &output,
+                              &length, td->history) != WA_ERR_NONE)
+        bail("cannot decrypt token with key identifier");
+}
+
+
+int
+main(void)
+{
+    struct webauth_context *ctx;
+    struct webauth_key *key;
+    struct webauth_keyring *ring;
+    struct webauth_token token;
+    struct token_data data;
+    char *cred;
+    time_t now;
+    int i;
+
+    ctx = bench_init();
+    if (webauth_key_create(ctx, WA_KEY_AES, WA_AES_128, NULL, &key)
+        != WA_ERR_NONE)
+        bail("cannot create key");
+    data.ring = webauth_keyring_from_key(ctx, key);
+    now = time(NULL);
+    cred = bcalloc(CRED_SIZE, 1);
+    memset(cred, 'x', CRED_SIZE);
+
+    /* Encode the tokens once. */
+    memset(&token, 0, sizeof(token));
+    token.type = WA_TOKEN_WEBKDC_PROXY;
+    token.token.webkdc_proxy.subject         = "testuser";
+    token.token.webkdc_proxy.proxy_type      = "krb5";
+    token.token.webkdc_proxy.proxy_subject   = "WEBKDC:krb5:testuser";
+    token.token.webkdc_proxy.data            = cred;
+    token.token.webkdc_proxy.data_len        = CRED_SIZE;
+    token.token.webkdc_proxy.initial_factors = "p";
+    token.token.webkdc_proxy.creation        = now;
+    token.token.webkdc_proxy.expiration      = now + 60 * 60;
+    if (webauth_token_encode(ctx, &token, data.ring, &data.webkdc_proxy)
+        != WA_ERR_NONE)
+        bail("cannot encode webkdc-proxy token");
+    memset(&token, 0, sizeof(token));
+    token.type = WA_TOKEN_CRED;
+    token.token.cred.subject    = "testuser";
+    token.token.cred.type       = "krb5";
+    token.token.cred.service    = "host/example.com@EXAMPLE.COM";
+    token.token.cred.data       = cred;
+    token.token.cred.data_len   = CRED_SIZE;
+    token.token.cred.creation   = now;
+    token.token.cred.expiration = now + 60 * 60;
+    if (webauth_token_encode(ctx, &token, data.ring, &data.cred)
+        != WA_ERR_NONE)
+        bail("cannot encode cred token");
+    data.cred_raw = bmalloc(apr_base64_decode_len(data.cred));
+    data.cred_length = apr_base64_decode(data.cred_raw, data.cred);
+    data.buffer = bmalloc(apr_base64_encode_len(data.cred_length));
+
+    /*
+     * Build a keyring with a key per day going back HISTORY_KEYS days, and
+     * encrypt tokens with its oldest key in both formats.  The hint in the
+     * first token is the current time, so it points at the newest key.
+     */
+    data.history = webauth_keyring_new(ctx, HISTORY_KEYS);
+    for (i = 0; i < HISTORY_KEYS; i++) {
+        if (webauth_key_create(ctx, WA_KEY_AES, WA_AES_128, NULL, &key)
+            != WA_ERR_NONE)
+            bail("cannot create key");
+        webauth_keyring_add(ctx, data.history, now - i * 86400,
+                            now - i * 86400, key);
+    }
+    ring = webauth_keyring_from_key(ctx, key);
+    if (webauth_token_encrypt(ctx, cred, DATA_SIZE, &data.hint_token,
+                              &data.hint_length, ring) != WA_ERR_NONE)
+        bail("cannot encrypt token with hint");
+    webauth_keyring_set_format(ring, WA_TOKEN_FORMAT_KEY_ID);
+    if (webauth_token_encrypt(ctx, cred, DATA_SIZE, &data.id_token,
+                              &data.id_length, ring) != WA_ERR_NONE)
+        bail("cannot encrypt token with key identifier");
+
+    bench_run("token/decode-webkdc-proxy", bench_webkdc_proxy, &data);
+    bench_run("token/decode-cred", bench_cred, &data);
+    bench_run("token/base64-encode-cred", bench_base64_encode, &data);
+    bench_run("token/base64-decode-cred", bench_base64_decode, &data);
+    bench_run("token/decrypt-hint-miss", bench_decrypt_hint, &data);
+    bench_run("token/decrypt-key-id", bench_decrypt_key_id, &data);
+    free(data.cred_raw);
+    free(data.buffer);
+    free(cred);
+    return 0;
+}
@@ -0,0 +1,130 @@
+/*
+ * Benchmarks for token encryption.
+ *
+ * Times encrypting and decrypting data the size of the encoded attributes of
+ * typical app, id, and cred tokens, in the original format with AES-CBC and
+ * HMAC-SHA1 and in the AEAD format with AES-GCM.  The id token carries a
+ * Kerberos authenticator and the cred token a Kerberos service ticket, so
+ * they're much larger than the app token.
+ *
+ * Copyright 2014
+ *     The Board of Trustees of the Leland Stanford Junior University
+ *
+ * See LICENSE for licensing terms.
+ */
+
+#include <config.h>
+#include <portable/apr.h>
+#include <portable/system.h>
+
+#include <tests/bench/bench.h>
+#include <tests/tap/basic.h>
+#include <tests/tap/string.h>
+#include <webauth/basic.h>
+#include <webauth/keys.h>
+#include <webauth/tokens.h>
+
+/* Sizes of the encoded attributes of app, id, and cred tokens. */
+#define APP_SIZE   100
+#define ID_SIZE    700
+#define CRED_SIZE 1300
+
+/* Data of one size and its encryption with a keyring in one format. */
+struct crypto_data {
+    struct webauth_keyring *ring;
+    void *data;
+    size_t size;
+    void *token;
+    size_t length;
+};
+
+
+static void
+bench_encrypt(struct webauth_context *ctx, void *data)
+{
+    struct crypto_data *cd = data;
+    void *token;
+    size_t length;
+
+    if (webauth_token_encrypt(ctx, cd->data, cd->size, &token, &length,
+                              cd->ring) != WA_ERR_NONE)
+        bail("cannot encrypt token");
+}
+
+
+static void
+bench_decrypt(struct webauth_context *ctx, void *data)
+{
+    struct crypto_data *cd = data;
+    void *output;
+    size_t length;
+
+    if (webauth_token_decrypt(ctx, cd->token, cd->length, &output, &length,
+                              cd->ring) != WA_ERR_NONE)
+        bail("cannot decrypt token");
+}
+
+
+/*
+ * Set up the data of the given size for a keyring, encrypting it for the
+ * decryption benchmarks.
+ */
+static void
+setup(struct webauth_context *ctx, struct crypto_data *cd,
+      struct webauth_keyring *ring, size_t size)
+{
+    size_t i;
+
+    cd->ring = ring;
+    cd->size = size;
+    cd->data = bmalloc(size);
+    for (i = 0; i < size; i++)
+        ((unsigned char *) cd->data)[i] = i % 256;
+    if (webauth_token_encrypt(ctx, cd->data, size, &cd->token, &cd->length,
+                              ring) != WA_ERR_NONE)
+        bail("cannot encrypt token");
+}
+
+
+int
+main(void)
+{
+    struct webauth_context *ctx;
+    struct webauth_keyring *cbc, *aead;
+    struct webauth_key *key;
+    struct crypto_data data[6];
+    const char *names[3] = { "app", "id", "cred" };
+    const size_t sizes[3] = { APP_SIZE, ID_SIZE, CRED_SIZE };
+    char *name;
+    size_t i;
+
+    /* Keyrings with the same key, one in each format. */
+    ctx = bench_init();
+    if (webauth_key_create(ctx, WA_KEY_AES, WA_AES_128, NULL, &key)
+        != WA_ERR_NONE)
+        bail("cannot create key");
+    cbc = webauth_keyring_from_key(ctx, key);
+    aead = webauth_keyring_from_key(ctx, key);
+    webauth_keyring_set_format(aead, WA_TOKEN_FORMAT_AEAD);
+    for (i = 0; i < 3; i++) {
+        setup(ctx, &data[i * 2], cbc, sizes[i]);
+        setup(ctx, &data[i * 2 + 1], aead, sizes[i]);
+    }
+
+    /* Run each benchmark for each token size. */
+    for (i = 0; i < 3; i++) {
+        basprintf(&name, "token-crypto/encrypt-cbc-%s", names[i]);
+        bench_run(name, bench_encrypt, &data[i * 2]);
+        free(name);
+        basprintf(&name, "token-crypto/encrypt-aead-%s", names[i]);
+        bench_run(name, bench_encrypt, &data[i * 2 + 1]);
+        free(name);
+        basprintf(&name, "token-crypto/decrypt-cbc-%s", names[i]);
+        bench_run(name, bench_decrypt, &data[i * 2]);
+        free(name);
+        basprintf(&name, "token-crypto/decrypt-aead-%s", names[i]);
+        bench_run(name, bench_decrypt, &data[i * 2 + 1]);
+        free(name);
+    }
+    return 0;
+}
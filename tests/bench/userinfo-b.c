@@ -0,0 +1,74 @@
+/*
+ * Benchmarks for user information service calls.
+ *
+ * Times a webkdc-userinfo call for a user with multifactor devices and a
+ * login history with both the XML and the JSON protocols.  The remctl call
+ * is replaced with the one in tests/bench/stubs.c, which returns a canned
+ * reply, so this measures only building the command and parsing the reply.
+ *
+ * Copyright 2014
+ *     The Board of Trustees of the Leland Stanford Junior University
+ *
+ * See LICENSE for licensing terms.
+ */
+
+#include <config.h>
+#include <portable/apr.h>
+#include <portable/system.h>
+
+#include <tests/bench/bench.h>
+#include <tests/tap/basic.h>
+#include <webauth/basic.h>
+#include <webauth/webkdc.h>
+
+/*
+ * Without remctl support, the user information service can't be configured,
+ * so there is nothing to time.
+ */
+#ifndef HAVE_REMCTL
+
+int
+main(void)
+{
+    return 0;
+}
+
+#else /* HAVE_REMCTL */
+
+static void
+bench_info(struct webauth_context *ctx, void *data UNUSED)
+{
+    struct webauth_user_info *info;
+
+    if (webauth_user_info(ctx, "testuser", "127.0.0.1", 0,
+                          "https://example.com/", "p", &info) != WA_ERR_NONE)
+        bail("cannot get user information");
+}
+
+
+int
+main(void)
+{
+    struct webauth_context *ctx;
+    struct webauth_user_config config;
+
+    /* The user information service configuration for each protocol. */
+    ctx = bench_init();
+    memset(&config, 0, sizeof(config));
+    config.protocol = WA_PROTOCOL_REMCTL;
+    config.host     = "localhost";
+    config.command  = "test";
+    config.keytab   = "keytab";
+    if (webauth_user_config(ctx, &config) != WA_ERR_NONE)
+        bail("cannot configure user information service");
+    bench_run("userinfo/info-xml", bench_info, NULL);
+# ifdef HAVE_JANSSON
+    config.json = 1;
+    if (webauth_user_config(ctx, &config) != WA_ERR_NONE)
+        bail("cannot configure user information service");
+    bench_run("userinfo/info-json", bench_info, NULL);
+# endif
+    return 0;
+}
+
+#endif /* HAVE_REMCTL */
@@ -2,10 +2,10 @@
  * APR buffer test suite.
  *
  * Test the APR-aware memory buffer code that's used internally by the
- * libwebauth library.
+ * libwebauth library, and the public interface to it.
  *
  * Written by Russ Allbery <eagle@eyrie.org>
- * Copyright 2012, 2013
+ * Copyright 2012, 2013, 2014
  *     The Board of Trustees of the Leland Stanford Junior University
  *
  * See LICENSE for licensing terms.
@@ -16,6 +16,7 @@
 
 #include <lib/internal.h>
 #include <tests/tap/basic.h>
+#include <webauth/buffer.h>
 
 static const char test_string1[] = "This is a test";
 static const char test_string2[] = " of the buffer system";
@@ -41,15 +42,18 @@ main(void)
 {
     apr_pool_t *pool;
     struct wai_buffer *buffer;
-    size_t offset;
+    struct webauth_buffer *collector;
+    size_t offset, i;
     char *data;
+    char *string;
+    char expected[181];
 
     if (apr_initialize() != APR_SUCCESS)
         bail("cannot initialize APR");
     if (apr_pool_create(&pool, NULL) != APR_SUCCESS)
         bail("cannot create memory pool");
 
-    plan(41);
+    plan(64);
 
     /* buffer_new, buffer_set, buffer_append */
     buffer = wai_buffer_new(pool);
@@ -142,6 +146,61 @@ main(void)
     wai_buffer_append(buffer, "", 1);
     is_string("testing 6 testing 7", buffer->data, "...and the right data");
 
+    /* Geometric growth. */
+    buffer = wai_buffer_new(pool);
+    wai_buffer_resize(buffer, 100);
+    is_int(128, buffer->size, "initial resize rounds up to 64 bytes");
+    wai_buffer_resize(buffer, 129);
+    is_int(256, buffer->size, "...and growing at least doubles the size");
+    wai_buffer_resize(buffer, 1000);
+    is_int(1024, buffer->size, "...unless more is needed");
+    for (i = 0; i < 150; i++)
+        wai_buffer_append(buffer, "0123456789", 10);
+    is_int(1500, buffer->used, "appending many times works");
+    is_int(2048, buffer->size, "...with geometric growth");
+
+    /* Chunked buffers. */
+    memset(expected, 'a', 40);
+    memset(expected + 40, 'b', 40);
+    memset(expected + 80, 'c', 100);
+    expected[180] = '\0';
+    buffer = wai_buffer_new_chunked(pool);
+    wai_buffer_append(buffer, expected, 40);
+    is_int(64, buffer->size, "chunked buffer starts with one block");
+    ok(buffer->chunks == NULL, "...and no chunks");
+    data = buffer->data;
+    wai_buffer_append(buffer, expected + 40, 40);
+    ok(buffer->chunks != NULL && buffer->chunks->data == data,
+       "growing saves the old block as a chunk without copying");
+    is_int(40, buffer->chunks->used, "...with the right length");
+    is_int(40, buffer->used, "...and the new block has the new data");
+    is_int(128, buffer->size, "...and is twice the size");
+    wai_buffer_append_sprintf(buffer, "%.100s", expected + 80);
+    is_int(100, buffer->used, "sprintf into a chunked buffer works");
+    is_int(180, wai_buffer_length(buffer), "...and the total length is right");
+    wai_buffer_flatten(buffer);
+    ok(buffer->chunks == NULL, "flattening removes the chunks");
+    is_int(180, buffer->used, "...and used is the total length");
+    is_string(expected, buffer->data, "...and the data is correct");
+    wai_buffer_append(buffer, "d", 1);
+    wai_buffer_set(buffer, "test", 4);
+    is_string("test", buffer->data, "setting a chunked buffer works");
+    is_int(4, wai_buffer_length(buffer), "...and discards the old data");
+    is_int(64 + 128 + 256 + 192, buffer->allocated,
+           "...and all blocks are counted in the memory used");
+
+    /* The public interface. */
+    collector = webauth_buffer_new(pool);
+    is_string("", webauth_buffer_string(collector), "new collector is empty");
+    for (i = 0; i < 10; i++)
+        webauth_buffer_append(collector, expected, 180);
+    is_int(1800, webauth_buffer_length(collector), "collector length is right");
+    ok(collector->buffer->chunks != NULL, "...and it is kept in blocks");
+    string = webauth_buffer_string(collector);
+    ok(strlen(string) == 1800 && strncmp(string, expected, 180) == 0
+       && strncmp(string + 1620, expected, 180) == 0,
+       "collector can be turned into a string in the right order");
+
     /* Clean up. */
     apr_terminate();
     return 0;
@@ -0,0 +1,75 @@
+/*
+ * Test suite for WebAuth context reuse and sharing.
+ *
+ * Copyright 2014
+ *     The Board of Trustees of the Leland Stanford Junior University
+ *
+ * See LICENSE for licensing terms.
+ */
+
+#include <config.h>
+#include <portable/apr.h>
+#include <portable/system.h>
+
+#include <lib/internal.h>
+#include <tests/tap/basic.h>
+#include <webauth/basic.h>
+#include <webauth/webkdc.h>
+
+
+int
+main(void)
+{
+    apr_pool_t *pool = NULL;
+    apr_pool_t *first;
+    struct webauth_context *ctx, *shared;
+    struct webauth_webkdc_config config;
+    struct webauth_webkdc_config *webkdc;
+    apr_array_header_t *realms;
+
+    plan(15);
+
+    if (apr_initialize() != APR_SUCCESS)
+        bail("cannot initialize APR");
+    if (apr_pool_create(&pool, NULL) != APR_SUCCESS)
+        bail("cannot create memory pool");
+    if (webauth_context_init_apr(&ctx, pool) != WA_ERR_NONE)
+        bail("cannot initialize WebAuth context");
+
+    /* Configure the context. */
+    memset(&config, 0, sizeof(config));
+    config.keytab_path = "keytab";
+    config.proxy_lifetime = 3600;
+    realms = apr_array_make(pool, 1, sizeof(const char *));
+    APR_ARRAY_PUSH(realms, const char *) = "EXAMPLE.COM";
+    config.local_realms = realms;
+    config.permitted_realms = realms;
+    is_int(WA_ERR_NONE, webauth_webkdc_config(ctx, &config),
+           "Configured WebKDC");
+    webkdc = ctx->webkdc;
+
+    /* Reset the context and check the configuration survives. */
+    wai_error_set(ctx, WA_ERR_INVALID, "test error");
+    is_int(WA_ERR_NONE, webauth_context_reset(ctx), "First reset");
+    first = ctx->pool;
+    ok(first != pool, "...and allocations now come from a subpool");
+    ok(ctx->webkdc == webkdc, "...and configuration is unchanged");
+    is_string("keytab", ctx->webkdc->keytab_path, "...and keytab is intact");
+    ok(ctx->error == NULL, "...and the error is cleared");
+    is_int(WA_ERR_NONE, ctx->status, "...and the status is cleared");
+    ok(apr_palloc(ctx->pool, 64) != NULL, "Allocation from the arena");
+    is_int(WA_ERR_NONE, webauth_context_reset(ctx), "Second reset");
+    ok(ctx->pool == first, "...and reuses the same subpool");
+    is_int(1, ctx->webkdc->permitted_realms->nelts,
+           "...and permitted realms are intact");
+
+    /* Create a context sharing that configuration. */
+    is_int(WA_ERR_NONE, webauth_context_init_shared(&shared, pool, ctx),
+           "Created shared context");
+    ok(shared->webkdc == webkdc, "...which shares the WebKDC configuration");
+    ok(shared->user == NULL, "...and the (empty) user configuration");
+    ok(shared->pool != ctx->pool, "...but not the pool");
+
+    apr_terminate();
+    return 0;
+}
@@ -0,0 +1,273 @@
+/*
+ * Tests for the generated attribute encoders and decoders.
+ *
+ * The encoders and decoders generated by lib/encoding-rules must behave
+ * exactly like the table-driven encoder and decoder that interpret the same
+ * rules.  Check that for every struct with a codec, both with all attributes
+ * present and with only the required ones, and check that errors are
+ * reported the same way.
+ *
+ * Copyright 2014
+ *     The Board of Trustees of the Leland Stanford Junior University
+ *
+ * See LICENSE for licensing terms.
+ */
+
+#include <config.h>
+#include <portable/apr.h>
+#include <portable/system.h>
+
+#include <lib/internal.h>
+#include <tests/tap/basic.h>
+#include <util/macros.h>
+#include <webauth/basic.h>
+#include <webauth/keys.h>
+#include <webauth/tokens.h>
+#include <webauth/was.h>
+
+/* Fixed creation and expiration times so that encodings are repeatable. */
+#define CT 1364943745
+#define ET 1893484800
+
+/* Token data with every attribute set. */
+static const struct webauth_token_app app_full = {
+    "testuser", "otheruser", CT, "\0key\1", 5, "p,o1", "p", 1, CT, ET
+};
+static const struct webauth_token_cred cred_full = {
+    "testuser", "krb5", "webauth/example.com@EXAMPLE.COM", "\0cred\377", 6,
+    CT, ET
+};
+static const struct webauth_token_error error_full = {
+    WA_PEC_LOGIN_FAILED, "login failed", CT
+};
+static const struct webauth_token_id id_full = {
+    "testuser", "otheruser", "krb5", "\0data", 5, "p,o1", "p", 1, CT, ET
+};
+static const struct webauth_token_login login_full = {
+    "testuser", "password", "123456", "o1", "device", CT
+};
+static const struct webauth_token_proxy proxy_full = {
+    "testuser", "otheruser", "krb5", "\0proxy", 6, "p,o1", "p", 1, CT, ET
+};
+static const struct webauth_token_request request_full = {
+    "id", "webkdc", "krb5", "\0state", 6, "https://example.com/", "fa",
+    "p,o1", "p", 1, "getTokensRequest", CT
+};
+static const struct webauth_token_webkdc_factor webkdc_factor_full = {
+    "testuser", "d", CT, ET
+};
+static const struct webauth_token_webkdc_proxy webkdc_proxy_full = {
+    "testuser", "krb5", "krb5:service/foo@EXAMPLE.COM", "\0data", 5, "p,o1",
+    1, CT, ET, NULL
+};
+static const struct webauth_token_webkdc_service webkdc_service_full = {
+    "krb5:webauth/example.com@EXAMPLE.COM", "\0key\1", 5, CT, ET
+};
+
+/* Token data with only the required attributes set. */
+static const struct webauth_token_app app_minimal = {
+    NULL, NULL, 0, NULL, 0, NULL, NULL, 0, CT, ET
+};
+static const struct webauth_token_id id_minimal = {
+    NULL, NULL, "webkdc", NULL, 0, NULL, NULL, 0, CT, ET
+};
+static const struct webauth_token_login login_minimal = {
+    "testuser", NULL, NULL, NULL, NULL, CT
+};
+static const struct webauth_token_proxy proxy_minimal = {
+    "testuser", NULL, "krb5", "\0proxy", 6, NULL, NULL, 0, CT, ET
+};
+static const struct webauth_token_request request_minimal = {
+    NULL, NULL, NULL, NULL, 0, NULL, NULL, NULL, NULL, 0, NULL, CT
+};
+static const struct webauth_token_webkdc_proxy webkdc_proxy_minimal = {
+    "testuser", "remuser", "WEBKDC:remuser", NULL, 0, NULL, 0, CT, ET, NULL
+};
+
+/* A service token cache. */
+static const struct webauth_was_token_cache was_cache = {
+    (char *) "abcdef", WA_KEY_AES, (void *) "0123456789abcdef", 16, CT, ET,
+    CT + 60, CT + 120
+};
+
+/* Keyring entries and a keyring that contains them. */
+static struct wai_keyring_entry keyring_entries[] = {
+    { CT, CT, WA_KEY_AES, (void *) "0123456789abcdef", 16 },
+    { CT - 86400, CT - 86400, WA_KEY_AES, (void *) "fedcba9876543210", 16 }
+};
+static const struct wai_keyring keyring = {
+    1, 2, keyring_entries
+};
+
+/* Kerberos credential data, both complete and minimal. */
+static struct wai_krb5_cred_address krb5_addresses[] = {
+    { 2, (void *) "\177\0\0\1", 4 },
+    { 24, (void *) "\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\1", 16 }
+};
+static struct wai_krb5_cred_authdata krb5_authdata[] = {
+    { 1, (void *) "\0authdata", 9 }
+};
+static const struct wai_krb5_cred krb5_full = {
+    (char *) "testuser@EXAMPLE.COM", (char *) "krbtgt/EXAMPLE.COM@EXAMPLE.COM",
+    18, (void *) "0123456789abcdef0123456789abcdef", 32, CT, CT, ET,
+    ET + 86400, 0, 0x40e00000, 2, krb5_addresses, (void *) "\0ticket", 7,
+    (void *) "\0second", 7, 1, krb5_authdata
+};
+static const struct wai_krb5_cred krb5_minimal = {
+    NULL, NULL, 18, (void *) "0123456789abcdef0123456789abcdef", 32, CT, CT,
+    ET, 0, 0, 0, 0, NULL, NULL, 0, NULL, 0, 0, NULL
+};
+
+
+/*
+ * Check that the generated codec and the encoding rules encode the given
+ * data identically, and that decoding that encoding with both produces data
+ * that encodes back to the same thing.  size is the size of the struct the
+ * data points to.  Reports four test results.
+ */
+static void
+check_codec(struct webauth_context *ctx, const struct wai_codec *codec,
+            const void *data, size_t size, const char *name)
+{
+    void *output, *rules_output, *decoded, *rules_decoded;
+    size_t length, rules_length;
+    int s, rules_s;
+
+    /* Encode both ways. */
+    s = wai_encode(ctx, codec, data, &output, &length);
+    rules_s = wai_encode_rules(ctx, codec->rules, data, &rules_output,
+                               &rules_length);
+    ok(s == WA_ERR_NONE && rules_s == WA_ERR_NONE, "%s encodes", name);
+    if (s != WA_ERR_NONE || rules_s != WA_ERR_NONE) {
+        ok_block(3, false, "%s encodes", name);
+        return;
+    }
+    ok(length == rules_length && memcmp(output, rules_output, length) == 0,
+       "...identically with the rules");
+
+    /* Decode both ways and encode the results again for comparison. */
+    decoded = apr_pcalloc(ctx->pool, size);
+    rules_decoded = apr_pcalloc(ctx->pool, size);
+    s = wai_decode(ctx, codec, output, length, decoded);
+    rules_s = wai_decode_rules(ctx, codec->rules, output, length,
+                               rules_decoded);
+    ok(s == WA_ERR_NONE && rules_s == WA_ERR_NONE, "...and decodes");
+    s = wai_encode_rules(ctx, codec->rules, decoded, &output, &length);
+    rules_s = wai_encode_rules(ctx, codec->rules, rules_decoded,
+                               &rules_output, &rules_length);
+    ok(s == WA_ERR_NONE && rules_s == WA_ERR_NONE
+       && length == rules_length
+       && memcmp(output, rules_output, length) == 0,
+       "...identically with the rules");
+}
+
+
+/*
+ * Check that the generated decoder and the encoding rules report the same
+ * error when decoding the given data.  Reports two test results.
+ */
+static void
+check_decode_error(struct webauth_context *ctx, const struct wai_codec *codec,
+                   const char *input, size_t size, const char *name)
+{
+    void *data;
+    char *message;
+    int s, rules_s;
+
+    data = apr_pcalloc(ctx->pool, size);
+    rules_s = wai_decode_rules(ctx, codec->rules, input, strlen(input), data);
+    message = apr_pstrdup(ctx->pool, webauth_error_message(ctx, rules_s));
+    s = wai_decode(ctx, codec, input, strlen(input), data);
+    ok(s != WA_ERR_NONE && s == rules_s, "Decoding %s fails the same way",
+       name);
+    is_string(message, webauth_error_message(ctx, s), "...with same error");
+}
+
+
+int
+main(void)
+{
+    struct webauth_context *ctx;
+    struct webauth_token_error error;
+    struct wai_keyring_entry entry;
+    struct wai_keyring bad_keyring;
+    void *output;
+    size_t length;
+    char *message;
+    int s;
+
+    plan(94);
+
+    if (webauth_context_init(&ctx, NULL) != WA_ERR_NONE)
+        bail("cannot initialize WebAuth context");
+
+    /* Check each codec. */
+#define CHECK(c, d, n) check_codec(ctx, &(c), &(d), sizeof(d), (n))
+    CHECK(wai_token_app_codec, app_full, "full app token");
+    CHECK(wai_token_app_codec, app_minimal, "minimal app token");
+    CHECK(wai_token_cred_codec, cred_full, "cred token");
+    CHECK(wai_token_error_codec, error_full, "error token");
+    CHECK(wai_token_id_codec, id_full, "full id token");
+    CHECK(wai_token_id_codec, id_minimal, "minimal id token");
+    CHECK(wai_token_login_codec, login_full, "full login token");
+    CHECK(wai_token_login_codec, login_minimal, "minimal login token");
+    CHECK(wai_token_proxy_codec, proxy_full, "full proxy token");
+    CHECK(wai_token_proxy_codec, proxy_minimal, "minimal proxy token");
+    CHECK(wai_token_request_codec, request_full, "full request token");
+    CHECK(wai_token_request_codec, request_minimal, "minimal request token");
+    CHECK(wai_token_webkdc_factor_codec, webkdc_factor_full,
+          "webkdc-factor token");
+    CHECK(wai_token_webkdc_proxy_codec, webkdc_proxy_full,
+          "full webkdc-proxy token");
+    CHECK(wai_token_webkdc_proxy_codec, webkdc_proxy_minimal,
+          "minimal webkdc-proxy token");
+    CHECK(wai_token_webkdc_service_codec, webkdc_service_full,
+          "webkdc-service token");
+    CHECK(wai_was_token_cache_codec, was_cache, "service token cache");
+    CHECK(wai_keyring_codec, keyring, "keyring");
+    CHECK(wai_krb5_cred_codec, krb5_full, "full Kerberos credential");
+    CHECK(wai_krb5_cred_codec, krb5_minimal, "minimal Kerberos credential");
+#undef CHECK
+
+    /* Missing required attributes, including in repeated structs. */
+    check_decode_error(ctx, &wai_token_error_codec, "ec=1;ct=\1\2\3\4;",
+                       sizeof(struct webauth_token_error),
+                       "error token without message");
+    check_decode_error(ctx, &wai_token_error_codec, "ec=x;em=foo;",
+                       sizeof(struct webauth_token_error),
+                       "error token with invalid code");
+    check_decode_error(ctx, &wai_keyring_codec, "v=1;n=1;ct0=1;va0=1;kt0=1;",
+                       sizeof(struct wai_keyring), "keyring without key");
+    check_decode_error(ctx, &wai_keyring_codec,
+                       "v=1;n=2;ct0=1;va0=1;kt0=1;kd0=00;ct1=1;va1=1;kt1=1;",
+                       sizeof(struct wai_keyring),
+                       "keyring without second key");
+
+    /* Missing required data when encoding. */
+    memset(&error, 0, sizeof(error));
+    error.code = 1;
+    error.creation = CT;
+    s = wai_encode_rules(ctx, wai_token_error_encoding, &error, &output,
+                         &length);
+    message = apr_pstrdup(ctx->pool, webauth_error_message(ctx, s));
+    is_int(WA_ERR_INVALID, s, "Encoding error token without message fails");
+    s = wai_encode(ctx, &wai_token_error_codec, &error, &output, &length);
+    is_int(WA_ERR_INVALID, s, "...and fails with the codec");
+    is_string(message, webauth_error_message(ctx, s), "...with same error");
+    bad_keyring = keyring;
+    bad_keyring.entry = &entry;
+    bad_keyring.entry_count = 1;
+    entry = keyring_entries[0];
+    entry.key = NULL;
+    s = wai_encode_rules(ctx, wai_keyring_encoding, &bad_keyring, &output,
+                         &length);
+    message = apr_pstrdup(ctx->pool, webauth_error_message(ctx, s));
+    is_int(WA_ERR_INVALID, s, "Encoding keyring without key fails");
+    s = wai_encode(ctx, &wai_keyring_codec, &bad_keyring, &output, &length);
+    is_int(WA_ERR_INVALID, s, "...and fails with the codec");
+    is_string(message, webauth_error_message(ctx, s), "...with same error");
+
+    /* Clean up. */
+    webauth_context_free(ctx);
+    return 0;
+}
@@ -25,7 +25,7 @@ main(void)
     struct webauth_factors *one, *two, *result;
     apr_array_header_t *factors;
 
-    plan(49);
+    plan(58);
 
     if (apr_initialize() != APR_SUCCESS)
         bail("cannot initialize APR");
@@ -210,6 +210,36 @@ main(void)
     is_string(NULL, webauth_factors_string(ctx, result),
               "Subtracting m from rm results in the empty set");
 
+    /* Factors we don't have special knowledge of still work. */
+    one = webauth_factors_parse(ctx, "o4,p,x2,o4");
+    is_string("o4,p,x2,m", webauth_factors_string(ctx, one),
+              "Parsed o4,p,x2,o4 into o4,p,x2,m");
+    is_int(1, webauth_factors_contains(ctx, one, "x2"), "...and contains x2");
+    is_int(0, webauth_factors_contains(ctx, one, "x"),
+           "...and does not contain x");
+    two = webauth_factors_parse(ctx, "x2,o2");
+    is_int(0, webauth_factors_satisfies(ctx, one, two),
+           "o4,p,x2,m does not satisfy x2,o2");
+    result = webauth_factors_subtract(ctx, two, one);
+    is_string("o2", webauth_factors_string(ctx, result),
+              "Subtracting o4,p,x2,m from x2,o2 returns o2");
+    result = webauth_factors_union(ctx, one, two);
+    is_string("o4,p,x2,m,o2", webauth_factors_string(ctx, result),
+              "Merging x2,o2 into o4,p,x2,m adds only o2");
+    is_int(1, webauth_factors_satisfies(ctx, result, two),
+           "...and the result satisfies x2,o2");
+
+    /* Duplicates are dropped when creating factors from an array. */
+    factors = apr_array_make(pool, 3, sizeof(const char *));
+    APR_ARRAY_PUSH(factors, const char *) = "o3";
+    APR_ARRAY_PUSH(factors, const char *) = "u2";
+    APR_ARRAY_PUSH(factors, const char *) = "o3";
+    APR_ARRAY_PUSH(factors, const char *) = "u2";
+    one = webauth_factors_new(ctx, factors);
+    is_string("o3,u2", webauth_factors_string(ctx, one),
+              "Duplicates are dropped from an array of factors");
+    is_int(1, webauth_factors_contains(ctx, one, "u2"), "...and contains u2");
+
     /* Clean up. */
     apr_terminate();
     return 0;
@@ -0,0 +1,125 @@
+/*
+ * Tests for WebAuth file input and output functions.
+ *
+ * Copyright 2014
+ *     The Board of Trustees of the Leland Stanford Junior University
+ *
+ * See LICENSE for licensing terms.
+ */
+
+#include <config.h>
+#include <portable/apr.h>
+#include <portable/system.h>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include <lib/internal.h>
+#include <tests/tap/basic.h>
+#include <tests/tap/string.h>
+#include <webauth/basic.h>
+
+/* Size of the large file, big enough to be mapped rather than read. */
+#define LARGE_SIZE (64 * 1024)
+
+
+int
+main(void)
+{
+    struct webauth_context *ctx;
+    char *tmpdir, *path, *missing;
+    const void *view, *view2;
+    void *data;
+    unsigned char *large;
+    size_t i, length, length2;
+    int s, fd;
+
+    plan(25);
+
+    if (webauth_context_init(&ctx, NULL) != WA_ERR_NONE)
+        bail("cannot initialize WebAuth context");
+    tmpdir = test_tmpdir();
+    basprintf(&path, "%s/file-io", tmpdir);
+    basprintf(&missing, "%s/missing", tmpdir);
+
+    /* Write a file and read it back in both ways. */
+    s = wai_file_write(ctx, "some data", 9, path);
+    is_int(WA_ERR_NONE, s, "Writing a file succeeds");
+    s = wai_file_read(ctx, path, &data, &length);
+    is_int(WA_ERR_NONE, s, "...and reading it succeeds");
+    ok(length == 9 && memcmp(data, "some data", 9) == 0,
+       "...with the correct data");
+    s = wai_file_map(ctx, path, &view, &length);
+    is_int(WA_ERR_NONE, s, "...and mapping it succeeds");
+    ok(length == 9 && memcmp(view, "some data", 9) == 0,
+       "...with the correct data");
+
+    /* Mapping an unchanged file again reuses the same mapping. */
+    s = wai_file_map(ctx, path, &view2, &length2);
+    is_int(WA_ERR_NONE, s, "Mapping the file again succeeds");
+    ok(view == view2, "...and returns the same mapping");
+    is_int(length, length2, "...with the same length");
+
+    /* Replace the file.  The next mapping should see the new data. */
+    s = wai_file_write(ctx, "some other data", 15, path);
+    is_int(WA_ERR_NONE, s, "Replacing the file succeeds");
+    s = wai_file_map(ctx, path, &view, &length);
+    is_int(WA_ERR_NONE, s, "...and mapping it succeeds");
+    ok(length == 15 && memcmp(view, "some other data", 15) == 0,
+       "...with the new data");
+
+    /* Clearing the pool doesn't drop the cached contents. */
+    webauth_context_reset(ctx);
+    s = wai_file_map(ctx, path, &view2, &length2);
+    is_int(WA_ERR_NONE, s, "Mapping after a context reset succeeds");
+    ok(view == view2, "...and reuses the cached contents");
+
+    /*
+     * A large file that only we can write is mapped, and one that others can
+     * write is read, but either way the contents are the same.
+     */
+    large = bcalloc(LARGE_SIZE, 1);
+    for (i = 0; i < LARGE_SIZE; i++)
+        large[i] = (unsigned char) i;
+    s = wai_file_write(ctx, large, LARGE_SIZE, path);
+    is_int(WA_ERR_NONE, s, "Writing a large file succeeds");
+    s = wai_file_map(ctx, path, &view, &length);
+    is_int(WA_ERR_NONE, s, "...and mapping it succeeds");
+    ok(length == LARGE_SIZE && memcmp(view, large, LARGE_SIZE) == 0,
+       "...with the correct data");
+    s = wai_file_map(ctx, path, &view2, &length2);
+    ok(s == WA_ERR_NONE && view == view2, "...and the mapping is reused");
+    large[0] = 'x';
+    s = wai_file_write(ctx, large, LARGE_SIZE, path);
+    is_int(WA_ERR_NONE, s, "Replacing the large file succeeds");
+    if (chmod(path, 0666) < 0)
+        sysbail("cannot chmod %s", path);
+    s = wai_file_map(ctx, path, &view, &length);
+    is_int(WA_ERR_NONE, s, "...and reading it when others can write succeeds");
+    ok(length == LARGE_SIZE && memcmp(view, large, LARGE_SIZE) == 0,
+       "...with the new data");
+    free(large);
+
+    /* Test errors. */
+    s = wai_file_map(ctx, missing, &view, &length);
+    is_int(WA_ERR_FILE_NOT_FOUND, s, "Mapping a missing file fails");
+    ok(view == NULL, "...and clears the view");
+    is_int(0, length, "...and the length");
+    fd = open(missing, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        sysbail("cannot create %s", missing);
+    close(fd);
+    s = wai_file_map(ctx, missing, &view, &length);
+    is_int(WA_ERR_FILE_READ, s, "Mapping an empty file fails");
+    s = wai_file_read(ctx, missing, &data, &length);
+    is_int(WA_ERR_FILE_READ, s, "...as does reading it");
+
+    /* Clean up. */
+    unlink(path);
+    unlink(missing);
+    free(path);
+    free(missing);
+    test_tmpdir_free(tmpdir);
+    webauth_context_free(ctx);
+    return 0;
+}
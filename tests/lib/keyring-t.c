@@ -30,16 +30,16 @@ main(void)
     const struct webauth_key *best;
     struct webauth_keyring *ring, *ring2;
     struct webauth_keyring_entry *entry, *entry2;
-    char *tmpdir, *keyring, *lock, *buf2;
+    char *tmpdir, *keyring, *lock, *buf2, *path;
     char buf[4096];
     FILE *file;
     int s, ks, fd;
-    size_t i, size;
+    size_t i, size, length;
     time_t now;
     enum webauth_kau_status kau;
     struct stat st;
 
-    plan(98);
+    plan(121);
 
     if (webauth_context_init(&ctx, NULL) != WA_ERR_NONE)
         bail("cannot initialize WebAuth context");
@@ -122,23 +122,65 @@ main(void)
     file = fopen(keyring, "r");
     ok(file != NULL, "...and can open the file");
     if (file == NULL)
-        ok_block(5, false, "Keyring file doesn't exist");
+        ok_block(6, false, "Keyring file doesn't exist");
     else {
-        size = fread(buf, 1, sizeof(buf), file);
-        buf[size] = '\0';
+        length = fread(buf, 1, sizeof(buf), file);
         fclose(file);
-        s = webauth_keyring_decode(ctx, buf, size, &ring2);
+        ok(length > 4 && buf[0] != '\0',
+           "...and it is in the attribute encoding");
+        s = webauth_keyring_decode(ctx, buf, length, &ring2);
         is_int(WA_ERR_NONE, s, "...and decode the results");
         is_int(ring->entries->nelts, ring2->entries->nelts,
            "... and the key count matches");
         s = webauth_keyring_encode(ctx, ring, &buf2, &size);
         is_int(WA_ERR_NONE, s, "Encoding the first keyring works");
-        is_int(strlen(buf), size,
-               "...and the length matches the first encoding");
-        ok(memcmp(buf, buf2, strlen(buf)) == 0,
+        is_int(length, size, "...and the length matches the first encoding");
+        ok(memcmp(buf, buf2, length) == 0,
            "...and the encoding matches what we read from the file");
     }
 
+    /* The binary format has to be asked for. */
+    s = webauth_keyring_write_format(ctx, ring, WA_FILE_FORMAT_BINARY,
+                                     keyring);
+    is_int(WA_ERR_NONE, s, "Writing a binary keyring succeeds");
+    s = webauth_keyring_read(ctx, keyring, &ring2);
+    is_int(WA_ERR_NONE, s, "...and reading it back succeeds");
+    is_int(ring->entries->nelts, ring2->entries->nelts,
+           "... and the key count matches");
+    file = fopen(keyring, "r");
+    if (file == NULL)
+        sysbail("cannot open %s", keyring);
+    length = fread(buf, 1, sizeof(buf), file);
+    fclose(file);
+    ok(length > 4 && memcmp(buf, "\0WAF", 4) == 0,
+       "...and it is in the binary format");
+    s = webauth_keyring_encode_format(ctx, ring, WA_FILE_FORMAT_BINARY,
+                                      &buf2, &size);
+    is_int(WA_ERR_NONE, s, "Encoding a binary keyring works");
+    ok(size == length && memcmp(buf, buf2, length) == 0,
+       "...and the encoding matches what we read from the file");
+    s = webauth_keyring_decode(ctx, buf, length, &ring2);
+    is_int(WA_ERR_NONE, s, "...and it can be decoded");
+
+    /* Damage the keyring and make sure the checksum catches it. */
+    buf[length - 1] ^= 0xff;
+    s = webauth_keyring_decode(ctx, buf, length, &ring2);
+    is_int(WA_ERR_CORRUPT, s, "Decoding a damaged keyring fails");
+    s = webauth_keyring_decode(ctx, buf, length - 1, &ring2);
+    is_int(WA_ERR_CORRUPT, s, "...as does decoding a truncated keyring");
+
+    /* Keyrings in the old attribute encoding can still be read. */
+    path = test_file_path("data/keyring");
+    if (path == NULL)
+        bail("cannot find data/keyring");
+    s = webauth_keyring_read(ctx, path, &ring2);
+    is_int(WA_ERR_NONE, s, "Reading an attribute-encoded keyring works");
+    is_int(1, ring2->entries->nelts, "...and it has one key");
+    entry2 = &APR_ARRAY_IDX(ring2->entries, 0, struct webauth_keyring_entry);
+    is_int(1308779086, entry2->creation, "...with the correct creation");
+    is_int(WA_AES_128, entry2->key->length, "...and the correct length");
+    test_file_path_free(path);
+
     /* Test removal of keys from a keyring. */
     s = webauth_keyring_remove(ctx, ring, 2);
     is_int(WA_ERR_NOT_FOUND, s,
@@ -188,6 +230,56 @@ main(void)
     is_int(WA_ERR_NONE, s, "Finding a past encryption key succeeds");
     is_int(WA_AES_256, best->length, "... and still finds the 256-bit key");
 
+    /*
+     * Test finding keys in a keyring whose keys were added out of order and
+     * with two keys valid at the same time.  The first of those is the best
+     * encryption key and the last is the best decryption key.
+     */
+    ring2 = webauth_keyring_new(ctx, 1);
+    webauth_keyring_add(ctx, ring2, now, now - 100, key);
+    webauth_keyring_add(ctx, ring2, now, now - 300, key);
+    webauth_keyring_add(ctx, ring2, now, now - 200, key);
+    webauth_keyring_add(ctx, ring2, now, now + 100, key);
+    webauth_keyring_add(ctx, ring2, now, now - 100, key);
+    s = webauth_keyring_best_key(ctx, ring2, WA_KEY_ENCRYPT, 0, &best);
+    entry = &APR_ARRAY_IDX(ring2->entries, 0, struct webauth_keyring_entry);
+    ok(s == WA_ERR_NONE && entry->key == best,
+       "Encryption key is the first of the newest valid keys");
+    s = webauth_keyring_best_key(ctx, ring2, WA_KEY_ENCRYPT, 0, &best);
+    ok(s == WA_ERR_NONE && entry->key == best, "...and again when cached");
+    s = webauth_keyring_best_key(ctx, ring2, WA_KEY_DECRYPT, now, &best);
+    entry = &APR_ARRAY_IDX(ring2->entries, 4, struct webauth_keyring_entry);
+    ok(s == WA_ERR_NONE && entry->key == best,
+       "Decryption key is the last of the newest valid keys");
+    s = webauth_keyring_best_key(ctx, ring2, WA_KEY_DECRYPT, now - 150, &best);
+    entry = &APR_ARRAY_IDX(ring2->entries, 2, struct webauth_keyring_entry);
+    ok(s == WA_ERR_NONE && entry->key == best,
+       "Decryption key for an older hint is correct");
+    s = webauth_keyring_remove(ctx, ring2, 0);
+    s = webauth_keyring_best_key(ctx, ring2, WA_KEY_ENCRYPT, 0, &best);
+    entry = &APR_ARRAY_IDX(ring2->entries, 3, struct webauth_keyring_entry);
+    ok(s == WA_ERR_NONE && entry->key == best,
+       "Encryption key is correct after removing a key");
+    s = webauth_keyring_best_key(ctx, ring2, WA_KEY_DECRYPT, now - 250, &best);
+    entry = &APR_ARRAY_IDX(ring2->entries, 0, struct webauth_keyring_entry);
+    ok(s == WA_ERR_NONE && entry->key == best,
+       "...as is the decryption key for an old hint");
+    entry2 = &APR_ARRAY_PUSH(ring2->entries, struct webauth_keyring_entry);
+    entry2->creation = now;
+    entry2->valid_after = now - 50;
+    entry2->key = entry->key;
+    s = webauth_keyring_best_key(ctx, ring2, WA_KEY_ENCRYPT, 0, &best);
+    ok(s == WA_ERR_NONE && entry2->key == best,
+       "Encryption key is correct after adding an entry directly");
+    s = webauth_keyring_remove(ctx, ring2, 0);
+    s = webauth_keyring_best_key(ctx, ring2, WA_KEY_ENCRYPT, 0, &best);
+    entry = &APR_ARRAY_IDX(ring2->entries, 3, struct webauth_keyring_entry);
+    ok(s == WA_ERR_NONE && entry->key == best,
+       "...and after removing a key");
+    s = webauth_keyring_best_key(ctx, ring2, WA_KEY_DECRYPT, now - 150, &best);
+    entry = &APR_ARRAY_IDX(ring2->entries, 0, struct webauth_keyring_entry);
+    ok(s == WA_ERR_NONE && entry->key == best, "...as is the decryption key");
+
     /* Test finding keys in an empty keyring. */
     webauth_keyring_remove(ctx, ring, 2);
     webauth_keyring_remove(ctx, ring, 1);
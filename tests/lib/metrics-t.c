@@ -0,0 +1,173 @@
+/*
+ * Test runtime metrics.
+ *
+ * Copyright 2014
+ *     The Board of Trustees of the Leland Stanford Junior University
+ *
+ * See LICENSE for licensing terms.
+ */
+
+#include <config.h>
+#include <portable/system.h>
+
+#include <time.h>
+
+#include <tests/tap/basic.h>
+#include <tests/tap/string.h>
+#include <webauth/basic.h>
+#include <webauth/keys.h>
+#include <webauth/metrics.h>
+#include <webauth/tokens.h>
+
+
+/*
+ * Check whether the formatted metrics contain a given line.
+ */
+static void
+has_line(const char *output, const char *line, const char *desc)
+{
+    char *wanted;
+
+    basprintf(&wanted, "\n%s\n", line);
+    ok(output != NULL && strstr(output, wanted) != NULL, "%s", desc);
+    free(wanted);
+}
+
+
+/*
+ * Create a keyring holding a single new random AES key.
+ */
+static struct webauth_keyring *
+new_keyring(struct webauth_context *ctx)
+{
+    struct webauth_key *key;
+    int s;
+
+    s = webauth_key_create(ctx, WA_KEY_AES, WA_AES_128, NULL, &key);
+    if (s != WA_ERR_NONE)
+        bail("cannot create key: %s", webauth_error_message(ctx, s));
+    return webauth_keyring_from_key(ctx, key);
+}
+
+
+int
+main(void)
+{
+    struct webauth_context *ctx;
+    struct webauth_metrics *metrics;
+    struct webauth_keyring *ring, *other, *multi;
+    struct webauth_token in, *out;
+    struct webauth_key *key;
+    const char *token, *p;
+    char *output;
+    void *memory;
+    size_t size;
+    time_t now;
+    int s;
+
+    plan(27);
+
+    if (webauth_context_init(&ctx, NULL) != WA_ERR_NONE)
+        bail("cannot initialize WebAuth context");
+
+    /* Set up the metrics block. */
+    size = webauth_metrics_size();
+    memory = bmalloc(size);
+    s = webauth_metrics_init(ctx, memory, size - 1, &metrics);
+    is_int(WA_ERR_INVALID, s, "Initializing too small a block fails");
+    ok(metrics == NULL, "...and returns no metrics");
+    s = webauth_metrics_init(ctx, memory, size, &metrics);
+    is_int(WA_ERR_NONE, s, "Initializing metrics succeeds");
+    if (metrics == NULL)
+        bail("cannot initialize metrics: %s", webauth_error_message(ctx, s));
+    ok(webauth_metrics_get(ctx) == NULL, "Contexts start without metrics");
+    webauth_metrics_set(ctx, metrics);
+    ok(webauth_metrics_get(ctx) == metrics, "...and metrics can be set");
+
+    /* Direct updates and formatting. */
+    webauth_metrics_count(NULL, WA_METRIC_WEBKDC_REQUEST);
+    webauth_metrics_count(metrics, WA_METRIC_WEBKDC_REQUEST);
+    webauth_metrics_count(metrics, WA_METRIC_WEBKDC_REQUEST);
+    webauth_metrics_count(metrics, WA_METRIC_SERVICE_TOKEN_HIT);
+    webauth_metrics_observe(metrics, WA_TIMER_WEBKDC_REQUEST, 1500);
+    webauth_metrics_observe(metrics, WA_TIMER_WEBKDC_REQUEST, 20000000);
+    s = webauth_metrics_format(ctx, metrics, &output);
+    is_int(WA_ERR_NONE, s, "Formatting metrics succeeds");
+    ok(output != NULL && strncmp(output, "# HELP ", 7) == 0,
+       "...and starts with help text");
+    has_line(output, "# TYPE webauth_webkdc_requests_total counter",
+             "...with counter type");
+    has_line(output, "webauth_webkdc_requests_total 2", "...counter value");
+    has_line(output, "webauth_service_token_cache_total{result=\"hit\"} 1",
+             "...labeled counter value");
+    has_line(output, "webauth_service_token_cache_total{result=\"miss\"} 0",
+             "...and its sibling");
+    has_line(output, "# TYPE webauth_webkdc_request_seconds histogram",
+             "...with histogram type");
+    has_line(output,
+             "webauth_webkdc_request_seconds_bucket{le=\"0.001000\"} 0",
+             "...empty histogram bucket");
+    has_line(output,
+             "webauth_webkdc_request_seconds_bucket{le=\"0.002500\"} 1",
+             "...cumulative histogram bucket");
+    has_line(output,
+             "webauth_webkdc_request_seconds_bucket{le=\"+Inf\"} 2",
+             "...overflow histogram bucket");
+    has_line(output, "webauth_webkdc_request_seconds_sum 20.001500",
+             "...histogram sum");
+    has_line(output, "webauth_webkdc_request_seconds_count 2",
+             "...histogram count");
+
+    /* Histograms with labels. */
+    webauth_metrics_observe(metrics, WA_TIMER_LOGIN_USERINFO, 50);
+    s = webauth_metrics_format(ctx, metrics, &output);
+    has_line(output, "webauth_webkdc_login_phase_seconds_bucket"
+             "{phase=\"userinfo\",le=\"0.000100\"} 1",
+             "...labeled histogram bucket");
+    has_line(output,
+             "webauth_webkdc_login_phase_seconds_sum{phase=\"userinfo\"}"
+             " 0.000050", "...labeled histogram sum");
+    p = strstr(output, "# TYPE webauth_webkdc_login_phase_seconds ");
+    ok(p != NULL
+       && strstr(p + 1, "# TYPE webauth_webkdc_login_phase_seconds ") == NULL,
+       "...with one header for the family");
+
+    /* Token operations update the metrics of their context. */
+    now = time(NULL);
+    ring = new_keyring(ctx);
+    memset(&in, 0, sizeof(in));
+    in.type = WA_TOKEN_APP;
+    in.token.app.subject = "testuser";
+    in.token.app.expiration = now + 60;
+    s = webauth_token_encode(ctx, &in, ring, &token);
+    if (s != WA_ERR_NONE)
+        bail("cannot encode token: %s", webauth_error_message(ctx, s));
+    s = webauth_token_decode(ctx, WA_TOKEN_APP, token, ring, &out);
+    if (s != WA_ERR_NONE)
+        bail("cannot decode token: %s", webauth_error_message(ctx, s));
+    other = new_keyring(ctx);
+    s = webauth_token_decode(ctx, WA_TOKEN_APP, token, other, &out);
+    is_int(WA_ERR_BAD_HMAC, s, "Decoding with the wrong key fails");
+    multi = new_keyring(ctx);
+    s = webauth_key_create(ctx, WA_KEY_AES, WA_AES_128, NULL, &key);
+    if (s != WA_ERR_NONE)
+        bail("cannot create key: %s", webauth_error_message(ctx, s));
+    webauth_keyring_add(ctx, multi, now, now, key);
+    webauth_token_decode(ctx, WA_TOKEN_APP, token, multi, &out);
+    s = webauth_metrics_format(ctx, metrics, &output);
+    is_int(WA_ERR_NONE, s, "Formatting metrics again succeeds");
+    has_line(output, "webauth_token_encode_total 1", "...encode count");
+    has_line(output, "webauth_token_decode_total 1", "...decode count");
+    has_line(output, "webauth_token_decode_failures_total 2",
+             "...decode failure count");
+    has_line(output,
+             "webauth_token_decrypt_failures_total{reason=\"bad_hmac\"} 2",
+             "...decryption failures by reason");
+    has_line(output, "webauth_keyring_hint_misses_total 1",
+             "...keyring hint misses");
+
+    /* Clean up. */
+    free(memory);
+    webauth_context_free(ctx);
+    return 0;
+}
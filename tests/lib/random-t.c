@@ -0,0 +1,89 @@
+/*
+ * Test the buffered random data for token nonces.
+ *
+ * Copyright 2014
+ *     The Board of Trustees of the Leland Stanford Junior University
+ *
+ * See LICENSE for licensing terms.
+ */
+
+#include <config.h>
+#include <portable/apr.h>
+#include <portable/system.h>
+
+#include <sys/wait.h>
+
+#include <lib/internal.h>
+#include <tests/tap/basic.h>
+#include <webauth/basic.h>
+
+/* Size of the nonces to get, the same as those in tokens. */
+#define NONCE_SIZE 16
+
+
+int
+main(void)
+{
+    struct webauth_context *ctx;
+    unsigned char first[NONCE_SIZE], nonce[NONCE_SIZE], child[NONCE_SIZE];
+    unsigned char large[4096];
+    int fds[2];
+    int i, s, status;
+    pid_t pid;
+
+    plan(6);
+
+    if (webauth_context_init(&ctx, NULL) != WA_ERR_NONE)
+        bail("cannot initialize WebAuth context");
+
+    /* Successive nonces differ. */
+    s = wai_random_nonce(ctx, first, sizeof(first));
+    is_int(WA_ERR_NONE, s, "Getting a nonce works");
+    s = wai_random_nonce(ctx, nonce, sizeof(nonce));
+    ok(s == WA_ERR_NONE && memcmp(first, nonce, sizeof(nonce)) != 0,
+       "...and the next one is different");
+
+    /* Use enough nonces to refill the block several times. */
+    for (i = 0; i < 1000; i++) {
+        s = wai_random_nonce(ctx, nonce, sizeof(nonce));
+        if (s != WA_ERR_NONE || memcmp(first, nonce, sizeof(nonce)) == 0)
+            break;
+    }
+    is_int(1000, i, "Many nonces work and differ from the first");
+
+    /* Requests larger than the block go directly to OpenSSL. */
+    s = wai_random_nonce(ctx, large, sizeof(large));
+    is_int(WA_ERR_NONE, s, "Getting a large nonce works");
+
+    /*
+     * A forked child must not hand out the same nonce as its parent, even
+     * though it inherits the parent's block.
+     */
+    if (pipe(fds) < 0)
+        sysbail("cannot create pipe");
+    pid = fork();
+    if (pid < 0)
+        sysbail("cannot fork");
+    else if (pid == 0) {
+        close(fds[0]);
+        if (wai_random_nonce(ctx, child, sizeof(child)) != WA_ERR_NONE)
+            _exit(1);
+        if (write(fds[1], child, sizeof(child)) != sizeof(child))
+            _exit(1);
+        _exit(0);
+    }
+    close(fds[1]);
+    if (read(fds[0], child, sizeof(child)) != sizeof(child))
+        sysbail("cannot read nonce from child");
+    close(fds[0]);
+    if (waitpid(pid, &status, 0) != pid)
+        sysbail("cannot wait for child");
+    is_int(0, status, "Getting a nonce in a child works");
+    s = wai_random_nonce(ctx, nonce, sizeof(nonce));
+    ok(s == WA_ERR_NONE && memcmp(child, nonce, sizeof(nonce)) != 0,
+       "...and it differs from the parent's");
+
+    /* Clean up. */
+    webauth_context_free(ctx);
+    return 0;
+}
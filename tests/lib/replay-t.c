@@ -0,0 +1,266 @@
+/*
+ * Test the shared-memory replay cache and login rate limiting.
+ *
+ * Copyright 2014
+ *     The Board of Trustees of the Leland Stanford Junior University
+ *
+ * See LICENSE for licensing terms.
+ */
+
+#include <config.h>
+#include <portable/system.h>
+
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#include <tests/tap/basic.h>
+#include <tests/tap/string.h>
+#include <webauth/basic.h>
+#include <webauth/replay.h>
+
+/* Number of processes and work per process in the concurrency test. */
+#define STRESS_PROCS    8
+#define STRESS_TOKENS   500
+#define STRESS_FAILS    100
+
+/* A time at the start of a day, so that rate limit intervals line up. */
+#define BASE_TIME       1399680000
+
+
+/*
+ * Run one worker for the concurrency test.  Opens the cache independently,
+ * so that the workers also race each other initializing the file, and then
+ * adds its own tokens and records failures for a shared user.  Returns the
+ * exit status for the child: 0 if everything behaved, 1 otherwise.
+ */
+static int
+stress_child(const struct webauth_replay_config *config, int id)
+{
+    struct webauth_context *ctx;
+    struct webauth_replay *replay;
+    char token[64];
+    time_t seen;
+    int i, s;
+
+    if (webauth_context_init(&ctx, NULL) != WA_ERR_NONE)
+        return 1;
+    s = webauth_replay_open(ctx, config, &replay);
+    if (s != WA_ERR_NONE)
+        return 1;
+    for (i = 0; i < STRESS_TOKENS; i++) {
+        snprintf(token, sizeof(token), "token-%d-%d", id, i);
+        s = webauth_replay_check(ctx, replay, token, strlen(token),
+                                 BASE_TIME, &seen);
+        if (s != WA_ERR_NONE || seen != 0)
+            return 1;
+        s = webauth_replay_add(ctx, replay, token, strlen(token), BASE_TIME);
+        if (s != WA_ERR_NONE)
+            return 1;
+        s = webauth_replay_check(ctx, replay, token, strlen(token),
+                                 BASE_TIME, &seen);
+        if (s != WA_ERR_NONE || seen != BASE_TIME)
+            return 1;
+        s = webauth_replay_add(ctx, replay, "shared", 6, BASE_TIME);
+        if (s != WA_ERR_NONE)
+            return 1;
+        if (i < STRESS_FAILS) {
+            s = webauth_replay_fail(ctx, replay, "shared", BASE_TIME);
+            if (s != WA_ERR_NONE)
+                return 1;
+        }
+    }
+    webauth_context_free(ctx);
+    return 0;
+}
+
+
+/*
+ * Fork the workers for the concurrency test, wait for them, and then check
+ * that every token they added is visible and that no failure was lost.
+ */
+static void
+test_stress(struct webauth_context *ctx, const char *path)
+{
+    struct webauth_replay_config config;
+    struct webauth_replay *replay;
+    pid_t pids[STRESS_PROCS];
+    char token[64];
+    time_t seen;
+    int i, j, s, status, failed, missing, limited;
+
+    memset(&config, 0, sizeof(config));
+    config.path = path;
+    config.replay_timeout = 300;
+    config.limit_threshold = STRESS_PROCS * STRESS_FAILS;
+    config.limit_interval = 86400;
+
+    /* Run the workers. */
+    for (i = 0; i < STRESS_PROCS; i++) {
+        pids[i] = fork();
+        if (pids[i] < 0)
+            sysbail("cannot fork");
+        else if (pids[i] == 0)
+            _exit(stress_child(&config, i));
+    }
+    failed = 0;
+    for (i = 0; i < STRESS_PROCS; i++) {
+        if (waitpid(pids[i], &status, 0) != pids[i])
+            sysbail("cannot wait for child %lu", (unsigned long) pids[i]);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            failed++;
+    }
+    is_int(0, failed, "All concurrent workers succeeded");
+
+    /* Check the results from the parent. */
+    s = webauth_replay_open(ctx, &config, &replay);
+    is_int(WA_ERR_NONE, s, "Reopening the shared cache succeeds");
+    if (replay == NULL)
+        bail("cannot open replay cache: %s", webauth_error_message(ctx, s));
+    missing = 0;
+    for (i = 0; i < STRESS_PROCS; i++)
+        for (j = 0; j < STRESS_TOKENS; j++) {
+            snprintf(token, sizeof(token), "token-%d-%d", i, j);
+            s = webauth_replay_check(ctx, replay, token, strlen(token),
+                                     BASE_TIME, &seen);
+            if (s != WA_ERR_NONE || seen != BASE_TIME)
+                missing++;
+        }
+    is_int(0, missing, "...and every token added by any worker is seen");
+    s = webauth_replay_check(ctx, replay, "shared", 6, BASE_TIME, &seen);
+    is_int(BASE_TIME, seen, "...as is the token they all added");
+    s = webauth_replay_limited(ctx, replay, "shared", BASE_TIME, &limited);
+    ok(limited, "...and every failure was counted");
+    config.limit_threshold++;
+    s = webauth_replay_open(ctx, &config, &replay);
+    if (s != WA_ERR_NONE)
+        bail("cannot open replay cache: %s", webauth_error_message(ctx, s));
+    s = webauth_replay_limited(ctx, replay, "shared", BASE_TIME, &limited);
+    ok(!limited, "...but no more than that");
+}
+
+
+int
+main(void)
+{
+    struct webauth_context *ctx;
+    struct webauth_replay_config config;
+    struct webauth_replay *replay, *old;
+    time_t now, seen;
+    char *tmpdir, *path, *lock;
+    int i, s, fd, limited;
+
+    plan(34);
+
+    if (webauth_context_init(&ctx, NULL) != WA_ERR_NONE)
+        bail("cannot initialize WebAuth context");
+    tmpdir = test_tmpdir();
+    basprintf(&path, "%s/replay", tmpdir);
+    basprintf(&lock, "%s/replay.lock", tmpdir);
+
+    /* Invalid configurations. */
+    memset(&config, 0, sizeof(config));
+    config.path = path;
+    config.replay_timeout = 300;
+    config.limit_threshold = 3;
+    s = webauth_replay_open(ctx, &config, &replay);
+    is_int(WA_ERR_INVALID, s, "Opening with no rate limit interval fails");
+    ok(replay == NULL, "...and returns no cache");
+
+    /* Open a new cache. */
+    config.limit_interval = 300;
+    config.slots = 1024;
+    s = webauth_replay_open(ctx, &config, &replay);
+    is_int(WA_ERR_NONE, s, "Opening a new replay cache succeeds");
+    if (replay == NULL)
+        bail("cannot open replay cache: %s", webauth_error_message(ctx, s));
+
+    /* Replay detection. */
+    now = time(NULL);
+    s = webauth_replay_check(ctx, replay, "token", 5, now, &seen);
+    is_int(WA_ERR_NONE, s, "Checking an unseen token succeeds");
+    is_int(0, seen, "...and it has not been seen");
+    s = webauth_replay_add(ctx, replay, "token", 5, now);
+    is_int(WA_ERR_NONE, s, "Adding the token succeeds");
+    s = webauth_replay_check(ctx, replay, "token", 5, now, &seen);
+    is_int(now, seen, "...and now it has been seen");
+    webauth_replay_check(ctx, replay, "token", 5, now + 10, &seen);
+    is_int(now, seen, "...and is still seen later");
+    webauth_replay_check(ctx, replay, "token", 5, now + 309, &seen);
+    is_int(now + 10, seen, "...with the time refreshed by each check");
+    webauth_replay_check(ctx, replay, "tokem", 5, now, &seen);
+    is_int(0, seen, "Another token has not been seen");
+    webauth_replay_check(ctx, replay, "token", 5, now + 1000, &seen);
+    is_int(0, seen, "The token expires after the timeout");
+
+    /* Rate limiting. */
+    s = webauth_replay_limited(ctx, replay, "user", BASE_TIME, &limited);
+    is_int(WA_ERR_NONE, s, "Checking the rate limit succeeds");
+    ok(!limited, "...and a new user is not limited");
+    for (i = 0; i < 2; i++)
+        webauth_replay_fail(ctx, replay, "user", BASE_TIME);
+    webauth_replay_limited(ctx, replay, "user", BASE_TIME, &limited);
+    ok(!limited, "...nor after two failures");
+    s = webauth_replay_fail(ctx, replay, "user", BASE_TIME);
+    is_int(WA_ERR_NONE, s, "Recording a failure succeeds");
+    webauth_replay_limited(ctx, replay, "user", BASE_TIME, &limited);
+    ok(limited, "...and the user is limited after three");
+    webauth_replay_limited(ctx, replay, "other", BASE_TIME, &limited);
+    ok(!limited, "...but another user is not");
+    webauth_replay_limited(ctx, replay, "user", BASE_TIME + 300, &limited);
+    ok(limited, "Failures still count at the start of the next interval");
+    webauth_replay_limited(ctx, replay, "user", BASE_TIME + 450, &limited);
+    ok(!limited, "...but age out as the window slides");
+    s = webauth_replay_clear(ctx, replay, "user");
+    is_int(WA_ERR_NONE, s, "Clearing the failures succeeds");
+    webauth_replay_limited(ctx, replay, "user", BASE_TIME, &limited);
+    ok(!limited, "...and the user is no longer limited");
+
+    /* Reopening uses the existing file regardless of the configured size. */
+    webauth_replay_add(ctx, replay, "token", 5, now);
+    config.slots = 0;
+    config.limit_threshold = 0;
+    s = webauth_replay_open(ctx, &config, &replay);
+    is_int(WA_ERR_NONE, s, "Reopening with a different size succeeds");
+    webauth_replay_check(ctx, replay, "token", 5, now, &seen);
+    is_int(now, seen, "...and sees the existing data");
+    webauth_replay_fail(ctx, replay, "user", BASE_TIME);
+    webauth_replay_limited(ctx, replay, "user", BASE_TIME, &limited);
+    ok(!limited, "A threshold of zero disables rate limiting");
+
+    /*
+     * An unrecognized header is rebuilt in place, so a process that still
+     * has the old cache mapped sees it emptied and can keep using it.
+     */
+    old = replay;
+    webauth_replay_add(ctx, old, "token", 5, now);
+    fd = open(path, O_WRONLY);
+    if (fd < 0)
+        sysbail("cannot open %s", path);
+    if (write(fd, "\0\0\0\0", 4) != 4)
+        sysbail("cannot write to %s", path);
+    close(fd);
+    s = webauth_replay_open(ctx, &config, &replay);
+    is_int(WA_ERR_NONE, s, "Reopening with a bad header succeeds");
+    webauth_replay_check(ctx, replay, "token", 5, now, &seen);
+    is_int(0, seen, "...and starts with an empty cache");
+    webauth_replay_check(ctx, old, "token", 5, now, &seen);
+    is_int(0, seen, "...which the old handle also sees");
+    webauth_replay_add(ctx, old, "token", 5, now);
+    webauth_replay_check(ctx, replay, "token", 5, now, &seen);
+    is_int(now, seen, "...and can still update");
+    unlink(path);
+    unlink(lock);
+
+    /* Many processes sharing one cache. */
+    test_stress(ctx, path);
+
+    /* Clean up. */
+    unlink(path);
+    unlink(lock);
+    free(path);
+    free(lock);
+    test_tmpdir_free(tmpdir);
+    webauth_context_free(ctx);
+    return 0;
+}
@@ -0,0 +1,146 @@
+/*
+ * Test the cache of exported Kerberos service tickets.
+ *
+ * Copyright 2014
+ *     The Board of Trustees of the Leland Stanford Junior University
+ *
+ * See LICENSE for licensing terms.
+ */
+
+#include <config.h>
+#include <portable/system.h>
+
+#include <tests/tap/basic.h>
+#include <webauth/basic.h>
+#include <webauth/krb5.h>
+
+/* An arbitrary current time and the size of the cache for most tests. */
+#define NOW     1399680000
+#define SLOTS   64
+
+/* Two different TGTs, which are just opaque data to the cache. */
+#define TGT1    "tgt one"
+#define TGT2    "tgt two"
+
+/* The server principal used for most tests. */
+#define SERVICE "service/example.com@EXAMPLE.COM"
+
+
+int
+main(void)
+{
+    struct webauth_context *ctx;
+    struct webauth_krb5_ticket_cache *cache;
+    char principal[64];
+    void *ticket;
+    size_t length;
+    time_t expiration;
+    int i, s;
+
+    plan(21);
+
+    if (webauth_context_init(&ctx, NULL) != WA_ERR_NONE)
+        bail("cannot initialize WebAuth context");
+
+    /* A cache must be at least as big as a probe window. */
+    s = webauth_krb5_ticket_cache_new(ctx, 4, 60, &cache);
+    is_int(WA_ERR_INVALID, s, "Creating a tiny ticket cache fails");
+    ok(cache == NULL, "...and returns NULL");
+    s = webauth_krb5_ticket_cache_new(ctx, SLOTS, 60, &cache);
+    is_int(WA_ERR_NONE, s, "Creating a ticket cache succeeds");
+
+    /* Add a ticket and look it up. */
+    s = webauth_krb5_ticket_cache_get(ctx, cache, TGT1, strlen(TGT1), SERVICE,
+                                      NOW, &ticket, &length, &expiration);
+    is_int(WA_ERR_NOT_FOUND, s, "Lookup in an empty cache fails");
+    s = webauth_krb5_ticket_cache_add(ctx, cache, TGT1, strlen(TGT1), SERVICE,
+                                      NOW, "ticket", 6, NOW + 3600);
+    is_int(WA_ERR_NONE, s, "Adding a ticket succeeds");
+    s = webauth_krb5_ticket_cache_get(ctx, cache, TGT1, strlen(TGT1), SERVICE,
+                                      NOW, &ticket, &length, &expiration);
+    is_int(WA_ERR_NONE, s, "...and looking it up succeeds");
+    ok(length == 6 && memcmp(ticket, "ticket", 6) == 0,
+       "...with the right ticket");
+    is_int(NOW + 3600, expiration, "...and the right expiration");
+
+    /* The ticket is only found with the same TGT and server. */
+    s = webauth_krb5_ticket_cache_get(ctx, cache, TGT2, strlen(TGT2), SERVICE,
+                                      NOW, &ticket, &length, &expiration);
+    is_int(WA_ERR_NOT_FOUND, s, "Lookup with a different TGT fails");
+    s = webauth_krb5_ticket_cache_get(ctx, cache, TGT1, strlen(TGT1),
+                                      "other/example.com@EXAMPLE.COM", NOW,
+                                      &ticket, &length, &expiration);
+    is_int(WA_ERR_NOT_FOUND, s, "Lookup with a different server fails");
+
+    /* Tickets without the minimum lifetime left are not returned. */
+    s = webauth_krb5_ticket_cache_get(ctx, cache, TGT1, strlen(TGT1), SERVICE,
+                                      NOW + 3600 - 61, &ticket, &length,
+                                      &expiration);
+    is_int(WA_ERR_NONE, s, "Lookup just before the minimum lifetime works");
+    s = webauth_krb5_ticket_cache_get(ctx, cache, TGT1, strlen(TGT1), SERVICE,
+                                      NOW + 3600 - 60, &ticket, &length,
+                                      &expiration);
+    is_int(WA_ERR_NOT_FOUND, s, "...but fails at the minimum lifetime");
+    s = webauth_krb5_ticket_cache_add(ctx, cache, TGT2, strlen(TGT2), SERVICE,
+                                      NOW, "expired", 7, NOW);
+    is_int(WA_ERR_NONE, s, "Adding an expired ticket succeeds");
+    s = webauth_krb5_ticket_cache_get(ctx, cache, TGT2, strlen(TGT2), SERVICE,
+                                      NOW - 3600, &ticket, &length,
+                                      &expiration);
+    is_int(WA_ERR_NOT_FOUND, s, "...but it isn't cached");
+
+    /*
+     * Replacing a ticket updates it in place, and a copy returned earlier is
+     * not changed by that.
+     */
+    s = webauth_krb5_ticket_cache_get(ctx, cache, TGT1, strlen(TGT1), SERVICE,
+                                      NOW, &ticket, &length, &expiration);
+    s = webauth_krb5_ticket_cache_add(ctx, cache, TGT1, strlen(TGT1), SERVICE,
+                                      NOW, "new ticket", 10, NOW + 7200);
+    is_int(WA_ERR_NONE, s, "Replacing a ticket succeeds");
+    ok(length == 6 && memcmp(ticket, "ticket", 6) == 0,
+       "...and the old copy is unchanged");
+    s = webauth_krb5_ticket_cache_get(ctx, cache, TGT1, strlen(TGT1), SERVICE,
+                                      NOW, &ticket, &length, &expiration);
+    ok(s == WA_ERR_NONE && length == 10
+       && memcmp(ticket, "new ticket", 10) == 0,
+       "...and the new ticket is returned");
+    is_int(NOW + 7200, expiration, "...with the new expiration");
+
+    /*
+     * With a cache the size of one probe window, every ticket competes for
+     * the same slots, so adding more tickets than that replaces the one that
+     * expires first.
+     */
+    s = webauth_krb5_ticket_cache_new(ctx, 8, 60, &cache);
+    if (s != WA_ERR_NONE)
+        bail("cannot create ticket cache");
+    for (i = 0; i < 9; i++) {
+        snprintf(principal, sizeof(principal), "service%d@EXAMPLE.COM", i);
+        s = webauth_krb5_ticket_cache_add(ctx, cache, TGT1, strlen(TGT1),
+                                          principal, NOW, "ticket", 6,
+                                          i == 3 ? NOW + 600 : NOW + 3600);
+        if (s != WA_ERR_NONE)
+            break;
+    }
+    is_int(WA_ERR_NONE, s, "Adding more tickets than slots succeeds");
+    s = webauth_krb5_ticket_cache_get(ctx, cache, TGT1, strlen(TGT1),
+                                      "service3@EXAMPLE.COM", NOW, &ticket,
+                                      &length, &expiration);
+    is_int(WA_ERR_NOT_FOUND, s, "...and the first to expire was replaced");
+    for (i = 0; i < 9; i++) {
+        if (i == 3)
+            continue;
+        snprintf(principal, sizeof(principal), "service%d@EXAMPLE.COM", i);
+        s = webauth_krb5_ticket_cache_get(ctx, cache, TGT1, strlen(TGT1),
+                                          principal, NOW, &ticket, &length,
+                                          &expiration);
+        if (s != WA_ERR_NONE)
+            break;
+    }
+    is_int(WA_ERR_NONE, s, "...and the others are still cached");
+
+    /* Clean up. */
+    webauth_context_free(ctx);
+    return 0;
+}
@@ -13,8 +13,11 @@
  */
 
 #include <config.h>
+#include <portable/apr.h>
 #include <portable/system.h>
 
+#include <time.h>
+
 #include <tests/tap/basic.h>
 #include <webauth/basic.h>
 #include <webauth/keys.h>
@@ -52,9 +55,13 @@ int
 main(void)
 {
     struct webauth_context *ctx;
-    struct webauth_keyring *ring;
+    struct webauth_keyring *ring, *other, *skewed;
+    struct webauth_keyring_entry *entry;
+    struct webauth_key *key;
     char *keyring;
-    int s;
+    int i, s;
+    time_t now;
+    unsigned char *bytes;
     void *data, *out, *token;
     size_t length, outlen;
     const char raw_data[] = { ';', ';', 0, ';', 't', '4', 1, 255 };
@@ -62,7 +69,7 @@ main(void)
         "t=app;s=testuser;lt=N\2]\312;ia=p;san=c;loa=\0\0\0\1;ct=N\2]\254;"
         "et=\177\377\377\320;";
 
-    plan(10);
+    plan(40);
 
     if (webauth_context_init(&ctx, NULL) != WA_ERR_NONE)
         bail("cannot initialize WebAuth context");
@@ -115,6 +122,125 @@ main(void)
     ok(memcmp(app_raw, out, sizeof(app_raw) - 1) == 0,
        "...and output data is correct");
 
+    /*
+     * Build a keyring with several keys and a copy of it on which the newest
+     * key isn't valid yet, as on a server with a clock that's behind, and
+     * encrypt a token with key identifiers.
+     */
+    now = time(NULL);
+    ring = webauth_keyring_new(ctx, 1);
+    skewed = webauth_keyring_new(ctx, 1);
+    other = webauth_keyring_new(ctx, 1);
+    for (i = 0; i < 4; i++) {
+        if (webauth_key_create(ctx, WA_KEY_AES, WA_AES_128, NULL, &key)
+            != WA_ERR_NONE)
+            bail("cannot create key");
+        webauth_keyring_add(ctx, ring, now - i * 3600, now - i * 3600, key);
+        webauth_keyring_add(ctx, skewed, now, now + 600 - i * 3600, key);
+        if (webauth_key_create(ctx, WA_KEY_AES, WA_AES_128, NULL, &key)
+            != WA_ERR_NONE)
+            bail("cannot create key");
+        webauth_keyring_add(ctx, other, now, now - i * 3600, key);
+    }
+    webauth_keyring_set_format(ring, WA_TOKEN_FORMAT_KEY_ID);
+    s = webauth_token_encrypt(ctx, raw_data, sizeof(raw_data), &data, &length,
+                              ring);
+    is_int(WA_ERR_NONE, s, "Token encryption with key identifier works");
+    bytes = data;
+    ok(bytes[0] == 0 && bytes[1] == 1, "...and has the right header");
+    is_int(10, length % 16, "...and the right length");
+    s = webauth_token_decrypt(ctx, data, length, &out, &outlen, ring);
+    is_int(WA_ERR_NONE, s, "...and decryption works");
+    ok(outlen == sizeof(raw_data) && memcmp(raw_data, out, outlen) == 0,
+       "...with the right data");
+    s = webauth_token_decrypt(ctx, data, length, &out, &outlen, skewed);
+    is_int(WA_ERR_NONE, s, "...and works with a key not yet valid");
+    s = webauth_token_decrypt(ctx, data, length, &out, &outlen, other);
+    is_int(WA_ERR_BAD_HMAC, s, "...and fails without the key");
+
+    /*
+     * If the keyring was changed directly, the key identifiers are computed
+     * as needed.
+     */
+    entry = apr_array_push(skewed->entries);
+    *entry = APR_ARRAY_IDX(ring->entries, 1, struct webauth_keyring_entry);
+    s = webauth_token_decrypt(ctx, data, length, &out, &outlen, skewed);
+    is_int(WA_ERR_NONE, s, "...and works with a changed keyring");
+    s = webauth_token_encrypt(ctx, "", 0, &data, &length, ring);
+    is_int(WA_ERR_NONE, s, "Encryption of empty token works");
+    s = webauth_token_decrypt(ctx, data, length, &out, &outlen, skewed);
+    is_int(WA_ERR_NONE, s, "...and decryption works");
+    is_int(0, outlen, "...and output length is correct");
+
+    /* Tokens with an unknown version are rejected. */
+    bytes = data;
+    bytes[1] = 255;
+    s = webauth_token_decrypt(ctx, data, length, &out, &outlen, ring);
+    is_int(WA_ERR_CORRUPT, s, "Decryption with unknown version fails");
+
+    /* Encrypt and decrypt the same data with AES-GCM. */
+    webauth_keyring_set_format(ring, WA_TOKEN_FORMAT_AEAD);
+    s = webauth_token_encrypt(ctx, raw_data, sizeof(raw_data), &data, &length,
+                              ring);
+    is_int(WA_ERR_NONE, s, "Token encryption with AES-GCM works");
+    bytes = data;
+    ok(bytes[0] == 0 && bytes[1] == 2, "...and has the right header");
+    is_int(10 + 12 + sizeof(raw_data) + 16, length, "...and the right length");
+    s = webauth_token_decrypt(ctx, data, length, &out, &outlen, ring);
+    is_int(WA_ERR_NONE, s, "...and decryption works");
+    ok(outlen == sizeof(raw_data) && memcmp(raw_data, out, outlen) == 0,
+       "...with the right data");
+    s = webauth_token_decrypt(ctx, data, length, &out, &outlen, skewed);
+    is_int(WA_ERR_NONE, s, "...and works with a key not yet valid");
+    s = webauth_token_decrypt(ctx, data, length, &out, &outlen, other);
+    is_int(WA_ERR_BAD_HMAC, s, "...and fails without the key");
+
+    /* Any change to the token, including in the header, is detected. */
+    bytes[length - 1] ^= 1;
+    s = webauth_token_decrypt(ctx, data, length, &out, &outlen, ring);
+    is_int(WA_ERR_BAD_HMAC, s, "Decryption with a modified tag fails");
+    bytes[length - 1] ^= 1;
+    bytes[22] ^= 1;
+    s = webauth_token_decrypt(ctx, data, length, &out, &outlen, ring);
+    is_int(WA_ERR_BAD_HMAC, s, "Decryption with modified data fails");
+    bytes[22] ^= 1;
+    entry = &APR_ARRAY_IDX(ring->entries, 0, struct webauth_keyring_entry);
+    other = webauth_keyring_from_key(ctx, entry->key);
+    bytes[1] = 1;
+    s = webauth_token_decrypt(ctx, data, length, &out, &outlen, other);
+    ok(s != WA_ERR_NONE, "Decryption with a modified version fails");
+    bytes[1] = 2;
+    s = webauth_token_decrypt(ctx, data, length, &out, &outlen, other);
+    is_int(WA_ERR_NONE, s, "...but works with the right version");
+    s = webauth_token_decrypt(ctx, data, 37, &out, &outlen, ring);
+    is_int(WA_ERR_CORRUPT, s, "Decryption of a truncated token fails");
+
+    /* The empty token and 256-bit keys work. */
+    s = webauth_token_encrypt(ctx, "", 0, &data, &length, ring);
+    is_int(WA_ERR_NONE, s, "Encryption of empty token works");
+    s = webauth_token_decrypt(ctx, data, length, &out, &outlen, ring);
+    ok(s == WA_ERR_NONE && outlen == 0, "...and decryption works");
+    if (webauth_key_create(ctx, WA_KEY_AES, WA_AES_256, NULL, &key)
+        != WA_ERR_NONE)
+        bail("cannot create key");
+    other = webauth_keyring_from_key(ctx, key);
+    webauth_keyring_set_format(other, WA_TOKEN_FORMAT_AEAD);
+    s = webauth_token_encrypt(ctx, raw_data, sizeof(raw_data), &data, &length,
+                              other);
+    is_int(WA_ERR_NONE, s, "Encryption with a 256-bit key works");
+    s = webauth_token_decrypt(ctx, data, length, &out, &outlen, other);
+    ok(s == WA_ERR_NONE && outlen == sizeof(raw_data)
+       && memcmp(raw_data, out, outlen) == 0, "...and decryption works");
+
+    /* Switching back to the old format works. */
+    webauth_keyring_set_format(ring, WA_TOKEN_FORMAT_HINT);
+    s = webauth_token_encrypt(ctx, raw_data, sizeof(raw_data), &data, &length,
+                              ring);
+    bytes = data;
+    ok(s == WA_ERR_NONE && bytes[0] != 0, "Encryption with hint works");
+    s = webauth_token_decrypt(ctx, data, length, &out, &outlen, skewed);
+    is_int(WA_ERR_NONE, s, "...and decryption works");
+
     /* Clean up. */
     free(token);
     webauth_context_free(ctx);
@@ -2,7 +2,7 @@
  * Test WebAuth Application Server token cache support.
  *
  * Written by Russ Allbery <eagle@eyrie.org>
- * Copyright 2012
+ * Copyright 2012, 2014
  *     The Board of Trustees of the Leland Stanford Junior University
  *
  * See LICENSE for licensing terms.
@@ -28,9 +28,10 @@ main(void)
     struct webauth_key *key;
     time_t now;
     char *tmpdir, *path;
+    FILE *file;
     int s;
 
-    plan(20);
+    plan(27);
 
     if (webauth_context_init(&ctx, NULL) != WA_ERR_NONE)
         bail("cannot initialize WebAuth context");
@@ -55,6 +56,11 @@ main(void)
     s = webauth_was_token_cache_write(ctx, &cache, path);
     is_int(WA_ERR_NONE, s, "Writing token cache succeeds");
     is_int(0, access(path, R_OK), "...and file now exists");
+    file = fopen(path, "r");
+    if (file == NULL)
+        sysbail("cannot open %s", path);
+    ok(fgetc(file) != '\0', "...and is in the attribute encoding");
+    fclose(file);
 
     /* Read the data back in. */
     memset(&cache2, 0, sizeof(cache2));
@@ -72,10 +78,37 @@ main(void)
            "...and last renewal is correct");
     is_int(cache.next_renewal, cache2.next_renewal,
            "...and next renewal is correct");
+
+    /* Write the cache in the binary format and read it back. */
+    s = webauth_was_token_cache_write_format(ctx, &cache,
+                                             WA_FILE_FORMAT_BINARY, path);
+    is_int(WA_ERR_NONE, s, "Writing a binary token cache succeeds");
+    memset(&cache2, 0, sizeof(cache2));
+    s = webauth_was_token_cache_read(ctx, path, &cache2);
+    is_int(WA_ERR_NONE, s, "...and reading it back succeeds");
+    is_string(cache.token, cache2.token, "...and token is correct");
+    ok(cache2.key_data_len == cache.key_data_len
+       && memcmp(cache.key_data, cache2.key_data, cache.key_data_len) == 0,
+       "...and key is correct");
+    is_int(cache.next_renewal, cache2.next_renewal,
+           "...and next renewal is correct");
+
+    /* Damage the token in the file and make sure the checksum catches it. */
+    file = fopen(path, "r+");
+    if (file == NULL)
+        sysbail("cannot open %s", path);
+    if (fseek(file, -2, SEEK_END) < 0 || fputc('X', file) == EOF)
+        sysbail("cannot modify %s", path);
+    fclose(file);
+    s = webauth_was_token_cache_read(ctx, path, &cache2);
+    is_int(WA_ERR_CORRUPT, s, "Reading a damaged token cache fails");
     unlink(path);
     free(path);
 
-    /* Read in a known service token and ensure that we can decode it. */
+    /*
+     * Read in a known service token and ensure that we can decode it.  This
+     * is in the attribute encoding used before the binary format.
+     */
     path = test_file_path("data/service-token");
     memset(&cache, 0, sizeof(cache));
     s = webauth_was_token_cache_read(ctx, path, &cache);
@@ -623,6 +623,21 @@ static const struct wat_login_test tests_id_acl[] = {
 };
 
 
+/*
+ * A callback for notice logging.  Takes a char ** and stores the message in
+ * newly-allocated memory at that address, so it holds the last login logged.
+ */
+static void
+log_callback(struct webauth_context *ctx UNUSED, void *data,
+             const char *message)
+{
+    char **buffer = data;
+
+    free(*buffer);
+    *buffer = bstrdup(message);
+}
+
+
 int
 main(void)
 {
@@ -633,6 +648,7 @@ main(void)
     size_t i;
     int s;
     char *keyring;
+    char *output = NULL;
 
     /* Use lazy planning so that test counts can vary on some errors. */
     plan_lazy();
@@ -661,9 +677,29 @@ main(void)
         diag("configuration failed: %s", webauth_error_message(ctx, s));
     is_int(WA_ERR_NONE, s, "WebKDC configuration succeeded");
 
-    /* Run the first set of tests. */
+    /* Run the first set of tests, capturing the login log messages. */
+    webauth_log_callback(ctx, WA_LOG_NOTICE, log_callback, &output);
     for (i = 0; i < ARRAY_SIZE(tests_login); i++)
         run_login_test(ctx, &tests_login[i], ring, NULL);
+    webauth_log_callback(ctx, WA_LOG_NOTICE, NULL, NULL);
+
+    /*
+     * The last of those tests is a successful login without a user
+     * information service, so the log message should have the time of each
+     * phase except that one and the total time.
+     */
+    if (output == NULL)
+        ok_block(7, false, "No login log message");
+    else {
+        ok(strstr(output, " tparse=") != NULL, "Login log has parse time");
+        ok(strstr(output, " tauth=") != NULL, "... and authentication time");
+        ok(strstr(output, " tmerge=") != NULL, "... and merge time");
+        ok(strstr(output, " tuserinfo=") == NULL, "... but no userinfo time");
+        ok(strstr(output, " tauthz=") != NULL, "... and authorization time");
+        ok(strstr(output, " tencode=") != NULL, "... and encoding time");
+        ok(strstr(output, " ttotal=") != NULL, "... and total time");
+    }
+    free(output);
 
     /*
      * Set a login time limit of 15 minutes.  Since the webkdc-proxy tokens
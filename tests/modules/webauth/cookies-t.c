@@ -0,0 +1,113 @@
+/*
+ * Test Cookie header parsing for the Apache WebAuth module.
+ *
+ * Copyright 2014
+ *     The Board of Trustees of the Leland Stanford Junior University
+ *
+ * See LICENSE for licensing terms.
+ */
+
+#include <config.h>
+#include <portable/apr.h>
+#include <portable/system.h>
+
+#include <modules/webauth/cookies.h>
+#include <tests/tap/basic.h>
+
+
+/*
+ * Parse a header and check the value of one cookie, which may be NULL if the
+ * cookie should not be found.
+ */
+static void
+is_cookie(apr_pool_t *pool, const char *header, const char *name,
+          const char *expected, const char *message)
+{
+    MWA_COOKIES *cookies;
+
+    cookies = mwa_cookies_parse(pool, header);
+    is_string(expected, mwa_cookies_get(pool, cookies, name), "%s", message);
+}
+
+
+int
+main(void)
+{
+    apr_pool_t *pool;
+    MWA_COOKIES *cookies;
+    apr_array_header_t *names;
+
+    if (apr_initialize() != APR_SUCCESS)
+        bail("cannot initialize APR");
+    if (apr_pool_create(&pool, NULL) != APR_SUCCESS)
+        bail("cannot create memory pool");
+
+    plan(21);
+
+    /* No header, or no WebAuth cookies. */
+    cookies = mwa_cookies_parse(pool, NULL);
+    ok(mwa_cookies_get(pool, cookies, "webauth_at") == NULL,
+       "No cookies without a header");
+    ok(mwa_cookies_names(pool, cookies) == NULL, "...and no names");
+    cookies = mwa_cookies_parse(pool, "foo=bar; baz=webauth_at");
+    ok(mwa_cookies_get(pool, cookies, "webauth_at") == NULL,
+       "No cookies if none are webauth_*");
+    ok(mwa_cookies_names(pool, cookies) == NULL, "...and no names");
+
+    /* Basic parsing. */
+    is_cookie(pool, "webauth_at=abc", "webauth_at", "abc", "Single cookie");
+    is_cookie(pool, "foo=bar; webauth_at=abc; baz=1", "webauth_at", "abc",
+              "Cookie among others");
+    is_cookie(pool, "webauth_at=abc; webauth_pt_krb5=def", "webauth_pt_krb5",
+              "def", "Last cookie");
+    is_cookie(pool, "webauth_at=abc", "webauth_pt_krb5", NULL,
+              "Missing cookie");
+
+    /* Quoted and empty values. */
+    is_cookie(pool, "webauth_at=\"abc\"; foo=bar", "webauth_at", "\"abc\"",
+              "Quotes are kept");
+    is_cookie(pool, "webauth_at=; foo=bar", "webauth_at", "",
+              "Empty value");
+    is_cookie(pool, "foo=bar; webauth_at=", "webauth_at", "",
+              "Empty value at the end");
+
+    /* Duplicate names. */
+    is_cookie(pool, "webauth_at=first; webauth_at=second", "webauth_at",
+              "first", "First of duplicate cookies wins");
+
+    /* Missing equal signs. */
+    is_cookie(pool, "webauth_at; webauth_pt_krb5=def", "webauth_at", NULL,
+              "Cookie without an equal sign is ignored");
+    is_cookie(pool, "webauth_at; webauth_pt_krb5=def", "webauth_pt_krb5",
+              "def", "...without affecting the next one");
+    is_cookie(pool, "webauth_at; webauth_at=abc", "webauth_at", "abc",
+              "...or a later one with the same name");
+
+    /* Whitespace. */
+    is_cookie(pool, " \twebauth_at=abc", "webauth_at", "abc",
+              "Leading whitespace");
+    is_cookie(pool, "foo=bar;\t webauth_at=abc \t; baz=1", "webauth_at",
+              "abc", "Whitespace around a cookie");
+    is_cookie(pool, "webauth_at=abc  ", "webauth_at", "abc",
+              "Trailing whitespace at the end");
+
+    /* Names that only contain the prefix somewhere. */
+    is_cookie(pool, "foo=webauth_at=bad; webauth_at=good", "webauth_at",
+              "good", "Prefix in another value is skipped");
+    is_cookie(pool, "xwebauth_at=bad; webauth_at=good", "webauth_at", "good",
+              "Prefix in another name is skipped");
+
+    /* Names, with duplicates only listed once. */
+    cookies = mwa_cookies_parse(pool, "webauth_at=1; foo=2; webauth_at=3");
+    names = mwa_cookies_names(pool, cookies);
+    if (names == NULL)
+        ok(0, "One name for duplicate cookies");
+    else
+        ok(names->nelts == 1
+           && strcmp(APR_ARRAY_IDX(names, 0, char *), "webauth_at") == 0,
+           "One name for duplicate cookies");
+
+    apr_pool_destroy(pool);
+    apr_terminate();
+    return 0;
+}